@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -11,6 +13,26 @@
 
 namespace weserv::api {
 
+/**
+ * Statistics of a cache.
+ */
+struct CacheStats {
+    /**
+     * Number of lookups that were served from the cache.
+     */
+    uint64_t hits;
+
+    /**
+     * Number of lookups that weren't.
+     */
+    uint64_t misses;
+
+    /**
+     * Number of entries currently in the cache.
+     */
+    size_t size;
+};
+
 /**
  * An API Manager interface.
  */
@@ -70,6 +92,12 @@ class ApiManager {
                                          std::string *out_buf,
                                          const Config &config) = 0;
 
+    /**
+     * @return the statistics of the ICC transform cache, which is shared by
+     *         all requests processed by this API Manager.
+     */
+    virtual CacheStats icc_cache_stats() const = 0;
+
  protected:
     ApiManager() = default;
 };
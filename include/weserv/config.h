@@ -2,21 +2,31 @@
 
 #include <cstdint>
 #include <ctime>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <weserv/enums.h>
 
 namespace weserv::api {
 
+namespace parsers {
+struct Preset;
+}  // namespace parsers
+
 /**
  * Data structure that can be configured within the weserv module.
  */
 struct Config {
     explicit Config()
-        : savers(static_cast<uintptr_t>(enums::Output::All)),
+        : savers(static_cast<uintptr_t>(enums::Output::All)), auto_format(0),
+          loaders(static_cast<uintptr_t>(enums::Loader::All)),
           process_timeout(10), limit_input_pixels(71000000),
           limit_output_pixels(71000000), max_pages(256), quality(80),
           avif_quality(80), jpeg_quality(80), tiff_quality(80),
-          webp_quality(80), avif_effort(4), gif_effort(7), webp_effort(4),
-          zlib_level(6), fail_on_error(0) {}
+          webp_quality(80), avif_effort(4), gif_effort(7), png_effort(7),
+          webp_effort(4), zlib_level(6), fail_on_error(0), icc_cache_size(16),
+          frame_threads(0), merge_frames(0), fast_blur_sigma(0), gif_threads(0),
+          gif_global_palette(0), jpeg_threads(0), png_threads(0) {}
 
     /**
      * Enables or disables image savers to be used within the `&output=` query
@@ -25,6 +35,21 @@ struct Config {
      */
     uintptr_t savers;
 
+    /**
+     * Negotiate the output format from the formats the client accepts (e.g.
+     * its `Accept` header) if no `&output=` is given, as with `&output=auto`.
+     * Defaults to `off`.
+     * weserv_auto_format off;
+     */
+    intptr_t auto_format;
+
+    /**
+     * Enables or disables image loaders, images in a format of a disabled
+     * loader are rejected.
+     * All supported loaders are enabled by default.
+     */
+    uintptr_t loaders;
+
     /**
      * Specifies a maximum allowed time for image processing.
      * Defaults to `10s`, set to `0` to remove the limit.
@@ -107,6 +132,14 @@ struct Config {
      */
     intptr_t gif_effort;
 
+    /**
+     * Controls the CPU effort spent on quantizing palette-based PNG images
+     * (`&palette=true`).
+     * Defaults to 7.
+     * weserv_png_effort 7;
+     */
+    intptr_t png_effort;
+
     /**
      * Controls the CPU effort spent on improving WebP compression.
      * Defaults to 4.
@@ -133,6 +166,97 @@ struct Config {
      * weserv_fail_on_error off;
      */
     intptr_t fail_on_error;
+
+    /**
+     * The maximum number of ICC transforms to keep around across requests.
+     * Building a colour transform is relatively expensive, whereas most
+     * images embed one of a handful of profiles.
+     * Defaults to `16`, set to `0` to disable the cache.
+     * weserv_icc_cache_size 16;
+     */
+    intptr_t icc_cache_size;
+
+    /**
+     * The number of threads used to process the frames of animated images in
+     * parallel, each frame runs through its own pipeline. This helps for
+     * images with many (small) frames, which parallelise poorly as a single
+     * tall image.
+     * Defaults to `0` (disabled).
+     * weserv_frame_threads 0;
+     */
+    intptr_t frame_threads;
+
+    /**
+     * Merge consecutive identical frames of animated GIF and WebP outputs.
+     * This renders the animation to memory in order to compare the frames,
+     * which only pays off for images with many repeated frames.
+     * Defaults to `off`.
+     * weserv_merge_frames off;
+     */
+    intptr_t merge_frames;
+
+    /**
+     * The sigma from which blurs (`&blur=`) are approximated with three
+     * successive box blurs. The cost of this approximation doesn't depend on
+     * sigma, unlike the accurate Gaussian blur.
+     * Defaults to `0` (disabled).
+     * weserv_fast_blur_sigma 0;
+     */
+    intptr_t fast_blur_sigma;
+
+    /**
+     * The number of threads used to encode animated GIF images. The frames
+     * are quantized and remapped concurrently by libimagequant.
+     * Defaults to `0` (disabled).
+     * weserv_gif_threads 0;
+     */
+    intptr_t gif_threads;
+
+    /**
+     * Share a single palette, built from a sample of the frames, between all
+     * frames of an animated GIF image. Only used when encoding on multiple
+     * threads (see `gif_threads`).
+     * Defaults to `off`.
+     * weserv_gif_global_palette off;
+     */
+    intptr_t gif_global_palette;
+
+    /**
+     * The number of threads used to encode (baseline) JPEG images. The image
+     * is encoded in stripes, one restart interval each, which are joined with
+     * restart markers.
+     * Defaults to `0` (disabled).
+     * weserv_jpeg_threads 0;
+     */
+    intptr_t jpeg_threads;
+
+    /**
+     * The number of threads used to encode PNG images. The rows are filtered
+     * and compressed in blocks, which are joined into a single zlib stream.
+     * Defaults to `0` (disabled).
+     * weserv_png_threads 0;
+     */
+    intptr_t png_threads;
+
+    /**
+     * Named transformation presets, which can be referenced with the
+     * `&preset=` query parameter. The query string of a preset is parsed only
+     * once, when it's added with `add_preset()`.
+     * NOTE: Any other query parameter takes precedence over the preset.
+     * weserv_preset thumb "w=200&h=200&fit=cover";
+     */
+    std::unordered_map<std::string, std::shared_ptr<const parsers::Preset>>
+        presets;
+
+    /**
+     * Parse and add a named preset.
+     * @param name The name of the preset, as used within `&preset=`.
+     * @param query The query string of the preset.
+     * @return `false` if the name is already taken, if the query string
+     *         doesn't contain any valid query parameter or if it refers to an
+     *         unknown preset, `true` otherwise.
+     */
+    bool add_preset(const std::string &name, const std::string &query);
 };
 
 }  // namespace weserv::api
@@ -13,6 +13,7 @@ enum class Output : uintptr_t {
     Tiff = 1U << 5,
     Gif = 1U << 6,
     Json = 1U << 7,
+    Auto = 1U << 8,  // Negotiated, not a saver
     All = Jpeg | Png | Webp | Avif | Tiff | Gif | Json,  // 0xFE
 };
 
@@ -50,4 +51,31 @@ inline Output &operator^=(Output &x, Output y) {
     return x;
 }
 
+enum class Loader : uintptr_t {
+    Jpeg = 1U << 0,
+    Png = 1U << 1,
+    Webp = 1U << 2,
+    Tiff = 1U << 3,
+    Gif = 1U << 4,
+    Svg = 1U << 5,
+    Pdf = 1U << 6,
+    Heif = 1U << 7,
+    Magick = 1U << 8,
+    All = Jpeg | Png | Webp | Tiff | Gif | Svg | Pdf | Heif | Magick,  // 0x1FF
+};
+
+inline constexpr Loader operator&(Loader x, Loader y) {
+    return static_cast<Loader>(static_cast<uintptr_t>(x) &
+                               static_cast<uintptr_t>(y));
+}
+
+inline constexpr Loader operator|(Loader x, Loader y) {
+    return static_cast<Loader>(static_cast<uintptr_t>(x) |
+                               static_cast<uintptr_t>(y));
+}
+
+inline constexpr Loader operator~(Loader x) {
+    return static_cast<Loader>(~static_cast<uintptr_t>(x));
+}
+
 }  // namespace weserv::api::enums
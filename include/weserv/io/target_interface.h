@@ -18,6 +18,36 @@ class TargetInterface {
      */
     virtual void setup(const std::string &extension) = 0;
 
+    /**
+     * Emitted just before an image is being written to a target, if its
+     * quality was chosen to fit within a maximum number of bytes
+     * (`&maxbytes=`). It's a good place to expose the quality in a response
+     * header.
+     * @param quality The chosen quality.
+     * @param fits Whether the image fits within the maximum number of bytes,
+     *             which it may not even at the lowest quality.
+     */
+    virtual void set_quality(int /*quality*/, bool /*fits*/) {}
+
+    /**
+     * The image outputs this target accepts, used to negotiate the output
+     * format for `&output=auto`. It's a good place to parse the request's
+     * `Accept` header.
+     * @return A bitmask of `enums::Output`, only WebP and AVIF are taken
+     *         into account.
+     */
+    virtual uintptr_t accepted_outputs() {
+        return 0;
+    }
+
+    /**
+     * Emitted just before an image is being written to a target, if its
+     * output format was negotiated from the outputs this target accepts
+     * (see `accepted_outputs()`), e.g. by `&output=auto` within a preset.
+     * It's a good place to set a `Vary: Accept` response header.
+     */
+    virtual void set_negotiated() {}
+
     /**
      * Write to output, args exactly as write(2).
      * @param data Input buffer.
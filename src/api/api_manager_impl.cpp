@@ -1,10 +1,15 @@
 #include "api_manager_impl.h"
 
+#include "codecs/parallel.h"
+
 #include "exceptions/invalid.h"
 #include "exceptions/large.h"
+#include "exceptions/unknown.h"
 #include "exceptions/unreadable.h"
 #include "exceptions/unsupported.h"
 
+#include "io/decode_session.h"
+
 #include "parsers/query.h"
 
 #include "processors/alignment.h"
@@ -26,17 +31,47 @@
 #include "processors/tint.h"
 #include "processors/trim.h"
 
-#include <exception>
+#include "utils/utility.h"
+
+#include <algorithm>
+#include <ctime>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include <vips/vips8>
 
 namespace weserv::api {
 
+using enums::Position;
 using io::Source;
 using io::Target;
 using utils::Status;
 using vips::VError;
+using vips::VImage;
+
+namespace {
+
+/**
+ * Can the frames of an animated image be processed on their own? Some
+ * operations act on the image as a whole, or are skipped for multi-page
+ * images.
+ * @param query The query holder.
+ * @return A bool indicating if the frames can be processed on their own.
+ */
+bool frames_are_independent(const parsers::Query &query) {
+    auto crop_position = query.get<Position>("a", Position::Center);
+
+    return query.get<int>("n") > 1 && query.get<int>("trim", 0) == 0 &&
+           query.get<int>("angle", 0) == 0 &&
+           query.get<int>("ro", 0) % 90 == 0 &&
+           !query.get<bool>("mtrim", false) &&
+           crop_position != Position::Entropy &&
+           crop_position != Position::Attention;
+}
+
+}  // namespace
 
 std::shared_ptr<ApiManager>
 ApiManagerFactory::create_api_manager(std::unique_ptr<ApiEnvInterface> env) {
@@ -120,6 +155,9 @@ Status ApiManagerImpl::exception_handler(const std::string &query) {
     } catch (const exceptions::UnsupportedSaverException &e) {
         return {Status::Code::UnsupportedSaver, e.what(),
                 Status::ErrorCause::Application};
+    } catch (const exceptions::UnknownPresetException &e) {
+        return {Status::Code::InvalidUri, utils::escape_string(e.what()),
+                Status::ErrorCause::Application};
     } catch (const VError &e) {
         std::string error_str = e.what();
 
@@ -146,6 +184,130 @@ Status ApiManagerImpl::exception_handler(const std::string &query) {
     // LCOV_EXCL_STOP
 }
 
+VImage
+ApiManagerImpl::process_image(const VImage &image,
+                              const std::shared_ptr<parsers::Query> &query,
+                              const Config &config) {
+    auto precrop = query->get<bool>("precrop", false);
+
+    // Image processors
+    auto trim = processors::Trim(query);
+    auto thumbnail = processors::Thumbnail(query, config, icc_cache_);
+    auto orientation = processors::Orientation(query, config);
+    auto alignment = processors::Alignment(query, config);
+    auto crop = processors::Crop(query);
+    auto embed = processors::Embed(query);
+    auto rotation = processors::Rotation(query, config);
+    auto brightness = processors::Brightness(query);
+    auto modulate = processors::Modulate(query);
+    auto contrast = processors::Contrast(query);
+    auto gamma = processors::Gamma(query);
+    auto sharpen = processors::Sharpen(query);
+    auto filter = processors::Filter(query);
+    auto blur = processors::Blur(query, config);
+    auto tint = processors::Tint(query);
+    auto background = processors::Background(query);
+    auto mask = processors::Mask(query);
+
+    VImage output_image;
+
+    // Image processing phase 1 and 2 (trim, size, crop, etc.)
+    // Note: trimming is always done before any resizing
+    if (precrop) {
+        output_image =
+            image | trim | orientation | crop | thumbnail | alignment;
+    } else {
+        output_image =
+            image | trim | thumbnail | orientation | alignment | crop;
+    }
+
+    // Image processing phase 3 (adjustments, effects, etc.)
+    return output_image | embed | rotation | brightness | modulate | contrast |
+           gamma | sharpen | filter | blur | tint | background | mask;
+}
+
+VImage
+ApiManagerImpl::process_frames(const VImage &image,
+                               const std::shared_ptr<parsers::Query> &query,
+                               const Config &config) {
+    int n_pages = query->get<int>("n");
+    int page_height = utils::get_page_height(image);
+    int n_threads = std::min(static_cast<int>(config.frame_threads), n_pages);
+
+    std::vector<VImage> frames(n_pages);
+
+    auto caller = std::this_thread::get_id();
+
+    // The process timeout applies to the animation as a whole, every batch
+    // and frame only gets the time that is left of it
+    time_t deadline = config.process_timeout > 0
+                          ? std::time(nullptr) + config.process_timeout
+                          : 0;
+    auto remaining_timeout = [&]() -> time_t {
+        if (deadline == 0) {
+            return 0;
+        }
+
+        time_t remaining = deadline - std::time(nullptr);
+        if (remaining <= 0) {
+            throw VError("Maximum image processing time of " +
+                         std::to_string(config.process_timeout) +
+                         " seconds exceeded");
+        }
+
+        return remaining;
+    };
+
+    // Any evaluation within the frame pipelines is bound by the same
+    // deadline, the timeout is updated before each batch starts
+    Config frame_config = config;
+
+    // The frames are decoded sequentially, since a frame may depend on the
+    // previous one. Only decode as many frames as can be processed at once,
+    // instead of the whole animation.
+    for (int first = 0; first < n_pages; first += n_threads) {
+        int count = std::min(n_threads, n_pages - first);
+
+        // Copy to memory evaluates the image, so set up the timeout handler,
+        // if necessary.
+        auto decoded = image.extract_area(0, page_height * first,
+                                          image.width(), page_height * count);
+        utils::setup_timeout_handler(decoded, remaining_timeout());
+        decoded = decoded.copy_memory();
+
+        frame_config.process_timeout = remaining_timeout();
+
+        codecs::parallel_for(count, n_threads, [&](size_t j) {
+            {
+                // The frames are processed as single-page images
+                auto frame_query = std::make_shared<parsers::Query>(*query);
+                frame_query->update("n", 1);
+
+                auto frame = process_image(
+                    decoded.extract_area(0, page_height * static_cast<int>(j),
+                                         decoded.width(), page_height),
+                    frame_query, frame_config);
+                frame = processors::unpremultiply(frame, frame_query.get());
+
+                utils::setup_timeout_handler(frame, remaining_timeout());
+                frames[first + j] = frame.copy_memory();
+            }
+
+            // Free libvips' per-thread data of the pool threads
+            if (std::this_thread::get_id() != caller) {
+                vips_thread_shutdown();
+            }
+        });
+    }
+
+    // All frames have the same dimensions, because they went through the
+    // same pipeline
+    query->update("page_height", frames[0].height());
+
+    // Reassemble the frames into a tall, thin image
+    return VImage::arrayjoin(frames, VImage::option()->set("across", 1));
+}
+
 utils::Status ApiManagerImpl::process(const std::string &query,
                                       const Source &source,
                                       const Target &target,
@@ -160,43 +322,37 @@ utils::Status ApiManagerImpl::process(const std::string &query,
     // Stream processor
     auto stream = processors::Stream(query_holder, config);
 
-    // Image processors
-    auto trim = processors::Trim(query_holder);
-    auto thumbnail = processors::Thumbnail(query_holder, config);
-    auto orientation = processors::Orientation(query_holder, config);
-    auto alignment = processors::Alignment(query_holder, config);
-    auto crop = processors::Crop(query_holder);
-    auto embed = processors::Embed(query_holder);
-    auto rotation = processors::Rotation(query_holder, config);
-    auto brightness = processors::Brightness(query_holder);
-    auto modulate = processors::Modulate(query_holder);
-    auto contrast = processors::Contrast(query_holder);
-    auto gamma = processors::Gamma(query_holder);
-    auto sharpen = processors::Sharpen(query_holder);
-    auto filter = processors::Filter(query_holder);
-    auto blur = processors::Blur(query_holder);
-    auto tint = processors::Tint(query_holder);
-    auto background = processors::Background(query_holder);
-    auto mask = processors::Mask(query_holder);
+    // Determine the loader once, the headers of any opened page are shared
+    // between the stream and thumbnail processors
+    auto session = io::DecodeSession(source, config);
 
     // Create image from a source
-    auto image = stream.new_from_source(source);
+    auto image = stream.new_from_source(session);
 
-    // Image processing phase 1 (make sure trimming is done first)
-    image = image | trim;
+    // Skip decoding and re-encoding altogether, if the query leaves the
+    // image untouched
+    if (stream.write_original(image, session, target)) {
+        // Clean up libvips' per-request data and threads
+        clean_up();
+
+        return Status::OK;
+    }
 
-    // Image processing phase 2 (size, crop, etc.)
     if (precrop) {
-        image = image | orientation | crop | thumbnail | alignment;
+        // Avoid decoding the parts of the image that are cropped away
+        image = processors::Crop(query_holder).region_on_load(image, session);
     } else {
-        // The very fast shrink-on-load tricks are possible
-        image = thumbnail.shrink_on_load(image, source);
-        image = image | thumbnail | orientation | alignment | crop;
+        // The very fast shrink-on-load tricks are possible, a trim box found
+        // at full scale is mapped onto the (possibly) shrunk image
+        image = processors::Thumbnail(query_holder, config, icc_cache_)
+                    .shrink_on_load(image, session);
     }
 
-    // Image processing phase 3 (adjustments, effects, etc.)
-    image = image | embed | rotation | brightness | modulate | contrast |
-            gamma | sharpen | filter | blur | tint | background | mask;
+    if (config.frame_threads > 1 && frames_are_independent(*query_holder)) {
+        image = process_frames(image, query_holder, config);
+    } else {
+        image = process_image(image, query_holder, config);
+    }
 
     // Write the image to a target
     stream.write_to_target(image, target);
@@ -207,6 +363,10 @@ utils::Status ApiManagerImpl::process(const std::string &query,
     return Status::OK;
 }
 
+CacheStats ApiManagerImpl::icc_cache_stats() const {
+    return icc_cache_.stats();
+}
+
 utils::Status
 ApiManagerImpl::process(const std::string &query,
                         std::unique_ptr<io::SourceInterface> source,
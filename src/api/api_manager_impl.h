@@ -2,7 +2,12 @@
 
 #include "io/source.h"
 #include "io/target.h"
+#include "parsers/query.h"
+#include "utils/icc_transform_cache.h"
 
+#include <memory>
+
+#include <vips/vips8>
 #include <weserv/api_manager.h>
 
 namespace weserv::api {
@@ -36,6 +41,8 @@ class ApiManagerImpl : public ApiManager {
                                  std::string *out_buf,
                                  const Config &config) override;
 
+    CacheStats icc_cache_stats() const override;
+
  private:
     /**
      * Clean up libvips' per-request data and threads.
@@ -60,6 +67,31 @@ class ApiManagerImpl : public ApiManager {
     utils::Status process(const std::string &query, const io::Source &source,
                           const io::Target &target, const Config &config);
 
+    /**
+     * Image processing phase 1, 2 and 3 (trim, size, crop, adjustments,
+     * effects, etc.).
+     * @param image The (possibly shrunk) source image.
+     * @param query The query holder.
+     * @param config API configuration.
+     * @return The processed image.
+     */
+    vips::VImage process_image(const vips::VImage &image,
+                               const std::shared_ptr<parsers::Query> &query,
+                               const Config &config);
+
+    /**
+     * Process the frames of an animated image in parallel, each frame runs
+     * through its own pipeline. The frames are reassembled afterwards.
+     * The process timeout is a single deadline for all frames together.
+     * @param image The (possibly shrunk) source image.
+     * @param query The query holder.
+     * @param config API configuration.
+     * @return The processed image.
+     */
+    vips::VImage process_frames(const vips::VImage &image,
+                                const std::shared_ptr<parsers::Query> &query,
+                                const Config &config);
+
     /**
      * Global environment across multiple services
      */
@@ -70,6 +102,11 @@ class ApiManagerImpl : public ApiManager {
      * g_log_set_handler().
      */
     unsigned int handler_id_ = 0;
+
+    /**
+     * Ready-to-use ICC transforms, kept around across requests.
+     */
+    mutable utils::IccTransformCache icc_cache_;
 };
 
 }  // namespace weserv::api
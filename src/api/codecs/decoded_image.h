@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace weserv::api::codecs {
+
+/**
+ * An image decoded by one of our own codecs, with interleaved samples.
+ */
+struct DecodedImage {
+    int width = 0;
+    int height = 0;
+    int bands = 0;
+
+    /**
+     * Bits per sample, either 8 or 16. 16-bit samples are stored in the
+     * native byte order.
+     */
+    int bit_depth = 8;
+
+    std::vector<unsigned char> pixels;
+
+    /**
+     * The embedded ICC profile, if any.
+     */
+    std::string icc_profile;
+};
+
+}  // namespace weserv::api::codecs
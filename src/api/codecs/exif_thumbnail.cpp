@@ -0,0 +1,193 @@
+#include "exif_thumbnail.h"
+
+#include "tiff_reader.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace weserv::api::codecs {
+
+using enums::ImageType;
+
+namespace {
+
+/**
+ * TIFF tags we're interested in.
+ */
+constexpr uint16_t TIFFTAG_JPEGIFOFFSET = 0x0201;
+constexpr uint16_t TIFFTAG_JPEGIFBYTECOUNT = 0x0202;
+constexpr uint16_t TIFFTAG_EXIFIFD = 0x8769;
+
+/**
+ * Field type of an IFD offset, some writers use it instead of LONG.
+ */
+constexpr uint16_t TIFF_TYPE_IFD = 13;
+
+/**
+ * JPEG markers we're interested in.
+ */
+constexpr unsigned char JPEG_MARKER_APP1 = 0xE1;
+constexpr unsigned char JPEG_MARKER_SOS = 0xDA;
+constexpr unsigned char JPEG_MARKER_EOI = 0xD9;
+
+/**
+ * Read the thumbnail location from the `JPEGInterchangeFormat` tags of a
+ * single IFD.
+ * @return The (offset, length) of the thumbnail, relative to the start of
+ *         the TIFF structure.
+ */
+std::pair<size_t, size_t> read_thumbnail_tags(const TiffReader &reader,
+                                              const unsigned char *data,
+                                              uint32_t ifd) {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    uint32_t next = 0;
+
+    auto on_entry = [&](uint16_t tag, uint16_t type, uint32_t count,
+                        size_t value_offset) {
+        if (count != 1 ||
+            (type != TiffReader::SHORT && type != TiffReader::LONG)) {
+            return;
+        }
+
+        if (tag == TIFFTAG_JPEGIFOFFSET) {
+            offset = reader.read_value(type, value_offset);
+        } else if (tag == TIFFTAG_JPEGIFBYTECOUNT) {
+            size = reader.read_value(type, value_offset);
+        }
+    };
+
+    // The thumbnail should at least start with a SOI marker
+    if (!reader.read_ifd(ifd, on_entry, &next) || offset == 0 || size < 2 ||
+        !reader.in_bounds(offset, size) || data[offset] != 0xFF ||
+        data[offset + 1] != 0xD8) {
+        return {0, 0};
+    }
+
+    return {offset, size};
+}
+
+/**
+ * Read the thumbnail location from IFD1 of an EXIF block, which holds the
+ * thumbnail of the image the block belongs to.
+ */
+std::pair<size_t, size_t> read_ifd1_thumbnail(const unsigned char *data,
+                                              size_t length) {
+    TiffReader reader(data, length);
+    if (!reader.valid()) {
+        return {0, 0};
+    }
+
+    // Skip IFD0 (the main image)
+    uint32_t ifd1 = 0;
+    if (!reader.read_ifd(
+            reader.first_ifd(),
+            [](uint16_t /* unused */, uint16_t /* unused */,
+               uint32_t /* unused */, size_t /* unused */) {},
+            &ifd1) ||
+        ifd1 == 0 || ifd1 == reader.first_ifd()) {
+        return {0, 0};
+    }
+
+    return read_thumbnail_tags(reader, data, ifd1);
+}
+
+/**
+ * Read the thumbnail location from the EXIF sub-IFD of a TIFF image. Unlike
+ * an EXIF block, IFD1 of a TIFF image is the second page, not a thumbnail.
+ */
+std::pair<size_t, size_t> read_exif_ifd_thumbnail(const unsigned char *data,
+                                                  size_t length) {
+    TiffReader reader(data, length);
+    if (!reader.valid()) {
+        return {0, 0};
+    }
+
+    uint32_t exif_ifd = 0;
+    uint32_t next = 0;
+
+    auto on_entry = [&](uint16_t tag, uint16_t type, uint32_t count,
+                        size_t value_offset) {
+        if (tag == TIFFTAG_EXIFIFD && count == 1 &&
+            (type == TiffReader::LONG || type == TIFF_TYPE_IFD)) {
+            exif_ifd = reader.read_value(TiffReader::LONG, value_offset);
+        }
+    };
+
+    if (!reader.read_ifd(reader.first_ifd(), on_entry, &next) ||
+        exif_ifd == 0 || exif_ifd == reader.first_ifd()) {
+        return {0, 0};
+    }
+
+    return read_thumbnail_tags(reader, data, exif_ifd);
+}
+
+/**
+ * Walk the JPEG segments until the EXIF APP1 segment is found.
+ */
+std::pair<size_t, size_t> find_jpeg_thumbnail(const unsigned char *data,
+                                              size_t length) {
+    if (length < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return {0, 0};
+    }
+
+    size_t pos = 2;
+    while (pos + 4 <= length) {
+        if (data[pos] != 0xFF) {
+            return {0, 0};
+        }
+
+        unsigned char marker = data[pos + 1];
+
+        // Skip any fill bytes
+        if (marker == 0xFF) {
+            ++pos;
+            continue;
+        }
+
+        // The EXIF data should precede the image data
+        if (marker == JPEG_MARKER_SOS || marker == JPEG_MARKER_EOI) {
+            break;
+        }
+
+        size_t segment_length = static_cast<size_t>(data[pos + 2]) << 8 |
+                                static_cast<size_t>(data[pos + 3]);
+        if (segment_length < 2 || segment_length > length - pos - 2) {
+            return {0, 0};
+        }
+
+        if (marker == JPEG_MARKER_APP1 && segment_length >= 8 &&
+            std::memcmp(data + pos + 4, "Exif\0\0", 6) == 0) {
+            // The EXIF offsets are relative to the TIFF header
+            size_t tiff_offset = pos + 10;
+            auto thumbnail = read_ifd1_thumbnail(data + tiff_offset,
+                                                 segment_length - 8);
+            if (thumbnail.second == 0) {
+                return {0, 0};
+            }
+
+            return {tiff_offset + thumbnail.first, thumbnail.second};
+        }
+
+        pos += 2 + segment_length;
+    }
+
+    return {0, 0};
+}
+
+}  // namespace
+
+std::pair<size_t, size_t> find_exif_thumbnail(ImageType image_type,
+                                              const unsigned char *data,
+                                              size_t length) {
+    switch (image_type) {
+        case ImageType::Jpeg:
+            return find_jpeg_thumbnail(data, length);
+        case ImageType::Tiff:
+            return read_exif_ifd_thumbnail(data, length);
+        default:
+            return {0, 0};
+    }
+}
+
+}  // namespace weserv::api::codecs
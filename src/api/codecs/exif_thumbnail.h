@@ -0,0 +1,26 @@
+#pragma once
+
+#include "../enums.h"
+
+#include <cstddef>
+#include <utility>
+
+namespace weserv::api::codecs {
+
+/**
+ * Locate the JPEG thumbnail embedded in the EXIF data of an image, i.e. the
+ * one referenced by the `JPEGInterchangeFormat` and
+ * `JPEGInterchangeFormatLength` tags. For JPEG, these are read from IFD1 of
+ * the APP1 segment. For TIFF, only from the EXIF sub-IFD, IFD1 of a TIFF
+ * image is its second page.
+ * @param image_type The image type of the data.
+ * @param data The image data.
+ * @param length Length of the image data in bytes.
+ * @return The (offset, length) of the thumbnail within the data, the length
+ *         is 0 if there's no (valid) thumbnail.
+ */
+std::pair<size_t, size_t> find_exif_thumbnail(enums::ImageType image_type,
+                                              const unsigned char *data,
+                                              size_t length);
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,378 @@
+#include "gif_encoder.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#if defined(WESERV_HAVE_IMAGEQUANT) && defined(WESERV_HAVE_CGIF)
+#include <cgif.h>
+#include <libimagequant.h>
+#endif
+
+namespace weserv::api::codecs {
+
+#if defined(WESERV_HAVE_IMAGEQUANT) && defined(WESERV_HAVE_CGIF)
+namespace {
+
+/**
+ * Pixels with an alpha below this threshold become transparent.
+ */
+constexpr int ALPHA_THRESHOLD = 128;
+
+/**
+ * The number of frames sampled for a global palette.
+ */
+constexpr int MAX_SAMPLED_FRAMES = 32;
+
+using LiqAttr = std::unique_ptr<liq_attr, decltype(&liq_attr_destroy)>;
+using LiqImage = std::unique_ptr<liq_image, decltype(&liq_image_destroy)>;
+using LiqResult = std::unique_ptr<liq_result, decltype(&liq_result_destroy)>;
+using LiqHistogram =
+    std::unique_ptr<liq_histogram, decltype(&liq_histogram_destroy)>;
+
+/**
+ * A frame handed to libimagequant.
+ */
+struct Frame {
+    const unsigned char *pixels;
+    int width;
+    int bands;
+};
+
+/**
+ * A frame, ready to be written.
+ */
+struct QuantizedFrame {
+    std::vector<uint8_t> indices;
+
+    /**
+     * The RGB colours of the frame, empty with a global palette.
+     */
+    std::vector<uint8_t> palette;
+
+    /**
+     * Index of the transparent colour, `-1` if there is none.
+     */
+    int transparent = -1;
+};
+
+/**
+ * Feed a row to libimagequant as RGBA, with the alpha reduced to either
+ * fully transparent or opaque (GIF has a single transparent colour).
+ */
+void read_row(liq_color row_out[], int row, int width, void *user_info) {
+    const auto *frame = static_cast<const Frame *>(user_info);
+    const unsigned char *p = frame->pixels + static_cast<size_t>(row) *
+                                                 frame->width * frame->bands;
+
+    for (int x = 0; x < width; ++x, p += frame->bands) {
+        if (frame->bands == 4 && p[3] < ALPHA_THRESHOLD) {
+            row_out[x] = liq_color{0, 0, 0, 0};
+        } else {
+            row_out[x] = liq_color{p[0], p[1], p[2], 255};
+        }
+    }
+}
+
+LiqAttr create_attr(int max_colors, int quality, int effort) {
+    LiqAttr attr(liq_attr_create(), &liq_attr_destroy);
+    if (attr == nullptr) {
+        return attr;
+    }
+
+    liq_set_max_colors(attr.get(), std::max(max_colors, 2));
+
+    // Like libvips, effort 1 - 10 maps to speed 10 - 1
+    liq_set_speed(attr.get(), 11 - std::clamp(effort, 1, 10));
+
+    // Never fail on a low quality, `quality` is only the target
+    liq_set_quality(attr.get(), 0, std::clamp(quality, 1, 100));
+
+    return attr;
+}
+
+LiqImage create_image(const liq_attr *attr, Frame *frame, int height) {
+    return LiqImage(liq_image_create_custom(attr, read_row, frame,
+                                            frame->width, height, 0),
+                    &liq_image_destroy);
+}
+
+/**
+ * The index of the (single) transparent colour in the palette, if any.
+ */
+int find_transparent(const liq_palette *palette) {
+    for (unsigned int i = 0; i < palette->count; ++i) {
+        if (palette->entries[i].a < ALPHA_THRESHOLD) {
+            return static_cast<int>(i);
+        }
+    }
+
+    return -1;
+}
+
+std::vector<uint8_t> to_rgb(const liq_palette *palette) {
+    std::vector<uint8_t> rgb;
+    rgb.reserve(static_cast<size_t>(palette->count) * 3);
+    for (unsigned int i = 0; i < palette->count; ++i) {
+        rgb.push_back(palette->entries[i].r);
+        rgb.push_back(palette->entries[i].g);
+        rgb.push_back(palette->entries[i].b);
+    }
+
+    return rgb;
+}
+
+/**
+ * The palette entry closest to the given colour.
+ */
+uint8_t find_nearest(const liq_palette *palette, const liq_color &color) {
+    unsigned int best = 0;
+    int best_distance = -1;
+    for (unsigned int i = 0; i < palette->count; ++i) {
+        const liq_color &entry = palette->entries[i];
+        int dr = entry.r - color.r;
+        int dg = entry.g - color.g;
+        int db = entry.b - color.b;
+        int da = entry.a - color.a;
+        int distance = dr * dr + dg * dg + db * db + da * da;
+        if (best_distance < 0 || distance < best_distance) {
+            best = i;
+            best_distance = distance;
+        }
+    }
+
+    return static_cast<uint8_t>(best);
+}
+
+int write_to_string(void *context, const uint8_t *data, const size_t size) {
+    static_cast<std::string *>(context)->append(
+        reinterpret_cast<const char *>(data), size);
+    return 0;
+}
+
+}  // namespace
+#endif
+
+bool encode_gif([[maybe_unused]] const GifAnimation &animation,
+                [[maybe_unused]] int quality, [[maybe_unused]] int effort,
+                [[maybe_unused]] double dither,
+                [[maybe_unused]] bool global_palette,
+                [[maybe_unused]] int threads,
+                [[maybe_unused]] std::string *out) {
+#if defined(WESERV_HAVE_IMAGEQUANT) && defined(WESERV_HAVE_CGIF)
+    int width = animation.width;
+    int height = animation.page_height;
+    int n_pages = animation.n_pages;
+    int bands = animation.bands;
+
+    if (animation.pixels == nullptr || width <= 0 || width > 65535 ||
+        height <= 0 || height > 65535 || n_pages <= 0 ||
+        (bands != 3 && bands != 4)) {
+        return false;
+    }
+
+    size_t frame_pixels = static_cast<size_t>(width) * height;
+    auto frame = [&](size_t page) {
+        return Frame{animation.pixels + page * frame_pixels * bands, width,
+                     bands};
+    };
+
+    bool has_alpha = bands == 4;
+
+    // With a global palette, cgif makes the pixels that don't change
+    // transparent and crops the frames to the area that changes. This needs
+    // a free palette entry and frames that are drawn on top of the previous
+    // one, which rules out frames with alpha.
+    bool optimize_frames = global_palette && !has_alpha && n_pages > 1;
+
+    // The palette shared by all frames, built from evenly spread frames
+    LiqAttr global_attr(nullptr, &liq_attr_destroy);
+    LiqResult global_result(nullptr, &liq_result_destroy);
+    if (global_palette) {
+        global_attr = create_attr(optimize_frames ? 255 : 256, quality, effort);
+        if (global_attr == nullptr) {
+            return false;
+        }
+
+        LiqHistogram histogram(liq_histogram_create(global_attr.get()),
+                               &liq_histogram_destroy);
+        if (histogram == nullptr) {
+            return false;
+        }
+
+        int n_sampled = std::min(n_pages, MAX_SAMPLED_FRAMES);
+        for (int i = 0; i < n_sampled; ++i) {
+            Frame sampled =
+                frame(static_cast<size_t>(i) * n_pages / n_sampled);
+            LiqImage image = create_image(global_attr.get(), &sampled, height);
+            if (image == nullptr ||
+                liq_histogram_add_image(histogram.get(), global_attr.get(),
+                                        image.get()) != LIQ_OK) {
+                return false;
+            }
+        }
+
+        liq_result *result = nullptr;
+        if (liq_histogram_quantize(histogram.get(), global_attr.get(),
+                                   &result) != LIQ_OK) {
+            return false;
+        }
+        global_result.reset(result);
+    }
+
+    const liq_palette *shared =
+        global_palette ? liq_get_palette(global_result.get()) : nullptr;
+
+    std::vector<QuantizedFrame> frames(n_pages);
+    std::atomic<bool> failed{false};
+
+    // Each frame gets its own libimagequant objects, so that they can be
+    // quantized and remapped concurrently. With a global palette, the frames
+    // are quantized against its colours (as fixed colours), which only
+    // leaves the remapping and dithering.
+    parallel_for(n_pages, threads, [&](size_t page) {
+        if (failed) {
+            return;
+        }
+
+        Frame current = frame(page);
+        LiqAttr attr = create_attr(shared != nullptr
+                                       ? static_cast<int>(shared->count)
+                                       : 256,
+                                   quality, effort);
+        LiqImage image = attr == nullptr
+                             ? LiqImage(nullptr, &liq_image_destroy)
+                             : create_image(attr.get(), &current, height);
+        if (image == nullptr) {
+            failed = true;
+            return;
+        }
+
+        if (shared != nullptr) {
+            for (unsigned int i = 0; i < shared->count; ++i) {
+                liq_image_add_fixed_color(image.get(), shared->entries[i]);
+            }
+        }
+
+        liq_result *quantized = nullptr;
+        if (liq_image_quantize(image.get(), attr.get(), &quantized) !=
+            LIQ_OK) {
+            failed = true;
+            return;
+        }
+        LiqResult result(quantized, &liq_result_destroy);
+
+        liq_set_dithering_level(result.get(), static_cast<float>(dither));
+
+        QuantizedFrame &encoded = frames[page];
+        encoded.indices.resize(frame_pixels);
+        if (liq_write_remapped_image(result.get(), image.get(),
+                                     encoded.indices.data(),
+                                     frame_pixels) != LIQ_OK) {
+            failed = true;
+            return;
+        }
+
+        const liq_palette *palette = liq_get_palette(result.get());
+
+        if (shared == nullptr) {
+            encoded.palette = to_rgb(palette);
+            encoded.transparent = find_transparent(palette);
+            return;
+        }
+
+        // libimagequant may order the fixed colours differently, so map the
+        // indices back to the global palette
+        uint8_t map[256];
+        for (unsigned int i = 0; i < palette->count; ++i) {
+            map[i] = find_nearest(shared, palette->entries[i]);
+        }
+        for (auto &index : encoded.indices) {
+            index = map[index];
+        }
+        encoded.transparent = find_transparent(shared);
+    });
+
+    if (failed) {
+        return false;
+    }
+
+    // Write the frames with cgif, one after another
+    std::vector<uint8_t> global_rgb;
+
+    CGIF_Config config{};
+    config.attrFlags = CGIF_ATTR_IS_ANIMATED;
+    config.width = static_cast<uint16_t>(width);
+    config.height = static_cast<uint16_t>(height);
+    if (global_palette) {
+        global_rgb = to_rgb(shared);
+        config.pGlobalPalette = global_rgb.data();
+        config.numGlobalPaletteEntries =
+            static_cast<uint16_t>(shared->count);
+    } else {
+        config.attrFlags |= CGIF_ATTR_NO_GLOBAL_TABLE;
+    }
+
+    // The NETSCAPE2.0 application extension, omitted when played once
+    if (animation.loop == 1) {
+        config.attrFlags |= CGIF_ATTR_NO_LOOP;
+    } else {
+        config.numLoops = static_cast<uint16_t>(
+            animation.loop <= 0 ? 0 : std::min(animation.loop - 1, 65535));
+    }
+
+    out->clear();
+    config.pWriteFn = write_to_string;
+    config.pContext = out;
+
+    CGIF *gif = cgif_newgif(&config);
+    if (gif == nullptr) {
+        return false;
+    }
+
+    int result = CGIF_OK;
+    for (int page = 0; page < n_pages && result == CGIF_OK; ++page) {
+        QuantizedFrame &encoded = frames[page];
+
+        int delay = 0;
+        if (!animation.delays.empty()) {
+            delay = animation.delays[std::min(
+                static_cast<size_t>(page), animation.delays.size() - 1)];
+        }
+
+        CGIF_FrameConfig frame_config{};
+        frame_config.pImageData = encoded.indices.data();
+        frame_config.delay =
+            static_cast<uint16_t>(std::min((std::max(delay, 0) + 5) / 10,
+                                           65535));
+        if (!global_palette) {
+            frame_config.attrFlags |= CGIF_FRAME_ATTR_USE_LOCAL_TABLE;
+            frame_config.pLocalPalette = encoded.palette.data();
+            frame_config.numLocalPaletteEntries =
+                static_cast<uint16_t>(encoded.palette.size() / 3);
+        }
+        if (encoded.transparent >= 0) {
+            frame_config.attrFlags |= CGIF_FRAME_ATTR_HAS_SET_TRANS;
+            frame_config.transIndex =
+                static_cast<uint8_t>(encoded.transparent);
+        }
+        if (optimize_frames) {
+            frame_config.genFlags = CGIF_FRAME_GEN_USE_TRANSPARENCY |
+                                    CGIF_FRAME_GEN_USE_DIFF_WINDOW;
+        }
+
+        result = cgif_addframe(gif, &frame_config);
+    }
+
+    // Always close, which frees the encoder
+    return cgif_close(gif) == CGIF_OK && result == CGIF_OK;
+#else
+    return false;
+#endif
+}
+
+}  // namespace weserv::api::codecs
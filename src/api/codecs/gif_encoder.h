@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace weserv::api::codecs {
+
+/**
+ * An animated image to encode as GIF, with the frames stacked vertically.
+ */
+struct GifAnimation {
+    /**
+     * The interleaved 8-bit samples, either RGB or RGBA.
+     */
+    const unsigned char *pixels = nullptr;
+
+    int width = 0;
+    int page_height = 0;
+    int n_pages = 0;
+
+    /**
+     * Number of bands, either 3 (RGB) or 4 (RGBA).
+     */
+    int bands = 0;
+
+    /**
+     * The delay of each frame in milliseconds, the last delay is repeated
+     * for any remaining frames.
+     */
+    std::vector<int> delays;
+
+    /**
+     * Number of times to play the animation, `0` loops forever.
+     */
+    int loop = 0;
+};
+
+/**
+ * Encode an animation as GIF, with the frames quantized and remapped by
+ * libimagequant on multiple threads, after which cgif writes them.
+ * With a global palette, a single palette is built from a sample of the
+ * frames and every frame is remapped against it. Unless the frames have
+ * alpha, pixels that don't change from one frame to the next are then made
+ * transparent and the frames are cropped to the area that changes, which
+ * compresses a lot better. Otherwise, each frame gets a palette of its own.
+ * Alpha is reduced to a single transparent colour.
+ * @param animation The animation to encode.
+ * @param quality The quantization quality, 1 - 100.
+ * @param effort The CPU effort spent on quantizing, 1 - 10.
+ * @param dither The amount of Floyd-Steinberg dithering, 0 - 1.
+ * @param global_palette Share a single palette between all frames.
+ * @param threads Number of threads to use.
+ * @param out Receives the GIF image.
+ * @return false if the animation can't be encoded as GIF, or if built
+ *         without libimagequant and cgif.
+ */
+bool encode_gif(const GifAnimation &animation, int quality, int effort,
+                double dither, bool global_palette, int threads,
+                std::string *out);
+
+}  // namespace weserv::api::codecs
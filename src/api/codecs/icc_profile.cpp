@@ -0,0 +1,105 @@
+#include "icc_profile.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace weserv::api::codecs {
+
+namespace {
+
+/**
+ * The profile header is followed by the tag count and the tag table.
+ */
+constexpr size_t ICC_HEADER_SIZE = 128;
+constexpr size_t ICC_TAG_SIZE = 12;
+
+uint32_t read_uint32_be(const unsigned char *p) {
+    return static_cast<uint32_t>(p[0]) << 24 |
+           static_cast<uint32_t>(p[1]) << 16 |
+           static_cast<uint32_t>(p[2]) << 8 | static_cast<uint32_t>(p[3]);
+}
+
+/**
+ * Read the text of a `desc` (v2) or `mluc` (v4) tag, non-ASCII characters
+ * of the latter are replaced with a question mark. Only the first record of
+ * a `mluc` tag is read.
+ */
+bool read_description(const unsigned char *tag, size_t size,
+                      std::string *out) {
+    if (size < 12) {
+        return false;
+    }
+
+    if (std::memcmp(tag, "desc", 4) == 0) {
+        size_t count = read_uint32_be(tag + 8);
+        if (count > size - 12) {
+            return false;
+        }
+
+        out->assign(reinterpret_cast<const char *>(tag + 12), count);
+
+        // The count includes the terminating null
+        out->resize(std::strlen(out->c_str()));
+        return true;
+    }
+
+    if (std::memcmp(tag, "mluc", 4) == 0) {
+        if (size < 28 || read_uint32_be(tag + 8) == 0) {
+            return false;
+        }
+
+        size_t length = read_uint32_be(tag + 20);
+        size_t offset = read_uint32_be(tag + 24);
+        if (offset > size || length > size - offset) {
+            return false;
+        }
+
+        // UTF-16BE
+        out->clear();
+        for (size_t i = 0; i + 1 < length; i += 2) {
+            const unsigned char *c = tag + offset + i;
+            out->push_back(c[0] == 0 && c[1] < 0x80 ? static_cast<char>(c[1])
+                                                    : '?');
+        }
+        return true;
+    }
+
+    return false;
+}
+
+}  // namespace
+
+bool is_srgb_profile(const unsigned char *data, size_t length) {
+    if (length < ICC_HEADER_SIZE + 4 ||
+        std::memcmp(data + 16, "RGB ", 4) != 0) {
+        return false;
+    }
+
+    size_t n_tags = read_uint32_be(data + ICC_HEADER_SIZE);
+    if (n_tags > (length - ICC_HEADER_SIZE - 4) / ICC_TAG_SIZE) {
+        return false;
+    }
+
+    for (size_t i = 0; i != n_tags; ++i) {
+        const unsigned char *entry =
+            data + ICC_HEADER_SIZE + 4 + i * ICC_TAG_SIZE;
+        if (std::memcmp(entry, "desc", 4) != 0) {
+            continue;
+        }
+
+        size_t offset = read_uint32_be(entry + 4);
+        size_t size = read_uint32_be(entry + 8);
+        if (offset > length || size > length - offset) {
+            return false;
+        }
+
+        std::string description;
+        return read_description(data + offset, size, &description) &&
+               description.compare(0, 4, "sRGB") == 0;
+    }
+
+    return false;
+}
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+namespace weserv::api::codecs {
+
+/**
+ * Is this ICC profile a flavour of sRGB? Decided on the colour space and the
+ * profile description (e.g. `sRGB IEC61966-2.1` or `sRGB built-in`), which
+ * may be an ASCII (v2) or a multi-localized Unicode (v4) text.
+ * @param data The ICC profile data.
+ * @param length Length of the profile data in bytes.
+ * @return A bool indicating if this is an sRGB profile, `false` if the
+ *         profile is malformed.
+ */
+bool is_srgb_profile(const unsigned char *data, size_t length);
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,697 @@
+#include "jpeg_encoder.h"
+
+#include "jpeg_error.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace weserv::api::codecs {
+
+#ifdef WESERV_HAVE_JPEG
+namespace {
+
+/**
+ * JPEG markers we're interested in.
+ */
+constexpr unsigned char JPEG_MARKER_SOF0 = 0xC0;
+constexpr unsigned char JPEG_MARKER_RST0 = 0xD0;
+constexpr unsigned char JPEG_MARKER_SOS = 0xDA;
+
+/**
+ * A restart interval is limited to 65535 MCUs.
+ */
+constexpr unsigned int MAX_RESTART_INTERVAL = 65535;
+
+/**
+ * The zigzag order of the coefficients within a block, i.e. the order in
+ * which they're entropy coded.
+ */
+constexpr int NATURAL_ORDER[DCTSIZE2] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+/**
+ * The longest code length that's considered while building an optimal
+ * Huffman table, longer codes are folded back to 16 bits afterwards.
+ */
+constexpr int MAX_CODE_LENGTH = 32;
+
+/**
+ * The JFIF density, written just as libvips does.
+ */
+struct Density {
+    UINT8 unit;
+    UINT16 x;
+    UINT16 y;
+};
+
+/**
+ * The number of times each Huffman symbol occurs, per table.
+ */
+struct SymbolCounts {
+    std::array<std::array<long, 257>, NUM_HUFF_TBLS> dc{};
+    std::array<std::array<long, 257>, NUM_HUFF_TBLS> ac{};
+};
+
+/**
+ * A Huffman table, as stored in the DHT marker.
+ */
+struct HuffmanTable {
+    bool used = false;
+    UINT8 bits[17] = {};
+    UINT8 huffval[256] = {};
+};
+
+/**
+ * The DCT coefficients of an encoded stripe, these stay around between
+ * gathering the statistics and entropy coding the stripe once more.
+ */
+struct StripeCoefficients {
+    ~StripeCoefficients() {
+        if (created) {
+            jpeg_destroy_decompress(&info);
+        }
+    }
+
+    jpeg_decompress_struct info{};
+    JpegErrorManager err{};
+    jvirt_barray_ptr *coefficients = nullptr;
+    bool created = false;
+};
+
+void set_density(jpeg_compress_struct *cinfo, const Density &density) {
+    cinfo->density_unit = density.unit;
+    cinfo->X_density = density.x;
+    cinfo->Y_density = density.y;
+}
+
+/**
+ * Encode a stripe of the image as a JPEG image of its own, with a single
+ * restart interval.
+ */
+bool compress_stripe(const unsigned char *pixels, int width, int height,
+                     int bands, int quality, unsigned int restart_interval,
+                     const Density &density, std::string *out) {
+    jpeg_compress_struct cinfo{};
+    JpegErrorManager err{};
+
+    cinfo.err = err.init();
+
+    // Allocated by libjpeg, while compressing
+    unsigned char *buffer = nullptr;
+    unsigned long buffer_size = 0;
+
+    // Note: no objects with non-trivial destructors may be created after this
+    // point, `longjmp` would skip them
+    if (setjmp(err.setjmp_buffer) != 0) {
+        jpeg_destroy_compress(&cinfo);
+        std::free(buffer);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &buffer_size);
+
+    cinfo.image_width = static_cast<JDIMENSION>(width);
+    cinfo.image_height = static_cast<JDIMENSION>(height);
+    cinfo.input_components = bands;
+    cinfo.in_color_space = bands == 1 ? JCS_GRAYSCALE : JCS_RGB;
+
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+
+    // Disable chroma subsampling from quality 90, as libvips does
+    if (bands == 3 && quality >= 90) {
+        cinfo.comp_info[0].h_samp_factor = 1;
+        cinfo.comp_info[0].v_samp_factor = 1;
+    }
+
+    // Let the decoder reset its DC predictions where the stripes are joined
+    cinfo.restart_interval = restart_interval;
+
+    set_density(&cinfo, density);
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    size_t row_bytes = static_cast<size_t>(width) * bands;
+    while (cinfo.next_scanline < cinfo.image_height) {
+        auto *row = const_cast<JSAMPROW>(pixels +
+                                         cinfo.next_scanline * row_bytes);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+
+    out->assign(reinterpret_cast<const char *>(buffer), buffer_size);
+
+    jpeg_destroy_compress(&cinfo);
+    std::free(buffer);
+
+    return true;
+}
+
+/**
+ * Count the Huffman symbols of a block, as libjpeg's baseline entropy
+ * encoder would emit them.
+ */
+void count_block(const JCOEF *block, int last_dc, std::array<long, 257> *dc,
+                 std::array<long, 257> *ac) {
+    // The number of bits of the magnitudes that fit in 12 bits, which covers
+    // the DC differences and AC values of 8-bit images
+    static const auto bit_lengths = []() {
+        std::array<unsigned char, 4096> lengths{};
+        for (size_t v = 1; v < lengths.size(); ++v) {
+            lengths[v] = static_cast<unsigned char>(lengths[v >> 1] + 1);
+        }
+        return lengths;
+    }();
+
+    auto n_bits = [](int value) {
+        auto magnitude = static_cast<unsigned int>(std::abs(value));
+        if (magnitude < bit_lengths.size()) {
+            return static_cast<int>(bit_lengths[magnitude]);
+        }
+
+        int bits = 0;
+        for (; magnitude != 0; magnitude >>= 1) {
+            ++bits;
+        }
+        return bits;
+    };
+
+    ++(*dc)[n_bits(block[0] - last_dc)];
+
+    int run = 0;
+    for (int k = 1; k < DCTSIZE2; ++k) {
+        int value = block[NATURAL_ORDER[k]];
+        if (value == 0) {
+            ++run;
+            continue;
+        }
+
+        // Runs of more than 15 zeros are split with ZRL symbols
+        for (; run > 15; run -= 16) {
+            ++(*ac)[0xF0];
+        }
+
+        ++(*ac)[(run << 4) + n_bits(value)];
+        run = 0;
+    }
+
+    // End of block
+    if (run > 0) {
+        ++(*ac)[0];
+    }
+}
+
+/**
+ * Read the DCT coefficients of a stripe and count the Huffman symbols it
+ * consists of. The coefficients are kept for `recode_stripe()`.
+ */
+bool gather_symbols(const std::string &stripe, StripeCoefficients *coefs,
+                    SymbolCounts *counts) {
+    jpeg_decompress_struct &info = coefs->info;
+
+    info.err = coefs->err.init();
+
+    if (setjmp(coefs->err.setjmp_buffer) != 0) {
+        return false;
+    }
+
+    jpeg_create_decompress(&info);
+    coefs->created = true;
+
+    jpeg_mem_src(&info, reinterpret_cast<const unsigned char *>(stripe.data()),
+                 static_cast<unsigned long>(stripe.size()));
+
+    if (jpeg_read_header(&info, TRUE) != JPEG_HEADER_OK) {
+        return false;
+    }
+
+    coefs->coefficients = jpeg_read_coefficients(&info);
+
+    // The stripe is a single baseline scan, its MCU layout is still around.
+    // A stripe is a restart interval of its own, so every component starts
+    // off with a zero DC prediction.
+    int last_dc[MAX_COMPS_IN_SCAN] = {};
+
+    for (JDIMENSION mcu_row = 0; mcu_row < info.MCU_rows_in_scan; ++mcu_row) {
+        JBLOCKARRAY rows[MAX_COMPS_IN_SCAN];
+        for (int ci = 0; ci < info.comps_in_scan; ++ci) {
+            jpeg_component_info *comp = info.cur_comp_info[ci];
+            rows[ci] = (*info.mem->access_virt_barray)(
+                reinterpret_cast<j_common_ptr>(&info),
+                coefs->coefficients[comp->component_index],
+                mcu_row * static_cast<JDIMENSION>(comp->MCU_height),
+                static_cast<JDIMENSION>(comp->MCU_height), FALSE);
+        }
+
+        for (JDIMENSION mcu_col = 0; mcu_col < info.MCUs_per_row; ++mcu_col) {
+            for (int ci = 0; ci < info.comps_in_scan; ++ci) {
+                jpeg_component_info *comp = info.cur_comp_info[ci];
+                auto &dc = counts->dc[comp->dc_tbl_no];
+                auto &ac = counts->ac[comp->ac_tbl_no];
+
+                int columns = mcu_col < info.MCUs_per_row - 1
+                                  ? comp->MCU_width
+                                  : comp->last_col_width;
+                int block_rows = mcu_row < info.MCU_rows_in_scan - 1
+                                     ? comp->MCU_height
+                                     : comp->last_row_height;
+
+                for (int y = 0; y < comp->MCU_height; ++y) {
+                    for (int x = 0; x < comp->MCU_width; ++x) {
+                        if (y < block_rows && x < columns) {
+                            const JCOEF *block =
+                                rows[ci][y][mcu_col * comp->MCU_width + x];
+                            count_block(block, last_dc[ci], &dc, &ac);
+                            last_dc[ci] = block[0];
+                        } else {
+                            // The padding blocks of the edge MCUs repeat the
+                            // DC of the preceding block, without any AC
+                            ++dc[0];
+                            ++ac[0];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Build an optimal Huffman table from the symbol counts, following
+ * section K.2 of the JPEG specification (as libjpeg does).
+ * @return false if the table can't be built.
+ */
+bool build_optimal_table(std::array<long, 257> freq, HuffmanTable *table) {
+    UINT8 bits[MAX_CODE_LENGTH + 1] = {};
+    int code_size[257] = {};
+    int others[257];
+    std::fill(std::begin(others), std::end(others), -1);
+
+    // Reserve one code point, so that no code consists of only 1-bits
+    freq[256] = 1;
+
+    for (;;) {
+        // The two least frequent symbols, preferring the larger symbol value
+        // on ties
+        int c1 = -1;
+        long v = 1000000000L;
+        for (int i = 0; i <= 256; ++i) {
+            if (freq[i] != 0 && freq[i] <= v) {
+                v = freq[i];
+                c1 = i;
+            }
+        }
+
+        int c2 = -1;
+        v = 1000000000L;
+        for (int i = 0; i <= 256; ++i) {
+            if (freq[i] != 0 && freq[i] <= v && i != c1) {
+                v = freq[i];
+                c2 = i;
+            }
+        }
+
+        if (c2 < 0) {
+            break;
+        }
+
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+
+        ++code_size[c1];
+        while (others[c1] >= 0) {
+            c1 = others[c1];
+            ++code_size[c1];
+        }
+
+        others[c1] = c2;
+
+        ++code_size[c2];
+        while (others[c2] >= 0) {
+            c2 = others[c2];
+            ++code_size[c2];
+        }
+    }
+
+    for (int size : code_size) {
+        if (size > MAX_CODE_LENGTH) {
+            return false;
+        }
+        if (size != 0) {
+            ++bits[size];
+        }
+    }
+
+    // Limit the code lengths to 16 bits
+    for (int i = MAX_CODE_LENGTH; i > 16; --i) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) {
+                --j;
+            }
+
+            bits[i] -= 2;
+            ++bits[i - 1];
+            bits[j + 1] += 2;
+            --bits[j];
+        }
+    }
+
+    // Remove the reserved code point from the longest codes
+    int longest = 16;
+    while (bits[longest] == 0) {
+        --longest;
+    }
+    --bits[longest];
+
+    std::memcpy(table->bits, bits, sizeof(table->bits));
+
+    int p = 0;
+    for (int size = 1; size <= MAX_CODE_LENGTH; ++size) {
+        for (int symbol = 0; symbol <= 255; ++symbol) {
+            if (code_size[symbol] == size) {
+                table->huffval[p++] = static_cast<UINT8>(symbol);
+            }
+        }
+    }
+
+    table->used = true;
+
+    return true;
+}
+
+/**
+ * Entropy code the DCT coefficients of a stripe once more, with the given
+ * Huffman tables.
+ */
+bool recode_stripe(StripeCoefficients *coefs,
+                   const std::array<HuffmanTable, NUM_HUFF_TBLS> &dc_tables,
+                   const std::array<HuffmanTable, NUM_HUFF_TBLS> &ac_tables,
+                   unsigned int restart_interval, const Density &density,
+                   std::string *out) {
+    jpeg_compress_struct cinfo{};
+
+    // Errors of either object end up here
+    cinfo.err = &coefs->err.pub;
+
+    // Allocated by libjpeg, while compressing
+    unsigned char *buffer = nullptr;
+    unsigned long buffer_size = 0;
+
+    // Note: no objects with non-trivial destructors may be created after this
+    // point, `longjmp` would skip them
+    if (setjmp(coefs->err.setjmp_buffer) != 0) {
+        jpeg_destroy_compress(&cinfo);
+        std::free(buffer);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &buffer_size);
+
+    jpeg_copy_critical_parameters(&coefs->info, &cinfo);
+
+    auto install = [&cinfo](JHUFF_TBL **slot, const HuffmanTable &table) {
+        if (!table.used) {
+            return;
+        }
+        if (*slot == nullptr) {
+            *slot = jpeg_alloc_huff_table(
+                reinterpret_cast<j_common_ptr>(&cinfo));
+        }
+        std::memcpy((*slot)->bits, table.bits, sizeof(table.bits));
+        std::memcpy((*slot)->huffval, table.huffval, sizeof(table.huffval));
+        (*slot)->sent_table = FALSE;
+    };
+
+    for (int i = 0; i < NUM_HUFF_TBLS; ++i) {
+        install(&cinfo.dc_huff_tbl_ptrs[i], dc_tables[i]);
+        install(&cinfo.ac_huff_tbl_ptrs[i], ac_tables[i]);
+    }
+
+    cinfo.optimize_coding = FALSE;
+    cinfo.restart_interval = restart_interval;
+
+    set_density(&cinfo, density);
+
+    jpeg_write_coefficients(&cinfo, coefs->coefficients);
+    jpeg_finish_compress(&cinfo);
+
+    out->assign(reinterpret_cast<const char *>(buffer), buffer_size);
+
+    jpeg_destroy_compress(&cinfo);
+    std::free(buffer);
+
+    return true;
+}
+
+/**
+ * Find the entropy-coded segment of a stripe, that is, everything between
+ * the scan header and the EOI marker.
+ * @return The start of the segment, or 0 if the stripe is malformed.
+ */
+size_t find_entropy_coded_segment(const std::string &stripe) {
+    const auto *data = reinterpret_cast<const unsigned char *>(stripe.data());
+    size_t length = stripe.size();
+
+    size_t pos = 2;
+    while (pos + 4 <= length) {
+        if (data[pos] != 0xFF) {
+            return 0;
+        }
+
+        unsigned char marker = data[pos + 1];
+        size_t segment_length = static_cast<size_t>(data[pos + 2]) << 8 |
+                                static_cast<size_t>(data[pos + 3]);
+
+        pos += segment_length + 2;
+        if (marker == JPEG_MARKER_SOS) {
+            // Leave room for the EOI marker
+            return pos + 2 <= length ? pos : 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Update the image height of the frame header.
+ */
+bool set_frame_height(std::string *header, int height) {
+    auto *data = reinterpret_cast<unsigned char *>(&(*header)[0]);
+    size_t length = header->size();
+
+    size_t pos = 2;
+    while (pos + 9 <= length) {
+        size_t segment_length = static_cast<size_t>(data[pos + 2]) << 8 |
+                                static_cast<size_t>(data[pos + 3]);
+
+        if (data[pos + 1] == JPEG_MARKER_SOF0) {
+            data[pos + 5] = static_cast<unsigned char>((height >> 8) & 0xFF);
+            data[pos + 6] = static_cast<unsigned char>(height & 0xFF);
+            return true;
+        }
+
+        pos += segment_length + 2;
+    }
+
+    return false;
+}
+
+/**
+ * Join the stripes with RSTn markers, under the headers of the first stripe.
+ */
+bool join_stripes(const std::vector<std::string> &stripes, int height,
+                  std::string *out) {
+    // The headers of the first stripe are shared by all stripes, except for
+    // the image height
+    size_t start = find_entropy_coded_segment(stripes[0]);
+    if (start == 0) {
+        return false;
+    }
+
+    std::string joined = stripes[0].substr(0, start);
+    if (!set_frame_height(&joined, height)) {
+        return false;
+    }
+
+    for (size_t stripe = 0; stripe < stripes.size(); ++stripe) {
+        const std::string &data = stripes[stripe];
+
+        start = stripe == 0 ? start : find_entropy_coded_segment(data);
+        if (start == 0) {
+            return false;
+        }
+
+        if (stripe > 0) {
+            joined += static_cast<char>(0xFF);
+            joined += static_cast<char>(JPEG_MARKER_RST0 + (stripe - 1) % 8);
+        }
+
+        // Strip the EOI marker
+        joined.append(data, start, data.size() - start - 2);
+    }
+
+    joined += "\xFF\xD9";
+
+    *out = std::move(joined);
+
+    return true;
+}
+
+}  // namespace
+#endif
+
+bool encode_jpeg([[maybe_unused]] const unsigned char *pixels,
+                 [[maybe_unused]] int width, [[maybe_unused]] int height,
+                 [[maybe_unused]] int bands, [[maybe_unused]] int quality,
+                 [[maybe_unused]] bool optimize_coding,
+                 [[maybe_unused]] double xres, [[maybe_unused]] double yres,
+                 [[maybe_unused]] bool resolution_in_cm,
+                 [[maybe_unused]] int threads,
+                 [[maybe_unused]] std::string *out) {
+#ifdef WESERV_HAVE_JPEG
+    if (width <= 0 || height <= 0 || width > JPEG_MAX_DIMENSION ||
+        height > JPEG_MAX_DIMENSION || (bands != 1 && bands != 3) ||
+        quality < 1 || quality > 100) {
+        return false;
+    }
+
+    // The size of an MCU, which is an iMCU for a (non-interleaved) grey image
+    bool subsample = bands == 3 && quality < 90;
+    int mcu_size = subsample ? 16 : 8;
+
+    auto mcus_per_row = static_cast<unsigned int>((width + mcu_size - 1) /
+                                                  mcu_size);
+    auto mcu_rows = static_cast<unsigned int>((height + mcu_size - 1) /
+                                              mcu_size);
+    if (mcus_per_row > MAX_RESTART_INTERVAL) {
+        return false;
+    }
+
+    // Spread the MCU rows over the threads, but don't make the stripes too
+    // small (or too large for a restart interval)
+    size_t row_bytes = static_cast<size_t>(width) * bands;
+    size_t image_size = row_bytes * height;
+    size_t n_stripes = std::max<size_t>(
+        1, std::min({static_cast<size_t>(std::max(threads, 1)) * 2,
+                     image_size / JPEG_STRIPE_SIZE,
+                     static_cast<size_t>(mcu_rows)}));
+
+    unsigned int rows_per_stripe = std::min(
+        (mcu_rows + static_cast<unsigned int>(n_stripes) - 1) /
+            static_cast<unsigned int>(n_stripes),
+        MAX_RESTART_INTERVAL / mcus_per_row);
+    n_stripes = (mcu_rows + rows_per_stripe - 1) / rows_per_stripe;
+
+    unsigned int restart_interval = rows_per_stripe * mcus_per_row;
+
+    // Pixels per inch or centimetre, as libvips writes it
+    double density_scale = resolution_in_cm ? 10.0 : 25.4;
+    Density density{
+        static_cast<UINT8>(resolution_in_cm ? 2 : 1),
+        static_cast<UINT16>(std::clamp(std::lround(xres * density_scale), 1L,
+                                       65535L)),
+        static_cast<UINT16>(std::clamp(std::lround(yres * density_scale), 1L,
+                                       65535L))};
+
+    std::vector<std::string> stripes(n_stripes);
+    std::atomic<bool> failed{false};
+
+    parallel_for(n_stripes, threads, [&](size_t stripe) {
+        int top = static_cast<int>(stripe * rows_per_stripe) * mcu_size;
+        int stripe_height = std::min(
+            static_cast<int>(rows_per_stripe) * mcu_size, height - top);
+
+        if (!compress_stripe(pixels + static_cast<size_t>(top) * row_bytes,
+                             width, stripe_height, bands, quality,
+                             restart_interval, density, &stripes[stripe])) {
+            failed = true;
+        }
+    });
+
+    if (failed) {
+        return false;
+    }
+
+    if (!optimize_coding) {
+        return join_stripes(stripes, height, out);
+    }
+
+    // Count the Huffman symbols of every stripe
+    std::vector<std::unique_ptr<StripeCoefficients>> coefficients(n_stripes);
+    std::vector<SymbolCounts> counts(n_stripes);
+
+    parallel_for(n_stripes, threads, [&](size_t stripe) {
+        coefficients[stripe] = std::make_unique<StripeCoefficients>();
+        if (!gather_symbols(stripes[stripe], coefficients[stripe].get(),
+                            &counts[stripe])) {
+            failed = true;
+        }
+    });
+
+    if (failed) {
+        return false;
+    }
+
+    // One set of optimal tables for the image as a whole
+    std::array<HuffmanTable, NUM_HUFF_TBLS> dc_tables;
+    std::array<HuffmanTable, NUM_HUFF_TBLS> ac_tables;
+
+    for (int i = 0; i < NUM_HUFF_TBLS; ++i) {
+        std::array<long, 257> dc{};
+        std::array<long, 257> ac{};
+        for (const auto &stripe_counts : counts) {
+            for (size_t symbol = 0; symbol < dc.size(); ++symbol) {
+                dc[symbol] += stripe_counts.dc[i][symbol];
+                ac[symbol] += stripe_counts.ac[i][symbol];
+            }
+        }
+
+        bool used_dc = std::any_of(dc.begin(), dc.end(),
+                                   [](long f) { return f != 0; });
+        bool used_ac = std::any_of(ac.begin(), ac.end(),
+                                   [](long f) { return f != 0; });
+        if ((used_dc && !build_optimal_table(dc, &dc_tables[i])) ||
+            (used_ac && !build_optimal_table(ac, &ac_tables[i]))) {
+            return false;
+        }
+    }
+
+    // And entropy code the stripes once more with these tables
+    parallel_for(n_stripes, threads, [&](size_t stripe) {
+        if (!recode_stripe(coefficients[stripe].get(), dc_tables, ac_tables,
+                           restart_interval, density, &stripes[stripe])) {
+            failed = true;
+        }
+
+        // Free the coefficients as soon as possible
+        coefficients[stripe].reset();
+    });
+
+    if (failed) {
+        return false;
+    }
+
+    return join_stripes(stripes, height, out);
+#else
+    return false;
+#endif
+}
+
+}  // namespace weserv::api::codecs
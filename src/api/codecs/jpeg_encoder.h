@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace weserv::api::codecs {
+
+/**
+ * The minimum amount of image data per stripe, smaller stripes aren't worth
+ * a thread.
+ */
+constexpr size_t JPEG_STRIPE_SIZE = 256 * 1024;
+
+/**
+ * Encode an image as a baseline JPEG image, with the stripes of the image
+ * encoded on multiple threads. Every stripe is a whole number of iMCU rows
+ * and is encoded as a restart interval of its own, the entropy-coded
+ * segments are joined with RSTn markers.
+ * When optimizing the Huffman tables, the symbols of every stripe are
+ * counted on its own thread and the stripes are entropy coded once more with
+ * the optimal tables for the whole image, so that no pass runs on a single
+ * thread.
+ * @note Chroma subsampling (4:2:0) is used below quality 90, as libvips
+ *       does. No metadata is written, apart from the JFIF density.
+ * @param pixels The interleaved 8-bit samples.
+ * @param width Width of the image.
+ * @param height Height of the image.
+ * @param bands Number of bands, either 1 (grey) or 3 (RGB).
+ * @param quality Quality factor, between 1 and 100.
+ * @param optimize_coding Compute optimal Huffman tables.
+ * @param xres Horizontal resolution, in pixels per millimetre.
+ * @param yres Vertical resolution, in pixels per millimetre.
+ * @param resolution_in_cm Write the density in pixels per centimetre,
+ *        instead of per inch.
+ * @param threads Number of threads to use.
+ * @param out Receives the JPEG image.
+ * @return false if the image can't be encoded (e.g. libjpeg isn't available
+ *         or the image is too large for a restart interval).
+ */
+bool encode_jpeg(const unsigned char *pixels, int width, int height, int bands,
+                 int quality, bool optimize_coding, double xres, double yres,
+                 bool resolution_in_cm, int threads, std::string *out);
+
+}  // namespace weserv::api::codecs
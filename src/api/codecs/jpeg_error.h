@@ -0,0 +1,42 @@
+#pragma once
+
+#ifdef WESERV_HAVE_JPEG
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+
+namespace weserv::api::codecs {
+
+/**
+ * Jump back to the caller on any libjpeg error, instead of exiting.
+ * @note The caller should `setjmp` on `setjmp_buffer` before calling into
+ *       libjpeg, no objects with non-trivial destructors may be created after
+ *       that point, `longjmp` would skip them.
+ */
+struct JpegErrorManager {
+    jpeg_error_mgr pub;
+    std::jmp_buf setjmp_buffer;
+
+    /**
+     * @return the error handler to assign to a (de)compress object.
+     */
+    jpeg_error_mgr *init() {
+        jpeg_std_error(&pub);
+        pub.error_exit = error_exit;
+        pub.output_message = output_message;
+        return &pub;
+    }
+
+    static void error_exit(j_common_ptr cinfo) {
+        auto *err = reinterpret_cast<JpegErrorManager *>(cinfo->err);
+        std::longjmp(err->setjmp_buffer, 1);
+    }
+
+    static void output_message(j_common_ptr /* unused */) {
+        // Warnings are ignored, just as with `fail=false`
+    }
+};
+
+}  // namespace weserv::api::codecs
+#endif
@@ -0,0 +1,125 @@
+#include "jpeg_region.h"
+
+#include "jpeg_error.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace weserv::api::codecs {
+
+bool decode_jpeg_region(const unsigned char *data, size_t length, int left,
+                        int top, int width, int height, DecodedImage *out) {
+#ifdef WESERV_HAVE_JPEG
+    if (left < 0 || top < 0 || width <= 0 || height <= 0) {
+        return false;
+    }
+
+    jpeg_decompress_struct cinfo{};
+    JpegErrorManager err{};
+
+    cinfo.err = err.init();
+
+    // Note: no objects with non-trivial destructors may be created after this
+    // point, `longjmp` would skip them
+    if (setjmp(err.setjmp_buffer) != 0) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char *>(data),
+                 static_cast<unsigned long>(length));
+    jpeg_read_header(&cinfo, TRUE);
+
+    // Leave CMYK/YCCK (and their Adobe quirks) to the JPEG loader
+    if ((cinfo.jpeg_color_space != JCS_YCbCr &&
+         cinfo.jpeg_color_space != JCS_RGB &&
+         cinfo.jpeg_color_space != JCS_GRAYSCALE) ||
+        static_cast<JDIMENSION>(left + width) > cinfo.image_width ||
+        static_cast<JDIMENSION>(top + height) > cinfo.image_height) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    cinfo.out_color_space =
+        cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+
+    jpeg_start_decompress(&cinfo);
+
+    auto x_offset = static_cast<JDIMENSION>(left);
+
+#ifdef LIBJPEG_TURBO_VERSION_NUMBER
+    // Only decode the MCU columns covering the region, this rounds the
+    // offset down (and the width up) to the nearest iMCU boundary. Fancy
+    // upsampling needs the neighbouring pixels of the region as context, so
+    // include an extra iMCU column on both sides.
+#if JPEG_LIB_VERSION >= 70
+    auto imcu_width = static_cast<JDIMENSION>(cinfo.max_h_samp_factor *
+                                              cinfo.min_DCT_h_scaled_size);
+#else
+    auto imcu_width = static_cast<JDIMENSION>(cinfo.max_h_samp_factor *
+                                              cinfo.min_DCT_scaled_size);
+#endif
+    x_offset = x_offset > imcu_width ? x_offset - imcu_width : 0;
+    auto crop_width = std::min(static_cast<JDIMENSION>(left + width) +
+                                   imcu_width,
+                               cinfo.output_width) -
+                      x_offset;
+    jpeg_crop_scanline(&cinfo, &x_offset, &crop_width);
+
+    size_t skip = static_cast<size_t>(left) - x_offset;
+
+    // Rows above the region are entropy-decoded only
+    auto skip_rows = static_cast<JDIMENSION>(top);
+    if (skip_rows > 0 && jpeg_skip_scanlines(&cinfo, skip_rows) != skip_rows) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+#else
+    size_t skip = static_cast<size_t>(x_offset);
+#endif
+
+    auto components = static_cast<size_t>(cinfo.output_components);
+    size_t row_size = static_cast<size_t>(cinfo.output_width) * components;
+
+    // The scanline buffer is allocated from libjpeg's pool, it's freed along
+    // with the decompress object
+    JSAMPARRAY row = (*cinfo.mem->alloc_sarray)(
+        reinterpret_cast<j_common_ptr>(&cinfo), JPOOL_IMAGE,
+        static_cast<JDIMENSION>(row_size), 1);
+
+#ifndef LIBJPEG_TURBO_VERSION_NUMBER
+    // Decode (and discard) the rows above the region
+    while (cinfo.output_scanline < static_cast<JDIMENSION>(top)) {
+        jpeg_read_scanlines(&cinfo, row, 1);
+    }
+#endif
+
+    out->width = width;
+    out->height = height;
+    out->bands = static_cast<int>(components);
+    out->bit_depth = 8;
+    out->pixels.resize(static_cast<size_t>(width) * height * components);
+
+    size_t out_row_size = static_cast<size_t>(width) * components;
+    for (int y = 0; y < height; ++y) {
+        if (jpeg_read_scanlines(&cinfo, row, 1) != 1) {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+
+        std::memcpy(out->pixels.data() + y * out_row_size,
+                    row[0] + skip * components, out_row_size);
+    }
+
+    // Don't bother decoding the rows below the region
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "decoded_image.h"
+
+#include <cstddef>
+
+namespace weserv::api::codecs {
+
+/**
+ * Decode a region of a JPEG image. Decoding stops after the last MCU row of
+ * the region, and with libjpeg-turbo, the rows above the region aren't
+ * colour-converted and only the MCU columns covering the region are decoded.
+ * @note Only (YCbCr) colour and grayscale images are supported, the JPEG
+ *       loader should be consulted for CMYK images.
+ * @param data The JPEG data.
+ * @param length Length of the JPEG data in bytes.
+ * @param left Left edge of the region.
+ * @param top Top edge of the region.
+ * @param width Width of the region.
+ * @param height Height of the region.
+ * @param out Receives the decoded region.
+ * @return false if the image isn't supported or couldn't be decoded.
+ */
+bool decode_jpeg_region(const unsigned char *data, size_t length, int left,
+                        int top, int width, int height, DecodedImage *out);
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,327 @@
+#include "jpeg_transform.h"
+
+#include "jpeg_error.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+namespace weserv::api::codecs {
+
+#ifdef WESERV_HAVE_JPEG
+namespace {
+
+/**
+ * The transform of the block grid, every transform is a transposition
+ * followed by mirroring the axes of the source.
+ */
+struct Plan {
+    bool transpose = false;
+    bool mirror_x = false;
+    bool mirror_y = false;
+};
+
+Plan resolve_plan(const JpegTransform &transform) {
+    Plan plan;
+
+    switch (transform.angle) {
+        case 90:
+            plan.transpose = true;
+            plan.mirror_y = true;
+            break;
+        case 180:
+            plan.mirror_x = true;
+            plan.mirror_y = true;
+            break;
+        case 270:
+            plan.transpose = true;
+            plan.mirror_x = true;
+            break;
+        default:
+            break;
+    }
+
+    // Mirroring the output mirrors the axis of the source it maps to
+    if (transform.flip) {
+        (plan.transpose ? plan.mirror_x : plan.mirror_y) ^= true;
+    }
+    if (transform.flop) {
+        (plan.transpose ? plan.mirror_y : plan.mirror_x) ^= true;
+    }
+
+    return plan;
+}
+
+JDIMENSION div_round_up(JDIMENSION a, JDIMENSION b) {
+    return (a + b - 1) / b;
+}
+
+JDIMENSION round_up(JDIMENSION a, JDIMENSION b) {
+    return div_round_up(a, b) * b;
+}
+
+/**
+ * Transform the coefficients of a single block. Mirroring negates the odd
+ * frequencies along that axis, transposing swaps the frequencies.
+ */
+void transform_block(const JCOEF *in, JCOEF *out, const Plan &plan) {
+    for (int v = 0; v < DCTSIZE; ++v) {
+        for (int u = 0; u < DCTSIZE; ++u) {
+            int sv = plan.transpose ? u : v;
+            int su = plan.transpose ? v : u;
+
+            JCOEF coefficient = in[sv * DCTSIZE + su];
+            if ((plan.mirror_x && (su & 1) != 0) !=
+                (plan.mirror_y && (sv & 1) != 0)) {
+                coefficient = static_cast<JCOEF>(-coefficient);
+            }
+
+            out[v * DCTSIZE + u] = coefficient;
+        }
+    }
+}
+
+/**
+ * Does this APP2 marker hold (a part of) an ICC profile?
+ */
+bool is_icc_marker(const jpeg_saved_marker_ptr marker) {
+    return marker->marker == JPEG_APP0 + 2 && marker->data_length >= 12 &&
+           std::memcmp(marker->data, "ICC_PROFILE\0", 12) == 0;
+}
+
+}  // namespace
+#endif
+
+bool transform_jpeg(const unsigned char *data, size_t length,
+                    const JpegTransform &transform, std::string *out) {
+#ifdef WESERV_HAVE_JPEG
+    if (transform.angle != 0 && transform.angle != 90 &&
+        transform.angle != 180 && transform.angle != 270) {
+        return false;
+    }
+
+    Plan plan = resolve_plan(transform);
+
+    jpeg_decompress_struct src{};
+    jpeg_compress_struct dst{};
+    JpegErrorManager err{};
+
+    src.err = err.init();
+    dst.err = src.err;
+
+    // Allocated by libjpeg, while compressing
+    unsigned char *buffer = nullptr;
+    unsigned long buffer_size = 0;
+
+    auto clean_up = [&]() {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        std::free(buffer);
+    };
+
+    // Note: no objects with non-trivial destructors may be created after this
+    // point, `longjmp` would skip them
+    if (setjmp(err.setjmp_buffer) != 0) {
+        clean_up();
+        return false;
+    }
+
+    jpeg_create_decompress(&src);
+    jpeg_create_compress(&dst);
+
+    jpeg_mem_src(&src, const_cast<unsigned char *>(data),
+                 static_cast<unsigned long>(length));
+    jpeg_save_markers(&src, JPEG_APP0 + 2, 0xFFFF);
+    jpeg_read_header(&src, TRUE);
+
+    // Leave CMYK/YCCK (and their Adobe quirks) to the JPEG loader
+    if (src.jpeg_color_space != JCS_YCbCr && src.jpeg_color_space != JCS_RGB &&
+        src.jpeg_color_space != JCS_GRAYSCALE) {
+        clean_up();
+        return false;
+    }
+
+    JDIMENSION imcu_width = src.max_h_samp_factor * DCTSIZE;
+    JDIMENSION imcu_height = src.max_v_samp_factor * DCTSIZE;
+
+    // Partial iMCUs can't be moved to the opposite edge
+    if ((plan.mirror_x && src.image_width % imcu_width != 0) ||
+        (plan.mirror_y && src.image_height % imcu_height != 0)) {
+        clean_up();
+        return false;
+    }
+
+    JDIMENSION out_width = plan.transpose ? src.image_height : src.image_width;
+    JDIMENSION out_height =
+        plan.transpose ? src.image_width : src.image_height;
+    JDIMENSION out_imcu_width = plan.transpose ? imcu_height : imcu_width;
+    JDIMENSION out_imcu_height = plan.transpose ? imcu_width : imcu_height;
+
+    JDIMENSION left = 0;
+    JDIMENSION top = 0;
+    JDIMENSION width = out_width;
+    JDIMENSION height = out_height;
+
+    if (transform.width > 0 && transform.height > 0) {
+        if (transform.left < 0 || transform.top < 0) {
+            clean_up();
+            return false;
+        }
+
+        left = static_cast<JDIMENSION>(transform.left);
+        top = static_cast<JDIMENSION>(transform.top);
+        width = static_cast<JDIMENSION>(transform.width);
+        height = static_cast<JDIMENSION>(transform.height);
+
+        // The crop should start on an iMCU boundary
+        if (left % out_imcu_width != 0 || top % out_imcu_height != 0 ||
+            left + width > out_width || top + height > out_height) {
+            clean_up();
+            return false;
+        }
+    }
+
+    int max_h_samp_factor =
+        plan.transpose ? src.max_v_samp_factor : src.max_h_samp_factor;
+    int max_v_samp_factor =
+        plan.transpose ? src.max_h_samp_factor : src.max_v_samp_factor;
+
+    // The output arrays need to be requested before reading the
+    // coefficients, libjpeg realizes all arrays at once
+    jvirt_barray_ptr dst_arrays[MAX_COMPONENTS];
+    for (int ci = 0; ci < src.num_components; ++ci) {
+        jpeg_component_info *component = &src.comp_info[ci];
+        int h_samp_factor = plan.transpose ? component->v_samp_factor
+                                           : component->h_samp_factor;
+        int v_samp_factor = plan.transpose ? component->h_samp_factor
+                                           : component->v_samp_factor;
+
+        JDIMENSION width_in_blocks = div_round_up(
+            width * h_samp_factor, max_h_samp_factor * DCTSIZE);
+        JDIMENSION height_in_blocks = div_round_up(
+            height * v_samp_factor, max_v_samp_factor * DCTSIZE);
+
+        dst_arrays[ci] = (*src.mem->request_virt_barray)(
+            reinterpret_cast<j_common_ptr>(&src), JPOOL_IMAGE, FALSE,
+            round_up(width_in_blocks, h_samp_factor),
+            round_up(height_in_blocks, v_samp_factor), v_samp_factor);
+    }
+
+    jvirt_barray_ptr *src_arrays = jpeg_read_coefficients(&src);
+
+    for (int ci = 0; ci < src.num_components; ++ci) {
+        jpeg_component_info *component = &src.comp_info[ci];
+        int h_samp_factor = plan.transpose ? component->v_samp_factor
+                                           : component->h_samp_factor;
+        int v_samp_factor = plan.transpose ? component->h_samp_factor
+                                           : component->v_samp_factor;
+
+        // The crop offset, in blocks of this component
+        JDIMENSION x_offset = left / out_imcu_width * h_samp_factor;
+        JDIMENSION y_offset = top / out_imcu_height * v_samp_factor;
+
+        // The extent of the source arrays, including the dummy blocks
+        JDIMENSION src_width = round_up(component->width_in_blocks,
+                                        component->h_samp_factor);
+        JDIMENSION src_height = round_up(component->height_in_blocks,
+                                         component->v_samp_factor);
+
+        JDIMENSION dst_width =
+            round_up(div_round_up(width * h_samp_factor,
+                                  max_h_samp_factor * DCTSIZE),
+                     h_samp_factor);
+        JDIMENSION dst_height =
+            round_up(div_round_up(height * v_samp_factor,
+                                  max_v_samp_factor * DCTSIZE),
+                     v_samp_factor);
+
+        for (JDIMENSION y = 0; y < dst_height; ++y) {
+            JBLOCKROW dst_row = (*src.mem->access_virt_barray)(
+                reinterpret_cast<j_common_ptr>(&src), dst_arrays[ci], y, 1,
+                TRUE)[0];
+
+            for (JDIMENSION x = 0; x < dst_width; ++x) {
+                // Find the source block, mirrored axes are a multiple of the
+                // iMCU size so these don't have any dummy blocks
+                auto block_x = static_cast<long>(plan.transpose ? y + y_offset
+                                                                : x + x_offset);
+                auto block_y = static_cast<long>(plan.transpose ? x + x_offset
+                                                                : y + y_offset);
+                if (plan.mirror_x) {
+                    block_x = component->width_in_blocks - 1 - block_x;
+                }
+                if (plan.mirror_y) {
+                    block_y = component->height_in_blocks - 1 - block_y;
+                }
+
+                if (block_x < 0 || block_y < 0 ||
+                    block_x >= static_cast<long>(src_width) ||
+                    block_y >= static_cast<long>(src_height)) {
+                    std::memset(dst_row[x], 0, sizeof(JBLOCK));
+                    continue;
+                }
+
+                JBLOCKROW src_row = (*src.mem->access_virt_barray)(
+                    reinterpret_cast<j_common_ptr>(&src), src_arrays[ci],
+                    static_cast<JDIMENSION>(block_y), 1, FALSE)[0];
+
+                transform_block(src_row[block_x], dst_row[x], plan);
+            }
+        }
+    }
+
+    jpeg_copy_critical_parameters(&src, &dst);
+
+    dst.image_width = width;
+    dst.image_height = height;
+
+    if (plan.transpose) {
+        for (int ci = 0; ci < dst.num_components; ++ci) {
+            jpeg_component_info *component = &dst.comp_info[ci];
+            std::swap(component->h_samp_factor, component->v_samp_factor);
+        }
+
+        // The quantization tables are transposed along with the blocks
+        for (auto *table : dst.quant_tbl_ptrs) {
+            if (table == nullptr) {
+                continue;
+            }
+
+            for (int v = 0; v < DCTSIZE; ++v) {
+                for (int u = v + 1; u < DCTSIZE; ++u) {
+                    std::swap(table->quantval[v * DCTSIZE + u],
+                              table->quantval[u * DCTSIZE + v]);
+                }
+            }
+        }
+    }
+
+    // Enable libjpeg's Huffman table optimiser
+    dst.optimize_coding = TRUE;
+
+    jpeg_mem_dest(&dst, &buffer, &buffer_size);
+    jpeg_write_coefficients(&dst, dst_arrays);
+
+    // Keep the ICC profile, drop any other metadata
+    for (auto marker = src.marker_list; marker != nullptr;
+         marker = marker->next) {
+        if (is_icc_marker(marker)) {
+            jpeg_write_marker(&dst, marker->marker, marker->data,
+                              marker->data_length);
+        }
+    }
+
+    jpeg_finish_compress(&dst);
+    jpeg_finish_decompress(&src);
+
+    out->assign(reinterpret_cast<const char *>(buffer), buffer_size);
+
+    clean_up();
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace weserv::api::codecs {
+
+/**
+ * A lossless transform of a JPEG image. The image is rotated (clockwise)
+ * first, then flipped, flopped and at last cropped.
+ */
+struct JpegTransform {
+    /**
+     * Angle of rotation, either 0, 90, 180 or 270.
+     */
+    int angle = 0;
+
+    /**
+     * Flip (mirror about the X axis) or flop (mirror about the Y axis).
+     */
+    bool flip = false;
+    bool flop = false;
+
+    /**
+     * The crop rectangle, within the rotated and mirrored image. The left and
+     * top edges should be on an iMCU boundary. A zero width or height means
+     * no crop.
+     */
+    int left = 0;
+    int top = 0;
+    int width = 0;
+    int height = 0;
+};
+
+/**
+ * Transform a JPEG image without decoding it, by rearranging the DCT
+ * coefficients (as jpegtran does). Only ICC profiles are kept, any other
+ * metadata is dropped.
+ * @note Only perfect transforms are done, i.e. an axis that is mirrored
+ *       should be a multiple of the iMCU size, as should the crop offset.
+ *       Other transforms require the partial iMCUs at the edges to be
+ *       decoded and re-encoded, the caller should fall back to that.
+ * @param data The JPEG data.
+ * @param length Length of the JPEG data in bytes.
+ * @param transform The transform to perform.
+ * @param out Receives the transformed image.
+ * @return false if the transform isn't perfect, the image isn't supported
+ *         or it couldn't be transformed.
+ */
+bool transform_jpeg(const unsigned char *data, size_t length,
+                    const JpegTransform &transform, std::string *out);
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,280 @@
+#include "metadata_strip.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace weserv::api::codecs {
+
+using enums::ImageType;
+
+namespace {
+
+/**
+ * JPEG markers we're interested in.
+ */
+constexpr unsigned char JPEG_MARKER_APP0 = 0xE0;
+constexpr unsigned char JPEG_MARKER_APP2 = 0xE2;
+constexpr unsigned char JPEG_MARKER_APP14 = 0xEE;
+constexpr unsigned char JPEG_MARKER_APP15 = 0xEF;
+constexpr unsigned char JPEG_MARKER_COM = 0xFE;
+constexpr unsigned char JPEG_MARKER_RST0 = 0xD0;
+constexpr unsigned char JPEG_MARKER_RST7 = 0xD7;
+constexpr unsigned char JPEG_MARKER_SOS = 0xDA;
+constexpr unsigned char JPEG_MARKER_EOI = 0xD9;
+
+/**
+ * The VP8X flags of the metadata that is dropped.
+ */
+constexpr unsigned char WEBP_FLAG_EXIF = 0x08;
+constexpr unsigned char WEBP_FLAG_XMP = 0x04;
+
+uint32_t read_uint32_be(const unsigned char *p) {
+    return static_cast<uint32_t>(p[0]) << 24 |
+           static_cast<uint32_t>(p[1]) << 16 |
+           static_cast<uint32_t>(p[2]) << 8 | static_cast<uint32_t>(p[3]);
+}
+
+uint32_t read_uint32_le(const unsigned char *p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 |
+           static_cast<uint32_t>(p[3]) << 24;
+}
+
+void write_uint32_le(uint32_t value, char *p) {
+    p[0] = static_cast<char>(value & 0xFF);
+    p[1] = static_cast<char>((value >> 8) & 0xFF);
+    p[2] = static_cast<char>((value >> 16) & 0xFF);
+    p[3] = static_cast<char>((value >> 24) & 0xFF);
+}
+
+/**
+ * Should this JPEG segment be kept? JFIF (APP0), the ICC profile (APP2) and
+ * the Adobe segment (APP14, which signals the color transform) are needed to
+ * render the image, the other application segments and comments are not.
+ */
+bool keep_jpeg_segment(unsigned char marker, const unsigned char *payload,
+                       size_t payload_length) {
+    if (marker == JPEG_MARKER_APP2) {
+        return payload_length >= 12 &&
+               std::memcmp(payload, "ICC_PROFILE\0", 12) == 0;
+    }
+
+    if (marker == JPEG_MARKER_COM) {
+        return false;
+    }
+
+    return marker < JPEG_MARKER_APP0 || marker > JPEG_MARKER_APP15 ||
+           marker == JPEG_MARKER_APP0 || marker == JPEG_MARKER_APP14;
+}
+
+/**
+ * Is this the start of a marker that ends the entropy-coded data? Stuffed
+ * zero bytes and restart markers are part of the data.
+ */
+bool is_jpeg_scan_end(const unsigned char *p) {
+    return p[0] == 0xFF && p[1] != 0x00 &&
+           (p[1] < JPEG_MARKER_RST0 || p[1] > JPEG_MARKER_RST7);
+}
+
+/**
+ * Walk the JPEG segments up to the end of the image, the entropy-coded data
+ * of each scan is copied as a whole.
+ */
+bool strip_jpeg(const unsigned char *data, size_t length, std::string *out) {
+    if (length < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+
+    out->reserve(length);
+    out->assign(reinterpret_cast<const char *>(data), 2);
+
+    bool has_scan = false;
+
+    size_t pos = 2;
+    while (pos + 2 <= length) {
+        if (data[pos] != 0xFF) {
+            return false;
+        }
+
+        unsigned char marker = data[pos + 1];
+
+        // Skip any fill bytes
+        if (marker == 0xFF) {
+            ++pos;
+            continue;
+        }
+
+        // Ignore anything after the end of the image (e.g. the secondary
+        // images of MPF or the gain map of Ultra HDR images, which may carry
+        // metadata of their own)
+        if (marker == JPEG_MARKER_EOI) {
+            if (!has_scan) {
+                return false;
+            }
+
+            out->append(reinterpret_cast<const char *>(data + pos), 2);
+            return true;
+        }
+
+        if (pos + 4 > length) {
+            return false;
+        }
+
+        size_t segment_length = static_cast<size_t>(data[pos + 2]) << 8 |
+                                static_cast<size_t>(data[pos + 3]);
+        if (segment_length < 2 || segment_length > length - pos - 2) {
+            return false;
+        }
+
+        // The scan header and its entropy-coded data are copied as-is
+        if (marker == JPEG_MARKER_SOS) {
+            size_t end = pos + segment_length + 2;
+            while (end + 1 < length && !is_jpeg_scan_end(data + end)) {
+                ++end;
+            }
+
+            // A truncated image
+            if (end + 1 >= length) {
+                return false;
+            }
+
+            out->append(reinterpret_cast<const char *>(data + pos),
+                        end - pos);
+
+            has_scan = true;
+            pos = end;
+            continue;
+        }
+
+        if (keep_jpeg_segment(marker, data + pos + 4, segment_length - 2)) {
+            out->append(reinterpret_cast<const char *>(data + pos),
+                        segment_length + 2);
+        }
+
+        pos += segment_length + 2;
+    }
+
+    return false;
+}
+
+/**
+ * Should this PNG chunk be kept? Only the textual chunks, EXIF and the
+ * modification time are dropped.
+ */
+bool keep_png_chunk(const unsigned char *type) {
+    return std::memcmp(type, "tEXt", 4) != 0 &&
+           std::memcmp(type, "zTXt", 4) != 0 &&
+           std::memcmp(type, "iTXt", 4) != 0 &&
+           std::memcmp(type, "eXIf", 4) != 0 &&
+           std::memcmp(type, "tIME", 4) != 0;
+}
+
+bool strip_png(const unsigned char *data, size_t length, std::string *out) {
+    if (length < 8 || std::memcmp(data, "\x89PNG\r\n\x1a\n", 8) != 0) {
+        return false;
+    }
+
+    out->reserve(length);
+    out->assign(reinterpret_cast<const char *>(data), 8);
+
+    size_t pos = 8;
+    while (pos + 12 <= length) {
+        // The length, type and CRC surround the chunk data
+        size_t chunk_length = read_uint32_be(data + pos);
+        if (chunk_length > length - pos - 12) {
+            return false;
+        }
+
+        const unsigned char *type = data + pos + 4;
+        if (keep_png_chunk(type)) {
+            out->append(reinterpret_cast<const char *>(data + pos),
+                        chunk_length + 12);
+        }
+
+        pos += chunk_length + 12;
+
+        // Ignore anything after the end of the image
+        if (std::memcmp(type, "IEND", 4) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool strip_webp(const unsigned char *data, size_t length, std::string *out) {
+    if (length < 12 || std::memcmp(data, "RIFF", 4) != 0 ||
+        std::memcmp(data + 8, "WEBP", 4) != 0) {
+        return false;
+    }
+
+    // Ignore anything after the end of the RIFF container
+    size_t riff_end = static_cast<size_t>(read_uint32_le(data + 4)) + 8;
+    if (riff_end > length) {
+        return false;
+    }
+
+    out->reserve(riff_end);
+    out->assign(reinterpret_cast<const char *>(data), 12);
+
+    size_t vp8x = 0;
+
+    size_t pos = 12;
+    while (pos + 8 <= riff_end) {
+        // Chunks are padded to an even size
+        size_t chunk_length = read_uint32_le(data + pos + 4);
+        size_t padded_length = chunk_length + (chunk_length & 1);
+        if (padded_length > riff_end - pos - 8) {
+            return false;
+        }
+
+        const unsigned char *fourcc = data + pos;
+        if (std::memcmp(fourcc, "VP8X", 4) == 0) {
+            if (chunk_length < 10) {
+                return false;
+            }
+            vp8x = out->size();
+        }
+
+        if (std::memcmp(fourcc, "EXIF", 4) != 0 &&
+            std::memcmp(fourcc, "XMP ", 4) != 0) {
+            out->append(reinterpret_cast<const char *>(data + pos),
+                        padded_length + 8);
+        }
+
+        pos += padded_length + 8;
+    }
+
+    if (pos != riff_end) {
+        return false;
+    }
+
+    // The extended header should no longer announce the metadata
+    if (vp8x != 0) {
+        (*out)[vp8x + 8] = static_cast<char>(
+            static_cast<unsigned char>((*out)[vp8x + 8]) &
+            ~(WEBP_FLAG_EXIF | WEBP_FLAG_XMP));
+    }
+
+    write_uint32_le(static_cast<uint32_t>(out->size() - 8), &(*out)[4]);
+
+    return true;
+}
+
+}  // namespace
+
+bool strip_metadata(ImageType image_type, const unsigned char *data,
+                    size_t length, std::string *out) {
+    switch (image_type) {
+        case ImageType::Jpeg:
+            return strip_jpeg(data, length, out);
+        case ImageType::Png:
+            return strip_png(data, length, out);
+        case ImageType::Webp:
+            return strip_webp(data, length, out);
+        default:
+            return false;
+    }
+}
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "../enums.h"
+
+#include <cstddef>
+#include <string>
+
+namespace weserv::api::codecs {
+
+/**
+ * Copy an image without its metadata, by dropping the segments (or chunks)
+ * that carry EXIF, XMP, IPTC and textual data. The image data itself is
+ * copied byte for byte. The ICC profile and anything else that affects the
+ * rendering of the image is kept. Supported are JPEG, PNG and WebP.
+ * @param image_type The image type of the data.
+ * @param data The image data.
+ * @param length Length of the image data in bytes.
+ * @param out Receives the image without metadata.
+ * @return A bool indicating if the image could be stripped, `false` if the
+ *         image type isn't supported or the data is malformed.
+ */
+bool strip_metadata(enums::ImageType image_type, const unsigned char *data,
+                    size_t length, std::string *out);
+
+}  // namespace weserv::api::codecs
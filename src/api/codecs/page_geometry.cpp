@@ -0,0 +1,273 @@
+#include "page_geometry.h"
+
+#include "tiff_reader.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <unordered_set>
+
+namespace weserv::api::codecs {
+
+namespace {
+
+using PageSizes = std::vector<std::pair<int, int>>;
+
+/**
+ * TIFF tags we're interested in.
+ */
+constexpr uint16_t TIFFTAG_IMAGEWIDTH = 256;
+constexpr uint16_t TIFFTAG_IMAGELENGTH = 257;
+
+uint32_t read_le16(const unsigned char *p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8;
+}
+
+uint32_t read_le24(const unsigned char *p) {
+    return read_le16(p) | static_cast<uint32_t>(p[2]) << 16;
+}
+
+uint32_t read_le32(const unsigned char *p) {
+    return read_le24(p) | static_cast<uint32_t>(p[3]) << 24;
+}
+
+/**
+ * Walk the main IFD chain, this matches the page numbering of libtiff (and
+ * therefore tiffload).
+ */
+PageSizes scan_tiff(const unsigned char *data, size_t length,
+                    size_t max_pages) {
+    TiffReader reader(data, length);
+    if (!reader.valid()) {
+        return {};
+    }
+
+    PageSizes pages;
+    std::unordered_set<uint32_t> visited;
+
+    uint32_t offset = reader.first_ifd();
+    while (offset != 0) {
+        // Guard against IFD loops, let libtiff complain about it
+        if (!visited.insert(offset).second) {
+            return {};
+        }
+
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t next = 0;
+
+        auto on_entry = [&](uint16_t tag, uint16_t type, uint32_t count,
+                            size_t value_offset) {
+            if (count != 1 ||
+                (type != TiffReader::SHORT && type != TiffReader::LONG)) {
+                return;
+            }
+
+            if (tag == TIFFTAG_IMAGEWIDTH) {
+                width = reader.read_value(type, value_offset);
+            } else if (tag == TIFFTAG_IMAGELENGTH) {
+                height = reader.read_value(type, value_offset);
+            }
+        };
+
+        if (!reader.read_ifd(offset, on_entry, &next) || width == 0 ||
+            height == 0 || width > INT_MAX || height > INT_MAX) {
+            return {};
+        }
+
+        pages.emplace_back(static_cast<int>(width), static_cast<int>(height));
+
+        if (max_pages > 0 && pages.size() >= max_pages) {
+            break;
+        }
+
+        offset = next;
+    }
+
+    return pages;
+}
+
+/**
+ * Count the image descriptors. Every frame is rendered onto the logical
+ * screen, so all pages share the same size.
+ * NOTE: The LZW data isn't validated, so a truncated file (i.e. one that ends
+ * before the trailer) is left to the loader, which may decode fewer frames.
+ */
+PageSizes scan_gif(const unsigned char *data, size_t length,
+                   size_t max_pages) {
+    if (length < 13 || std::memcmp(data, "GIF8", 4) != 0) {
+        return {};
+    }
+
+    uint32_t width = read_le16(data + 6);
+    uint32_t height = read_le16(data + 8);
+    unsigned char flags = data[10];
+
+    size_t pos = 13;
+
+    // Global color table
+    if ((flags & 0x80) != 0) {
+        pos += 3 * (static_cast<size_t>(1) << ((flags & 0x07) + 1));
+    }
+
+    auto skip_sub_blocks = [&]() {
+        while (pos < length) {
+            size_t size = data[pos++];
+            if (size == 0) {
+                return true;
+            }
+            pos += size;
+        }
+        return false;
+    };
+
+    size_t frames = 0;
+    bool complete = false;
+    while (pos < length) {
+        unsigned char block = data[pos++];
+        if (block == 0x21) {  // Extension
+            // Skip the label
+            if (++pos > length || !skip_sub_blocks()) {
+                break;
+            }
+        } else if (block == 0x2C) {  // Image descriptor
+            if (pos + 9 > length) {
+                break;
+            }
+
+            // Frames that exceed the logical screen will enlarge it
+            width = std::max(width,
+                             read_le16(data + pos) + read_le16(data + pos + 4));
+            height = std::max(height, read_le16(data + pos + 2) +
+                                          read_le16(data + pos + 6));
+
+            unsigned char frame_flags = data[pos + 8];
+            pos += 9;
+
+            // Local color table
+            if ((frame_flags & 0x80) != 0) {
+                pos += 3 * (static_cast<size_t>(1) << ((frame_flags & 0x07) + 1));
+            }
+
+            // Skip the LZW minimum code size
+            if (++pos > length || !skip_sub_blocks()) {
+                break;
+            }
+
+            if (++frames == max_pages) {
+                complete = true;
+                break;
+            }
+        } else if (block == 0x3B) {  // Trailer
+            complete = true;
+            break;
+        } else {
+            // Unknown block, let the loader decide
+            return {};
+        }
+    }
+
+    if (!complete || frames == 0 || width == 0 || height == 0) {
+        return {};
+    }
+
+    return PageSizes(frames,
+                     {static_cast<int>(width), static_cast<int>(height)});
+}
+
+/**
+ * Read the canvas size from the VP8X chunk (or the bitstream header of a
+ * simple file format) and count the ANMF chunks.
+ */
+PageSizes scan_webp(const unsigned char *data, size_t length,
+                    size_t max_pages) {
+    if (length < 20 || std::memcmp(data, "RIFF", 4) != 0 ||
+        std::memcmp(data + 8, "WEBP", 4) != 0) {
+        return {};
+    }
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    bool animated = false;
+    size_t frames = 0;
+
+    size_t pos = 12;
+    while (pos + 8 <= length) {
+        const unsigned char *chunk = data + pos;
+        const unsigned char *payload = chunk + 8;
+        size_t size = read_le32(chunk + 4);
+        size_t available = length - pos - 8;
+
+        if (std::memcmp(chunk, "VP8X", 4) == 0) {
+            if (size < 10 || available < 10) {
+                return {};
+            }
+
+            animated = (payload[0] & 0x02) != 0;
+            width = read_le24(payload + 4) + 1;
+            height = read_le24(payload + 7) + 1;
+
+            if (!animated) {
+                break;
+            }
+        } else if (std::memcmp(chunk, "ANMF", 4) == 0) {
+            if (++frames == max_pages) {
+                break;
+            }
+        } else if (width == 0 && std::memcmp(chunk, "VP8 ", 4) == 0) {
+            // Frame tag (3 bytes) followed by the start code
+            if (available < 10 || payload[3] != 0x9D || payload[4] != 0x01 ||
+                payload[5] != 0x2A) {
+                return {};
+            }
+
+            width = read_le16(payload + 6) & 0x3FFF;
+            height = read_le16(payload + 8) & 0x3FFF;
+            break;
+        } else if (width == 0 && std::memcmp(chunk, "VP8L", 4) == 0) {
+            if (available < 5 || payload[0] != 0x2F) {
+                return {};
+            }
+
+            uint32_t bits = read_le32(payload + 1);
+            width = (bits & 0x3FFF) + 1;
+            height = ((bits >> 14) & 0x3FFF) + 1;
+            break;
+        }
+
+        // Chunks are padded to an even size
+        if (size > available) {
+            break;
+        }
+        pos += 8 + size + (size & 1);
+    }
+
+    size_t n_pages = animated ? frames : 1;
+    if (n_pages == 0 || width == 0 || height == 0) {
+        return {};
+    }
+
+    return PageSizes(n_pages,
+                     {static_cast<int>(width), static_cast<int>(height)});
+}
+
+}  // namespace
+
+std::vector<std::pair<int, int>>
+scan_page_geometry(enums::ImageType image_type, const unsigned char *data,
+                   size_t length, size_t max_pages) {
+    switch (image_type) {
+        case enums::ImageType::Tiff:
+            return scan_tiff(data, length, max_pages);
+        case enums::ImageType::Gif:
+            return scan_gif(data, length, max_pages);
+        case enums::ImageType::Webp:
+            return scan_webp(data, length, max_pages);
+        default:
+            // PDF, HEIF, etc. need the loader
+            return {};
+    }
+}
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "../enums.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace weserv::api::codecs {
+
+/**
+ * Scan the size of every page within an image, directly from its container
+ * and without instantiating a loader. Supported are TIFF (IFD chain),
+ * GIF (image descriptors) and WebP (VP8X/ANMF chunks).
+ * @param image_type The image type of the data.
+ * @param data The image data.
+ * @param length Length of the image data in bytes.
+ * @param max_pages Stop scanning after this number of pages (0 = no limit).
+ * @return The (width, height) of each page, or an empty vector if the format
+ *         is unsupported or the container couldn't be parsed. In that case,
+ *         the loader should be consulted instead.
+ */
+std::vector<std::pair<int, int>>
+scan_page_geometry(enums::ImageType image_type, const unsigned char *data,
+                   size_t length, size_t max_pages = 0);
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,68 @@
+#include "parallel.h"
+
+#include <system_error>
+#include <utility>
+
+namespace weserv::api::codecs {
+
+ThreadPool &ThreadPool::instance() {
+    static ThreadPool pool(
+        std::max(std::thread::hardware_concurrency(), 1U));
+
+    return pool;
+}
+
+ThreadPool::ThreadPool(size_t max_threads) : max_threads_(max_threads) {}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    available_.notify_all();
+
+    for (auto &thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+
+    // Start another thread, if none is idle and the pool isn't full yet
+    if (idle_ < tasks_.size() && threads_.size() < max_threads_) {
+        try {
+            threads_.emplace_back(&ThreadPool::run, this);
+        } catch (const std::system_error &) {
+            // The task runs once one of the existing threads is available
+        }
+    }
+
+    available_.notify_one();
+}
+
+void ThreadPool::run() {
+    for (;;) {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ++idle_;
+            available_.wait(lock,
+                            [this]() { return stop_ || !tasks_.empty(); });
+            --idle_;
+
+            if (stop_) {
+                return;
+            }
+
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+
+        task();
+    }
+}
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace weserv::api::codecs {
+
+/**
+ * A pool of worker threads shared between all requests, so that the number
+ * of threads stays bounded regardless of the number of concurrent requests.
+ */
+class ThreadPool {
+ public:
+    /**
+     * The pool of this process. Threads are started on demand (i.e. after
+     * nginx has forked its worker processes), up to one per CPU core.
+     */
+    static ThreadPool &instance();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool();
+
+    /**
+     * Queue a task, which must not throw. The task may run much later, if all
+     * threads of the pool are busy.
+     * @param task The task to run.
+     */
+    void submit(std::function<void()> task);
+
+ private:
+    explicit ThreadPool(size_t max_threads);
+
+    /**
+     * Run queued tasks, until the pool is destroyed.
+     */
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable available_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+    size_t max_threads_;
+    size_t idle_ = 0;
+    bool stop_ = false;
+};
+
+/**
+ * Run `fn(i)` for every i in [0, n), spread over the given number of
+ * threads. The additional threads are taken from the shared pool, the calling
+ * thread picks up any work they don't get to. The first exception thrown is
+ * rethrown on the calling thread.
+ * @param n Number of work items.
+ * @param threads Maximum number of threads, including the calling thread.
+ * @param fn The function to run for each work item.
+ */
+template <typename Function>
+void parallel_for(size_t n, int threads, Function fn) {
+    // Shared with the queued helpers, which may outlive this call when they
+    // didn't get to start in time
+    struct State {
+        std::atomic<size_t> next{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+        int active = 0;
+        bool closed = false;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<State>();
+
+    auto worker = [state, n, &fn]() {
+        for (size_t i = state->next++; i < n; i = state->next++) {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->error) {
+                    state->error = std::current_exception();
+                }
+
+                // Skip the remaining work
+                state->next = n;
+            }
+        }
+    };
+
+    auto helper = [state, worker]() {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+
+            // All work is already done, `fn` may no longer exist
+            if (state->closed) {
+                return;
+            }
+            ++state->active;
+        }
+
+        worker();
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        --state->active;
+        state->finished.notify_all();
+    };
+
+    int n_threads = static_cast<int>(
+        std::min(static_cast<size_t>(std::max(threads, 1)), n));
+
+    auto &pool = ThreadPool::instance();
+    for (int i = 1; i < n_threads; ++i) {
+        try {
+            pool.submit(helper);
+        } catch (...) {
+            // Carry on with the helpers queued so far
+            break;
+        }
+    }
+
+    // The current thread acts as a worker as well
+    worker();
+
+    // Wait for the helpers that are still busy
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->closed = true;
+    state->finished.wait(lock, [&state]() { return state->active == 0; });
+
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,362 @@
+#include "png_encoder.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef WESERV_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace weserv::api::codecs {
+
+#ifdef WESERV_HAVE_ZLIB
+namespace {
+
+/**
+ * PNG colour types, indexed by the number of bands.
+ */
+constexpr unsigned char PNG_COLOR_TYPES[5] = {0, 0, 4, 2, 6};
+
+/**
+ * PNG filter types.
+ */
+constexpr unsigned char PNG_FILTER_NONE = 0;
+constexpr unsigned char PNG_FILTER_SUB = 1;
+constexpr unsigned char PNG_FILTER_UP = 2;
+constexpr unsigned char PNG_FILTER_AVERAGE = 3;
+constexpr unsigned char PNG_FILTER_PAETH = 4;
+
+/**
+ * The size of the deflate window, each block is primed with this much of the
+ * preceding block.
+ */
+constexpr size_t DICTIONARY_SIZE = 32 * 1024;
+
+void write_uint32_be(uint32_t value, unsigned char *p) {
+    p[0] = static_cast<unsigned char>((value >> 24) & 0xFF);
+    p[1] = static_cast<unsigned char>((value >> 16) & 0xFF);
+    p[2] = static_cast<unsigned char>((value >> 8) & 0xFF);
+    p[3] = static_cast<unsigned char>(value & 0xFF);
+}
+
+void append_chunk(const char *type, const unsigned char *data, size_t length,
+                  std::string *out) {
+    unsigned char header[8];
+    write_uint32_be(static_cast<uint32_t>(length), header);
+    std::memcpy(header + 4, type, 4);
+
+    uLong crc = crc32(0L, header + 4, 4);
+    if (length > 0) {
+        crc = crc32(crc, data, static_cast<uInt>(length));
+    }
+
+    unsigned char footer[4];
+    write_uint32_be(static_cast<uint32_t>(crc), footer);
+
+    out->append(reinterpret_cast<const char *>(header), sizeof(header));
+    if (length > 0) {
+        out->append(reinterpret_cast<const char *>(data), length);
+    }
+    out->append(reinterpret_cast<const char *>(footer), sizeof(footer));
+}
+
+/**
+ * Copy a row of samples, 16-bit samples are stored big-endian within PNG.
+ */
+void copy_row(const unsigned char *in, size_t row_bytes, int bit_depth,
+              unsigned char *out) {
+    if (bit_depth == 8) {
+        std::memcpy(out, in, row_bytes);
+        return;
+    }
+
+    for (size_t i = 0; i < row_bytes; i += 2) {
+        uint16_t sample;
+        std::memcpy(&sample, in + i, 2);
+        out[i] = static_cast<unsigned char>(sample >> 8);
+        out[i + 1] = static_cast<unsigned char>(sample & 0xFF);
+    }
+}
+
+unsigned char paeth_predictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+
+    if (pa <= pb && pa <= pc) {
+        return static_cast<unsigned char>(a);
+    }
+
+    return static_cast<unsigned char>(pb <= pc ? b : c);
+}
+
+/**
+ * Filter a row with the given filter type.
+ * @param row The row, in PNG byte order.
+ * @param prev The previous row, or a row of zeros for the first row.
+ * @param row_bytes Length of a row in bytes.
+ * @param bpp Bytes per complete pixel, rounded up to one.
+ * @param filter The filter type.
+ * @param out Receives the filtered row, without the filter type byte.
+ */
+void filter_row(const unsigned char *row, const unsigned char *prev,
+                size_t row_bytes, size_t bpp, unsigned char filter,
+                unsigned char *out) {
+    for (size_t i = 0; i < row_bytes; ++i) {
+        int a = i >= bpp ? row[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= bpp ? prev[i - bpp] : 0;
+
+        int predictor;
+        switch (filter) {
+            case PNG_FILTER_SUB:
+                predictor = a;
+                break;
+            case PNG_FILTER_UP:
+                predictor = b;
+                break;
+            case PNG_FILTER_AVERAGE:
+                predictor = (a + b) / 2;
+                break;
+            case PNG_FILTER_PAETH:
+                predictor = paeth_predictor(a, b, c);
+                break;
+            case PNG_FILTER_NONE:
+            default:
+                predictor = 0;
+                break;
+        }
+
+        out[i] = static_cast<unsigned char>(row[i] - predictor);
+    }
+}
+
+/**
+ * The heuristic of libpng to pick a filter: the minimum sum of absolute
+ * differences, with the filtered bytes taken as signed values.
+ */
+uint64_t filter_cost(const unsigned char *filtered, size_t row_bytes) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < row_bytes; ++i) {
+        sum += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+    }
+
+    return sum;
+}
+
+/**
+ * Compress a block as a raw deflate stream, ending with either a sync flush
+ * (so that the next block starts on a byte boundary) or the final block.
+ */
+bool deflate_block(const unsigned char *data, size_t length,
+                   const unsigned char *dictionary, size_t dictionary_length,
+                   int level, int strategy, bool last, std::string *out) {
+    z_stream stream{};
+    if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, strategy) !=
+        Z_OK) {
+        return false;
+    }
+
+    if (dictionary_length > 0 &&
+        deflateSetDictionary(&stream, dictionary,
+                             static_cast<uInt>(dictionary_length)) != Z_OK) {
+        deflateEnd(&stream);
+        return false;
+    }
+
+    // Leave room for the sync flush marker and the final block
+    out->resize(deflateBound(&stream, static_cast<uLong>(length)) + 16);
+
+    stream.next_in = const_cast<unsigned char *>(data);
+    stream.avail_in = static_cast<uInt>(length);
+    stream.next_out = reinterpret_cast<unsigned char *>(&(*out)[0]);
+    stream.avail_out = static_cast<uInt>(out->size());
+
+    int ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    bool ok = last ? ret == Z_STREAM_END
+                   : ret == Z_OK && stream.avail_in == 0;
+
+    out->resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return ok;
+}
+
+}  // namespace
+#endif
+
+bool encode_png([[maybe_unused]] const unsigned char *pixels,
+                [[maybe_unused]] int width, [[maybe_unused]] int height,
+                [[maybe_unused]] int bands, [[maybe_unused]] int bit_depth,
+                [[maybe_unused]] int level,
+                [[maybe_unused]] bool adaptive_filter,
+                [[maybe_unused]] double xres, [[maybe_unused]] double yres,
+                [[maybe_unused]] int threads,
+                [[maybe_unused]] std::string *out) {
+#ifdef WESERV_HAVE_ZLIB
+    if (width <= 0 || height <= 0 || bands < 1 || bands > 4 ||
+        (bit_depth != 8 && bit_depth != 16) || level < 0 || level > 9) {
+        return false;
+    }
+
+    size_t bpp = static_cast<size_t>(bands) * (bit_depth / 8);
+    size_t row_bytes = static_cast<size_t>(width) * bpp;
+    size_t stride = row_bytes + 1;
+
+    // Filter whole rows per block
+    size_t rows_per_block = std::max<size_t>(1, PNG_BLOCK_SIZE / stride);
+    size_t n_blocks =
+        (static_cast<size_t>(height) + rows_per_block - 1) / rows_per_block;
+
+    // Every row prefixed with its filter type byte
+    std::vector<unsigned char> filtered(stride * height);
+
+    // Filters only depend on the unfiltered rows, so the blocks can be
+    // filtered independently
+    parallel_for(n_blocks, threads, [&](size_t block) {
+        size_t first = block * rows_per_block;
+        size_t last =
+            std::min(first + rows_per_block, static_cast<size_t>(height));
+
+        std::vector<unsigned char> prev(row_bytes, 0);
+        std::vector<unsigned char> row(row_bytes);
+        std::vector<unsigned char> candidate(row_bytes);
+
+        if (first > 0) {
+            copy_row(pixels + (first - 1) * row_bytes, row_bytes, bit_depth,
+                     prev.data());
+        }
+
+        for (size_t y = first; y < last; ++y) {
+            copy_row(pixels + y * row_bytes, row_bytes, bit_depth, row.data());
+
+            unsigned char *dest = &filtered[y * stride];
+            if (!adaptive_filter) {
+                dest[0] = PNG_FILTER_NONE;
+                std::memcpy(dest + 1, row.data(), row_bytes);
+            } else {
+                uint64_t best_cost = UINT64_MAX;
+                for (unsigned char filter = PNG_FILTER_NONE;
+                     filter <= PNG_FILTER_PAETH; ++filter) {
+                    filter_row(row.data(), prev.data(), row_bytes, bpp, filter,
+                               candidate.data());
+
+                    uint64_t cost = filter_cost(candidate.data(), row_bytes);
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        dest[0] = filter;
+                        std::memcpy(dest + 1, candidate.data(), row_bytes);
+                    }
+                }
+            }
+
+            std::swap(prev, row);
+        }
+    });
+
+    // libpng uses the filtered strategy whenever rows are filtered
+    int strategy = adaptive_filter ? Z_FILTERED : Z_DEFAULT_STRATEGY;
+
+    std::vector<std::string> compressed(n_blocks);
+    std::vector<uLong> checksums(n_blocks);
+    std::atomic<bool> failed{false};
+
+    parallel_for(n_blocks, threads, [&](size_t block) {
+        size_t start = block * rows_per_block * stride;
+        size_t end = std::min(start + rows_per_block * stride, filtered.size());
+
+        // Prime the window with the tail of the preceding block, so that the
+        // compression ratio is close to a single stream
+        size_t dictionary_length = std::min(start, DICTIONARY_SIZE);
+
+        if (!deflate_block(&filtered[start], end - start,
+                           &filtered[start - dictionary_length],
+                           dictionary_length, level, strategy,
+                           block == n_blocks - 1, &compressed[block])) {
+            failed = true;
+        }
+
+        checksums[block] =
+            adler32(adler32(0L, nullptr, 0), &filtered[start],
+                    static_cast<uInt>(end - start));
+    });
+
+    if (failed) {
+        return false;
+    }
+
+    // Join the checksums of the blocks
+    uLong checksum = checksums[0];
+    for (size_t block = 1; block < n_blocks; ++block) {
+        size_t start = block * rows_per_block * stride;
+        size_t end = std::min(start + rows_per_block * stride, filtered.size());
+
+        checksum = adler32_combine(checksum, checksums[block],
+                                   static_cast<z_off_t>(end - start));
+    }
+
+    out->clear();
+    out->append("\x89PNG\r\n\x1A\n", 8);
+
+    unsigned char header[13];
+    write_uint32_be(static_cast<uint32_t>(width), header);
+    write_uint32_be(static_cast<uint32_t>(height), header + 4);
+    header[8] = static_cast<unsigned char>(bit_depth);
+    header[9] = PNG_COLOR_TYPES[bands];
+    header[10] = 0;  // deflate
+    header[11] = 0;  // adaptive filtering
+    header[12] = 0;  // no interlace
+    append_chunk("IHDR", header, sizeof(header), out);
+
+    // The resolution in pixels per metre, as libvips' pngsave writes it
+    unsigned char resolution[9];
+    write_uint32_be(static_cast<uint32_t>(std::lround(xres * 1000)),
+                    resolution);
+    write_uint32_be(static_cast<uint32_t>(std::lround(yres * 1000)),
+                    resolution + 4);
+    resolution[8] = 1;  // metre
+    append_chunk("pHYs", resolution, sizeof(resolution), out);
+
+    // The zlib header, with the level hint as zlib would write it
+    unsigned char zlib_header[2] = {0x78, 0};
+    int level_flags = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+    zlib_header[1] = static_cast<unsigned char>(level_flags << 6);
+    zlib_header[1] = static_cast<unsigned char>(
+        zlib_header[1] + 31 - (zlib_header[0] * 256 + zlib_header[1]) % 31);
+
+    unsigned char trailer[4];
+    write_uint32_be(static_cast<uint32_t>(checksum), trailer);
+
+    // Each block goes into its own IDAT chunk, with the zlib header in front
+    // of the first and the checksum after the last
+    for (size_t block = 0; block < n_blocks; ++block) {
+        std::string &data = compressed[block];
+        if (block == 0) {
+            data.insert(0, reinterpret_cast<const char *>(zlib_header), 2);
+        }
+        if (block == n_blocks - 1) {
+            data.append(reinterpret_cast<const char *>(trailer), 4);
+        }
+
+        append_chunk("IDAT", reinterpret_cast<const unsigned char *>(
+                                 data.data()),
+                     data.size(), out);
+    }
+
+    append_chunk("IEND", nullptr, 0, out);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace weserv::api::codecs {
+
+/**
+ * The amount of (filtered) image data per block, as used by pigz.
+ */
+constexpr size_t PNG_BLOCK_SIZE = 128 * 1024;
+
+/**
+ * Encode an image as a (non-interlaced) PNG image, with the filtering and
+ * compression spread over multiple threads. The rows are split into blocks
+ * that are compressed as independent deflate streams, each primed with the
+ * last 32 KiB of the preceding block. The streams are joined with a sync
+ * flush into a single zlib stream, as pigz does, with the checksums combined
+ * by `adler32_combine()`.
+ * @note The resolution is the only ancillary chunk (pHYs) that's written,
+ *       any other metadata is dropped.
+ * @param pixels The interleaved samples, 16-bit samples are in the native
+ *        byte order.
+ * @param width Width of the image.
+ * @param height Height of the image.
+ * @param bands Number of bands, between 1 (grey) and 4 (RGBA).
+ * @param bit_depth Bits per sample, either 8 or 16.
+ * @param level zlib compression level, between 0 and 9.
+ * @param adaptive_filter Use adaptive row filtering, instead of none.
+ * @param xres Horizontal resolution, in pixels per millimetre.
+ * @param yres Vertical resolution, in pixels per millimetre.
+ * @param threads Number of threads to use.
+ * @param out Receives the PNG image.
+ * @return false if the image can't be encoded (e.g. zlib isn't available).
+ */
+bool encode_png(const unsigned char *pixels, int width, int height, int bands,
+                int bit_depth, int level, bool adaptive_filter, double xres,
+                double yres, int threads, std::string *out);
+
+}  // namespace weserv::api::codecs
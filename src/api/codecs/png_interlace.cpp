@@ -0,0 +1,447 @@
+#include "png_interlace.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#ifdef WESERV_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace weserv::api::codecs {
+
+#ifdef WESERV_HAVE_ZLIB
+namespace {
+
+using Chunks = std::vector<std::pair<const unsigned char *, size_t>>;
+
+/**
+ * The Adam7 passes, as (x-offset, y-offset, x-step, y-step).
+ */
+constexpr int ADAM7_PASSES[7][4] = {
+    {0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4},
+    {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2},
+};
+
+/**
+ * PNG colour types.
+ */
+constexpr int PNG_COLOR_GRAY = 0;
+constexpr int PNG_COLOR_RGB = 2;
+constexpr int PNG_COLOR_PALETTE = 3;
+constexpr int PNG_COLOR_GRAY_ALPHA = 4;
+constexpr int PNG_COLOR_RGBA = 6;
+
+/**
+ * The maximum size of an embedded ICC profile we're willing to inflate.
+ */
+constexpr size_t MAX_ICC_PROFILE_SIZE = 16 * 1024 * 1024;
+
+/**
+ * The maximum size of the inflated passes and of the decoded image. Larger
+ * images are left to the PNG loader, which enforces its own limits.
+ */
+constexpr size_t MAX_BUFFER_SIZE = INT_MAX;
+
+uint32_t read_be32(const unsigned char *p) {
+    return static_cast<uint32_t>(p[0]) << 24 |
+           static_cast<uint32_t>(p[1]) << 16 |
+           static_cast<uint32_t>(p[2]) << 8 | static_cast<uint32_t>(p[3]);
+}
+
+int channels_of(int color_type) {
+    switch (color_type) {
+        case PNG_COLOR_GRAY:
+        case PNG_COLOR_PALETTE:
+            return 1;
+        case PNG_COLOR_GRAY_ALPHA:
+            return 2;
+        case PNG_COLOR_RGB:
+            return 3;
+        case PNG_COLOR_RGBA:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Add `a * b` to `total`, unless the result would exceed `MAX_BUFFER_SIZE`.
+ * @return false if the result would be too large.
+ */
+bool add_product(size_t a, size_t b, size_t *total) {
+    if (a != 0 && b > (MAX_BUFFER_SIZE - *total) / a) {
+        return false;
+    }
+
+    *total += a * b;
+    return true;
+}
+
+/**
+ * The number of pixels of a pass along a single axis.
+ */
+size_t pass_size(uint32_t size, int offset, int step) {
+    return size > static_cast<uint32_t>(offset)
+               ? (size - offset + step - 1) / step
+               : 0;
+}
+
+unsigned char paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+
+    if (pa <= pb && pa <= pc) {
+        return static_cast<unsigned char>(a);
+    }
+
+    return static_cast<unsigned char>(pb <= pc ? b : c);
+}
+
+/**
+ * Reverse the filter of a single scanline, in place.
+ * @param row The scanline, without the filter type byte.
+ * @param prev The previous (already unfiltered) scanline of the same pass,
+ *        or `nullptr` if this is the first one.
+ * @param size Length of the scanline in bytes.
+ * @param bpp Bytes per complete pixel, rounded up to one.
+ * @param filter The filter type.
+ * @return false if the filter type is invalid.
+ */
+bool unfilter(unsigned char *row, const unsigned char *prev, size_t size,
+              size_t bpp, int filter) {
+    switch (filter) {
+        case 0:  // None
+            return true;
+        case 1:  // Sub
+            for (size_t i = bpp; i < size; ++i) {
+                row[i] += row[i - bpp];
+            }
+            return true;
+        case 2:  // Up
+            if (prev != nullptr) {
+                for (size_t i = 0; i < size; ++i) {
+                    row[i] += prev[i];
+                }
+            }
+            return true;
+        case 3:  // Average
+            for (size_t i = 0; i < size; ++i) {
+                int left = i >= bpp ? row[i - bpp] : 0;
+                int up = prev != nullptr ? prev[i] : 0;
+                row[i] += static_cast<unsigned char>((left + up) / 2);
+            }
+            return true;
+        case 4:  // Paeth
+            for (size_t i = 0; i < size; ++i) {
+                int left = i >= bpp ? row[i - bpp] : 0;
+                int up = prev != nullptr ? prev[i] : 0;
+                int up_left = prev != nullptr && i >= bpp ? prev[i - bpp] : 0;
+                row[i] += paeth(left, up, up_left);
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Inflate the zlib stream, spread over multiple IDAT chunks, until the
+ * output buffer is filled. The remainder of the stream is never touched.
+ */
+bool inflate_prefix(const Chunks &chunks, unsigned char *out, size_t size) {
+    if (size > UINT_MAX) {
+        return false;
+    }
+
+    z_stream stream{};
+    if (inflateInit(&stream) != Z_OK) {
+        return false;
+    }
+
+    stream.next_out = out;
+    stream.avail_out = static_cast<uInt>(size);
+
+    for (const auto &chunk : chunks) {
+        stream.next_in = const_cast<Bytef *>(chunk.first);
+        stream.avail_in = static_cast<uInt>(chunk.second);
+
+        while (stream.avail_in > 0 && stream.avail_out > 0) {
+            int ret = inflate(&stream, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                // Note: Z_STREAM_END before the buffer is filled is an error
+                // as well, the image data is truncated
+                break;
+            }
+        }
+
+        if (stream.avail_out == 0) {
+            break;
+        }
+    }
+
+    bool filled = stream.avail_out == 0;
+
+    inflateEnd(&stream);
+
+    return filled;
+}
+
+/**
+ * Inflate a complete zlib stream (e.g. an embedded ICC profile).
+ */
+bool inflate_all(const unsigned char *data, size_t length, std::string *out) {
+    if (length > UINT_MAX) {
+        return false;
+    }
+
+    z_stream stream{};
+    if (inflateInit(&stream) != Z_OK) {
+        return false;
+    }
+
+    stream.next_in = const_cast<Bytef *>(data);
+    stream.avail_in = static_cast<uInt>(length);
+
+    unsigned char buffer[16384];
+    int ret;
+    do {
+        stream.next_out = buffer;
+        stream.avail_out = sizeof(buffer);
+
+        ret = inflate(&stream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            break;
+        }
+
+        out->append(reinterpret_cast<const char *>(buffer),
+                    sizeof(buffer) - stream.avail_out);
+    } while (ret != Z_STREAM_END && out->size() <= MAX_ICC_PROFILE_SIZE);
+
+    inflateEnd(&stream);
+
+    return ret == Z_STREAM_END;
+}
+
+}  // namespace
+#endif
+
+bool decode_png_passes(const unsigned char *data, size_t length, int shrink,
+                       [[maybe_unused]] bool verify_crc, DecodedImage *out) {
+#ifdef WESERV_HAVE_ZLIB
+    int n_passes = shrink == 8 ? 1 : shrink == 4 ? 3 : shrink == 2 ? 5 : 0;
+    if (n_passes == 0 || length < 8 ||
+        std::memcmp(data, "\x89PNG\r\n\x1A\n", 8) != 0) {
+        return false;
+    }
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    int bit_depth = 0;
+    int color_type = -1;
+    int interlace_method = 0;
+
+    const unsigned char *palette = nullptr;
+    size_t palette_length = 0;
+    const unsigned char *transparency = nullptr;
+    size_t transparency_length = 0;
+    const unsigned char *icc_profile = nullptr;
+    size_t icc_profile_length = 0;
+    Chunks image_data;
+
+    // Walk the chunks, the CRCs are only verified when asked for
+    size_t pos = 8;
+    while (pos + 12 <= length) {
+        uint32_t chunk_length = read_be32(data + pos);
+        if (chunk_length > length - pos - 12) {
+            return false;
+        }
+
+        const unsigned char *type = data + pos + 4;
+        const unsigned char *chunk = data + pos + 8;
+
+        // The CRC covers the chunk type and data
+        if (verify_crc &&
+            crc32(crc32(0L, nullptr, 0), type, chunk_length + 4) !=
+                read_be32(chunk + chunk_length)) {
+            return false;
+        }
+
+        if (std::memcmp(type, "IHDR", 4) == 0) {
+            if (chunk_length != 13) {
+                return false;
+            }
+
+            width = read_be32(chunk);
+            height = read_be32(chunk + 4);
+            bit_depth = chunk[8];
+            color_type = chunk[9];
+            interlace_method = chunk[12];
+        } else if (std::memcmp(type, "PLTE", 4) == 0) {
+            palette = chunk;
+            palette_length = chunk_length;
+        } else if (std::memcmp(type, "tRNS", 4) == 0) {
+            transparency = chunk;
+            transparency_length = chunk_length;
+        } else if (std::memcmp(type, "iCCP", 4) == 0) {
+            icc_profile = chunk;
+            icc_profile_length = chunk_length;
+        } else if (std::memcmp(type, "IDAT", 4) == 0) {
+            image_data.emplace_back(chunk, chunk_length);
+        } else if (std::memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+
+        pos += 12 + static_cast<size_t>(chunk_length);
+    }
+
+    int channels = channels_of(color_type);
+    if (interlace_method != 1 || channels == 0 || image_data.empty() ||
+        width == 0 || height == 0 || width > INT_MAX || height > INT_MAX ||
+        (bit_depth != 8 && bit_depth != 16) ||
+        (color_type == PNG_COLOR_PALETTE &&
+         (bit_depth != 8 || palette == nullptr)) ||
+        (color_type != PNG_COLOR_PALETTE && transparency != nullptr)) {
+        return false;
+    }
+
+    size_t sample_size = static_cast<size_t>(bit_depth) / 8;
+    size_t bpp = channels * sample_size;
+
+    // The passes follow each other within the decompressed stream. The
+    // dimensions come straight from the IHDR chunk (and aren't necessarily
+    // bound by a pixel limit), so guard against overflow.
+    size_t needed = 0;
+    for (int p = 0; p < n_passes; ++p) {
+        size_t pass_width =
+            pass_size(width, ADAM7_PASSES[p][0], ADAM7_PASSES[p][2]);
+        size_t pass_height =
+            pass_size(height, ADAM7_PASSES[p][1], ADAM7_PASSES[p][3]);
+
+        // Empty passes don't even have a filter type byte
+        if (pass_width == 0 || pass_height == 0) {
+            continue;
+        }
+
+        size_t row_size = 0;
+        if (!add_product(pass_width, bpp, &row_size) ||
+            !add_product(pass_height, 1 + row_size, &needed)) {
+            return false;
+        }
+    }
+
+    size_t out_width = (width + shrink - 1) / shrink;
+    size_t out_height = (height + shrink - 1) / shrink;
+    size_t out_bands = color_type == PNG_COLOR_PALETTE
+                           ? (transparency != nullptr ? 4 : 3)
+                           : channels;
+    size_t out_pixel_size = out_bands * sample_size;
+
+    size_t out_row_size = 0;
+    size_t out_size = 0;
+    if (!add_product(out_width, out_pixel_size, &out_row_size) ||
+        !add_product(out_height, out_row_size, &out_size)) {
+        return false;
+    }
+
+    std::vector<unsigned char> raw(needed);
+    if (!inflate_prefix(image_data, raw.data(), needed)) {
+        return false;
+    }
+
+    out->width = static_cast<int>(out_width);
+    out->height = static_cast<int>(out_height);
+    out->bands = static_cast<int>(out_bands);
+    out->bit_depth = bit_depth;
+    out->pixels.assign(out_size, 0);
+
+    unsigned char *row = raw.data();
+    for (int p = 0; p < n_passes; ++p) {
+        const int *pass = ADAM7_PASSES[p];
+        size_t pass_width = pass_size(width, pass[0], pass[2]);
+        size_t pass_height = pass_size(height, pass[1], pass[3]);
+        if (pass_width == 0 || pass_height == 0) {
+            continue;
+        }
+
+        size_t row_size = pass_width * bpp;
+        const unsigned char *prev = nullptr;
+
+        for (size_t j = 0; j < pass_height; ++j) {
+            int filter = row[0];
+            unsigned char *pixels = row + 1;
+
+            if (!unfilter(pixels, prev, row_size, bpp, filter)) {
+                return false;
+            }
+
+            // Every pixel of these passes lies on the shrink grid
+            size_t out_y = (pass[1] + j * pass[3]) / shrink;
+            unsigned char *out_row =
+                out->pixels.data() + out_y * out_row_size;
+
+            for (size_t i = 0; i < pass_width; ++i) {
+                size_t out_x = (pass[0] + i * pass[2]) / shrink;
+                unsigned char *dst = out_row + out_x * out_pixel_size;
+                const unsigned char *src = pixels + i * bpp;
+
+                if (color_type == PNG_COLOR_PALETTE) {
+                    size_t index = src[0];
+                    if (index * 3 + 3 > palette_length) {
+                        return false;
+                    }
+
+                    std::memcpy(dst, palette + index * 3, 3);
+                    if (transparency != nullptr) {
+                        dst[3] = index < transparency_length
+                                     ? transparency[index]
+                                     : 255;
+                    }
+                } else if (bit_depth == 16) {
+                    // Big-endian to native
+                    for (int k = 0; k < channels; ++k) {
+                        auto value = static_cast<uint16_t>(src[k * 2] << 8 |
+                                                           src[k * 2 + 1]);
+                        std::memcpy(dst + k * 2, &value, 2);
+                    }
+                } else {
+                    std::memcpy(dst, src, bpp);
+                }
+            }
+
+            prev = pixels;
+            row += 1 + row_size;
+        }
+    }
+
+    if (icc_profile != nullptr) {
+        // Profile name (1 - 79 bytes), a null separator and the compression
+        // method (always 0), followed by the compressed profile
+        const auto *separator = static_cast<const unsigned char *>(
+            std::memchr(icc_profile, 0, std::min<size_t>(icc_profile_length,
+                                                         80)));
+        if (separator == nullptr ||
+            static_cast<size_t>(separator - icc_profile) + 2 >
+                icc_profile_length) {
+            return false;
+        }
+
+        size_t offset = separator - icc_profile + 2;
+        if (!inflate_all(icc_profile + offset, icc_profile_length - offset,
+                         &out->icc_profile)) {
+            return false;
+        }
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+}  // namespace weserv::api::codecs
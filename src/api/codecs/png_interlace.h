@@ -0,0 +1,31 @@
+#pragma once
+
+#include "decoded_image.h"
+
+#include <cstddef>
+
+namespace weserv::api::codecs {
+
+/**
+ * Decode an Adam7-interlaced PNG image at a reduced resolution. Only the
+ * interlace passes that are needed are inflated and unfiltered:
+ *  - pass 1 for a shrink of 8;
+ *  - passes 1 - 3 for a shrink of 4;
+ *  - passes 1 - 5 for a shrink of 2.
+ * The result is the image subsampled by that shrink, i.e. every pixel
+ * represents the top-left pixel of its block.
+ * @note Sub-byte bit depths and colour-keyed transparency (`tRNS` on non
+ *       palette images) aren't supported, the PNG loader should be consulted
+ *       for these.
+ * @param data The PNG data.
+ * @param length Length of the PNG data in bytes.
+ * @param shrink The shrink factor, either 2, 4 or 8.
+ * @param verify_crc Verify the CRC of every chunk.
+ * @param out Receives the decoded image.
+ * @return false if the image isn't interlaced, isn't supported or couldn't
+ *         be decoded.
+ */
+bool decode_png_passes(const unsigned char *data, size_t length, int shrink,
+                       bool verify_crc, DecodedImage *out);
+
+}  // namespace weserv::api::codecs
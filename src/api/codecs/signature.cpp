@@ -0,0 +1,82 @@
+#include "signature.h"
+
+#include <cstring>
+#include <string_view>
+
+namespace weserv::api::codecs {
+
+using enums::ImageType;
+using namespace std::string_view_literals;
+
+namespace {
+
+/**
+ * A sequence of bytes at a fixed offset.
+ */
+struct Magic {
+    size_t offset;
+    std::string_view bytes;
+};
+
+/**
+ * A signature matches if both of its magic byte sequences match (the second
+ * one may be empty).
+ */
+struct Signature {
+    ImageType image_type;
+    Magic first;
+    Magic second;
+};
+
+// clang-format off
+constexpr Signature SIGNATURES[] = {
+    {ImageType::Jpeg, {0, "\xFF\xD8\xFF"sv}, {}},
+    {ImageType::Png, {0, "\x89PNG\r\n\x1A\n"sv}, {}},
+    {ImageType::Webp, {0, "RIFF"sv}, {8, "WEBP"sv}},
+    {ImageType::Tiff, {0, "II\x2A\x00"sv}, {}},
+    {ImageType::Tiff, {0, "MM\x00\x2A"sv}, {}},
+    // BigTIFF
+    {ImageType::Tiff, {0, "II\x2B\x00"sv}, {}},
+    {ImageType::Tiff, {0, "MM\x00\x2B"sv}, {}},
+    {ImageType::Gif, {0, "GIF87a"sv}, {}},
+    {ImageType::Gif, {0, "GIF89a"sv}, {}},
+    {ImageType::Svg, {0, "<svg"sv}, {}},
+    {ImageType::Svg, {0, "<?xml"sv}, {}},
+    {ImageType::Pdf, {0, "%PDF"sv}, {}},
+    // ISO Base Media File Format brands, see:
+    // https://github.com/strukturag/libheif/blob/master/libheif/heif.cc
+    {ImageType::Heif, {4, "ftypheic"sv}, {}},
+    {ImageType::Heif, {4, "ftypheix"sv}, {}},
+    {ImageType::Heif, {4, "ftyphevc"sv}, {}},
+    {ImageType::Heif, {4, "ftyphevx"sv}, {}},
+    {ImageType::Heif, {4, "ftypmif1"sv}, {}},
+    {ImageType::Heif, {4, "ftypmsf1"sv}, {}},
+    {ImageType::Heif, {4, "ftypavif"sv}, {}},
+    {ImageType::Heif, {4, "ftypavis"sv}, {}},
+};
+// clang-format on
+
+bool matches(const Magic &magic, const unsigned char *data, size_t length) {
+    return magic.offset + magic.bytes.size() <= length &&
+           std::memcmp(data + magic.offset, magic.bytes.data(),
+                       magic.bytes.size()) == 0;
+}
+
+}  // namespace
+
+ImageType sniff_image_type(const unsigned char *data, size_t length) {
+    if (data == nullptr) {
+        return ImageType::Unknown;
+    }
+
+    for (const auto &signature : SIGNATURES) {
+        if (matches(signature.first, data, length) &&
+            matches(signature.second, data, length)) {
+            return signature.image_type;
+        }
+    }
+
+    return ImageType::Unknown;
+}
+
+}  // namespace weserv::api::codecs
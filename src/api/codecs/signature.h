@@ -0,0 +1,26 @@
+#pragma once
+
+#include "../enums.h"
+
+#include <cstddef>
+
+namespace weserv::api::codecs {
+
+/**
+ * Number of leading bytes needed to recognize any of the signatures.
+ */
+constexpr size_t SIGNATURE_LENGTH = 32;
+
+/**
+ * Identify an image by its magic bytes, using a fixed table of signatures.
+ * Supported are JPEG, PNG, WebP, TIFF, GIF, SVG, PDF and HEIF/AVIF.
+ * @note This is only a hint, the loader itself should still confirm the
+ *       result (with its cheap `is_a` check).
+ * @param data The leading bytes of the image.
+ * @param length Length of the data in bytes.
+ * @return The image type, or `ImageType::Unknown` if none of the signatures
+ *         matched. In that case, every loader should be consulted instead.
+ */
+enums::ImageType sniff_image_type(const unsigned char *data, size_t length);
+
+}  // namespace weserv::api::codecs
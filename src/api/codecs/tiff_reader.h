@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace weserv::api::codecs {
+
+/**
+ * A minimal, bounds-checked reader for TIFF structures (as used by TIFF
+ * images and EXIF blocks). It only walks the IFDs, it never decodes any
+ * image data.
+ */
+class TiffReader {
+ public:
+    /**
+     * TIFF field types we're able to read.
+     */
+    static constexpr uint16_t SHORT = 3;
+    static constexpr uint16_t LONG = 4;
+
+    /**
+     * @param data Start of the TIFF structure (i.e. the byte order mark).
+     * @param length Length of the TIFF structure in bytes.
+     */
+    TiffReader(const unsigned char *data, size_t length)
+        : data_(data), length_(length) {
+        if (length_ < 8) {
+            return;
+        }
+
+        if (data_[0] == 'I' && data_[1] == 'I') {
+            little_endian_ = true;
+        } else if (data_[0] == 'M' && data_[1] == 'M') {
+            little_endian_ = false;
+        } else {
+            return;
+        }
+
+        // Only classic TIFF, BigTIFF uses 43
+        valid_ = read16(2) == 42;
+    }
+
+    /**
+     * @return true if the header is a valid (classic) TIFF header.
+     */
+    bool valid() const {
+        return valid_;
+    }
+
+    /**
+     * @return the offset of the first IFD.
+     */
+    uint32_t first_ifd() const {
+        return read32(4);
+    }
+
+    /**
+     * Walk the entries of a single IFD.
+     * @param offset Offset of the IFD.
+     * @param callback Called as `callback(tag, type, count, value_offset)` for
+     *        every entry, where `value_offset` points to the 4-byte value (or
+     *        offset) field of the entry.
+     * @param next Receives the offset of the next IFD (0 if this is the last).
+     * @return false if the IFD doesn't fit within the structure.
+     */
+    template <typename Callback>
+    bool read_ifd(uint32_t offset, Callback callback, uint32_t *next) const {
+        if (offset < 8 || !in_bounds(offset, 2)) {
+            return false;
+        }
+
+        uint16_t count = read16(offset);
+        size_t entries = static_cast<size_t>(offset) + 2;
+        if (!in_bounds(entries, static_cast<size_t>(count) * 12 + 4)) {
+            return false;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            size_t entry = entries + i * 12;
+            callback(read16(entry), read16(entry + 2), read32(entry + 4),
+                     entry + 8);
+        }
+
+        *next = read32(entries + static_cast<size_t>(count) * 12);
+
+        return true;
+    }
+
+    /**
+     * Read a single SHORT or LONG value.
+     * @param type The field type, either `SHORT` or `LONG`.
+     * @param offset Offset of the value.
+     * @return The value.
+     */
+    uint32_t read_value(uint16_t type, size_t offset) const {
+        return type == SHORT ? read16(offset) : read32(offset);
+    }
+
+    /**
+     * @return true if `size` bytes at `offset` are within the structure.
+     */
+    bool in_bounds(size_t offset, size_t size) const {
+        return offset <= length_ && size <= length_ - offset;
+    }
+
+    uint16_t read16(size_t offset) const {
+        const unsigned char *p = data_ + offset;
+        return little_endian_ ? static_cast<uint16_t>(p[0] | p[1] << 8)
+                              : static_cast<uint16_t>(p[0] << 8 | p[1]);
+    }
+
+    uint32_t read32(size_t offset) const {
+        const unsigned char *p = data_ + offset;
+        return little_endian_
+                   ? static_cast<uint32_t>(p[0]) |
+                         static_cast<uint32_t>(p[1]) << 8 |
+                         static_cast<uint32_t>(p[2]) << 16 |
+                         static_cast<uint32_t>(p[3]) << 24
+                   : static_cast<uint32_t>(p[0]) << 24 |
+                         static_cast<uint32_t>(p[1]) << 16 |
+                         static_cast<uint32_t>(p[2]) << 8 |
+                         static_cast<uint32_t>(p[3]);
+    }
+
+ private:
+    const unsigned char *data_;
+    size_t length_;
+    bool little_endian_ = true;
+    bool valid_ = false;
+};
+
+}  // namespace weserv::api::codecs
@@ -0,0 +1,34 @@
+#include <weserv/config.h>
+
+#include "exceptions/unknown.h"
+#include "parsers/query.h"
+
+#include <utility>
+
+namespace weserv::api {
+
+bool Config::add_preset(const std::string &name, const std::string &query) {
+    if (name.empty() || presets.find(name) != presets.end()) {
+        return false;
+    }
+
+    // Only keep the parsed parameters, the query itself refers to this
+    // configuration
+    parsers::QueryMap parameters;
+    try {
+        parameters = parsers::Query(query, *this).parameters();
+    } catch (const exceptions::UnknownPresetException &) {
+        return false;
+    }
+
+    if (parameters.empty()) {
+        return false;
+    }
+
+    presets.emplace(name, std::make_shared<const parsers::Preset>(
+                              parsers::Preset{std::move(parameters)}));
+
+    return true;
+}
+
+}  // namespace weserv::api
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdexcept>
+
+namespace weserv::api::exceptions {
+
+/**
+ * Exception when a requested preset is not defined.
+ */
+class UnknownPresetException : public std::runtime_error {
+ public:
+    explicit UnknownPresetException(const std::string &error)
+        : std::runtime_error(error) {}
+};
+
+}  // namespace weserv::api::exceptions
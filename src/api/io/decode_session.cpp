@@ -0,0 +1,438 @@
+#include "decode_session.h"
+
+#include "../codecs/exif_thumbnail.h"
+#include "../codecs/jpeg_region.h"
+#include "../codecs/jpeg_transform.h"
+#include "../codecs/metadata_strip.h"
+#include "../codecs/page_geometry.h"
+#include "../codecs/png_interlace.h"
+#include "../codecs/signature.h"
+#include "../exceptions/invalid.h"
+#include "../exceptions/unreadable.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <tuple>
+
+namespace weserv::api::io {
+
+using enums::ImageType;
+using vips::VError;
+using vips::VImage;
+
+namespace {
+
+/**
+ * Loaders are looked up by their nickname, e.g. `jpegload_buffer`.
+ */
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+constexpr const char *LOADER_SUFFIX = "_source";
+#else
+constexpr const char *LOADER_SUFFIX = "_buffer";
+#endif
+
+/**
+ * The nickname of the load operation for an image type, without suffix.
+ * @param image_type The image type enum.
+ * @return The nickname, or `nullptr` if the image type has no dedicated
+ *         loader.
+ */
+const char *loader_nickname(ImageType image_type) {
+    switch (image_type) {
+        case ImageType::Jpeg:
+            return "jpegload";
+        case ImageType::Png:
+            return "pngload";
+        case ImageType::Webp:
+            return "webpload";
+        case ImageType::Tiff:
+            return "tiffload";
+        case ImageType::Gif:
+            return "gifload";
+        case ImageType::Svg:
+            return "svgload";
+        case ImageType::Pdf:
+            return "pdfload";
+        case ImageType::Heif:
+            return "heifload";
+        case ImageType::Magick:
+        case ImageType::Unknown:
+        default:
+            return nullptr;
+    }
+}
+
+}  // namespace
+
+DecodeSession::DecodeSession(const Source &source, const Config &config)
+    : source_(source), config_(config) {
+    const char *loader = sniff_loader();
+
+    if (loader == nullptr) {
+        loader = find_loader();
+    }
+
+    if (loader == nullptr) {
+        throw exceptions::InvalidImageException(vips_error_buffer());
+    }
+
+    loader_ = loader;
+    image_type_ = utils::determine_image_type(loader_);
+
+    if (!utils::is_loader_enabled(config_.loaders, image_type_)) {
+        throw exceptions::InvalidImageException(
+            "Loading from " + utils::image_type_id(image_type_) +
+            " is disabled. Supported loaders: " +
+            utils::supported_loaders_string(config_.loaders));
+    }
+}
+
+const char *DecodeSession::sniff_loader() const {
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    // Note: this fails for sources shorter than the signature length, the
+    // generic search will handle these
+    const unsigned char *data =
+        vips_source_sniff(source_.get_source(), codecs::SIGNATURE_LENGTH);
+    size_t length = codecs::SIGNATURE_LENGTH;
+
+    if (data == nullptr) {
+        vips_error_clear();
+        return nullptr;
+    }
+#else
+    const auto *data =
+        reinterpret_cast<const unsigned char *>(source_.buffer().data());
+    size_t length =
+        std::min(source_.buffer().size(), codecs::SIGNATURE_LENGTH);
+#endif
+
+    auto image_type = codecs::sniff_image_type(data, length);
+    const char *nickname = loader_nickname(image_type);
+    if (nickname == nullptr) {
+        return nullptr;
+    }
+
+    // The loader might not be built in
+    std::string name = std::string(nickname) + LOADER_SUFFIX;
+    GType type = vips_type_find("VipsForeignLoad", name.c_str());
+    if (type == 0) {
+        return nullptr;
+    }
+
+    auto *load_class = VIPS_FOREIGN_LOAD_CLASS(g_type_class_ref(type));
+
+    // Let the loader confirm the signature, this is the same (cheap) check
+    // that the generic search would do
+    bool is_a = is_loadable(load_class);
+
+    g_type_class_unref(load_class);
+
+    return is_a ? g_type_name(type) : nullptr;
+}
+
+const char *DecodeSession::find_loader() const {
+    // All loaders are enabled, use the generic search
+    if (config_.loaders == static_cast<uintptr_t>(enums::Loader::All)) {
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+        return vips_foreign_find_load_source(source_.get_source());
+#else
+        return vips_foreign_find_load_buffer(source_.buffer().data(),
+                                             source_.buffer().size());
+#endif
+    }
+
+    // Otherwise, walk the loaders ourselves (in order of priority) and skip
+    // the disabled ones, so that their `is_a` check is never done
+    auto *load_class = static_cast<VipsForeignLoadClass *>(vips_foreign_map(
+        "VipsForeignLoad",
+        [](void *item, void *a, void * /* unused */) -> void * {
+            auto *load_class = static_cast<VipsForeignLoadClass *>(item);
+            auto *session = static_cast<const DecodeSession *>(a);
+
+            if (!vips_ispostfix(VIPS_OBJECT_CLASS(load_class)->nickname,
+                                LOADER_SUFFIX) ||
+                !utils::is_loader_enabled(
+                    session->config_.loaders,
+                    utils::determine_image_type(
+                        G_OBJECT_CLASS_NAME(load_class)))) {
+                return nullptr;
+            }
+
+            return session->is_loadable(load_class) ? load_class : nullptr;
+        },
+        const_cast<DecodeSession *>(this), nullptr));
+
+    if (load_class == nullptr) {
+        vips_error("VipsForeignLoad", "%s",
+                   "buffer is not in a known format");
+        return nullptr;
+    }
+
+    return G_OBJECT_CLASS_NAME(load_class);
+}
+
+bool DecodeSession::is_loadable(VipsForeignLoadClass *load_class) const {
+#if VIPS_VERSION_AT_LEAST(8, 13, 0)
+    // Blocked by `vips_block_untrusted_set` / `vips_operation_block_set`
+    if ((VIPS_OPERATION_CLASS(load_class)->flags & VIPS_OPERATION_BLOCKED) !=
+        0) {
+        return false;
+    }
+#endif
+
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    return load_class->is_a_source != nullptr &&
+           load_class->is_a_source(source_.get_source()) != 0;
+#else
+    return load_class->is_a_buffer != nullptr &&
+           load_class->is_a_buffer(source_.buffer().data(),
+                                   source_.buffer().size()) != 0;
+#endif
+}
+
+const VImage &DecodeSession::page(int page) {
+    auto it = pages_.find(page);
+    if (it != pages_.end()) {
+        return it->second;
+    }
+
+    vips::VOption *options = VImage::option()
+                                 ->set("access", VIPS_ACCESS_SEQUENTIAL)
+                                 ->set("fail", config_.fail_on_error == 1);
+
+    // Single-page loaders don't have a page option
+    if (utils::support_multi_pages(image_type_)) {
+        options->set("page", page);
+    }
+
+    return pages_.emplace(page, load(options)).first->second;
+}
+
+bool DecodeSession::scan_page_sizes() {
+    if (!scanned_) {
+        scanned_ = true;
+
+#ifndef WESERV_ENABLE_TRUE_STREAMING
+        // Scan one page beyond the limit, so that it can still be enforced
+        size_t max_pages =
+            config_.max_pages > 0 ? static_cast<size_t>(config_.max_pages) + 1
+                                  : 0;
+
+        page_sizes_ = codecs::scan_page_geometry(
+            image_type_,
+            reinterpret_cast<const unsigned char *>(source_.buffer().data()),
+            source_.buffer().size(), max_pages);
+#endif
+    }
+
+    return !page_sizes_.empty();
+}
+
+const std::vector<std::pair<int, int>> &DecodeSession::page_sizes() {
+    if (scan_page_sizes()) {
+        return page_sizes_;
+    }
+
+    // Fallback to the loader
+    int n = n_pages();
+    page_sizes_.reserve(n);
+
+    for (int i = 0; i < n; ++i) {
+        const auto &image = page(i);
+        page_sizes_.emplace_back(image.width(), image.height());
+    }
+
+    return page_sizes_;
+}
+
+int DecodeSession::n_pages() {
+    if (scan_page_sizes()) {
+        return static_cast<int>(page_sizes_.size());
+    }
+
+    const auto &image = page(0);
+
+    return image.get_typeof(VIPS_META_N_PAGES) != 0
+               ? image.get_int(VIPS_META_N_PAGES)
+               : 1;
+}
+
+VImage DecodeSession::load(vips::VOption *options) const {
+    VImage out_image;
+
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    try {
+        VImage::call(loader_.c_str(),
+                     options->set("source", source_)->set("out", &out_image));
+#else
+    // We don't take a copy of the data or free it
+    auto *blob = vips_blob_new(nullptr, source_.buffer().data(),
+                               source_.buffer().size());
+    options = options->set("buffer", blob)->set("out", &out_image);
+    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+
+    try {
+        VImage::call(loader_.c_str(), options);
+#endif
+    } catch (const VError &err) {
+        throw exceptions::UnreadableImageException(err.what());
+    }
+
+    return out_image;
+}
+
+VImage DecodeSession::load_exif_thumbnail(vips::VOption *options) const {
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    delete options;
+
+    return VImage();
+#else
+    const auto *data =
+        reinterpret_cast<const unsigned char *>(source_.buffer().data());
+
+    size_t offset;
+    size_t length;
+    std::tie(offset, length) = codecs::find_exif_thumbnail(
+        image_type_, data, source_.buffer().size());
+
+    if (length == 0) {
+        delete options;
+
+        return VImage();
+    }
+
+    VImage out_image;
+
+    // We don't take a copy of the data or free it
+    auto *blob = vips_blob_new(nullptr, data + offset, length);
+    options = options->set("buffer", blob)->set("out", &out_image);
+    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+
+    try {
+        VImage::call("jpegload_buffer", options);
+    } catch (const VError &) {
+        // A broken thumbnail, we could still use the main image
+        return VImage();
+    }
+
+    return out_image;
+#endif
+}
+
+VImage DecodeSession::load_png_passes(int shrink) const {
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    return VImage();
+#else
+    if (image_type_ != ImageType::Png) {
+        return VImage();
+    }
+
+    codecs::DecodedImage decoded;
+    if (!codecs::decode_png_passes(
+            reinterpret_cast<const unsigned char *>(source_.buffer().data()),
+            source_.buffer().size(), shrink, config_.fail_on_error == 1,
+            &decoded)) {
+        return VImage();
+    }
+
+    return to_image(decoded);
+#endif
+}
+
+VImage DecodeSession::load_region(int page, int left, int top, int width,
+                                  int height) const {
+    if (image_type_ == ImageType::Tiff) {
+        // With random access, tiffload only reads the tiles (or strips) that
+        // intersect with the region
+        return load(VImage::option()
+                        ->set("access", VIPS_ACCESS_RANDOM)
+                        ->set("fail", config_.fail_on_error == 1)
+                        ->set("page", page))
+            .extract_area(left, top, width, height);
+    }
+
+#ifndef WESERV_ENABLE_TRUE_STREAMING
+    if (image_type_ == ImageType::Jpeg) {
+        codecs::DecodedImage decoded;
+        if (codecs::decode_jpeg_region(
+                reinterpret_cast<const unsigned char *>(
+                    source_.buffer().data()),
+                source_.buffer().size(), left, top, width, height,
+                &decoded)) {
+            return to_image(decoded);
+        }
+    }
+#endif
+
+    return VImage();
+}
+
+bool DecodeSession::copy_without_metadata(
+    [[maybe_unused]] std::string *out) const {
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    return false;
+#else
+    return codecs::strip_metadata(
+        image_type_,
+        reinterpret_cast<const unsigned char *>(source_.buffer().data()),
+        source_.buffer().size(), out);
+#endif
+}
+
+bool DecodeSession::transform_jpeg(
+    [[maybe_unused]] const codecs::JpegTransform &transform,
+    [[maybe_unused]] std::string *out) const {
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    return false;
+#else
+    if (image_type_ != ImageType::Jpeg) {
+        return false;
+    }
+
+    return codecs::transform_jpeg(
+        reinterpret_cast<const unsigned char *>(source_.buffer().data()),
+        source_.buffer().size(), transform, out);
+#endif
+}
+
+VImage DecodeSession::to_image(const codecs::DecodedImage &decoded) {
+    bool is_16_bit = decoded.bit_depth == 16;
+    VipsImage *image = vips_image_new_from_memory_copy(
+        decoded.pixels.data(), decoded.pixels.size(), decoded.width,
+        decoded.height, decoded.bands,
+        is_16_bit ? VIPS_FORMAT_USHORT : VIPS_FORMAT_UCHAR);
+    if (image == nullptr) {
+        throw VError();
+    }
+
+    VipsInterpretation interpretation;
+    if (decoded.bands < 3) {
+        interpretation =
+            is_16_bit ? VIPS_INTERPRETATION_GREY16 : VIPS_INTERPRETATION_B_W;
+    } else {
+        interpretation =
+            is_16_bit ? VIPS_INTERPRETATION_RGB16 : VIPS_INTERPRETATION_sRGB;
+    }
+
+    VImage out_image = VImage(image).copy(
+        VImage::option()->set("interpretation", interpretation));
+
+    if (!decoded.icc_profile.empty()) {
+        size_t length = decoded.icc_profile.size();
+        void *profile = g_malloc(length);
+        std::memcpy(profile, decoded.icc_profile.data(), length);
+
+        out_image.set(
+            VIPS_META_ICC_NAME,
+            [](void *data, void * /* unused */) -> int {
+                g_free(data);
+                return 0;
+            },
+            profile, length);
+    }
+
+    return out_image;
+}
+
+}  // namespace weserv::api::io
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "source.h"
+
+#include "../codecs/decoded_image.h"
+#include "../codecs/jpeg_transform.h"
+#include "../enums.h"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <vips/vips8>
+#include <weserv/config.h>
+
+namespace weserv::api::io {
+
+/**
+ * The decode session of a single request. The loader of a source is
+ * determined only once (by its magic bytes, whenever possible) and the
+ * headers of any opened page are kept around, so that the stream and
+ * thumbnail processors can share them instead of opening (and in true
+ * streaming mode, rewinding) the source over and over again.
+ */
+class DecodeSession {
+ public:
+    DecodeSession(const Source &source, const Config &config);
+
+    /**
+     * @return the loader that is able to load the source.
+     */
+    const std::string &loader() const {
+        return loader_;
+    }
+
+    /**
+     * @return the image type of the source.
+     */
+    enums::ImageType image_type() const {
+        return image_type_;
+    }
+
+    /**
+     * Open a single page of the source, without decoding any pixels. The
+     * header is cached, so subsequent calls for the same page are free.
+     * @note The page is opened with sequential access, the returned image can
+     *       therefore be used for (at most) one pipeline.
+     * @param page The page to open, numbered from zero.
+     * @return The page as a `VImage`.
+     */
+    const vips::VImage &page(int page);
+
+    /**
+     * @note If the page geometry could be scanned from the container, this
+     *       is capped at `config.max_pages + 1`.
+     * @return the number of pages within the source.
+     */
+    int n_pages();
+
+    /**
+     * Get the size of every page within the source. For TIFF, GIF and WebP
+     * these are scanned directly from the container in a single pass, for
+     * other formats every page is opened by the loader (once).
+     * @return The (width, height) of each page.
+     */
+    const std::vector<std::pair<int, int>> &page_sizes();
+
+    /**
+     * Load the source with the given options.
+     * @note This behaves exactly as `VImage::new_from_source`, but the loader
+     *       is determined only once. It will throw a `UnreadableImageException`
+     *       if an error occurs during loading.
+     * @param options Any options to pass on to the load operation.
+     * @return A new `VImage`.
+     */
+    vips::VImage load(vips::VOption *options) const;
+
+    /**
+     * Load the JPEG thumbnail embedded in the EXIF data of the source.
+     * @note This is only supported for JPEG and TIFF images, and not in true
+     *       streaming mode.
+     * @param options Any options to pass on to the load operation.
+     * @return The thumbnail, or an empty `VImage` if there's none.
+     */
+    vips::VImage load_exif_thumbnail(vips::VOption *options) const;
+
+    /**
+     * Load an Adam7-interlaced PNG image at a reduced resolution, by decoding
+     * only the interlace passes that are needed.
+     * @note This is not supported in true streaming mode.
+     * @param shrink The shrink factor, either 2, 4 or 8.
+     * @return The subsampled image, or an empty `VImage` if the source isn't
+     *         an (supported) interlaced PNG image.
+     */
+    vips::VImage load_png_passes(int shrink) const;
+
+    /**
+     * Decode only a region of the source, whenever the format allows it. For
+     * TIFF, only the intersecting tiles or strips are read. JPEG images are
+     * decoded up to the last MCU row of the region (and with libjpeg-turbo,
+     * only the MCU columns covering the region).
+     * @param page The page to decode, numbered from zero.
+     * @param left Left edge of the region.
+     * @param top Top edge of the region.
+     * @param width Width of the region.
+     * @param height Height of the region.
+     * @return The region, or an empty `VImage` if it can't be decoded on its
+     *         own.
+     */
+    vips::VImage load_region(int page, int left, int top, int width,
+                             int height) const;
+
+    /**
+     * Copy the source without its metadata (EXIF, XMP, IPTC), the image data
+     * itself is copied byte for byte.
+     * @note This is only supported for JPEG, PNG and WebP images, and not in
+     *       true streaming mode.
+     * @param out Receives the image without metadata.
+     * @return A bool indicating if the source could be copied.
+     */
+    bool copy_without_metadata(std::string *out) const;
+
+    /**
+     * Rotate, flip and crop a JPEG source without decoding it, by
+     * rearranging its DCT coefficients.
+     * @note This is not supported in true streaming mode.
+     * @param transform The transform to perform.
+     * @param out Receives the transformed image.
+     * @return A bool indicating if the source could be transformed
+     *         losslessly.
+     */
+    bool transform_jpeg(const codecs::JpegTransform &transform,
+                        std::string *out) const;
+
+ private:
+    /**
+     * Source to read from.
+     */
+    const Source &source_;
+
+    /**
+     * Global config.
+     */
+    const Config &config_;
+
+    /**
+     * The loader that is able to load the source.
+     */
+    std::string loader_;
+
+    /**
+     * The image type of the source, derived from the loader.
+     */
+    enums::ImageType image_type_;
+
+    /**
+     * The pages opened so far, keyed by page number.
+     */
+    std::unordered_map<int, vips::VImage> pages_;
+
+    /**
+     * The size of every page, if known.
+     */
+    std::vector<std::pair<int, int>> page_sizes_;
+
+    /**
+     * Have we tried to scan the page geometry?
+     */
+    bool scanned_ = false;
+
+    /**
+     * Find the loader by the magic bytes of the source, only the loader of
+     * the matching signature needs to be consulted.
+     * @return The name of the load operation, or `nullptr` if the signature
+     *         is unknown.
+     */
+    const char *sniff_loader() const;
+
+    /**
+     * Find the loader by asking every enabled loader, in order of priority.
+     * @return The name of the load operation, or `nullptr` if none of the
+     *         loaders is able to load the source.
+     */
+    const char *find_loader() const;
+
+    /**
+     * Is this loader able to load the source?
+     * @param load_class The class of the load operation.
+     * @return A bool indicating if the source can be loaded.
+     */
+    bool is_loadable(VipsForeignLoadClass *load_class) const;
+
+    /**
+     * Wrap an image that was decoded by one of our own codecs.
+     * @param decoded The decoded image.
+     * @return A new `VImage`.
+     */
+    static vips::VImage to_image(const codecs::DecodedImage &decoded);
+
+    /**
+     * Try to scan the page geometry from the container.
+     * @return true if the size of every page is known.
+     */
+    bool scan_page_sizes();
+};
+
+}  // namespace weserv::api::io
@@ -106,6 +106,32 @@ void Target::setup(const std::string &extension) const {
     }
 }
 
+void Target::set_quality(int quality, bool fits) const {
+    VipsTarget *output = get_target();
+    if (WESERV_IS_TARGET(output)) {
+        io::TargetInterface *target = WESERV_TARGET(output)->target;
+        target->set_quality(quality, fits);
+    }
+}
+
+uintptr_t Target::accepted_outputs() const {
+    VipsTarget *output = get_target();
+    if (WESERV_IS_TARGET(output)) {
+        io::TargetInterface *target = WESERV_TARGET(output)->target;
+        return target->accepted_outputs();
+    }
+
+    return 0;
+}
+
+void Target::set_negotiated() const {
+    VipsTarget *output = get_target();
+    if (WESERV_IS_TARGET(output)) {
+        io::TargetInterface *target = WESERV_TARGET(output)->target;
+        target->set_negotiated();
+    }
+}
+
 int64_t Target::write(const void *data, size_t length) const {
     return vips_target_write(get_target(), data, length);
 }
@@ -132,6 +158,18 @@ void Target::setup(const std::string &extension) const {
     target_->setup(extension);
 }
 
+void Target::set_quality(int quality, bool fits) const {
+    target_->set_quality(quality, fits);
+}
+
+uintptr_t Target::accepted_outputs() const {
+    return target_->accepted_outputs();
+}
+
+void Target::set_negotiated() const {
+    target_->set_negotiated();
+}
+
 int64_t Target::write(const void *data, size_t length) const {
     return target_->write(data, length);
 }
@@ -147,6 +147,12 @@ class Target {
 
     void setup(const std::string &extension) const;
 
+    void set_quality(int quality, bool fits) const;
+
+    uintptr_t accepted_outputs() const;
+
+    void set_negotiated() const;
+
     int64_t write(const void *data, size_t length) const;
 
     int end() const;
@@ -145,6 +145,9 @@ inline enums::Output parse(const std::string &value) {
     if (value == "json") {
         return enums::Output::Json;
     }
+    if (value == "auto") {
+        return enums::Output::Auto;
+    }
     // if (value == "origin")
 
     // Honor the origin image format by default
@@ -1,5 +1,6 @@
 #include "query.h"
 
+#include "../exceptions/unknown.h"
 #include "base.h"
 #include "enumeration.h"
 #include "numeric.h"
@@ -14,8 +15,8 @@ using enums::MaskType;
 using enums::Output;
 using enums::Position;
 
-// `&[precrop]=true`
-constexpr size_t MAX_KEY_LENGTH = sizeof("precrop") - 1;
+// `&[maxframes]=10`
+constexpr size_t MAX_KEY_LENGTH = sizeof("maxframes") - 1;
 
 // A vector must not have more than 65536 elements.
 const size_t MAX_VECTOR_SIZE = 65536;
@@ -24,54 +25,60 @@ const size_t MAX_VECTOR_SIZE = 65536;
 
 // clang-format off
 const TypeMap &type_map = {
-    {"w",       typeid(int)},
-    {"h",       typeid(int)},
-    {"dpr",     typeid(float)},
-    {"fit",     typeid(Canvas)},
-    {"we",      typeid(bool)},
-    {"crop",    typeid(std::vector<int>)},  // Deprecated
-    {"cx",      typeid(int)},
-    {"cy",      typeid(int)},
-    {"cw",      typeid(int)},
-    {"ch",      typeid(int)},
-    {"precrop", typeid(bool)},
-    {"a",       typeid(Position)},
-    {"fpx",     typeid(float)},
-    {"fpy",     typeid(float)},
-    {"mask",    typeid(MaskType)},
-    {"mtrim",   typeid(bool)},
-    {"mbg",     typeid(Color)},
-    {"ro",      typeid(int)},
-    {"flip",    typeid(bool)},
-    {"flop",    typeid(bool)},
-    {"bri",     typeid(int)},
-    {"mod",     typeid(std::vector<float>)},
-    {"sat",     typeid(float)},
-    {"hue",     typeid(int)},
-    {"con",     typeid(int)},
-    {"gam",     typeid(float)},
-    {"sharp",   typeid(std::vector<float>)},
-    {"sharpf",  typeid(float)},
-    {"sharpj",  typeid(float)},
-    {"trim",    typeid(int)},
-    {"blur",    typeid(float)},
-    {"filt",    typeid(FilterType)},
-    {"start",   typeid(Color)},
-    {"stop",    typeid(Color)},
-    {"bg",      typeid(Color)},
-    {"cbg",     typeid(Color)},
-    {"rbg",     typeid(Color)},
-    {"tint",    typeid(Color)},
-    {"q",       typeid(int)},
-    {"l",       typeid(int)},
-    {"output",  typeid(Output)},
-    {"il",      typeid(bool)},
-    {"af",      typeid(bool)},
-    {"page",    typeid(int)},
-    {"n",       typeid(int)},
-    {"loop",    typeid(int)},               // TODO(kleisauke): Documentation needed.
-    {"delay",   typeid(std::vector<int>)},  // TODO(kleisauke): Documentation needed.
-    {"fsol",    typeid(bool)},              // TODO(kleisauke): Documentation needed.
+    {"w",         typeid(int)},
+    {"h",         typeid(int)},
+    {"dpr",       typeid(float)},
+    {"fit",       typeid(Canvas)},
+    {"we",        typeid(bool)},
+    {"crop",      typeid(std::vector<int>)},  // Deprecated
+    {"cx",        typeid(int)},
+    {"cy",        typeid(int)},
+    {"cw",        typeid(int)},
+    {"ch",        typeid(int)},
+    {"precrop",   typeid(bool)},
+    {"a",         typeid(Position)},
+    {"fpx",       typeid(float)},
+    {"fpy",       typeid(float)},
+    {"mask",      typeid(MaskType)},
+    {"mtrim",     typeid(bool)},
+    {"mbg",       typeid(Color)},
+    {"ro",        typeid(int)},
+    {"flip",      typeid(bool)},
+    {"flop",      typeid(bool)},
+    {"bri",       typeid(int)},
+    {"mod",       typeid(std::vector<float>)},
+    {"sat",       typeid(float)},
+    {"hue",       typeid(int)},
+    {"con",       typeid(int)},
+    {"gam",       typeid(float)},
+    {"sharp",     typeid(std::vector<float>)},
+    {"sharpf",    typeid(float)},
+    {"sharpj",    typeid(float)},
+    {"trim",      typeid(int)},
+    {"blur",      typeid(float)},
+    {"filt",      typeid(FilterType)},
+    {"start",     typeid(Color)},
+    {"stop",      typeid(Color)},
+    {"bg",        typeid(Color)},
+    {"cbg",       typeid(Color)},
+    {"rbg",       typeid(Color)},
+    {"tint",      typeid(Color)},
+    {"q",         typeid(int)},
+    {"l",         typeid(int)},
+    {"output",    typeid(Output)},
+    {"il",        typeid(bool)},
+    {"af",        typeid(bool)},
+    {"palette",   typeid(bool)},
+    {"colors",    typeid(int)},
+    {"dither",    typeid(float)},
+    {"page",      typeid(int)},
+    {"n",         typeid(int)},
+    {"fps",       typeid(float)},
+    {"maxframes", typeid(int)},
+    {"maxbytes",  typeid(int)},
+    {"loop",      typeid(int)},               // TODO(kleisauke): Documentation needed.
+    {"delay",     typeid(std::vector<int>)},  // TODO(kleisauke): Documentation needed.
+    {"fsol",      typeid(bool)},              // TODO(kleisauke): Documentation needed.
 };
 
 const SynonymMap &synonym_map = {
@@ -88,6 +95,14 @@ const SynonymMap &synonym_map = {
     {"align",   "a"},
     {"level",   "l"},
     {"quality", "q"},
+    {"colours", "colors"},
+};
+
+// Parameters that set other parameters as well while being parsed
+const DerivedKeyMap &derived_keys = {
+    {"a",     {"fpx", "fpy"}},        // &a=focal-x%-y%
+    {"mod",   {"sat", "hue"}},        // &mod=brightness,saturation,hue
+    {"sharp", {"sharpf", "sharpj"}},  // &sharp=flat,jagged,sigma
 };
 
 const NginxKeySet &nginx_keys = {
@@ -241,7 +256,34 @@ void Query::add_value(const std::string &key, const std::string &value,
     }
 }
 
+void Query::merge_preset(const std::string &name) {
+    auto preset_it = config_.presets.find(name);
+    if (preset_it == config_.presets.end()) {
+        throw exceptions::UnknownPresetException("Preset \"" + name +
+                                                 "\" is not defined.");
+    }
+
+    // A parameter given in the query replaces the parameters that the preset
+    // derived from it, e.g. `&sharp=5` drops the flat and jagged slopes of a
+    // preset with `&sharp=1,2,3`
+    std::unordered_set<std::string> overridden;
+    for (const auto &[key, derived] : derived_keys) {
+        if (query_map_.find(key) != query_map_.end()) {
+            overridden.insert(derived.begin(), derived.end());
+        }
+    }
+
+    for (const auto &[key, value] : preset_it->second->parameters) {
+        if (overridden.find(key) == overridden.end()) {
+            query_map_.emplace(key, value);
+        }
+    }
+}
+
 Query::Query(const std::string &value, const Config &config) : config_(config) {
+    // The named preset, if any (merged after all other parameters are parsed)
+    std::string preset;
+
     size_t pos = 0;
     size_t max_pos = value.size();
 
@@ -268,6 +310,22 @@ Query::Query(const std::string &value, const Config &config) : config_(config) {
             key = synonym_it->second;
         }
 
+        // Named presets are merged once all parameters are known, the first
+        // occurrence wins
+        if (key == "preset") {
+            if (end < max_pos && value.at(end) == '=' && preset.empty()) {
+                pos = end + 1;
+                end = value.find('&', pos);
+
+                preset = value.substr(pos, end - pos);
+            } else {
+                end = value.find('&', end);
+            }
+
+            pos = end == std::string::npos ? max_pos : end + 1;
+            continue;
+        }
+
         // Check whether the key is defined by the API
         auto type_it = type_map.find(key);
         if (type_it != type_map.end()) {
@@ -289,6 +347,10 @@ Query::Query(const std::string &value, const Config &config) : config_(config) {
 
         pos = end == std::string::npos ? max_pos : end + 1;
     }
+
+    if (!preset.empty()) {
+        merge_preset(preset);
+    }
 }
 
 }  // namespace weserv::api::parsers
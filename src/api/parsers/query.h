@@ -2,6 +2,7 @@
 
 #include "color.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <string>
 #include <type_traits>
@@ -17,7 +18,19 @@ namespace weserv::api::parsers {
 
 using TypeMap = std::unordered_map<std::string, std::type_index>;
 using SynonymMap = std::unordered_map<std::string, std::string>;
+using DerivedKeyMap =
+    std::unordered_map<std::string, std::vector<std::string>>;
 using NginxKeySet = std::unordered_set<std::string>;
+using QueryVariant = std::variant<bool, int, float, Color, std::vector<int>,
+                                  std::vector<float>>;
+using QueryMap = std::unordered_map<std::string, QueryVariant>;
+
+/**
+ * The parsed parameters of a named preset.
+ */
+struct Preset {
+    QueryMap parameters;
+};
 
 class Query {
  public:
@@ -67,16 +80,37 @@ class Query {
         return query_map_.find(key) != query_map_.end();
     }
 
+    inline bool empty() const {
+        return query_map_.empty();
+    }
+
+    /**
+     * @param keys The keys to allow.
+     * @return true if this query has no other keys than the given ones.
+     */
+    inline bool
+    contains_only(const std::unordered_set<std::string> &keys) const {
+        return std::all_of(query_map_.begin(), query_map_.end(),
+                           [&keys](const auto &pair) {
+                               return keys.count(pair.first) != 0;
+                           });
+    }
+
     template <typename T,
               typename = typename std::enable_if<!std::is_enum<T>::value>::type>
     inline void update(const std::string &key, const T &val) {
         query_map_[key] = val;
     }
 
+    /**
+     * @return The parsed parameters of this query.
+     */
+    inline const QueryMap &parameters() const {
+        return query_map_;
+    }
+
  private:
-    using QueryVariant = std::variant<bool, int, float, Color, std::vector<int>,
-                                      std::vector<float>>;
-    std::unordered_map<std::string, QueryVariant> query_map_;
+    QueryMap query_map_;
 
     const Config &config_;
 
@@ -86,6 +120,14 @@ class Query {
 
     inline void add_value(const std::string &key, const std::string &value,
                           std::type_index type);
+
+    /**
+     * Merge the parameters of a named preset into this query. Parameters
+     * which are already present take precedence over the preset.
+     * @param name The name of the preset.
+     * @throws exceptions::UnknownPresetException if the preset isn't defined.
+     */
+    void merge_preset(const std::string &name);
 };
 
 }  // namespace weserv::api::parsers
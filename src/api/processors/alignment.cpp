@@ -1,9 +1,11 @@
 #include "alignment.h"
 
 #include "../enums.h"
+#include "../utils/multi_page.h"
 #include "../utils/utility.h"
 
 #include <algorithm>
+#include <cmath>
 #include <tuple>
 
 namespace weserv::api::processors {
@@ -11,6 +13,10 @@ namespace weserv::api::processors {
 using enums::Canvas;
 using enums::Position;
 
+// Entropy and attention scores barely change below this size, so smartcrop
+// never looks at more pixels than this along the longest side.
+const int SMARTCROP_PROXY_SIZE = 256;
+
 VImage Alignment::process(const VImage &image) const {
     // Should we process the image?
     if (query_->get<Canvas>("fit", Canvas::Max) != Canvas::Crop) {
@@ -51,15 +57,54 @@ VImage Alignment::process(const VImage &image) const {
     // Skip smart crop for multi-page images
     if (n_pages == 1 && (crop_position == Position::Entropy ||
                          crop_position == Position::Attention)) {
+        // Find the interesting area on straight alpha
+        auto output_image = unpremultiply(image, query_.get());
+
         // Copy to memory evaluates the image, so set up the timeout handler,
         // if necessary.
-        utils::setup_timeout_handler(image, config_.process_timeout);
+        utils::setup_timeout_handler(output_image, config_.process_timeout);
 
         // Need to copy to memory, we have to stay seq
-        return image.copy_memory().smartcrop(
-            crop_width, crop_height,
+        output_image = output_image.copy_memory();
+
+        int longest_side = std::max(image_width, image_height);
+        if (longest_side <= SMARTCROP_PROXY_SIZE) {
+            return output_image.smartcrop(
+                crop_width, crop_height,
+                VImage::option()->set("interesting",
+                                      static_cast<int>(crop_position)));
+        }
+
+        // Find the interesting area on a small proxy instead, the analysis
+        // doesn't need every pixel of the intermediate
+        double factor = static_cast<double>(SMARTCROP_PROXY_SIZE) /
+                        static_cast<double>(longest_side);
+        auto proxy = output_image
+                         .resize(factor, VImage::option()->set(
+                                             "kernel", VIPS_KERNEL_LINEAR))
+                         .copy_memory();
+
+        int proxy_width = std::min(
+            proxy.width(),
+            std::max(1, static_cast<int>(std::round(crop_width * factor))));
+        int proxy_height = std::min(
+            proxy.height(),
+            std::max(1, static_cast<int>(std::round(crop_height * factor))));
+
+        auto window = proxy.smartcrop(
+            proxy_width, proxy_height,
             VImage::option()->set("interesting",
                                   static_cast<int>(crop_position)));
+
+        // The offset of the extracted window is recorded as its negated
+        // origin, map it back to the full resolution image
+        auto left = static_cast<int>(std::round(-window.xoffset() / factor));
+        auto top = static_cast<int>(std::round(-window.yoffset() / factor));
+
+        left = std::max(0, std::min(left, image_width - crop_width));
+        top = std::max(0, std::min(top, image_height - crop_height));
+
+        return output_image.extract_area(left, top, crop_width, crop_height);
     }
 
     int left;
@@ -30,21 +30,25 @@ VImage Background::process(const VImage &image) const {
     }
 
     if (background_rgba.size() == 4) {  // Alpha compositing
+        // Premultiply the image, if this hasn't been done already
+        auto output_image = premultiply(image, query_.get());
+
         // Create a new image from a constant that matches the origin image
         // dimensions
-        auto background_image = image.new_from_image(background_rgba);
+        auto background_image =
+            output_image.new_from_image(premultiply_color(background_rgba));
 
         // Alpha composite src over dst.
-        // Assumes alpha channels are already premultiplied and will be
-        // unpremultiplied after.
+        // Both are premultiplied and will be unpremultiplied after.
         return background_image.composite2(
-            image, VIPS_BLEND_MODE_OVER,
+            output_image, VIPS_BLEND_MODE_OVER,
             VImage::option()->set("premultiplied", true));
     }
 
     // Flatten the alpha from the image by replacing it with a constant
     // background color.
-    return image.flatten(VImage::option()->set("background", background_rgba));
+    return unpremultiply(image, query_.get())
+        .flatten(VImage::option()->set("background", background_rgba));
 }
 
 }  // namespace weserv::api::processors
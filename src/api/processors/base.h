@@ -4,6 +4,7 @@
 
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include <vips/vips8>
 
@@ -11,6 +12,70 @@ namespace weserv::api::processors {
 
 using vips::VImage;
 
+/**
+ * Is the alpha channel of the image (still) premultiplied? Once premultiplied,
+ * images stay in that form through resize, blur, rotate, embed, etc., and are
+ * unpremultiplied (or flattened) only once.
+ * @param query The query holder.
+ * @return A bool indicating if the image is premultiplied.
+ */
+inline bool is_premultiplied(const parsers::Query &query) {
+    return query.get<bool>("premultiplied", false);
+}
+
+/**
+ * Premultiply the alpha channel of an image, if this hasn't been done yet.
+ * @note The result is a float image, the original format is restored by
+ *       `unpremultiply()`.
+ * @param image The source image.
+ * @param query The query holder, keeps track of the premultiplied state.
+ * @return The (possibly) premultiplied image.
+ */
+inline VImage premultiply(const VImage &image, parsers::Query *query) {
+    if (!image.has_alpha() || is_premultiplied(*query)) {
+        return image;
+    }
+
+    query->update("premultiplied", true);
+    query->update("unpremultiplied_format", static_cast<int>(image.format()));
+
+    return image.premultiply();
+}
+
+/**
+ * Unpremultiply the alpha channel of an image and cast back to the
+ * pre-premultiply format, if necessary. Operations that aren't linear (e.g.
+ * colour space conversions, LUTs) need to call this first.
+ * @param image The source image.
+ * @param query The query holder, keeps track of the premultiplied state.
+ * @return The unpremultiplied image.
+ */
+inline VImage unpremultiply(const VImage &image, parsers::Query *query) {
+    if (!is_premultiplied(*query)) {
+        return image;
+    }
+
+    query->update("premultiplied", false);
+
+    return image.unpremultiply().cast(static_cast<VipsBandFormat>(
+        query->get<int>("unpremultiplied_format")));
+}
+
+/**
+ * Premultiply a RGBA (or grey-alpha) background color, so that it can be
+ * used on premultiplied images.
+ * @param color The color, the last element being the alpha (0 - 255).
+ * @return The premultiplied color.
+ */
+inline std::vector<double> premultiply_color(std::vector<double> color) {
+    double alpha = color.back() / 255.0;
+    for (size_t i = 0; i < color.size() - 1; ++i) {
+        color[i] *= alpha;
+    }
+
+    return color;
+}
+
 class ImageProcessor {
  public:
     explicit ImageProcessor(std::shared_ptr<parsers::Query> query)
@@ -1,5 +1,6 @@
 #include "blur.h"
 
+#include "../utils/box_blur.h"
 #include "../utils/utility.h"
 
 namespace weserv::api::processors {
@@ -30,6 +31,12 @@ VImage Blur::process(const VImage &image) const {
         return image.conv(blur);
     }
 
+    // Approximate large blurs with box blurs, whose cost doesn't depend on
+    // sigma
+    if (config_.fast_blur_sigma > 0 && sigma >= config_.fast_blur_sigma) {
+        return utils::box_gaussblur(image, sigma, config_.process_timeout);
+    }
+
     // Slower, accurate Gaussian blur
     return (image.get_typeof(VIPS_META_SEQUENTIAL) != 0
                 ? utils::line_cache(image, 10)
@@ -6,9 +6,16 @@ namespace weserv::api::processors {
 
 class Blur : ImageProcessor {
  public:
-    using ImageProcessor::ImageProcessor;
+    Blur(std::shared_ptr<parsers::Query> query, const Config &config)
+        : ImageProcessor(std::move(query)), config_(config) {}
 
     VImage process(const VImage &image) const override;
+
+ private:
+    /**
+     * Global config.
+     */
+    const Config &config_;
 };
 
 }  // namespace weserv::api::processors
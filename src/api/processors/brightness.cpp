@@ -20,16 +20,19 @@ VImage Brightness::process(const VImage &image) const {
     // Map brightness from -100/100 to -255/255 range
     double brightness = bri * 2.55;
 
+    // Needs straight alpha
+    auto output_image = unpremultiply(image, query_.get());
+
     // Edit the brightness
-    if (image.has_alpha()) {
+    if (output_image.has_alpha()) {
         // Separate alpha channel
-        auto image_without_alpha = image.extract_band(
-            0, VImage::option()->set("n", image.bands() - 1));
-        auto alpha = image[image.bands() - 1];
+        auto image_without_alpha = output_image.extract_band(
+            0, VImage::option()->set("n", output_image.bands() - 1));
+        auto alpha = output_image[output_image.bands() - 1];
         return image_without_alpha.linear(1, brightness).bandjoin(alpha);
     }
 
-    return image.linear(1, brightness);
+    return output_image.linear(1, brightness);
 
     /*VipsInterpretation old_interpretation = image.interpretation();
     auto lch = image.colourspace(VIPS_INTERPRETATION_LCH);
@@ -88,7 +88,8 @@ VImage Contrast::process(const VImage &image) const {
     // Remap contrast from -100/100 to -30/30 range
     double contrast = con * 0.3;
 
-    return sigmoid(image, contrast);
+    // Needs straight alpha
+    return sigmoid(unpremultiply(image, query_.get()), contrast);
 }
 
 }  // namespace weserv::api::processors
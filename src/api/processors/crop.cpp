@@ -1,26 +1,14 @@
 #include "crop.h"
 
+#include "../utils/multi_page.h"
 #include "../utils/utility.h"
 
 namespace weserv::api::processors {
 
-VImage Crop::process(const VImage &image) const {
-    // Should we process the image?
-    if (!query_->exists("cx") && !query_->exists("cy") &&
-        !query_->exists("cw") && !query_->exists("ch")) {
-        return image;
-    }
-
-    auto n_pages = query_->get<int>("n");
-
-    int image_width = image.width();
-
-    // Pre-resize extract needs to fetch the page height from the image
-    int image_height =
-        n_pages > 1
-            ? query_->get<int>("page_height", utils::get_page_height(image))
-            : image.height();
+using io::DecodeSession;
 
+std::tuple<int, int, int, int> Crop::resolve_crop(int image_width,
+                                                  int image_height) const {
     auto crop_x = query_->get_if<int>(
         "cx",
         [&image_width](int x) {
@@ -55,6 +43,119 @@ VImage Crop::process(const VImage &image) const {
         },
         boundary_h);
 
+    return std::make_tuple(crop_x, crop_y, crop_w, crop_h);
+}
+
+VImage Crop::region_on_load(const VImage &image,
+                            DecodeSession &session) const {
+    // Should we process the image?
+    if (!query_->exists("cx") && !query_->exists("cy") &&
+        !query_->exists("cw") && !query_->exists("ch")) {
+        return image;
+    }
+
+    // Trimming needs to see the whole image and multi-page images are
+    // cropped page by page
+    auto trim = query_->get_if<int>(
+        "trim",
+        [](int t) {
+            // Threshold needs to be in the
+            // range of 1 - 254
+            return t >= 1 && t <= 254;
+        },
+        0);
+    if (trim != 0 || query_->get<int>("n") != 1) {
+        return image;
+    }
+
+    auto angle = query_->get<int>("angle", 0);
+    auto flip = query_->get<bool>("flip", false);
+    auto flop = query_->get<bool>("flop", false);
+
+    if (angle != 0 && angle != 90 && angle != 180 && angle != 270) {
+        return image;
+    }
+
+    int source_width = image.width();
+    int source_height = image.height();
+
+    // The crop rectangle is specified after the orientation
+    bool swap = angle == 90 || angle == 270;
+    int image_width = swap ? source_height : source_width;
+    int image_height = swap ? source_width : source_height;
+
+    int left, top, width, height;
+    std::tie(left, top, width, height) =
+        resolve_crop(image_width, image_height);
+
+    // Nothing to gain
+    if (width == image_width && height == image_height) {
+        return image;
+    }
+
+    // Undo the flop and the flip
+    if (flop) {
+        left = image_width - left - width;
+    }
+    if (flip) {
+        top = image_height - top - height;
+    }
+
+    // Undo the (clockwise) rotation
+    switch (angle) {
+        case 90:
+            std::tie(left, top, width, height) = std::make_tuple(
+                top, source_height - left - width, height, width);
+            break;
+        case 180:
+            left = source_width - left - width;
+            top = source_height - top - height;
+            break;
+        case 270:
+            std::tie(left, top, width, height) = std::make_tuple(
+                source_width - top - height, left, height, width);
+            break;
+        default:
+            break;
+    }
+
+    auto region = session.load_region(query_->get<int>("page", 0), left, top,
+                                      width, height);
+    if (region.is_null()) {
+        return image;
+    }
+
+    // Our own decoders don't attach any metadata
+    utils::copy_fields(image, region,
+                       {VIPS_META_ORIENTATION, VIPS_META_ICC_NAME});
+
+    query_->update("precropped", true);
+
+    return region;
+}
+
+VImage Crop::process(const VImage &image) const {
+    // Should we process the image?
+    if ((!query_->exists("cx") && !query_->exists("cy") &&
+         !query_->exists("cw") && !query_->exists("ch")) ||
+        query_->get<bool>("precropped", false)) {
+        return image;
+    }
+
+    auto n_pages = query_->get<int>("n");
+
+    int image_width = image.width();
+
+    // Pre-resize extract needs to fetch the page height from the image
+    int image_height =
+        n_pages > 1
+            ? query_->get<int>("page_height", utils::get_page_height(image))
+            : image.height();
+
+    int crop_x, crop_y, crop_w, crop_h;
+    std::tie(crop_x, crop_y, crop_w, crop_h) =
+        resolve_crop(image_width, image_height);
+
     if (n_pages > 1) {
         // Update the page height
         query_->update("page_height", crop_h);
@@ -1,14 +1,38 @@
 #pragma once
 
+#include "../io/decode_session.h"
 #include "base.h"
 
+#include <tuple>
+
 namespace weserv::api::processors {
 
 class Crop : ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
+    /**
+     * Decode only the region of interest, when the crop is applied before
+     * resizing. The crop rectangle is mapped back through the orientation,
+     * so the region is still in the orientation of the source.
+     * @param image The source image.
+     * @param session The decode session.
+     * @return The region of interest, or the source image if the region
+     *         can't be decoded on its own.
+     */
+    VImage region_on_load(const VImage &image,
+                          io::DecodeSession &session) const;
+
     VImage process(const VImage &image) const override;
+
+    /**
+     * Resolve the crop rectangle, limited to the image boundaries.
+     * @param image_width Width of the image.
+     * @param image_height (Page) height of the image.
+     * @return The left, top, width and height of the crop rectangle.
+     */
+    std::tuple<int, int, int, int> resolve_crop(int image_width,
+                                                int image_height) const;
 };
 
 }  // namespace weserv::api::processors
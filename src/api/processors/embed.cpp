@@ -1,6 +1,7 @@
 #include "embed.h"
 
 #include "../enums.h"
+#include "../utils/multi_page.h"
 #include "../utils/utility.h"
 
 #include <cmath>
@@ -13,77 +14,6 @@ using enums::Canvas;
 using enums::Position;
 using parsers::Color;
 
-VImage Embed::embed_multi_page(const VImage &image, int left, int top,
-                               int width, int height,
-                               const std::vector<double> &background,
-                               int n_pages, int page_height) const {
-    if (top == 0 && height == page_height) {
-        // Fast path; no need to adjust the height of the multi-page image
-        return image.embed(left, 0, width, image.height(),
-                           VImage::option()
-                               ->set("extend", VIPS_EXTEND_BACKGROUND)
-                               ->set("background", background));
-    }
-    if (left == 0 && width == image.width()) {
-        // Fast path; no need to adjust the width of the multi-page image
-        std::vector<VImage> pages;
-        pages.reserve(n_pages);
-
-        // Rearrange the tall image into a vertical grid
-        VImage wide = image.grid(page_height, n_pages, 1);
-
-        // Do the embed on the wide image
-        wide = wide.embed(0, top, wide.width(), height,
-                          VImage::option()
-                              ->set("extend", VIPS_EXTEND_BACKGROUND)
-                              ->set("background", background));
-
-        // Split the wide image into frames
-        for (int i = 0; i < n_pages; i++) {
-            pages.push_back(wide.extract_area(width * i, 0, width, height));
-        }
-
-        // Reassemble the frames into a tall, thin image
-        VImage assembled =
-            VImage::arrayjoin(pages, VImage::option()->set("across", 1));
-
-        // Update the page height
-        query_->update("page_height", height);
-
-        return assembled;
-    }
-    // Embedding will always hit the above code paths, below is for reference
-    // only and excluded for code coverage
-    // LCOV_EXCL_START
-
-    std::vector<VImage> pages;
-    pages.reserve(n_pages);
-
-    // Split the image into frames
-    for (int i = 0; i < n_pages; i++) {
-        pages.push_back(
-            image.extract_area(0, page_height * i, image.width(), page_height));
-    }
-
-    // Embed each frame in the target size
-    for (int i = 0; i < n_pages; i++) {
-        pages[i] = pages[i].embed(left, top, width, height,
-                                  VImage::option()
-                                      ->set("extend", VIPS_EXTEND_BACKGROUND)
-                                      ->set("background", background));
-    }
-
-    // Reassemble the frames into a tall, thin image
-    VImage assembled =
-        VImage::arrayjoin(pages, VImage::option()->set("across", 1));
-
-    // Update the page height
-    query_->update("page_height", height);
-
-    return assembled;
-    // LCOV_EXCL_STOP
-}
-
 VImage Embed::process(const VImage &image) const {
     // Should we process the image?
     if (query_->get<Canvas>("fit", Canvas::Max) != Canvas::Embed) {
@@ -146,19 +76,29 @@ VImage Embed::process(const VImage &image) const {
         background_rgba.pop_back();
     }
 
+    // The image may still be premultiplied, do the same with the background
+    if (has_alpha && is_premultiplied(*query_)) {
+        background_rgba = premultiply_color(background_rgba);
+    }
+
     // Internal copy to ensure that the image has an alpha channel, if missing
     auto output_image =
         opaque || has_alpha
             ? image
             : image.bandjoin_const({255});  // Assumes images are always 8-bit
 
-    return n_pages > 1
-               ? embed_multi_page(output_image, left, top, width, height,
-                                  background_rgba, n_pages, image_height)
-               : output_image.embed(left, top, width, height,
-                                    VImage::option()
-                                        ->set("extend", VIPS_EXTEND_BACKGROUND)
-                                        ->set("background", background_rgba));
+    if (n_pages > 1) {
+        // Update the page height
+        query_->update("page_height", height);
+
+        return utils::embed_multi_page(output_image, left, top, width, height,
+                                       background_rgba, n_pages, image_height);
+    }
+
+    return output_image.embed(left, top, width, height,
+                              VImage::option()
+                                  ->set("extend", VIPS_EXTEND_BACKGROUND)
+                                  ->set("background", background_rgba));
 }
 
 }  // namespace weserv::api::processors
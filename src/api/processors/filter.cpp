@@ -18,10 +18,13 @@ VImage Filter::process(const VImage &image) const {
         return image;
     }
 
+    // Needs straight alpha
+    auto output_image = unpremultiply(image, query_.get());
+
     switch (filter_type) {
         case FilterType::Greyscale:
             // Perform greyscale filter manipulation
-            return image.colourspace(VIPS_INTERPRETATION_B_W);
+            return output_image.colourspace(VIPS_INTERPRETATION_B_W);
         case FilterType::Sepia: {
             // Perform sepia filter manipulation
             // clang-format off
@@ -32,7 +35,7 @@ VImage Filter::process(const VImage &image) const {
             };
 
             auto matrix =
-                image.bands() == 3
+                output_image.bands() == 3
                     ? VImage::new_from_memory(sepia.begin(), 9 * sizeof(double),
                                               3, 3, 1, VIPS_FORMAT_DOUBLE)
                     : VImage::new_matrixv(4, 4,
@@ -41,7 +44,7 @@ VImage Filter::process(const VImage &image) const {
                                           sepia[6], sepia[7], sepia[8], 0.0,
                                           0.0, 0.0, 0.0, 1.0);
 
-            return image
+            return output_image
                 .colourspace(VIPS_INTERPRETATION_sRGB)
                 .recomb(matrix);
             // clang-format on
@@ -70,30 +73,31 @@ VImage Filter::process(const VImage &image) const {
             // Mapping is done by looping over the image and looking up each
             // pixel value in the lut and replacing it with the pre-calculated
             // result.
-            if (image.has_alpha()) {
+            if (output_image.has_alpha()) {
                 // Separate alpha channel
-                auto image_without_alpha = image.extract_band(
-                    0, VImage::option()->set("n", image.bands() - 1));
-                auto alpha = image[image.bands() - 1];
+                auto image_without_alpha = output_image.extract_band(
+                    0, VImage::option()->set("n", output_image.bands() - 1));
+                auto alpha = output_image[output_image.bands() - 1];
                 return image_without_alpha.colourspace(VIPS_INTERPRETATION_B_W)
                     .maplut(lut)
                     .bandjoin(alpha);
             }
 
-            return image.colourspace(VIPS_INTERPRETATION_B_W).maplut(lut);
+            return output_image.colourspace(VIPS_INTERPRETATION_B_W)
+                .maplut(lut);
         }
         case FilterType::Negate:
         default:
             // Perform negate filter manipulation
-            if (image.has_alpha()) {
+            if (output_image.has_alpha()) {
                 // Separate alpha channel
-                auto image_without_alpha = image.extract_band(
-                    0, VImage::option()->set("n", image.bands() - 1));
-                auto alpha = image[image.bands() - 1];
+                auto image_without_alpha = output_image.extract_band(
+                    0, VImage::option()->set("n", output_image.bands() - 1));
+                auto alpha = output_image[output_image.bands() - 1];
                 return image_without_alpha.invert().bandjoin(alpha);
             }
 
-            return image.invert();
+            return output_image.invert();
     }
 }
 
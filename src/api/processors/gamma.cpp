@@ -16,18 +16,21 @@ VImage Gamma::process(const VImage &image) const {
         gamma = 2.2;
     }
 
+    // Needs straight alpha
+    auto output_image = unpremultiply(image, query_.get());
+
     // Edit the gamma
-    if (image.has_alpha()) {
+    if (output_image.has_alpha()) {
         // Separate alpha channel
-        auto image_without_alpha = image.extract_band(
-            0, VImage::option()->set("n", image.bands() - 1));
-        auto alpha = image[image.bands() - 1];
+        auto image_without_alpha = output_image.extract_band(
+            0, VImage::option()->set("n", output_image.bands() - 1));
+        auto alpha = output_image[output_image.bands() - 1];
         return image_without_alpha
             .gamma(VImage::option()->set("exponent", 1.0 / gamma))
             .bandjoin(alpha);
     }
 
-    return image.gamma(VImage::option()->set("exponent", 1.0 / gamma));
+    return output_image.gamma(VImage::option()->set("exponent", 1.0 / gamma));
 }
 
 }  // namespace weserv::api::processors
@@ -1,24 +1,87 @@
 #include "mask.h"
 
+#include "../utils/multi_page.h"
+#include "../utils/outline.h"
 #include "../utils/utility.h"
 
 #include <algorithm>
 #include <cmath>
 #include <iomanip>
 #include <limits>
-#include <ostream>
+#include <sstream>
 #include <stdexcept>
+#include <string>
 #include <tuple>
+#include <vector>
 
 namespace weserv::api::processors {
 
 using enums::MaskType;
 using parsers::Color;
+using utils::Outline;
+
+Outline Mask::outline_by_type(const int width, const int height,
+                              const MaskType &mask, int *out_x_min,
+                              int *out_y_min, int *out_width,
+                              int *out_height) {
+    int min = std::min(width, height);
+    float outer_radius = static_cast<float>(min) / 2.0;
+    float mid_x = static_cast<float>(width) / 2.0;
+    float mid_y = static_cast<float>(height) / 2.0;
+
+    if (mask == MaskType::Heart) {
+        std::vector<PathCoordinate> coordinates =
+            heart_path(outer_radius, outer_radius, out_x_min, out_y_min,
+                       out_width, out_height);
+
+        PathCoordinate mask_transl{};
+        double scale;
+        std::tie(mask_transl, scale) = translation_and_scaling(
+            width, height, *out_x_min, *out_y_min, out_width, out_height);
+
+        return transformed_outline(coordinates, mask_transl, scale);
+    }
+
+    if (mask == MaskType::Ellipse || mask == MaskType::Circle) {
+        Outline outline;
+        outline.ellipse = true;
+        outline.cx = mid_x;
+        outline.cy = mid_y;
+
+        if (mask == MaskType::Ellipse) {
+            *out_x_min = 0;
+            *out_y_min = 0;
+            *out_width = width;
+            *out_height = height;
+
+            outline.rx = mid_x;
+            outline.ry = mid_y;
+        } else {
+            *out_x_min = static_cast<int>(std::round(mid_x - outer_radius));
+            *out_y_min = static_cast<int>(std::round(mid_y - outer_radius));
+            *out_width = min;
+            *out_height = min;
+
+            outline.rx = outer_radius;
+            outline.ry = outer_radius;
+        }
+
+        return outline;
+    }
+
+    PathCoordinate mask_transl{};
+    double scale;
+    auto coordinates =
+        polygon_path(width, height, mask, out_x_min, out_y_min, out_width,
+                     out_height, &scale, &mask_transl);
+
+    return transformed_outline(coordinates, mask_transl, scale);
+}
 
 std::string Mask::svg_path_by_type(const int width, const int height,
-                                   const MaskType &mask,
-                                   int *out_x_min, int *out_y_min,
-                                   int *out_width, int *out_height) const {
+                                   const MaskType &mask, int *out_x_min,
+                                   int *out_y_min, int *out_width,
+                                   int *out_height) {
     int min = std::min(width, height);
     float outer_radius = static_cast<float>(min) / 2.0;
     float mid_x = static_cast<float>(width) / 2.0;
@@ -55,6 +118,34 @@ std::string Mask::svg_path_by_type(const int width, const int height,
         return svg_circle_path(mid_x, mid_y, outer_radius);
     }
 
+    PathCoordinate mask_transl{};
+    double scale;
+    auto coordinates =
+        polygon_path(width, height, mask, out_x_min, out_y_min, out_width,
+                     out_height, &scale, &mask_transl);
+
+    std::string path = transformed_path_string(coordinates, mask_transl, scale);
+
+    // If an odd number of points, add a point at the top of the polygon; this
+    // will shift the calculated center point of the shape so that the center
+    // point of the polygon is at x,y (otherwise the center is mis-located)
+    if (coordinates.size() % 2 == 1) {
+        path = "M0 " + std::to_string(outer_radius) + " " + path;
+    }
+
+    return path;
+}
+
+std::vector<Mask::PathCoordinate>
+Mask::polygon_path(const int width, const int height, const MaskType &mask,
+                   int *out_x_min, int *out_y_min, int *out_width,
+                   int *out_height, double *out_scale,
+                   PathCoordinate *out_transl) {
+    int min = std::min(width, height);
+    float outer_radius = static_cast<float>(min) / 2.0;
+    float mid_x = static_cast<float>(width) / 2.0;
+    float mid_y = static_cast<float>(height) / 2.0;
+
     // 'inner' radius of the polygon/star
     float inner_radius = outer_radius;
 
@@ -140,25 +231,14 @@ std::string Mask::svg_path_by_type(const int width, const int height,
     *out_width = static_cast<int>(std::round(x_max - x_min));
     *out_height = static_cast<int>(std::round(y_max - y_min));
 
-    PathCoordinate mask_transl{};
-    double scale;
-    std::tie(mask_transl, scale) = translation_and_scaling(
+    std::tie(*out_transl, *out_scale) = translation_and_scaling(
         width, height, *out_x_min, *out_y_min, out_width, out_height);
 
-    std::string path = transformed_path_string(coordinates, mask_transl, scale);
-
-    // If an odd number of points, add a point at the top of the polygon; this
-    // will shift the calculated center point of the shape so that the center
-    // point of the polygon is at x,y (otherwise the center is mis-located)
-    if (points % 2 == 1) {
-        path = "M0 " + std::to_string(outer_radius) + " " + path;
-    }
-
-    return path;
+    return coordinates;
 }
 
 std::string Mask::svg_circle_path(const float cx, const float cy,
-                                  const float r) const {
+                                  const float r) {
     std::ostringstream ss;
     ss << "M " << cx - r << ", " << cy << "a" << r << "," << r << " 0 1,0 "
        << r * 2 << ",0 a " << r << "," << r << " 0 1,0 -" << r * 2 << ",0";
@@ -166,7 +246,7 @@ std::string Mask::svg_circle_path(const float cx, const float cy,
 }
 
 std::string Mask::svg_ellipse_path(const float cx, const float cy,
-                                   const float rx, const float ry) const {
+                                   const float rx, const float ry) {
     std::ostringstream ss;
     ss << "M " << cx - rx << ", " << cy << "a" << rx << "," << ry << " 0 1,0 "
        << rx * 2 << ",0a" << rx << "," << ry << " 0 1,0 -" << rx * 2 << ",0";
@@ -175,7 +255,7 @@ std::string Mask::svg_ellipse_path(const float cx, const float cy,
 
 std::vector<Mask::PathCoordinate>
 Mask::heart_path(const float cx, const float cy, int *out_x_min, int *out_y_min,
-                 int *out_width, int *out_height) const {
+                 int *out_width, int *out_height) {
     std::vector<PathCoordinate> coordinates;
 
     float x_max = std::numeric_limits<float>::min();
@@ -219,7 +299,7 @@ Mask::heart_path(const float cx, const float cy, int *out_x_min, int *out_y_min,
 std::pair<Mask::PathCoordinate, double>
 Mask::translation_and_scaling(const int image_width, const int image_height,
                               const int mask_x, const int mask_y,
-                              int *mask_width, int *mask_height) const {
+                              int *mask_width, int *mask_height) {
     // How much bigger is the image relative to the path in each dimension?
     auto ratio_x = static_cast<double>(image_width) / *mask_width;
     auto ratio_y = static_cast<double>(image_height) / *mask_height;
@@ -256,10 +336,25 @@ Mask::translation_and_scaling(const int image_width, const int image_height,
     return std::pair{mask_transl, scale};
 }
 
+Outline
+Mask::transformed_outline(const std::vector<PathCoordinate> &coordinates,
+                          const PathCoordinate &transl,
+                          const double scale) {
+    Outline outline;
+    outline.points.reserve(coordinates.size());
+
+    for (const auto &coordinate : coordinates) {
+        outline.points.push_back({coordinate.x * scale + transl.x,
+                                  coordinate.y * scale + transl.y});
+    }
+
+    return outline;
+}
+
 std::string
 Mask::transformed_path_string(const std::vector<PathCoordinate> &coordinates,
                               const PathCoordinate &transl,
-                              const double scale) const {
+                              const double scale) {
     std::ostringstream ss;
     ss << std::fixed << std::showpoint << std::setprecision(1);
 
@@ -292,71 +387,45 @@ VImage Mask::process(const VImage &image) const {
     auto page_height =
         n_pages > 1 ? query_->get<int>("page_height") : image_height;
 
-    const auto *preserve_aspect_ratio =
-        mask_type == MaskType::Ellipse ? "none" : "xMidYMid meet";
-
     int x_min, y_min, mask_width, mask_height;
-    auto path = svg_path_by_type(image_width, page_height, mask_type, &x_min,
-                                 &y_min, &mask_width, &mask_height);
+    auto outline = outline_by_type(image_width, page_height, mask_type,
+                                   &x_min, &y_min, &mask_width, &mask_height);
+
+    // The coverage of the mask, computed on demand for each tile
+    auto mask = utils::rasterize_outline(outline, image_width, page_height,
+                                         n_pages);
 
     auto mask_background = query_->get<Color>("mbg", Color::DEFAULT);
 
-    // Internal copy, we need to re-assign a few times
-    auto output_image = image;
+    // Internal copy, we need to re-assign a few times. The compositing below
+    // needs straight alpha.
+    auto output_image = unpremultiply(image, query_.get());
 
     // Cut out first if the mask background is not opaque or when the image has
     // an alpha channel
     if (!mask_background.is_opaque() || output_image.has_alpha()) {
-        std::ostringstream svg;
-        svg << R"(<svg xmlns="http://www.w3.org/2000/svg")"
-            << R"( xmlns:xlink="http://www.w3.org/1999/xlink")"
-            << " width=\"" << image_width << "\" height=\"" << image_height
-            << "\""
-            << " preserveAspectRatio=\"" << preserve_aspect_ratio << "\">\n"
-            << R"(<defs><path id="shape" d=")" << path << "\"/></defs>\n";
-        for (int i = 0; i < n_pages; ++i) {
-            svg << R"(<use xlink:href="#shape" y=")"
-                << static_cast<uint64_t>(page_height) * i << "\"/>\n";
-        }
-        svg << "</svg>";
-
-        auto svg_mask = svg.str();
-
-        // We don't take a copy of the data or free it
-        auto *blob = vips_blob_new(nullptr, svg_mask.data(), svg_mask.size());
-        auto mask = VImage::svgload_buffer(
-            blob, VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
-        vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+        auto cutout = mask.new_from_image(std::vector<double>{0, 0, 0})
+                          .bandjoin(mask)
+                          .copy(VImage::option()->set(
+                              "interpretation", VIPS_INTERPRETATION_sRGB));
 
         // Cutout via dest-in
-        output_image = output_image.composite2(mask, VIPS_BLEND_MODE_DEST_IN);
+        output_image =
+            output_image.composite2(cutout, VIPS_BLEND_MODE_DEST_IN);
     }
 
     // If the mask background is not completely transparent; overlay the frame
     if (!mask_background.is_transparent()) {
-        std::ostringstream svg;
-        svg << R"(<svg xmlns="http://www.w3.org/2000/svg")"
-            << R"( xmlns:xlink="http://www.w3.org/1999/xlink")"
-            << " width=\"" << image_width << "\" height=\"" << image_height
-            << "\""
-            << " preserveAspectRatio=\"" << preserve_aspect_ratio << "\">\n"
-            << R"(<defs><path id="shape" d=")" << path << " M0 0 h"
-            << image_width << " v" << page_height << " h-" << image_width
-            << R"( Z" fill-rule="evenodd" )"
-            << "fill=\"" << mask_background.to_string() << "\"/></defs>\n";
-        for (int i = 0; i < n_pages; ++i) {
-            svg << R"(<use xlink:href="#shape" y=")"
-                << static_cast<uint64_t>(page_height) * i << "\"/>\n";
-        }
-        svg << "</svg>";
-
-        auto svg_frame = svg.str();
-
-        // We don't take a copy of the data or free it
-        auto *blob = vips_blob_new(nullptr, svg_frame.data(), svg_frame.size());
-        auto frame = VImage::svgload_buffer(
-            blob, VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
-        vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+        std::vector<double> background_rgba = mask_background.to_rgba();
+        double alpha = background_rgba.back() / 255.0;
+        background_rgba.pop_back();
+
+        // The frame covers everything outside the mask
+        auto frame = mask.new_from_image(background_rgba)
+                         .bandjoin((255 - mask) * alpha)
+                         .cast(VIPS_FORMAT_UCHAR)
+                         .copy(VImage::option()->set(
+                             "interpretation", VIPS_INTERPRETATION_sRGB));
 
         // Ensure image to composite is premultiplied sRGB
         frame = frame.premultiply();
@@ -2,8 +2,10 @@
 
 #include "base.h"
 #include "../enums.h"
+#include "../utils/outline.h"
 
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace weserv::api::processors {
@@ -18,9 +20,43 @@ class Mask : ImageProcessor {
 
     VImage process(const VImage &image) const override;
 
- private:
+    /**
+     * Get the mask outline by type.
+     * @param width Image width.
+     * @param height Image width.
+     * @param mask Type mask.
+     * @param out_x_min Left edge of mask.
+     * @param out_y_min Top edge of mask.
+     * @param out_width Mask width.
+     * @param out_height Mask height.
+     * @return The outline of the mask.
+     */
+    static utils::Outline outline_by_type(int width, int height,
+                                          const enums::MaskType &mask,
+                                          int *out_x_min, int *out_y_min,
+                                          int *out_width, int *out_height);
+
     /**
      * Get the SVG mask path by type.
+     * @note Masks are no longer rendered through SVG, this is kept as the
+     *       reference for the outline rasterizer in the tests.
+     * @param width Image width.
+     * @param height Image width.
+     * @param mask Type mask.
+     * @param out_x_min Left edge of mask.
+     * @param out_y_min Top edge of mask.
+     * @param out_width Mask width.
+     * @param out_height Mask height.
+     * @return The mask represented as SVG path.
+     */
+    static std::string svg_path_by_type(int width, int height,
+                                        const enums::MaskType &mask,
+                                        int *out_x_min, int *out_y_min,
+                                        int *out_width, int *out_height);
+
+ private:
+    /**
+     * Get the coordinates of the polygon (or star) by type.
      * @param width Image width.
      * @param height Image width.
      * @param mask Type mask.
@@ -28,11 +64,15 @@ class Mask : ImageProcessor {
      * @param out_y_min Top edge of mask.
      * @param out_width Mask width.
      * @param out_height Mask height.
+     * @param out_scale Receives the scale factor.
+     * @param out_transl Receives the x, y-coordinate transformation.
+     * @return The untransformed coordinates.
      */
-    std::string svg_path_by_type(int width, int height,
-                                 const enums::MaskType &mask,
-                                 int *out_x_min, int *out_y_min,
-                                 int *out_width, int *out_height) const;
+    static std::vector<PathCoordinate>
+    polygon_path(int width, int height, const enums::MaskType &mask,
+                 int *out_x_min, int *out_y_min, int *out_width,
+                 int *out_height, double *out_scale,
+                 PathCoordinate *out_transl);
 
     /**
      * Formula from http://mathworld.wolfram.com/HeartCurve.html
@@ -40,9 +80,11 @@ class Mask : ImageProcessor {
      * @param cy The y coordinate of the center of the image.
      * @return The circle represented as SVG path.
      */
-    std::vector<PathCoordinate> heart_path(float cx, float cy,
-                                           int *out_x_min, int *out_y_min,
-                                           int *out_width, int *out_height) const;
+    static std::vector<PathCoordinate> heart_path(float cx, float cy,
+                                                  int *out_x_min,
+                                                  int *out_y_min,
+                                                  int *out_width,
+                                                  int *out_height);
 
     /**
      * Calculate the transformation, i.e. the translation and scaling, required
@@ -55,10 +97,21 @@ class Mask : ImageProcessor {
      * @param mask_y Top edge of mask.
      * @return Transformation coordinate and scale pair.
      */
-    std::pair<PathCoordinate, double>
+    static std::pair<PathCoordinate, double>
     translation_and_scaling(int image_width, int image_height,
                             int mask_x, int mask_y,
-                            int *mask_width, int *mask_height) const;
+                            int *mask_width, int *mask_height);
+
+    /**
+     * Get the transformed outline.
+     * @param coordinates Path coordinates.
+     * @param transl x, y-coordinate transformation.
+     * @param scale Scale factor.
+     * @return Transformed outline.
+     */
+    static utils::Outline
+    transformed_outline(const std::vector<PathCoordinate> &coordinates,
+                        const PathCoordinate &transl, double scale);
 
     /**
      * Get the transformed path "d" attribute.
@@ -67,9 +120,9 @@ class Mask : ImageProcessor {
      * @param scale Scale factor.
      * @return Transformed path as string.
      */
-    std::string
+    static std::string
     transformed_path_string(const std::vector<PathCoordinate> &coordinates,
-                            const PathCoordinate &transl, double scale) const;
+                            const PathCoordinate &transl, double scale);
 
     /**
      * Generates an circle SVG path.
@@ -79,7 +132,7 @@ class Mask : ImageProcessor {
      * @param r The radius of the circle.
      * @return The circle represented as SVG path.
      */
-    std::string svg_circle_path(float cx, float cy, float r) const;
+    static std::string svg_circle_path(float cx, float cy, float r);
 
     /**
      * Generates an ellipse SVG path.
@@ -89,7 +142,8 @@ class Mask : ImageProcessor {
      * @param ry The vertical radius.
      * @return The ellipse represented as SVG path.
      */
-    std::string svg_ellipse_path(float cx, float cy, float rx, float ry) const;
+    static std::string svg_ellipse_path(float cx, float cy, float rx,
+                                        float ry);
 };
 
 }  // namespace weserv::api::processors
@@ -30,15 +30,18 @@ VImage Modulate::process(const VImage &image) const {
         hue = 360 + hue;
     }
 
+    // Needs straight alpha
+    auto output_image = unpremultiply(image, query_.get());
+
     // Get original colorspace
-    VipsInterpretation type_before_modulate = image.interpretation();
+    VipsInterpretation type_before_modulate = output_image.interpretation();
 
     // Modulate brightness, saturation and hue
-    if (image.has_alpha()) {
+    if (output_image.has_alpha()) {
         // Separate alpha channel
-        auto image_without_alpha = image.extract_band(
-            0, VImage::option()->set("n", image.bands() - 1));
-        auto alpha = image[image.bands() - 1];
+        auto image_without_alpha = output_image.extract_band(
+            0, VImage::option()->set("n", output_image.bands() - 1));
+        auto alpha = output_image[output_image.bands() - 1];
         return image_without_alpha.colourspace(VIPS_INTERPRETATION_LCH)
             .linear({brightness, saturation, 1},
                     {0.0, 0.0, static_cast<double>(hue)})
@@ -46,7 +49,7 @@ VImage Modulate::process(const VImage &image) const {
             .bandjoin(alpha);
     }
 
-    return image.colourspace(VIPS_INTERPRETATION_LCH)
+    return output_image.colourspace(VIPS_INTERPRETATION_LCH)
         .linear({brightness, saturation, 1},
                 {0.0, 0.0, static_cast<double>(hue)})
         .colourspace(type_before_modulate);
@@ -32,6 +32,11 @@ VImage Rotation::process(const VImage &image) const {
         background_rgba.pop_back();
     }
 
+    // The image may still be premultiplied, do the same with the background
+    if (has_alpha && is_premultiplied(*query_)) {
+        background_rgba = premultiply_color(background_rgba);
+    }
+
     // Internal copy to ensure that the image has an alpha channel, if missing
     auto output_image =
         opaque || has_alpha
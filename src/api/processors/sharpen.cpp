@@ -10,6 +10,9 @@ VImage Sharpen::process(const VImage &image) const {
         return image;
     }
 
+    // Needs straight alpha
+    auto output_image = unpremultiply(image, query_.get());
+
     // Sigma of gaussian
     auto sigma = query_->get_if<float>(
         "sharp",
@@ -29,7 +32,7 @@ VImage Sharpen::process(const VImage &image) const {
                                            -1.0, -1.0, -1.0);
         // clang-format on
         sharpen.set("scale", 24.0);
-        return image.conv(sharpen);
+        return output_image.conv(sharpen);
     }
 
     // Slope for flat areas
@@ -54,9 +57,9 @@ VImage Sharpen::process(const VImage &image) const {
 
     // Slow, accurate sharpen in LAB colour space,
     // with control over flat vs jagged areas
-    return (image.get_typeof(VIPS_META_SEQUENTIAL) != 0
-                ? utils::line_cache(image, 10)
-                : image)
+    return (output_image.get_typeof(VIPS_META_SEQUENTIAL) != 0
+                ? utils::line_cache(output_image, 10)
+                : output_image)
         .sharpen(VImage::option()
                      ->set("sigma", sigma)
                      ->set("m1", flat)
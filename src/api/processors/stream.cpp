@@ -1,39 +1,67 @@
 #include "stream.h"
 
-#include "../exceptions/invalid.h"
+#include "../codecs/gif_encoder.h"
+#include "../codecs/icc_profile.h"
+#include "../codecs/jpeg_encoder.h"
+#include "../codecs/png_encoder.h"
 #include "../exceptions/large.h"
-#include "../exceptions/unreadable.h"
 #include "../exceptions/unsupported.h"
 #include "../utils/utility.h"
+#include "crop.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <functional>
+#include <map>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 namespace weserv::api::processors {
 
+using enums::Canvas;
 using enums::ImageType;
 using enums::Output;
-using vips::VError;
 
-using io::Source;
+using io::DecodeSession;
 using io::Target;
 
-template <typename Comparator>
-int Stream::resolve_page(const Source &source, const std::string &loader,
-                         Comparator comp) const {
-    auto image = new_from_source(source, loader,
-                                 VImage::option()
-                                     ->set("access", VIPS_ACCESS_SEQUENTIAL)
-                                     ->set("fail", config_.fail_on_error == 1)
-                                     ->set("page", 0));
+// Tiny images gain next to nothing from AVIF over WebP, while still paying
+// for its slow encoder.
+const uint64_t AUTO_AVIF_MIN_PIXELS = 128 * 128;
+
+// Trial encodes for `&maxbytes=` are cheap at this size, yet big enough to
+// estimate the size of the full image from.
+const int MAX_BYTES_PROXY_SIZE = 512;
+
+namespace {
+
+/**
+ * Does the image embed an ICC profile other than sRGB? The pixels of such
+ * images are converted to sRGB by the thumbnail processor.
+ * @param image The source image.
+ * @return A bool indicating if the image has a non-sRGB profile.
+ */
+bool has_non_srgb_profile(const VImage &image) {
+    if (!utils::has_profile(image)) {
+        return false;
+    }
 
-    int n_pages = image.get_typeof(VIPS_META_N_PAGES) != 0
-                      ? image.get_int(VIPS_META_N_PAGES)
-                      : 1;
+    size_t length;
+    const void *data = image.get_blob(VIPS_META_ICC_NAME, &length);
+
+    return !codecs::is_srgb_profile(static_cast<const unsigned char *>(data),
+                                    length);
+}
+
+}  // namespace
+
+template <typename Comparator>
+int Stream::resolve_page(DecodeSession &session, Comparator comp) const {
+    int n_pages = session.n_pages();
 
     // Limit the number of pages
     if (config_.max_pages > 0 && n_pages > config_.max_pages) {
@@ -43,20 +71,16 @@ int Stream::resolve_page(const Source &source, const std::string &loader,
             std::to_string(config_.max_pages));
     }
 
-    uint64_t size = static_cast<uint64_t>(image.height()) * image.width();
+    const auto &page_sizes = session.page_sizes();
+
+    uint64_t size = static_cast<uint64_t>(page_sizes[0].first) *
+                    page_sizes[0].second;
 
     int target_page = 0;
 
     for (int i = 1; i < n_pages; ++i) {
-        auto image_page =
-            new_from_source(source, loader,
-                            VImage::option()
-                                ->set("access", VIPS_ACCESS_SEQUENTIAL)
-                                ->set("fail", config_.fail_on_error == 1)
-                                ->set("page", i));
-
-        uint64_t page_size =
-            static_cast<uint64_t>(image_page.height()) * image_page.width();
+        uint64_t page_size = static_cast<uint64_t>(page_sizes[i].first) *
+                             page_sizes[i].second;
 
         if (comp(page_size, size)) {
             target_page = i;
@@ -68,8 +92,7 @@ int Stream::resolve_page(const Source &source, const std::string &loader,
 }
 
 std::pair<int, int>
-Stream::get_page_load_options(const Source &source,
-                              const std::string &loader) const {
+Stream::get_page_load_options(DecodeSession &session) const {
     auto n = query_->get_if<int>(
         "n",
         [](int p) {
@@ -97,9 +120,9 @@ Stream::get_page_load_options(const Source &source,
     }
 
     if (page == -1) {
-        page = resolve_page(source, loader, std::greater<>());
+        page = resolve_page(session, std::greater<>());
     } else {  // page == -2
-        page = resolve_page(source, loader, std::less<>());
+        page = resolve_page(session, std::less<>());
     }
 
     // Update page according to new value
@@ -108,29 +131,81 @@ Stream::get_page_load_options(const Source &source,
     return std::pair{n, page};
 }
 
-VImage Stream::new_from_source(const Source &source, const std::string &loader,
-                               vips::VOption *options) const {
-    VImage out_image;
+VImage Stream::resolve_frames(const VImage &image, int n_pages) const {
+    auto fps = query_->get_if<float>(
+        "fps",
+        [](float f) {
+            // Frame rate needs to be in the range of 0 - 1000
+            return f > 0 && f <= 1000;
+        },
+        0.0F);
+    auto max_frames = query_->get_if<int>(
+        "maxframes",
+        [n_pages](int m) {
+            // Maximum number of frames needs to be in
+            // the range of 1 - number of pages
+            return m >= 1 && m < n_pages;
+        },
+        n_pages);
 
-#ifdef WESERV_ENABLE_TRUE_STREAMING
-    try {
-        VImage::call(loader.c_str(),
-                     options->set("source", source)->set("out", &out_image));
-#else
-    // We don't take a copy of the data or free it
-    auto *blob =
-        vips_blob_new(nullptr, source.buffer().data(), source.buffer().size());
-    options = options->set("buffer", blob)->set("out", &out_image);
-    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
-
-    try {
-        VImage::call(loader.c_str(), options);
-#endif
-    } catch (const VError &err) {
-        throw exceptions::UnreadableImageException(err.what());
+    if (fps == 0.0F && max_frames == n_pages) {
+        return image;
+    }
+
+    std::vector<int> delays = image.get_typeof("delay") != 0
+                                  ? image.get_array_int("delay")
+                                  : std::vector<int>{};
+
+    std::vector<int> pages;
+    pages.reserve(n_pages);
+
+    if (fps > 0.0F) {
+        double interval = 1000.0 / fps;
+        double next = 0.0;
+        int time = 0;
+
+        // Keep the first frame of every interval
+        for (int i = 0; i < n_pages; ++i) {
+            if (time >= next) {
+                pages.push_back(i);
+                next = (std::floor(time / interval) + 1.0) * interval;
+            }
+
+            time += static_cast<size_t>(i) < delays.size() ? delays[i] : 100;
+        }
+    } else {
+        for (int i = 0; i < n_pages; ++i) {
+            pages.push_back(i);
+        }
+    }
+
+    if (static_cast<int>(pages.size()) > max_frames) {
+        // Evenly spread the remaining frames
+        std::vector<int> spread;
+        spread.reserve(max_frames);
+
+        for (int i = 0; i < max_frames; ++i) {
+            spread.push_back(pages[i * pages.size() / max_frames]);
+        }
+
+        pages = std::move(spread);
     }
 
-    return out_image;
+    if (static_cast<int>(pages.size()) == n_pages) {
+        return image;
+    }
+
+    // Attaching metadata, need to copy the image
+    auto copy = utils::select_pages(image, pages, utils::get_page_height(image))
+                    .copy();
+    copy.set("delay", utils::merge_delays(delays, pages, n_pages));
+
+    // Update the number of pages, shrink-on-load needs the kept pages to
+    // select them again after reloading
+    query_->update("n", static_cast<int>(pages.size()));
+    query_->update("kept_pages", pages);
+
+    return copy;
 }
 
 void Stream::resolve_dimensions() const {
@@ -207,19 +282,8 @@ void Stream::resolve_rotation_and_flip(const VImage &image) const {
     query_->update("flop", flop);
 }
 
-VImage Stream::new_from_source(const Source &source) const {
-#ifdef WESERV_ENABLE_TRUE_STREAMING
-    const char *loader = vips_foreign_find_load_source(source.get_source());
-#else
-    const char *loader = vips_foreign_find_load_buffer(source.buffer().data(),
-                                                       source.buffer().size());
-#endif
-
-    if (loader == nullptr) {
-        throw exceptions::InvalidImageException(vips_error_buffer());
-    }
-
-    ImageType image_type = utils::determine_image_type(loader);
+VImage Stream::new_from_source(DecodeSession &session) const {
+    ImageType image_type = session.image_type();
 
     // Save the image type so that we can work out
     // what options to pass to write_to_target()
@@ -231,25 +295,28 @@ VImage Stream::new_from_source(const Source &source) const {
                              ? VIPS_ACCESS_RANDOM
                              : VIPS_ACCESS_SEQUENTIAL;
 
-    vips::VOption *options;
     int n = 1;
     int page = 0;
     if (utils::support_multi_pages(image_type)) {
-        std::tie(n, page) = get_page_load_options(source, loader);
+        std::tie(n, page) = get_page_load_options(session);
+    }
 
-        options = VImage::option()
-                      ->set("access", access_method)
-                      ->set("fail", config_.fail_on_error == 1)
-                      ->set("n", n)
-                      ->set("page", page);
+    VImage image;
+    if (n == 1 && access_method == VIPS_ACCESS_SEQUENTIAL) {
+        // Share the header that may have been opened while resolving the page
+        image = session.page(page);
+    } else if (utils::support_multi_pages(image_type)) {
+        image = session.load(VImage::option()
+                                 ->set("access", access_method)
+                                 ->set("fail", config_.fail_on_error == 1)
+                                 ->set("n", n)
+                                 ->set("page", page));
     } else {
-        options = VImage::option()
-                      ->set("access", access_method)
-                      ->set("fail", config_.fail_on_error == 1);
+        image = session.load(VImage::option()
+                                 ->set("access", access_method)
+                                 ->set("fail", config_.fail_on_error == 1));
     }
 
-    auto image = new_from_source(source, loader, options);
-
     // Limit input images to a given number of pixels, where
     // pixels = width * height
     if (config_.limit_input_pixels > 0 &&
@@ -280,6 +347,11 @@ VImage Stream::new_from_source(const Source &source) const {
     // Always store the number of pages to load
     query_->update("n", n);
 
+    // Drop frames before any of the heavy lifting
+    if (n > 1) {
+        image = resolve_frames(image, n);
+    }
+
     // Resolve target dimensions
     resolve_dimensions();
 
@@ -295,19 +367,250 @@ VImage Stream::new_from_source(const Source &source) const {
     return image;
 }
 
-template <>
-void Stream::append_save_options<Output::Jpeg>(vips::VOption *options) const {
-    auto quality = query_->get_if<int>(
+Output Stream::requested_output() const {
+    return query_->get<Output>("output", config_.auto_format != 0
+                                             ? Output::Auto
+                                             : Output::Origin);
+}
+
+Output Stream::negotiate_output(const VImage &image,
+                                const Target &target) const {
+    // The response depends on the outputs the target accepts, whatever the
+    // outcome
+    target.set_negotiated();
+
+    auto accepted = target.accepted_outputs() & config_.savers;
+
+    bool animated = query_->get<int>("n") > 1;
+    uint64_t pixels =
+        static_cast<uint64_t>(image.width()) * utils::get_page_height(image);
+
+    // AVIF compresses best, but libvips saves the pages of animated images as
+    // separate images
+    if ((accepted & static_cast<uintptr_t>(Output::Avif)) != 0 && !animated &&
+        pixels >= AUTO_AVIF_MIN_PIXELS) {
+        return Output::Avif;
+    }
+
+    if ((accepted & static_cast<uintptr_t>(Output::Webp)) != 0) {
+        return Output::Webp;
+    }
+
+    // Don't send WebP or AVIF images to clients that don't accept them
+    auto origin =
+        utils::to_output(query_->get<ImageType>("type", ImageType::Unknown));
+    if ((origin == Output::Webp || origin == Output::Avif) &&
+        (accepted & static_cast<uintptr_t>(origin)) == 0) {
+        auto fallback = animated            ? Output::Gif
+                        : image.has_alpha() ? Output::Png
+                                            : Output::Jpeg;
+        if ((config_.savers & static_cast<uintptr_t>(fallback)) != 0) {
+            return fallback;
+        }
+    }
+
+    return Output::Origin;
+}
+
+bool Stream::is_identity(const VImage &image) const {
+    // Any other parameter alters the image (or how it's encoded), the rest
+    // are resolved by new_from_source()
+    if (!query_->contains_only({"w", "h", "dpr", "fit", "we", "fsol", "output",
+                                "type", "n", "page", "angle", "flip", "flop",
+                                "input_width", "input_height"})) {
+        return false;
+    }
+
+    auto image_type = query_->get<ImageType>("type", ImageType::Unknown);
+    if (image_type != ImageType::Jpeg && image_type != ImageType::Png &&
+        image_type != ImageType::Webp) {
+        return false;
+    }
+
+    // A negotiated output is resolved by write_original()
+    auto output = requested_output();
+    if (output != Output::Origin && output != Output::Auto &&
+        output != utils::to_output(image_type)) {
+        return false;
+    }
+
+    // Only single-page images, which don't need to be rotated or flipped
+    int n_pages = image.get_typeof(VIPS_META_N_PAGES) != 0
+                      ? image.get_int(VIPS_META_N_PAGES)
+                      : 1;
+    if (n_pages > 1 || query_->get<int>("page", 0) != 0 ||
+        query_->get<int>("angle") != 0 || query_->get<bool>("flip") ||
+        query_->get<bool>("flop")) {
+        return false;
+    }
+
+    // CMYK images and images with a non-sRGB profile are always converted
+    // to sRGB
+    if (image.interpretation() == VIPS_INTERPRETATION_CMYK ||
+        has_non_srgb_profile(image)) {
+        return false;
+    }
+
+    auto width = query_->get<int>("w");
+    auto height = query_->get<int>("h");
+    if (width == 0 && height == 0) {
+        return true;
+    }
+
+    // Without enlargement, a larger target leaves the image untouched
+    // (except when the image needs to be embedded)
+    return query_->get<bool>("we", false) &&
+           query_->get<Canvas>("fit", Canvas::Max) != Canvas::Embed &&
+           (width == 0 || width >= image.width()) &&
+           (height == 0 || height >= image.height());
+}
+
+bool Stream::resolve_lossless_transform(
+    const VImage &image, codecs::JpegTransform *transform) const {
+    // Besides the parameters of is_identity(), only a rotation and a crop
+    // are allowed
+    if (!query_->contains_only({"w", "h", "dpr", "fit", "we", "fsol",
+                                "output", "type", "n", "page", "angle",
+                                "flip", "flop", "input_width", "input_height",
+                                "ro", "cx", "cy", "cw", "ch", "precrop"})) {
+        return false;
+    }
+
+    if (query_->get<ImageType>("type", ImageType::Unknown) !=
+        ImageType::Jpeg) {
+        return false;
+    }
+
+    auto output = requested_output();
+    if (output != Output::Origin && output != Output::Auto &&
+        output != Output::Jpeg) {
+        return false;
+    }
+
+    // Any resize requires the image to be decoded
+    if (query_->get<int>("w") != 0 || query_->get<int>("h") != 0) {
+        return false;
+    }
+
+    // As does a rotation that isn't a multiple of 90 degrees
+    if (query_->get_if<int>(
+            "ro", [](int r) { return r % 90 != 0; }, 0) != 0) {
+        return false;
+    }
+
+    int n_pages = image.get_typeof(VIPS_META_N_PAGES) != 0
+                      ? image.get_int(VIPS_META_N_PAGES)
+                      : 1;
+    if (n_pages > 1 || query_->get<int>("page", 0) != 0) {
+        return false;
+    }
+
+    // CMYK images and images with a non-sRGB profile are always converted
+    // to sRGB
+    if (image.interpretation() == VIPS_INTERPRETATION_CMYK ||
+        has_non_srgb_profile(image)) {
+        return false;
+    }
+
+    transform->angle = query_->get<int>("angle");
+    transform->flip = query_->get<bool>("flip");
+    transform->flop = query_->get<bool>("flop");
+
+    if (query_->exists("cx") || query_->exists("cy") ||
+        query_->exists("cw") || query_->exists("ch")) {
+        // The crop rectangle is specified after the orientation
+        bool swap = transform->angle == 90 || transform->angle == 270;
+        int image_width = swap ? image.height() : image.width();
+        int image_height = swap ? image.width() : image.height();
+
+        int left, top, width, height;
+        std::tie(left, top, width, height) =
+            Crop(query_).resolve_crop(image_width, image_height);
+
+        if (width != image_width || height != image_height) {
+            transform->left = left;
+            transform->top = top;
+            transform->width = width;
+            transform->height = height;
+        }
+    }
+
+    // Nothing to transform, that's up to is_identity()
+    return transform->angle != 0 || transform->flip || transform->flop ||
+           transform->width != 0;
+}
+
+bool Stream::write_original(const VImage &image,
+                            const DecodeSession &session,
+                            const Target &target) const {
+    // The original image can only be written if the negotiated output is
+    // the original format
+    if (requested_output() == Output::Auto &&
+        negotiate_output(image, target) != Output::Origin) {
+        return false;
+    }
+
+    codecs::JpegTransform transform;
+
+    bool identity = is_identity(image);
+    if (!identity && !resolve_lossless_transform(image, &transform)) {
+        return false;
+    }
+
+    auto output = utils::to_output(session.image_type());
+
+    // Let write_to_target() report a disabled saver
+    if ((config_.savers & static_cast<uintptr_t>(output)) == 0) {
+        return false;
+    }
+
+    // The limit on output pixels applies as well
+    uint64_t output_pixels =
+        transform.width != 0
+            ? static_cast<uint64_t>(transform.width) * transform.height
+            : static_cast<uint64_t>(image.width()) * image.height();
+    if (config_.limit_output_pixels > 0 &&
+        output_pixels > config_.limit_output_pixels) {
+        return false;
+    }
+
+    std::string out;
+    if (identity ? !session.copy_without_metadata(&out)
+                 : !session.transform_jpeg(transform, &out)) {
+        return false;
+    }
+
+    target.setup(utils::determine_image_extension(output));
+    target.write(out.data(), out.size());
+    target.end();
+
+    return true;
+}
+
+int Stream::resolve_quality(int quality, intptr_t default_quality) const {
+    if (quality > 0) {
+        return quality;
+    }
+
+    return query_->get_if<int>(
         "q",
         [](int q) {
             // Quality needs to be in the range
             // of 1 - 100
             return q >= 1 && q <= 100;
         },
-        static_cast<int>(config_.jpeg_quality));
+        static_cast<int>(default_quality));
+}
 
+bool Stream::is_palette_png() const {
+    return query_->get<bool>("palette", false) || query_->exists("colors");
+}
+
+template <>
+void Stream::append_save_options<Output::Jpeg>(vips::VOption *options,
+                                             int quality) const {
     // Set quality (default is 80)
-    options->set("Q", quality);
+    options->set("Q", resolve_quality(quality, config_.jpeg_quality));
 
     // Use progressive (interlace) scan, if necessary
     options->set("interlace", query_->get<bool>("il", false));
@@ -317,7 +620,8 @@ void Stream::append_save_options<Output::Jpeg>(vips::VOption *options) const {
 }
 
 template <>
-void Stream::append_save_options<Output::Png>(vips::VOption *options) const {
+void Stream::append_save_options<Output::Png>(vips::VOption *options,
+                                             int quality) const {
     auto level = query_->get_if<int>(
         "l",
         [](int l) {
@@ -338,21 +642,53 @@ void Stream::append_save_options<Output::Png>(vips::VOption *options) const {
 
     // Use adaptive row filtering (default is none)
     options->set("filter", filter);
-}
 
-template <>
-void Stream::append_save_options<Output::Webp>(vips::VOption *options) const {
-    auto quality = query_->get_if<int>(
-        "q",
-        [](int q) {
-            // Quality needs to be in the range
-            // of 1 - 100
-            return q >= 1 && q <= 100;
+    if (!is_palette_png()) {
+        return;
+    }
+
+    // Quantize to an 8-bit palette with libimagequant
+    options->set("palette", true);
+
+    auto colors = query_->get_if<int>(
+        "colors",
+        [](int c) {
+            // Colors needs to be in the range of 2 - 256
+            return c >= 2 && c <= 256;
         },
-        static_cast<int>(config_.webp_quality));
+        256);
+
+    // Note: libvips 8.12 derives the bit depth from the number of colors
+    // and quantizes to the maximum of that bit depth, i.e. the palette holds
+    // at most 2^ceil(log2(colors)) colors (e.g. 32 for `&colors=20`)
+    options->set("colours", colors);
+
+#if VIPS_VERSION_AT_LEAST(8, 12, 0)
+    // Control the CPU effort spent on quantizing (default 7)
+    options->set("effort", static_cast<int>(config_.png_effort));
+#endif
 
+    // Set the amount of Floyd-Steinberg dithering (default is 1.0)
+    options->set("dither", static_cast<double>(query_->get_if<float>(
+                               "dither",
+                               [](float d) {
+                                   // Dither needs to be in the range of
+                                   // 0 (none) - 1 (full)
+                                   return d >= 0.0F && d <= 1.0F;
+                               },
+                               1.0F)));
+
+    // The quantisation quality (default is 100)
+    if (quality > 0 || query_->exists("q")) {
+        options->set("Q", resolve_quality(quality, 100));
+    }
+}
+
+template <>
+void Stream::append_save_options<Output::Webp>(vips::VOption *options,
+                                             int quality) const {
     // Set quality (default is 80)
-    options->set("Q", quality);
+    options->set("Q", resolve_quality(quality, config_.webp_quality));
 
 #if VIPS_VERSION_AT_LEAST(8, 12, 0)
     // Control the CPU effort spent on improving compression (default 4)
@@ -364,18 +700,10 @@ void Stream::append_save_options<Output::Webp>(vips::VOption *options) const {
 }
 
 template <>
-void Stream::append_save_options<Output::Avif>(vips::VOption *options) const {
-    auto quality = query_->get_if<int>(
-        "q",
-        [](int q) {
-            // Quality needs to be in the range
-            // of 1 - 100
-            return q >= 1 && q <= 100;
-        },
-        static_cast<int>(config_.avif_quality));
-
+void Stream::append_save_options<Output::Avif>(vips::VOption *options,
+                                             int quality) const {
     // Set quality (default is 80)
-    options->set("Q", quality);
+    options->set("Q", resolve_quality(quality, config_.avif_quality));
 
     // Set compression format to AV1
     options->set("compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1);
@@ -390,25 +718,18 @@ void Stream::append_save_options<Output::Avif>(vips::VOption *options) const {
 }
 
 template <>
-void Stream::append_save_options<Output::Tiff>(vips::VOption *options) const {
-    auto quality = query_->get_if<int>(
-        "q",
-        [](int q) {
-            // Quality needs to be in the range
-            // of 1 - 100
-            return q >= 1 && q <= 100;
-        },
-        static_cast<int>(config_.tiff_quality));
-
+void Stream::append_save_options<Output::Tiff>(vips::VOption *options,
+                                             int quality) const {
     // Set quality (default is 80)
-    options->set("Q", quality);
+    options->set("Q", resolve_quality(quality, config_.tiff_quality));
 
     // Set the tiff compression to jpeg
     options->set("compression", "jpeg");
 }
 
 template <>
-void Stream::append_save_options<Output::Gif>(vips::VOption *options) const {
+void Stream::append_save_options<Output::Gif>(vips::VOption *options,
+                                             int /*quality*/) const {
 // libvips 8.12 features a gifsave operation that uses cgif and libimagequant
 #if VIPS_VERSION_AT_LEAST(8, 12, 0)
     // Control the CPU effort spent on improving compression (default 7)
@@ -420,33 +741,346 @@ void Stream::append_save_options<Output::Gif>(vips::VOption *options) const {
 }
 
 void Stream::append_save_options(const Output &output,
-                                 vips::VOption *options) const {
+                                 vips::VOption *options, int quality) const {
     switch (output) {
         case Output::Jpeg:
-            append_save_options<Output::Jpeg>(options);
+            append_save_options<Output::Jpeg>(options, quality);
             break;
         case Output::Webp:
-            append_save_options<Output::Webp>(options);
+            append_save_options<Output::Webp>(options, quality);
             break;
         case Output::Avif:
-            append_save_options<Output::Avif>(options);
+            append_save_options<Output::Avif>(options, quality);
             break;
         case Output::Tiff:
-            append_save_options<Output::Tiff>(options);
+            append_save_options<Output::Tiff>(options, quality);
             break;
         case Output::Gif:
-            append_save_options<Output::Gif>(options);
+            append_save_options<Output::Gif>(options, quality);
             break;
         case Output::Png:
         default:
-            append_save_options<Output::Png>(options);
+            append_save_options<Output::Png>(options, quality);
             break;
     }
 }
 
+std::string Stream::encode_with_quality(const VImage &image,
+                                       const Output &output,
+                                       int quality) const {
+    // Strip all metadata (EXIF, XMP, IPTC).
+    // (all savers supports this option)
+    vips::VOption *save_options = VImage::option()->set("strip", true);
+
+    append_save_options(output, save_options, quality);
+
+    void *buf;
+    size_t size;
+
+    image.write_to_buffer(utils::determine_image_extension(output).c_str(),
+                          &buf, &size, save_options);
+
+    std::string out(static_cast<const char *>(buf), size);
+
+    g_free(buf);
+
+    return out;
+}
+
+bool Stream::write_max_bytes(const VImage &image, const Output &output,
+                             const Target &target) const {
+    auto max_bytes = query_->get_if<int>(
+        "maxbytes",
+        [](int b) {
+            // Max bytes needs to be positive
+            return b > 0;
+        },
+        0);
+
+    // Animated images are left as-is, the frames would need a proxy each
+    if (max_bytes == 0 || query_->get<int>("n") > 1) {
+        return false;
+    }
+
+    // Never exceed the quality that would be used otherwise
+    auto default_quality = output == Output::Webp   ? config_.webp_quality
+                           : output == Output::Avif ? config_.avif_quality
+                                                    : config_.jpeg_quality;
+    auto max_quality = resolve_quality(0, default_quality);
+
+    // Copy to memory evaluates the image, so set up the timeout handler,
+    // if necessary. Every encode below reuses these pixels.
+    utils::setup_timeout_handler(image, config_.process_timeout);
+    VImage memory = image.copy_memory();
+
+    // The trial encodes are done on a small proxy, whose size is scaled up
+    // by the number of pixels to estimate the size of the full image
+    int longest_side = std::max(memory.width(), memory.height());
+    bool has_proxy = longest_side > MAX_BYTES_PROXY_SIZE;
+    VImage proxy = has_proxy
+                       ? memory
+                             .resize(static_cast<double>(MAX_BYTES_PROXY_SIZE) /
+                                     static_cast<double>(longest_side))
+                             .copy_memory()
+                       : memory;
+    double ratio = static_cast<double>(memory.width()) * memory.height() /
+                   (static_cast<double>(proxy.width()) * proxy.height());
+
+    // The trial encodes by quality
+    std::map<int, std::string> trials;
+    auto estimate = [&](int quality) {
+        auto it = trials.find(quality);
+        if (it == trials.end()) {
+            it = trials
+                     .emplace(quality,
+                              encode_with_quality(proxy, output, quality))
+                     .first;
+        }
+        return static_cast<double>(it->second.size()) * ratio;
+    };
+
+    // Binary search for the highest quality whose estimated size fits, or
+    // `low - 1` if none does. `correction` adjusts the estimates for the
+    // actual size of the full image.
+    auto search = [&](int low, int high, double correction) {
+        int best = low - 1;
+        while (low <= high) {
+            int mid = low + (high - low) / 2;
+            if (estimate(mid) * correction <= max_bytes) {
+                best = mid;
+                low = mid + 1;
+            } else {
+                high = mid - 1;
+            }
+        }
+        return best;
+    };
+
+    int quality = std::max(1, search(1, max_quality, 1.0));
+
+    // Without a proxy, the trial encode is the image itself
+    std::string out = has_proxy ? encode_with_quality(memory, output, quality)
+                                : trials[quality];
+
+    // Correct the estimates by the actual size and encode the full image
+    // once more, with a lower quality if it doesn't fit or with a higher
+    // quality if that would fit (the proxy has more detail per pixel, so
+    // the estimates tend to be too large)
+    if (has_proxy) {
+        double correction =
+            static_cast<double>(out.size()) / estimate(quality);
+
+        if (out.size() > static_cast<size_t>(max_bytes)) {
+            if (quality > 1) {
+                quality = std::max(1, search(1, quality - 1, correction));
+                out = encode_with_quality(memory, output, quality);
+            }
+        } else {
+            int higher = search(quality + 1, max_quality, correction);
+            if (higher > quality) {
+                std::string candidate =
+                    encode_with_quality(memory, output, higher);
+                if (candidate.size() <= static_cast<size_t>(max_bytes)) {
+                    quality = higher;
+                    out = std::move(candidate);
+                }
+            }
+        }
+    }
+
+    // The image may not fit even at the lowest quality, report that rather
+    // than failing the request
+    bool fits = out.size() <= static_cast<size_t>(max_bytes);
+
+    target.setup(utils::determine_image_extension(output));
+    target.set_quality(quality, fits);
+    target.write(out.data(), out.size());
+    target.end();
+
+    return true;
+}
+
+bool Stream::write_parallel_gif(const VImage &image,
+                                const Target &target) const {
+    if (config_.gif_threads <= 1) {
+        return false;
+    }
+
+    // Only animated sRGB images, still images are left to cgif
+    int page_height = utils::get_page_height(image);
+    int bands = image.bands();
+    if (image.format() != VIPS_FORMAT_UCHAR ||
+        image.interpretation() != VIPS_INTERPRETATION_sRGB ||
+        (bands != 3 && bands != 4) || page_height <= 0 ||
+        image.height() % page_height != 0 ||
+        image.height() / page_height <= 1) {
+        return false;
+    }
+
+    // Copy to memory evaluates the image, so set up the timeout handler,
+    // if necessary.
+    utils::setup_timeout_handler(image, config_.process_timeout);
+    VImage memory = image.copy_memory();
+
+    codecs::GifAnimation animation;
+    animation.pixels = static_cast<const unsigned char *>(memory.data());
+    animation.width = memory.width();
+    animation.page_height = page_height;
+    animation.n_pages = memory.height() / page_height;
+    animation.bands = bands;
+    if (memory.get_typeof("delay") != 0) {
+        animation.delays = memory.get_array_int("delay");
+    }
+    if (memory.get_typeof("loop") != 0) {
+        animation.loop = memory.get_int("loop");
+    }
+
+    // The quantisation quality (default is 100)
+    auto quality = resolve_quality(0, 100);
+
+    // Set the amount of Floyd-Steinberg dithering (default is 1.0)
+    auto dither = query_->get_if<float>(
+        "dither",
+        [](float d) {
+            // Dither needs to be in the range of
+            // 0 (none) - 1 (full)
+            return d >= 0.0F && d <= 1.0F;
+        },
+        1.0F);
+
+    std::string out;
+    if (!codecs::encode_gif(animation, quality,
+                            static_cast<int>(config_.gif_effort), dither,
+                            config_.gif_global_palette != 0,
+                            static_cast<int>(config_.gif_threads), &out)) {
+        return false;
+    }
+
+    target.setup(utils::determine_image_extension(Output::Gif));
+    target.write(out.data(), out.size());
+    target.end();
+
+    return true;
+}
+
+bool Stream::write_parallel_jpeg(const VImage &image,
+                                 const Target &target) const {
+    // Progressive images are left to libjpeg
+    if (config_.jpeg_threads <= 1 || query_->get<bool>("il", false)) {
+        return false;
+    }
+
+    // Only images that libjpeg would save as-is
+    auto interpretation = image.interpretation();
+    int bands = image.bands();
+    if (image.format() != VIPS_FORMAT_UCHAR ||
+        !((interpretation == VIPS_INTERPRETATION_sRGB && bands == 3) ||
+          (interpretation == VIPS_INTERPRETATION_B_W && bands == 1))) {
+        return false;
+    }
+
+    // Not worth the threads for images that fit in a couple of stripes
+    if (static_cast<uint64_t>(image.width()) * image.height() * bands <
+        2 * codecs::JPEG_STRIPE_SIZE) {
+        return false;
+    }
+
+    auto quality = resolve_quality(0, config_.jpeg_quality);
+
+    // Copy to memory evaluates the image, so set up the timeout handler,
+    // if necessary.
+    utils::setup_timeout_handler(image, config_.process_timeout);
+    VImage memory = image.copy_memory();
+
+    // The JFIF density is written in pixels per centimetre when the image
+    // says so, as with libvips
+    bool resolution_in_cm =
+        memory.get_typeof(VIPS_META_RESOLUTION_UNIT) != 0 &&
+        std::strncmp(memory.get_string(VIPS_META_RESOLUTION_UNIT), "cm", 2) ==
+            0;
+
+    // Enable libjpeg's Huffman table optimiser, as with libvips
+    std::string out;
+    if (!codecs::encode_jpeg(static_cast<const unsigned char *>(memory.data()),
+                             memory.width(), memory.height(), bands, quality,
+                             true, memory.xres(), memory.yres(),
+                             resolution_in_cm,
+                             static_cast<int>(config_.jpeg_threads), &out)) {
+        return false;
+    }
+
+    target.setup(utils::determine_image_extension(Output::Jpeg));
+    target.write(out.data(), out.size());
+    target.end();
+
+    return true;
+}
+
+bool Stream::write_parallel_png(const VImage &image,
+                                const Target &target) const {
+    // Interlaced and palette-based images are left to libpng
+    if (config_.png_threads <= 1 || query_->get<bool>("il", false) ||
+        is_palette_png()) {
+        return false;
+    }
+
+    // Only images that libpng would save as-is
+    auto interpretation = image.interpretation();
+    int bands = image.bands();
+    bool is_16_bit = interpretation == VIPS_INTERPRETATION_RGB16 ||
+                     interpretation == VIPS_INTERPRETATION_GREY16;
+    bool is_grey = interpretation == VIPS_INTERPRETATION_B_W ||
+                   interpretation == VIPS_INTERPRETATION_GREY16;
+    if ((!is_16_bit && interpretation != VIPS_INTERPRETATION_sRGB &&
+         interpretation != VIPS_INTERPRETATION_B_W) ||
+        image.format() !=
+            (is_16_bit ? VIPS_FORMAT_USHORT : VIPS_FORMAT_UCHAR) ||
+        (is_grey ? bands > 2 : bands < 3 || bands > 4)) {
+        return false;
+    }
+
+    // Not worth the threads for images that fit in a couple of blocks
+    int bit_depth = is_16_bit ? 16 : 8;
+    if (static_cast<uint64_t>(image.width()) * image.height() * bands *
+            (bit_depth / 8) <
+        2 * codecs::PNG_BLOCK_SIZE) {
+        return false;
+    }
+
+    auto level = query_->get_if<int>(
+        "l",
+        [](int l) {
+            // Level needs to be in the range of
+            // 0 (no Deflate) - 9 (maximum Deflate)
+            return l >= 0 && l <= 9;
+        },
+        static_cast<int>(config_.zlib_level));
+
+    // Copy to memory evaluates the image, so set up the timeout handler,
+    // if necessary.
+    utils::setup_timeout_handler(image, config_.process_timeout);
+    VImage memory = image.copy_memory();
+
+    std::string out;
+    if (!codecs::encode_png(static_cast<const unsigned char *>(memory.data()),
+                            memory.width(), memory.height(), bands,
+                            bit_depth, level, query_->get<bool>("af", false),
+                            memory.xres(), memory.yres(),
+                            static_cast<int>(config_.png_threads), &out)) {
+        return false;
+    }
+
+    target.setup(utils::determine_image_extension(Output::Png));
+    target.write(out.data(), out.size());
+    target.end();
+
+    return true;
+}
+
 void Stream::write_to_target(const VImage &image, const Target &target) const {
-    // Attaching metadata, need to copy the image
-    auto copy = image.copy();
+    // Unpremultiply the image once, if this hasn't been done already.
+    // Attaching metadata, need to copy the image.
+    auto copy = unpremultiply(image, query_.get()).copy();
 
     // Only update page height if we have more than one page, or this could
     // accidentally turn into an animated image later.
@@ -482,9 +1116,13 @@ void Stream::write_to_target(const VImage &image, const Target &target) const {
         copy.set("delay", delays);
     }
 
-    auto output = query_->get<Output>("output", Output::Origin);
+    auto output = requested_output();
     auto image_type = query_->get<ImageType>("type", ImageType::Unknown);
 
+    if (output == Output::Auto) {
+        output = negotiate_output(copy, target);
+    }
+
     if (output == Output::Origin) {
         // We force the output to PNG if the image has alpha and doesn't have
         // the right extension to output alpha (useful for masking and
@@ -503,40 +1141,77 @@ void Stream::write_to_target(const VImage &image, const Target &target) const {
             utils::supported_savers_string(config_.savers));
     }
 
+    // Merge consecutive identical frames, the encoding time of animated
+    // images scales with the number of frames
+    if (config_.merge_frames != 0 && query_->get<int>("n") > 1 &&
+        (output == Output::Gif || output == Output::Webp)) {
+        // Copy to memory evaluates the image, so set up the timeout handler,
+        // if necessary.
+        utils::setup_timeout_handler(copy, config_.process_timeout);
+
+        copy = utils::merge_duplicate_pages(copy,
+                                            query_->get<int>("page_height"));
+    }
+
     if (output == Output::Json) {
         std::string out = utils::image_to_json(copy, image_type);
 
         target.setup(extension);
         target.write(out.c_str(), out.size());
         target.end();
-    } else {
-        // Strip all metadata (EXIF, XMP, IPTC).
-        // (all savers supports this option)
-        vips::VOption *save_options = VImage::option()->set("strip", true);
 
-        append_save_options(output, save_options);
+        return;
+    }
 
-        target.setup(extension);
+    bool written = false;
 
-        // Set up the timeout handler, if necessary
-        utils::setup_timeout_handler(copy, config_.process_timeout);
+    // Search for the highest quality that fits within `&maxbytes=`, if given
+    if (output == Output::Jpeg || output == Output::Webp ||
+        output == Output::Avif) {
+        written = write_max_bytes(copy, output, target);
+    }
+
+    // Otherwise, try to encode the image on multiple threads
+    if (!written) {
+        if (output == Output::Jpeg) {
+            written = write_parallel_jpeg(copy, target);
+        } else if (output == Output::Png) {
+            written = write_parallel_png(copy, target);
+        } else if (output == Output::Gif) {
+            written = write_parallel_gif(copy, target);
+        }
+    }
+
+    if (written) {
+        return;
+    }
+
+    // Fall back to libvips' own saver, stripping all metadata (EXIF, XMP,
+    // IPTC). (all savers supports this option)
+    vips::VOption *save_options = VImage::option()->set("strip", true);
+
+    append_save_options(output, save_options);
+
+    target.setup(extension);
+
+    // Set up the timeout handler, if necessary
+    utils::setup_timeout_handler(copy, config_.process_timeout);
 
 #ifdef WESERV_ENABLE_TRUE_STREAMING
-        // Write the image to the target
-        copy.write_to_target(extension.c_str(), target, save_options);
+    // Write the image to the target
+    copy.write_to_target(extension.c_str(), target, save_options);
 #else
-        void *buf;
-        size_t size;
+    void *buf;
+    size_t size;
 
-        // Write the image to a formatted string
-        copy.write_to_buffer(extension.c_str(), &buf, &size, save_options);
+    // Write the image to a formatted string
+    copy.write_to_buffer(extension.c_str(), &buf, &size, save_options);
 
-        target.write(buf, size);
-        target.end();
+    target.write(buf, size);
+    target.end();
 
-        g_free(buf);
+    g_free(buf);
 #endif
-    }
 }
 
 }  // namespace weserv::api::processors
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "../io/source.h"
+#include "../io/decode_session.h"
 #include "../io/target.h"
 #include "base.h"
 
@@ -16,10 +16,23 @@ class Stream {
     Stream(std::shared_ptr<parsers::Query> query, const Config &config)
         : query_(std::move(query)), config_(config) {}
 
-    VImage new_from_source(const io::Source &source) const;
+    VImage new_from_source(io::DecodeSession &session) const;
 
     void write_to_target(const VImage &image, const io::Target &target) const;
 
+    /**
+     * Write the original image to a target, without decoding and re-encoding
+     * it. This is only done if the query leaves the image untouched, or if it
+     * only rotates, flips or crops a JPEG image in a way that can be done
+     * losslessly. Any metadata is dropped from the original bytes.
+     * @param image The source image, as returned by `new_from_source()`.
+     * @param session The decode session.
+     * @param target The target to write to.
+     * @return A bool indicating if the original image was written.
+     */
+    bool write_original(const VImage &image, const io::DecodeSession &session,
+                        const io::Target &target) const;
+
  private:
     /**
      * Query holder.
@@ -36,38 +49,30 @@ class Stream {
      * Pages are compared using the given comparison function.
      * See: https://github.com/weserv/images/issues/170.
      * @tparam T Comparison type.
-     * @param source Source to read from.
-     * @param loader Image loader.
+     * @param session The decode session.
      * @param comp Comparison function object.
      * @return The largest/smallest page in the range [0, VIPS_META_N_PAGES].
      */
     template <typename Comparator>
-    int resolve_page(const io::Source &source, const std::string &loader,
-                     Comparator comp) const;
+    int resolve_page(io::DecodeSession &session, Comparator comp) const;
 
     /**
      * Get the page options for a specified loader to pass on
      * to the load operation.
-     * @param source Source to read from.
-     * @param loader Image loader.
+     * @param session The decode session.
      * @return Any options to pass on to the load operation
      */
-    std::pair<int, int> get_page_load_options(const io::Source &souce,
-                                              const std::string &loader) const;
+    std::pair<int, int> get_page_load_options(io::DecodeSession &session) const;
 
     /**
-     * Load a formatted image from a source.
-     * @note This behaves exactly as `VImage::new_from_source`, but the loader
-     *       can be specified instead of being found automatically.
-     *       It will throw a `UnreadableImageException` if an error occurs
-     *       during loading.
-     * @param source Source to read from.
-     * @param loader Image loader.
-     * @param options Any options to pass on to the load operation.
-     * @return A new `VImage`.
+     * Drop frames of an animated image according to the maximum frame rate
+     * and number of frames, the delays of dropped frames are added to the
+     * preceding kept frame.
+     * @param image The source image.
+     * @param n_pages Number of pages.
+     * @return An image with the kept frames.
      */
-    VImage new_from_source(const io::Source &source, const std::string &loader,
-                           vips::VOption *options) const;
+    VImage resolve_frames(const VImage &image, int n_pages) const;
 
     /**
      * Resolve dimensions (width, height).
@@ -81,23 +86,136 @@ class Stream {
      */
     void resolve_rotation_and_flip(const VImage &image) const;
 
+    /**
+     * Does the query leave the image untouched? That is, no resize (or one
+     * that would enlarge with `&we`), no crop, no rotation, no effects, no
+     * change of format and no encoder options.
+     * @param image The source image.
+     * @return A bool indicating if the output would be equal to the source.
+     */
+    bool is_identity(const VImage &image) const;
+
+    /**
+     * Does the query only rotate, flip and/or crop a JPEG image? These can be
+     * done in the DCT domain, as long as the transform is perfect (see
+     * `codecs::transform_jpeg()`).
+     * @param image The source image.
+     * @param transform Receives the transform to perform.
+     * @return A bool indicating if the transform could be done losslessly.
+     */
+    bool resolve_lossless_transform(const VImage &image,
+                                    codecs::JpegTransform *transform) const;
+
+    /**
+     * @return The output requested with `&output=`, which defaults to
+     *         `Output::Auto` if `auto_format` is enabled.
+     */
+    enums::Output requested_output() const;
+
+    /**
+     * Negotiate the output format from the outputs accepted by the target,
+     * the enabled savers and the image itself. AVIF is preferred over WebP,
+     * except for animated and tiny images.
+     * @param image The image to negotiate the output for.
+     * @param target The target to negotiate with.
+     * @return The negotiated output, `Output::Origin` if the original format
+     *         should be kept.
+     */
+    enums::Output negotiate_output(const VImage &image,
+                                   const io::Target &target) const;
+
+    /**
+     * Check if a PNG image should be quantized to a palette (`&palette=true`
+     * or `&colors=`).
+     * @return A bool indicating if the image should be palette-based.
+     */
+    bool is_palette_png() const;
+
+    /**
+     * Resolve the quality to encode with.
+     * @param quality An explicit quality, or 0 to use `&q=`.
+     * @param default_quality The quality to use if `&q=` isn't given (or
+     *                        invalid).
+     * @return The quality, in the range of 1 - 100.
+     */
+    int resolve_quality(int quality, intptr_t default_quality) const;
+
     /**
      * Append the save options for a specified image output.
      * These options will be passed on to the selected save operation.
      * @tparam Output Image output.
      * @param options Options to pass on to the selected save operation.
+     * @param quality The quality to encode with, or 0 to use `&q=`.
      */
     template <enums::Output Output>
-    void append_save_options(vips::VOption *options) const;
+    void append_save_options(vips::VOption *options, int quality) const;
+
+    /**
+     * Encode an image with the given quality, as libvips would save it.
+     * @param image The image to encode.
+     * @param output Image output.
+     * @param quality The quality to encode with.
+     * @return The encoded image.
+     */
+    std::string encode_with_quality(const VImage &image,
+                                    const enums::Output &output,
+                                    int quality) const;
+
+    /**
+     * Encode an image with the highest quality that fits within
+     * `&maxbytes=`. The quality is searched for with trial encodes on a
+     * downscaled proxy, followed by at most two encodes of the full image.
+     * @param image The image to save.
+     * @param output Image output, either JPEG, WebP or AVIF.
+     * @param target The target to write to.
+     * @return A bool indicating if the image was written, `false` if no
+     *         maximum number of bytes was given.
+     */
+    bool write_max_bytes(const VImage &image, const enums::Output &output,
+                         const io::Target &target) const;
+
+    /**
+     * Quantize the frames of an animated GIF image on multiple threads (see
+     * `codecs::encode_gif()`), instead of one after another by libvips.
+     * @param image The image to save.
+     * @param target The target to write to.
+     * @return A bool indicating if the image was written, `false` if the
+     *         image should be saved by libvips instead.
+     */
+    bool write_parallel_gif(const VImage &image,
+                            const io::Target &target) const;
+
+    /**
+     * Encode a JPEG image on multiple threads (see `codecs::encode_jpeg()`),
+     * instead of handing it to libvips.
+     * @param image The image to save.
+     * @param target The target to write to.
+     * @return A bool indicating if the image was written, `false` if the
+     *         image should be saved by libvips instead.
+     */
+    bool write_parallel_jpeg(const VImage &image,
+                             const io::Target &target) const;
+
+    /**
+     * Encode a PNG image on multiple threads (see `codecs::encode_png()`),
+     * instead of handing it to libpng.
+     * @param image The image to save.
+     * @param target The target to write to.
+     * @return A bool indicating if the image was written, `false` if the
+     *         image should be saved by libvips instead.
+     */
+    bool write_parallel_png(const VImage &image,
+                            const io::Target &target) const;
 
     /**
      * Append the save options for a specified image output.
      * These options will be passed on to the selected save operation.
      * @param output Image output.
      * @param options Options to pass on to the selected save operation.
+     * @param quality The quality to encode with, or 0 to use `&q=`.
      */
     void append_save_options(const enums::Output &output,
-                             vips::VOption *options) const;
+                             vips::VOption *options, int quality = 0) const;
 };
 
 }  // namespace weserv::api::processors
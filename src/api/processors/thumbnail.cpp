@@ -1,11 +1,13 @@
 #include "thumbnail.h"
 
+#include "../codecs/icc_profile.h"
 #include "../exceptions/large.h"
 
 #include <algorithm>
 #include <cmath>
 #include <string>
 #include <tuple>
+#include <vector>
 
 namespace weserv::api::processors {
 
@@ -18,116 +20,33 @@ using enums::ImageType;
 // NOTE: Can be overridden with `&fsol=0`.
 const bool FAST_SHRINK_ON_LOAD = true;
 
-using io::Source;
-
-template <>
-VImage
-Thumbnail::new_from_source<ImageType::Jpeg>(const Source &source,
-                                            vips::VOption *options) const {
-#ifdef WESERV_ENABLE_TRUE_STREAMING
-    return VImage::jpegload_source(source, options);
-#else
-    // We don't take a copy of the data or free it
-    auto *blob =
-        vips_blob_new(nullptr, source.buffer().data(), source.buffer().size());
-    auto image = VImage::jpegload_buffer(blob, options);
-    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
-    return image;
-#endif
-}
-
-template <>
-VImage
-Thumbnail::new_from_source<ImageType::Pdf>(const Source &source,
-                                           vips::VOption *options) const {
-#ifdef WESERV_ENABLE_TRUE_STREAMING
-    return VImage::pdfload_source(source, options);
-#else
-    // We don't take a copy of the data or free it
-    auto *blob =
-        vips_blob_new(nullptr, source.buffer().data(), source.buffer().size());
-    auto image = VImage::pdfload_buffer(blob, options);
-    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
-    return image;
-#endif
-}
-
-template <>
-VImage
-Thumbnail::new_from_source<ImageType::Webp>(const Source &source,
-                                            vips::VOption *options) const {
-#ifdef WESERV_ENABLE_TRUE_STREAMING
-    return VImage::webpload_source(source, options);
-#else
-    // We don't take a copy of the data or free it
-    auto *blob =
-        vips_blob_new(nullptr, source.buffer().data(), source.buffer().size());
-    auto image = VImage::webpload_buffer(blob, options);
-    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
-    return image;
-#endif
-}
-
-template <>
-VImage
-Thumbnail::new_from_source<ImageType::Tiff>(const Source &source,
-                                            vips::VOption *options) const {
-#ifdef WESERV_ENABLE_TRUE_STREAMING
-    return VImage::tiffload_source(source, options);
-#else
-    // We don't take a copy of the data or free it
-    auto *blob =
-        vips_blob_new(nullptr, source.buffer().data(), source.buffer().size());
-    auto image = VImage::tiffload_buffer(blob, options);
-    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
-    return image;
-#endif
-}
-
-// TODO(kleisauke): Support whole-slide images(?)
-/*template <>
-VImage
-Thumbnail::new_from_source<ImageType::OpenSlide>(const Source &source,
-                                                 vips::VOption *options) const {
-#ifdef WESERV_ENABLE_TRUE_STREAMING
-    return VImage::openslideload_source(source, options);
-#else
-    // openslideload_buffer is not available
-    return nullptr;
-#endif
-}*/
+using io::DecodeSession;
+
+namespace {
+
+/**
+ * Raise the (non-alpha) pixel values of an image to the given power, in the
+ * normalised 0 - 1 range.
+ * @note The result is a float image, the caller should cast back when done.
+ * @param image The source image.
+ * @param exponent The exponent.
+ * @param max_value The maximum pixel value, e.g. 255 for 8-bit images.
+ * @return The new image.
+ */
+VImage apply_power(const VImage &image, double exponent, double max_value) {
+    if (image.has_alpha()) {
+        // Separate alpha channel
+        auto image_without_alpha = image.extract_band(
+            0, VImage::option()->set("n", image.bands() - 1));
+        auto alpha = image[image.bands() - 1];
+        return apply_power(image_without_alpha, exponent, max_value)
+            .bandjoin(alpha);
+    }
 
-template <>
-VImage
-Thumbnail::new_from_source<ImageType::Svg>(const Source &source,
-                                           vips::VOption *options) const {
-#ifdef WESERV_ENABLE_TRUE_STREAMING
-    return VImage::svgload_source(source, options);
-#else
-    // We don't take a copy of the data or free it
-    auto *blob =
-        vips_blob_new(nullptr, source.buffer().data(), source.buffer().size());
-    auto image = VImage::svgload_buffer(blob, options);
-    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
-    return image;
-#endif
+    return (image / max_value).pow(exponent) * max_value;
 }
 
-template <>
-VImage
-Thumbnail::new_from_source<ImageType::Heif>(const Source &source,
-                                            vips::VOption *options) const {
-#ifdef WESERV_ENABLE_TRUE_STREAMING
-    return VImage::heifload_source(source, options);
-#else
-    // We don't take a copy of the data or free it
-    auto *blob =
-        vips_blob_new(nullptr, source.buffer().data(), source.buffer().size());
-    auto image = VImage::heifload_buffer(blob, options);
-    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
-    return image;
-#endif
-}
+}  // namespace
 
 std::pair<double, double> Thumbnail::resolve_shrink(int width,
                                                     int height) const {
@@ -218,8 +137,14 @@ double Thumbnail::resolve_common_shrink(int width, int height) const {
 
 int Thumbnail::resolve_jpeg_shrink(int width, int height) const {
     double shrink = resolve_common_shrink(width, height);
+
+    // Be conservative when gamma correction needs to be applied, the
+    // remaining shrink is done in linear light
     int shrink_on_load_factor =
-        query_->get<bool>("fsol", FAST_SHRINK_ON_LOAD) ? 1 : 2;
+        query_->get<float>("gam", 0.0F) == 0.0F &&
+                query_->get<bool>("fsol", FAST_SHRINK_ON_LOAD)
+            ? 1
+            : 2;
     int jpeg_shrink_on_load = 1;
 
     // Shrink-on-load is a simple block shrink and will
@@ -241,12 +166,30 @@ int Thumbnail::resolve_jpeg_shrink(int width, int height) const {
     return jpeg_shrink_on_load;
 }
 
-int Thumbnail::resolve_tiff_pyramid(const VImage &image, const Source &source,
-                                    int width, int height) const {
+int Thumbnail::resolve_interlace_shrink(int width, int height) const {
+    double shrink = resolve_common_shrink(width, height);
+    int shrink_on_load_factor =
+        query_->get<bool>("fsol", FAST_SHRINK_ON_LOAD) ? 1 : 2;
+
+    // The interlace passes are subsampled (rather than block averaged), so
+    // leave (at least) the same amount of shrink as JPEG to `resize`
+    if (shrink >= 8 * shrink_on_load_factor) {
+        return 8;
+    }
+    if (shrink >= 4 * shrink_on_load_factor) {
+        return 4;
+    }
+    if (shrink >= 2 * shrink_on_load_factor) {
+        return 2;
+    }
+
+    return 1;
+}
+
+int Thumbnail::resolve_tiff_pyramid(DecodeSession &session, int width,
+                                    int height) const {
     // Note: This is checked against config_.max_pages in stream.cpp
-    int n_pages = image.get_typeof(VIPS_META_N_PAGES) != 0
-                      ? image.get_int(VIPS_META_N_PAGES)
-                      : 1;
+    int n_pages = session.n_pages();
 
     // Only one page? Can't be
     if (n_pages < 2) {
@@ -255,15 +198,11 @@ int Thumbnail::resolve_tiff_pyramid(const VImage &image, const Source &source,
 
     int target_page = -1;
 
-    for (int i = n_pages - 1; i >= 0; i--) {
-        auto page = new_from_source<ImageType::Tiff>(
-            source, VImage::option()
-                        ->set("access", VIPS_ACCESS_SEQUENTIAL)
-                        ->set("fail", config_.fail_on_error == 1)
-                        ->set("page", i));
+    const auto &page_sizes = session.page_sizes();
 
-        int level_width = page.width();
-        int level_height = page.height();
+    for (int i = n_pages - 1; i >= 0; i--) {
+        int level_width = page_sizes[i].first;
+        int level_height = page_sizes[i].second;
 
         // Try to sanity-check the size of the pages. Do they look
         // like a pyramid?
@@ -321,6 +260,162 @@ int Thumbnail::resolve_tiff_pyramid(const VImage &image, const Source &source,
     return 0;
 }*/
 
+bool Thumbnail::resolve_trim_box(DecodeSession &session, int threshold,
+                                 int shrink, int width, int height,
+                                 VImage *preview) const {
+    // The background is the pixel at (0, 0) of the full-scale image, this
+    // only decodes the first MCU row
+    auto corner = session.load_region(0, 0, 0, 1, 1);
+    if (corner.is_null()) {
+        return false;
+    }
+    auto background = corner(0, 0);
+
+    // The preview is small, keep it around so that it can be reused when the
+    // trimmed image has the same shrink-on-load factor
+    *preview = session.load(VImage::option()
+                                ->set("access", VIPS_ACCESS_RANDOM)
+                                ->set("fail", config_.fail_on_error == 1)
+                                ->set("shrink", shrink));
+
+    int left, top, trim_width, trim_height;
+    std::tie(left, top, trim_width, trim_height) =
+        utils::find_trim(*preview, threshold, background);
+
+    // Nothing to trim (or too aggressive), the Trim processor will return the
+    // image as-is
+    if (trim_width == 0 || trim_height == 0) {
+        query_->update("trim_left", 0);
+        query_->update("trim_top", 0);
+        query_->update("trim_width", 0);
+        query_->update("trim_height", 0);
+
+        return true;
+    }
+
+    // Scale up the box, each edge is accurate up to a couple of pixels at
+    // full scale
+    int margin = 2 * shrink;
+    int right = std::min((left + trim_width) * shrink, width);
+    int bottom = std::min((top + trim_height) * shrink, height);
+    left = std::min(left * shrink, width - 1);
+    top = std::min(top * shrink, height - 1);
+
+    int outer_left = std::max(left - margin, 0);
+    int outer_top = std::max(top - margin, 0);
+    int outer_right = std::min(right + margin, width);
+    int outer_bottom = std::min(bottom + margin, height);
+
+    // Search for the box within a band around an edge, in full-scale
+    // coordinates
+    auto find_trim_band = [&](int x, int y, int w, int h) {
+        auto band = session.load_region(0, x, y, w, h);
+        if (band.is_null()) {
+            return std::tuple{0, 0, 0, 0};
+        }
+
+        auto box = utils::find_trim(band, threshold, background);
+        std::get<0>(box) += x;
+        std::get<1>(box) += y;
+        return box;
+    };
+
+    int band_left, band_top, band_width, band_height;
+
+    // Refine the left and right edges, the bands span the full height of
+    // the (enlarged) box
+    std::tie(band_left, std::ignore, band_width, std::ignore) =
+        find_trim_band(outer_left, outer_top,
+                       std::min(left + margin, outer_right) - outer_left,
+                       outer_bottom - outer_top);
+    int refined_left = band_width != 0 ? band_left : left;
+
+    int right_band = std::max(right - margin, outer_left);
+    std::tie(band_left, std::ignore, band_width, std::ignore) =
+        find_trim_band(right_band, outer_top, outer_right - right_band,
+                       outer_bottom - outer_top);
+    int refined_right = band_width != 0 ? band_left + band_width : right;
+
+    // Likewise for the top and bottom edges
+    std::tie(std::ignore, band_top, std::ignore, band_height) =
+        find_trim_band(outer_left, outer_top, outer_right - outer_left,
+                       std::min(top + margin, outer_bottom) - outer_top);
+    int refined_top = band_height != 0 ? band_top : top;
+
+    int bottom_band = std::max(bottom - margin, outer_top);
+    std::tie(std::ignore, band_top, std::ignore, band_height) =
+        find_trim_band(outer_left, bottom_band, outer_right - outer_left,
+                       outer_bottom - bottom_band);
+    int refined_bottom = band_height != 0 ? band_top + band_height : bottom;
+
+    // Keep the scaled up box if the refined edges cross each other
+    if (refined_right > refined_left && refined_bottom > refined_top) {
+        left = refined_left;
+        top = refined_top;
+        right = refined_right;
+        bottom = refined_bottom;
+    }
+
+    // The Trim processor maps this box onto the image that is shrunk on load
+    query_->update("trim_left", left);
+    query_->update("trim_top", top);
+    query_->update("trim_width", right - left);
+    query_->update("trim_height", bottom - top);
+
+    return true;
+}
+
+VImage Thumbnail::resolve_exif_thumbnail(const VImage &image,
+                                         DecodeSession &session) const {
+    // The pixels of the main image are converted to sRGB when it embeds
+    // another profile, which the thumbnail would skip
+    if (utils::has_profile(image)) {
+        size_t length;
+        const void *data = image.get_blob(VIPS_META_ICC_NAME, &length);
+
+        if (!codecs::is_srgb_profile(static_cast<const unsigned char *>(data),
+                                     length)) {
+            return VImage();
+        }
+    }
+
+    auto thumb = session.load_exif_thumbnail(
+        VImage::option()
+            ->set("access", VIPS_ACCESS_SEQUENTIAL)
+            ->set("fail", config_.fail_on_error == 1));
+    if (thumb.is_null()) {
+        return thumb;
+    }
+
+    // The thumbnail should match the aspect ratio (and therefore the
+    // orientation) of the main image, within a pixel of rounding. This also
+    // rules out letterboxed thumbnails. Its colour space should match as
+    // well, e.g. CMYK images usually have a RGB thumbnail.
+    auto expected_height =
+        static_cast<double>(thumb.width()) * image.height() / image.width();
+    if (std::abs(thumb.height() - expected_height) > 1.0 ||
+        thumb.bands() != image.bands() ||
+        thumb.interpretation() != image.interpretation()) {
+        return VImage();
+    }
+
+    // Use the thumbnail if, by using it, we could get a factor > 1.0,
+    // i.e. we would not need to expand the thumbnail.
+    // Don't use >= since factor can be clipped to 1.0 under some
+    // resizing modes.
+    if (resolve_common_shrink(thumb.width(), thumb.height()) <= 1.0) {
+        return VImage();
+    }
+
+    // The thumbnail lacks the metadata of the main image, copy the field
+    // needed for auto-rotation. The ICC profile isn't copied, the pixels of
+    // the thumbnail aren't necessarily in the colour space of the main image.
+    thumb = thumb.copy();
+    utils::copy_fields(image, thumb, {VIPS_META_ORIENTATION});
+
+    return thumb;
+}
+
 void Thumbnail::append_page_options(vips::VOption *options) const {
     auto n = query_->get<int>("n");
     auto page = query_->get_if<int>(
@@ -332,19 +427,59 @@ void Thumbnail::append_page_options(vips::VOption *options) const {
         },
         0);
 
+    // Frames may have been dropped, the kept frames are selected again after
+    // reloading
+    if (query_->exists("kept_pages")) {
+        n = query_->get<std::vector<int>>("kept_pages").back() + 1;
+    }
+
     options->set("n", n);
     options->set("page", page);
 }
 
+VImage Thumbnail::select_kept_frames(const VImage &image,
+                                     const VImage &reloaded) const {
+    if (!query_->exists("kept_pages")) {
+        return reloaded;
+    }
+
+    const auto &pages = query_->get<std::vector<int>>("kept_pages");
+
+    // Attaching metadata, need to copy the image
+    auto copy = utils::select_pages(reloaded, pages,
+                                    utils::get_page_height(reloaded))
+                    .copy();
+
+    // The delays of the dropped frames were already merged into the kept
+    // frames
+    utils::copy_fields(image, copy, {"delay"});
+
+    return copy;
+}
+
 VImage Thumbnail::shrink_on_load(const VImage &image,
-                                 const Source &source) const {
-    // Try to reload input using shrink-on-load, when:
-    //  - the width or height parameters are specified
-    //  - gamma correction doesn't need to be applied
-    //  - trimming isn't required
-    if (query_->get<bool>("trim", false) ||
-        query_->get<float>("gam", 0.0F) != 0.0F ||
-        (query_->get<int>("w") == 0 && query_->get<int>("h") == 0)) {
+                                 DecodeSession &session) const {
+    // Try to reload input using shrink-on-load, when the width or height
+    // parameters are specified
+    if (query_->get<int>("w") == 0 && query_->get<int>("h") == 0) {
+        return image;
+    }
+
+    auto image_type = query_->get<ImageType>("type", ImageType::Unknown);
+    auto trim = query_->get_if<int>(
+        "trim",
+        [](int t) {
+            // Threshold needs to be in the
+            // range of 1 - 254
+            return t >= 1 && t <= 254;
+        },
+        0);
+    auto gamma = query_->get<float>("gam", 0.0F);
+
+    // Trimming and gamma correction can only be combined with the JPEG
+    // shrink-on-load feature, the other loaders would need the full-scale
+    // image anyway
+    if ((trim != 0 || gamma != 0.0F) && image_type != ImageType::Jpeg) {
         return image;
     }
 
@@ -355,21 +490,77 @@ VImage Thumbnail::shrink_on_load(const VImage &image,
                                       ->set("access", VIPS_ACCESS_SEQUENTIAL)
                                       ->set("fail", config_.fail_on_error == 1);
 
-    auto image_type = query_->get<ImageType>("type", ImageType::Unknown);
-
     if (image_type == ImageType::Jpeg) {
+        // Tiny outputs can be served from the embedded EXIF thumbnail
+        if (trim == 0 && gamma == 0.0F) {
+            auto thumb = resolve_exif_thumbnail(image, session);
+            if (!thumb.is_null()) {
+                delete load_options;
+
+                return thumb;
+            }
+        }
+
         auto shrink = resolve_jpeg_shrink(width, height);
 
-        return new_from_source<ImageType::Jpeg>(
-            source, load_options->set("shrink", shrink));
+        // Trimming can only lower the shrink, so the trim box is only worth
+        // finding up front if the untrimmed image can be shrunk on load
+        VImage preview;
+        int preview_shrink = shrink;
+        if (trim != 0 && shrink > 1) {
+            if (!resolve_trim_box(session, trim, shrink, width, height,
+                                  &preview)) {
+                // Let the Trim processor find the box at full scale
+                delete load_options;
+
+                return image;
+            }
+
+            auto trim_width = query_->get<int>("trim_width");
+            auto trim_height = query_->get<int>("trim_height");
+            if (trim_width > 0 && trim_height > 0) {
+                shrink = resolve_jpeg_shrink(trim_width, trim_height);
+            }
+        }
+
+        if (shrink == 1) {
+            delete load_options;
+
+            return image;
+        }
+
+        // The remaining shrink is done in linear light, see process()
+        if (gamma != 0.0F) {
+            query_->update("linear_light", true);
+        }
+
+        // The preview on which the trim box was searched for is already
+        // shrunk on load by the same factor
+        if (!preview.is_null() && shrink == preview_shrink) {
+            delete load_options;
+
+            return preview;
+        }
+
+        return session.load(load_options->set("shrink", shrink));
+    } else if (image_type == ImageType::Png) {
+        auto shrink = resolve_interlace_shrink(width, height);
+
+        // Only the interlace passes that are needed will be decoded
+        auto thumb = shrink > 1 ? session.load_png_passes(shrink) : VImage();
+        if (!thumb.is_null()) {
+            delete load_options;
+
+            return thumb;
+        }
     } else if (image_type == ImageType::Pdf) {
         append_page_options(load_options);
 
         auto scale =
             1.0 / resolve_common_shrink(width, utils::get_page_height(image));
 
-        return new_from_source<ImageType::Pdf>(
-            source, load_options->set("scale", scale));
+        return select_kept_frames(
+            image, session.load(load_options->set("scale", scale)));
     } else if (image_type == ImageType::Webp) {
         append_page_options(load_options);
 
@@ -378,16 +569,27 @@ VImage Thumbnail::shrink_on_load(const VImage &image,
 
         // Avoid upsizing via libwebp
         if (scale < 1.0) {
-            return new_from_source<ImageType::Webp>(
-                source, load_options->set("scale", scale));
+            return select_kept_frames(
+                image, session.load(load_options->set("scale", scale)));
         }
     } else if (image_type == ImageType::Tiff) {
-        auto page = resolve_tiff_pyramid(image, source, width, height);
+        auto page = resolve_tiff_pyramid(session, width, height);
 
-        // We've found a pyramid
+        // We've found a pyramid, its header is already opened
         if (page != -1) {
-            return new_from_source<ImageType::Tiff>(
-                source, load_options->set("page", page));
+            delete load_options;
+
+            return session.page(page);
+        }
+
+        // The EXIF thumbnail belongs to the first page
+        if (query_->get<int>("n") == 1 && query_->get<int>("page", 0) == 0) {
+            auto thumb = resolve_exif_thumbnail(image, session);
+            if (!thumb.is_null()) {
+                delete load_options;
+
+                return thumb;
+            }
         }
     /*} else if (image_type == ImageType::OpenSlide) {
         auto level = resolve_open_slide_level(image);
@@ -397,21 +599,19 @@ VImage Thumbnail::shrink_on_load(const VImage &image,
     } else if (image_type == ImageType::Svg) {
         auto scale = 1.0 / resolve_common_shrink(width, height);
 
-        return new_from_source<ImageType::Svg>(
-            source, load_options->set("scale", scale));
+        return session.load(load_options->set("scale", scale));
     } else if (image_type == ImageType::Heif) {
         append_page_options(load_options);
 
         // Fetch the size of the stored thumbnail
-        auto thumb = new_from_source<ImageType::Heif>(
-            source, load_options->set("thumbnail", true));
+        auto thumb = session.load(load_options->set("thumbnail", true));
 
         // Use the thumbnail if, by using it, we could get a factor > 1.0,
         // i.e. we would not need to expand the thumbnail.
         // Don't use >= since factor can be clipped to 1.0 under some
         // resizing modes.
         return resolve_common_shrink(thumb.width(), thumb.height()) > 1.0
-                   ? thumb
+                   ? select_kept_frames(image, thumb)
                    : image;
     }
 
@@ -453,6 +653,25 @@ VImage Thumbnail::process(const VImage &image) const {
         static_cast<int>(std::rint(static_cast<double>(thumb_width) / hshrink));
     auto target_page_height =
         static_cast<int>(std::rint(static_cast<double>(page_height) / vshrink));
+
+    // A trimmed JPEG image may have been shrunk on load, resolve the target
+    // size against the full-scale trim box instead. This way, the output size
+    // doesn't depend on the shrink-on-load factor.
+    auto trim_width = query_->get<int>("trim_width", 0);
+    auto trim_height = query_->get<int>("trim_height", 0);
+    if (trim_width > 0 && trim_height > 0 &&
+        (trim_width != thumb_width || trim_height != page_height)) {
+        std::tie(hshrink, vshrink) = resolve_shrink(trim_width, trim_height);
+
+        target_width = static_cast<int>(
+            std::rint(static_cast<double>(trim_width) / hshrink));
+        target_page_height = static_cast<int>(
+            std::rint(static_cast<double>(trim_height) / vshrink));
+
+        hshrink = static_cast<double>(thumb_width) / target_width;
+        vshrink = static_cast<double>(page_height) / target_page_height;
+    }
+
     auto target_image_height = target_page_height;
 
     // In toilet-roll mode, we must adjust vshrink so that we exactly hit
@@ -475,28 +694,62 @@ VImage Thumbnail::process(const VImage &image) const {
             std::to_string(config_.limit_output_pixels));
     }
 
+    // The remaining shrink of gamma corrected JPEG images that are shrunk on
+    // load is done in linear light. Only RGB and greyscale images qualify,
+    // e.g. CMYK images with an embedded profile are still resized as-is.
+    // Note: the block shrink of libjpeg still averages in gamma space, its
+    // error is bounded by the conservative factor of resolve_jpeg_shrink().
+    double gamma = query_->get<float>("gam", 0.0F);
+    auto interpretation = thumb.interpretation();
+    auto linear_light =
+        query_->get<bool>("linear_light", false) &&
+        (hshrink != 1.0 || vshrink != 1.0) &&
+        (interpretation == VIPS_INTERPRETATION_sRGB ||
+         interpretation == VIPS_INTERPRETATION_RGB ||
+         interpretation == VIPS_INTERPRETATION_RGB16 ||
+         interpretation == VIPS_INTERPRETATION_B_W ||
+         interpretation == VIPS_INTERPRETATION_GREY16);
+    auto format = thumb.format();
+    auto max_value = utils::is_16_bit(interpretation) ? 65535.0 : 255.0;
+
+    // Gamma needs to be in the range of 1.0 - 3.0
+    if (gamma < 1.0 || gamma > 3.0) {
+        // Set gamma to the default correction (sRGB)
+        gamma = 2.2;
+    }
+
+    if (linear_light) {
+        thumb = apply_power(thumb, gamma, max_value);
+    }
+
     // If there's an alpha, we have to premultiply before shrinking. See
     // https://github.com/libvips/libvips/issues/291
-    VipsBandFormat unpremultiplied_format = VIPS_FORMAT_NOTSET;
-    if (thumb.has_alpha() && hshrink != 1.0 && vshrink != 1.0) {
-        // .premultiply() makes a float image. When we .unpremultiply() below,
-        // we need to cast back to the pre-premultiply format.
-        unpremultiplied_format = thumb.format();
-
-        thumb = thumb.premultiply();
+    // The image stays premultiplied until the end of the pipeline (or until
+    // a processor needs straight alpha), see base.h.
+    if (hshrink != 1.0 && vshrink != 1.0) {
+        thumb = premultiply(thumb, query_.get());
     }
 
     thumb = thumb.resize(1.0 / hshrink,
                          VImage::option()->set("vscale", 1.0 / vshrink));
 
-    query_->update("page_height", target_page_height);
-
-    if (unpremultiplied_format != VIPS_FORMAT_NOTSET) {
-        thumb = thumb.unpremultiply().cast(unpremultiplied_format);
+    if (linear_light) {
+        thumb = apply_power(unpremultiply(thumb, query_.get()), 1.0 / gamma,
+                            max_value)
+                    .cast(format);
     }
 
-    // Colour management.
+    query_->update("page_height", target_page_height);
+
+    // Colour management, prefer a cached transform whenever possible.
     if (has_icc_profile) {
+        // ICC transforms need straight alpha
+        thumb = unpremultiply(thumb, query_.get());
+    }
+    if (has_icc_profile &&
+        !icc_cache_.transform(thumb, "srgb", VIPS_INTENT_PERCEPTUAL,
+                              static_cast<size_t>(config_.icc_cache_size),
+                              &thumb)) {
         // If there's some kind of import profile, we can transform to the
         // output.
         thumb = thumb.icc_transform(
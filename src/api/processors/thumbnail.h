@@ -1,6 +1,7 @@
 #pragma once
 
-#include "../io/source.h"
+#include "../io/decode_session.h"
+#include "../utils/icc_transform_cache.h"
 #include "base.h"
 
 #include <weserv/config.h>
@@ -9,16 +10,19 @@ namespace weserv::api::processors {
 
 class Thumbnail : ImageProcessor {
  public:
-    Thumbnail(std::shared_ptr<parsers::Query> query, const Config &config)
-        : ImageProcessor(std::move(query)), config_(config) {}
+    Thumbnail(std::shared_ptr<parsers::Query> query, const Config &config,
+              utils::IccTransformCache &icc_cache)
+        : ImageProcessor(std::move(query)), config_(config),
+          icc_cache_(icc_cache) {}
 
     /**
      * Use any shrink-on-load features available in the file import library.
      * @param image The source image.
-     * @param source Source to read from.
+     * @param session The decode session.
      * @return An image that may have shrunk.
      */
-    VImage shrink_on_load(const VImage &image, const io::Source &source) const;
+    VImage shrink_on_load(const VImage &image,
+                          io::DecodeSession &session) const;
 
     VImage process(const VImage &image) const override;
 
@@ -29,15 +33,9 @@ class Thumbnail : ImageProcessor {
     const Config &config_;
 
     /**
-     * Load a formatted image from a source for a specified image type.
-     * @tparam ImageType Image type.
-     * @param source Source to read from.
-     * @param options Any options to pass on to the load operation.
-     * @return A new `VImage`.
+     * Ready-to-use ICC transforms, shared across requests.
      */
-    template <enums::ImageType ImageType>
-    VImage new_from_source(const io::Source &source,
-                           vips::VOption *options) const;
+    utils::IccTransformCache &icc_cache_;
 
     /**
      * Calculate the shrink factor, taking into account auto-rotate, the fit
@@ -67,17 +65,54 @@ class Thumbnail : ImageProcessor {
      */
     int resolve_jpeg_shrink(int width, int height) const;
 
+    /**
+     * Find the best shrink for interlaced images, i.e. the number of
+     * interlace passes that need to be decoded.
+     * @param width Input width.
+     * @param height Input height.
+     * @return The interlace shrink level.
+     */
+    int resolve_interlace_shrink(int width, int height) const;
+
+    /**
+     * Find the trim box of a JPEG image. The box is searched for on a preview
+     * that is shrunk on load, only its edges are refined at full scale. The
+     * box is stored in the query, the Trim processor maps it onto the image
+     * that is shrunk on load.
+     * @param session The decode session.
+     * @param threshold The trim threshold.
+     * @param shrink The shrink-on-load factor of the preview.
+     * @param width Input width.
+     * @param height Input height.
+     * @param preview Receives the preview.
+     * @return false if the edges can't be decoded on their own, the trim box
+     *         should then be found on the full-scale image instead.
+     */
+    bool resolve_trim_box(io::DecodeSession &session, int threshold,
+                          int shrink, int width, int height,
+                          VImage *preview) const;
+
+    /**
+     * Find the JPEG thumbnail embedded in the EXIF data, if it's usable.
+     * It should match the aspect ratio of the main image and shouldn't need
+     * to be expanded. Images with a non-sRGB profile never use it.
+     * @param image The source image.
+     * @param session The decode session.
+     * @return The thumbnail, or an empty `VImage` if it's not usable.
+     */
+    VImage resolve_exif_thumbnail(const VImage &image,
+                                  io::DecodeSession &session) const;
+
     /**
      * Find the pyramid level, if it's a pyr tiff.
      * We just look for two or more pages following roughly /2 shrinks.
-     * @param image The source image.
-     * @param source Source to read from.
+     * @param session The decode session.
      * @param width Input width.
      * @param height Input height.
      * @return The pyramid level.
      */
-    int resolve_tiff_pyramid(const VImage &image, const io::Source &source,
-                             int width, int height) const;
+    int resolve_tiff_pyramid(io::DecodeSession &session, int width,
+                             int height) const;
 
     /**
      * Find the best openslide level.
@@ -92,6 +127,17 @@ class Thumbnail : ImageProcessor {
      * @param options The source options.
      */
     void append_page_options(vips::VOption *options) const;
+
+    /**
+     * Drop the same frames from a reloaded image as `Stream::resolve_frames`
+     * did from the source image, if any.
+     * @param image The source image, with the kept frames.
+     * @param reloaded The reloaded image, with all frames up to the last kept
+     *        frame (see `append_page_options`).
+     * @return The reloaded image with the kept frames and their delays.
+     */
+    VImage select_kept_frames(const VImage &image,
+                              const VImage &reloaded) const;
 };
 
 }  // namespace weserv::api::processors
@@ -14,13 +14,16 @@ VImage Tint::process(const VImage &image) const {
         return image;
     }
 
+    // Needs straight alpha
+    auto output_image = unpremultiply(image, query_.get());
+
     std::vector<double> lab = tint.to_lab();
 
     // Get original colorspace
-    VipsInterpretation type_before_tint = image.interpretation();
+    VipsInterpretation type_before_tint = output_image.interpretation();
 
     // Extract luminance
-    auto luminance = image.colourspace(VIPS_INTERPRETATION_LAB)[0];
+    auto luminance = output_image.colourspace(VIPS_INTERPRETATION_LAB)[0];
 
     // Create the tinted version by combining the L from the original and the
     // chroma from the tint
@@ -32,9 +35,9 @@ VImage Tint::process(const VImage &image) const {
                       .colourspace(type_before_tint);
 
     // Attach original alpha channel, if any
-    if (image.has_alpha()) {
+    if (output_image.has_alpha()) {
         // Extract original alpha channel
-        auto alpha = image[image.bands() - 1];
+        auto alpha = output_image[output_image.bands() - 1];
 
         // Join alpha channel to normalized image
         tinted = tinted.bandjoin(alpha);
@@ -2,6 +2,9 @@
 
 #include "../utils/utility.h"
 
+#include <algorithm>
+#include <cmath>
+
 namespace weserv::api::processors {
 
 VImage Trim::process(const VImage &image) const {
@@ -15,46 +18,51 @@ VImage Trim::process(const VImage &image) const {
         0);
 
     // Make sure that trimming is required
-    if (threshold == 0 || image.width() < 3 || image.height() < 3) {
-        // We could use shrink-on-load for the next thumbnail processor
-        query_->update("trim", false);
-
+    if (threshold == 0) {
         return image;
     }
 
-    // Find the value of the pixel at (0, 0), `find_trim` search for all pixels
-    // significantly different from this
-    auto background = image.extract_area(0, 0, 1, 1);
+    int left, top, width, height;
+    if (query_->exists("trim_width")) {
+        // The trim box was already found in full-scale coordinates (see
+        // Thumbnail::resolve_trim_box), map it onto the image that may have
+        // been shrunk on load
+        auto xfactor = static_cast<double>(image.width()) /
+                       query_->get<int>("input_width");
+        auto yfactor = static_cast<double>(image.height()) /
+                       query_->get<int>("input_height");
 
-    // Note: If the image has alpha, we'll need to flatten before `getpoint`
-    // to get a correct background value
-    if (image.has_alpha()) {
-        background = background.flatten();
-    }
+        auto trim_left = query_->get<int>("trim_left");
+        auto trim_top = query_->get<int>("trim_top");
+        auto trim_width = query_->get<int>("trim_width");
+        auto trim_height = query_->get<int>("trim_height");
 
-    // Scale up 8-bit values to match 16-bit input image
-    if (utils::is_16_bit(image.interpretation())) {
-        threshold = threshold * 256;
-    }
+        // Map the edges, so that the box stays within the image
+        left = std::min(static_cast<int>(std::rint(trim_left * xfactor)),
+                        image.width() - 1);
+        top = std::min(static_cast<int>(std::rint(trim_top * yfactor)),
+                       image.height() - 1);
+        auto right = std::min(
+            static_cast<int>(std::rint((trim_left + trim_width) * xfactor)),
+            image.width());
+        auto bottom = std::min(
+            static_cast<int>(std::rint((trim_top + trim_height) * yfactor)),
+            image.height());
 
-    int left, top, width, height;
-    left = image.find_trim(&top, &width, &height,
-                           VImage::option()
-                               ->set("threshold", threshold)
-                               ->set("background", background(0, 0)));
+        width = trim_width == 0 ? 0 : std::max(right - left, 1);
+        height = trim_height == 0 ? 0 : std::max(bottom - top, 1);
+    } else {
+        std::tie(left, top, width, height) =
+            utils::find_trim(image, threshold);
+    }
 
     // Sanity check, this usually happens when a high tolerance is specified
+    // (or when the image is too small to trim)
     if (width == 0 || height == 0) {
-        // We could use shrink-on-load for the next thumbnail processor
-        query_->update("trim", false);
-
         // Just return the original image
         return image;
     }
 
-    // Skip shrink-on-load for the next thumbnail processor
-    query_->update("trim", true);
-
     // Don't trim the height in toilet-roll mode
     if (query_->get<int>("n") > 1) {
         top = 0;
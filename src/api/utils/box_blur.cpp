@@ -0,0 +1,214 @@
+#include "box_blur.h"
+
+#include "utility.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace weserv::api::utils {
+
+namespace {
+
+/**
+ * Number of successive box blurs, three already gets within a few percent of
+ * a true Gaussian.
+ */
+constexpr int BOX_PASSES = 3;
+
+/**
+ * Calculate the radii of the box blurs whose combined variance matches a
+ * Gaussian with the given sigma.
+ * See: http://blog.ivank.net/fastest-gaussian-blur.html
+ */
+std::array<int, BOX_PASSES> box_radii(double sigma) {
+    double ideal = std::sqrt(12.0 * sigma * sigma / BOX_PASSES + 1.0);
+
+    // The (odd) widths of the smaller and the larger box
+    auto lower = static_cast<int>(std::floor(ideal));
+    if (lower % 2 == 0) {
+        --lower;
+    }
+    int upper = lower + 2;
+
+    // The number of passes that use the smaller box
+    auto m = static_cast<int>(
+        std::round((12.0 * sigma * sigma - BOX_PASSES * lower * lower -
+                    4.0 * BOX_PASSES * lower - 3.0 * BOX_PASSES) /
+                   (-4.0 * lower - 4.0)));
+
+    std::array<int, BOX_PASSES> radii{};
+    for (int i = 0; i < BOX_PASSES; ++i) {
+        radii[i] = ((i < m ? lower : upper) - 1) / 2;
+    }
+
+    return radii;
+}
+
+/**
+ * Box blur the rows of an image, pixels beyond the edges repeat the edge
+ * pixel.
+ */
+void box_blur_rows(const float *in, float *out, int width, int height,
+                   int bands, int radius) {
+    double scale = 1.0 / (2 * radius + 1);
+    int last = width - 1;
+    int inner = std::min(radius, last);
+
+    for (int y = 0; y < height; ++y) {
+        const float *p = in + static_cast<size_t>(y) * width * bands;
+        float *q = out + static_cast<size_t>(y) * width * bands;
+
+        for (int b = 0; b < bands; ++b) {
+            double sum = (radius + 1.0) * p[b] +
+                         std::max(0, radius - last) * p[last * bands + b];
+            for (int x = 1; x <= inner; ++x) {
+                sum += p[x * bands + b];
+            }
+
+            for (int x = 0; x < width; ++x) {
+                q[x * bands + b] = static_cast<float>(sum * scale);
+
+                sum += p[std::min(x + radius + 1, last) * bands + b] -
+                       p[std::max(x - radius, 0) * bands + b];
+            }
+        }
+    }
+}
+
+/**
+ * Box blur the columns of an image, one row at a time to stay cache-friendly.
+ */
+void box_blur_columns(const float *in, float *out, int width, int height,
+                      int bands, int radius, std::vector<double> *sums) {
+    double scale = 1.0 / (2 * radius + 1);
+    size_t line = static_cast<size_t>(width) * bands;
+    int last = height - 1;
+    int inner = std::min(radius, last);
+
+    auto row = [&](int y) { return in + static_cast<size_t>(y) * line; };
+
+    sums->assign(line, 0.0);
+    double *sum = sums->data();
+
+    const float *first_row = row(0);
+    const float *last_row = row(last);
+    double repeat = std::max(0, radius - last);
+    for (size_t i = 0; i < line; ++i) {
+        sum[i] = (radius + 1.0) * first_row[i] + repeat * last_row[i];
+    }
+    for (int y = 1; y <= inner; ++y) {
+        const float *p = row(y);
+        for (size_t i = 0; i < line; ++i) {
+            sum[i] += p[i];
+        }
+    }
+
+    for (int y = 0; y < height; ++y) {
+        float *q = out + static_cast<size_t>(y) * line;
+        const float *add = row(std::min(y + radius + 1, last));
+        const float *remove = row(std::max(y - radius, 0));
+
+        for (size_t i = 0; i < line; ++i) {
+            q[i] = static_cast<float>(sum[i] * scale);
+            sum[i] += add[i] - remove[i];
+        }
+    }
+}
+
+/**
+ * Keeps the blurred pixels alive for as long as the output image exists.
+ */
+struct BoxBlurClosure {
+    std::vector<float> pixels;
+};
+
+void box_blur_closure_free(void *data) {
+    delete static_cast<BoxBlurClosure *>(data);
+}
+
+int box_blur_generate(VipsRegion *out_region, void * /*unused*/,
+                      void * /*unused*/, void *b, gboolean * /*unused*/) {
+    auto *closure = static_cast<BoxBlurClosure *>(b);
+    VipsImage *image = out_region->im;
+    VipsRect *r = &out_region->valid;
+
+    size_t line = static_cast<size_t>(image->Xsize) * image->Bands;
+    size_t length = VIPS_REGION_SIZEOF_LINE(out_region);
+
+    for (int y = 0; y < r->height; ++y) {
+        const float *p = closure->pixels.data() +
+                         static_cast<size_t>(r->top + y) * line +
+                         static_cast<size_t>(r->left) * image->Bands;
+
+        std::copy_n(reinterpret_cast<const VipsPel *>(p), length,
+                    VIPS_REGION_ADDR(out_region, r->left, r->top + y));
+    }
+
+    return 0;
+}
+
+}  // namespace
+
+VImage box_gaussblur(const VImage &image, double sigma,
+                     time_t process_timeout) {
+    auto format = image.format();
+    auto in = image.cast(VIPS_FORMAT_FLOAT);
+
+    // Copy to memory evaluates the image, so set up the timeout handler, if
+    // necessary.
+    setup_timeout_handler(in, process_timeout);
+
+    in = in.copy_memory();
+
+    int width = in.width();
+    int height = in.height();
+    int bands = in.bands();
+
+    const auto *data = static_cast<const float *>(in.data());
+    size_t size = static_cast<size_t>(width) * height * bands;
+
+    auto radii = box_radii(sigma);
+
+    std::vector<float> pixels(size);
+    std::vector<float> scratch(size);
+    std::vector<double> sums;
+
+    // Box blurs are separable and commute, so blur all rows first
+    box_blur_rows(data, pixels.data(), width, height, bands, radii[0]);
+    for (int i = 1; i < BOX_PASSES; ++i) {
+        box_blur_rows(pixels.data(), scratch.data(), width, height, bands,
+                      radii[i]);
+        std::swap(pixels, scratch);
+    }
+    for (int radius : radii) {
+        box_blur_columns(pixels.data(), scratch.data(), width, height, bands,
+                         radius, &sums);
+        std::swap(pixels, scratch);
+    }
+
+    VipsImage *input = in.get_image();
+    VipsImage *output = vips_image_new();
+
+    if (vips_image_pipelinev(output, VIPS_DEMAND_STYLE_ANY, input, nullptr) !=
+        0) {
+        VIPS_UNREF(output);
+        throw vips::VError();
+    }
+
+    auto *closure = new BoxBlurClosure{std::move(pixels)};
+    g_object_set_data_full(G_OBJECT(output), "weserv-box-blur", closure,
+                           box_blur_closure_free);
+
+    if (vips_image_generate(output, nullptr, box_blur_generate, nullptr,
+                            nullptr, closure) != 0) {
+        VIPS_UNREF(output);
+        throw vips::VError();
+    }
+
+    return VImage(output).cast(format);
+}
+
+}  // namespace weserv::api::utils
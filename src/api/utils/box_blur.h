@@ -0,0 +1,25 @@
+#pragma once
+
+#include <ctime>
+
+#include <vips/vips8>
+
+namespace weserv::api::utils {
+
+using vips::VImage;
+
+/**
+ * Approximate a Gaussian blur with three successive box blurs, each box blur
+ * is computed with a running sum. Unlike `VImage::gaussblur`, the cost of
+ * this blur doesn't depend on sigma, which makes it a lot faster for large
+ * sigmas.
+ * @note The image is evaluated (and kept in memory) as a whole.
+ * @param image The image to blur.
+ * @param sigma Sigma of the Gaussian.
+ * @param process_timeout The process timeout, in seconds.
+ * @return A new image, in the same format as the input.
+ */
+VImage box_gaussblur(const VImage &image, double sigma,
+                     time_t process_timeout);
+
+}  // namespace weserv::api::utils
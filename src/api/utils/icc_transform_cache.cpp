@@ -0,0 +1,321 @@
+#include "icc_transform_cache.h"
+
+#include "utility.h"
+
+#include <cstring>
+#include <string_view>
+
+// The output profile is loaded with vips_profile_load(), so that the cached
+// transforms match libvips' own icc_transform.
+#if defined(WESERV_HAVE_LCMS2) && VIPS_VERSION_AT_LEAST(8, 11, 0)
+#define WESERV_CACHE_ICC_TRANSFORMS
+#include <lcms2.h>
+#endif
+
+namespace weserv::api::utils {
+
+struct IccTransformCache::Transform {
+#ifdef WESERV_CACHE_ICC_TRANSFORMS
+    ~Transform() {
+        if (handle != nullptr) {
+            cmsDeleteTransform(handle);
+        }
+    }
+
+    /**
+     * The lcms transform, `nullptr` if the profile can't be handled.
+     */
+    cmsHTRANSFORM handle = nullptr;
+#endif
+
+    /**
+     * @return `true` if images can be transformed with this transform.
+     */
+    bool valid() const {
+#ifdef WESERV_CACHE_ICC_TRANSFORMS
+        return handle != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * The embedded profile, used to rule out hash collisions.
+     */
+    std::string profile;
+
+    /**
+     * The output profile, attached to the transformed images.
+     */
+    std::string output_profile;
+
+    /**
+     * Number of output bands.
+     */
+    int bands = 0;
+};
+
+#ifdef WESERV_CACHE_ICC_TRANSFORMS
+namespace {
+
+/**
+ * Keeps the input image and the transform alive for as long as the output
+ * image exists.
+ */
+struct TransformClosure {
+    VImage in;
+    std::shared_ptr<void> transform;
+    cmsHTRANSFORM handle;
+};
+
+void transform_closure_free(void *data) {
+    delete static_cast<TransformClosure *>(data);
+}
+
+int transform_generate(VipsRegion *out_region, void *seq, void * /*unused*/,
+                       void *b, gboolean * /*unused*/) {
+    auto *ir = static_cast<VipsRegion *>(seq);
+    auto *closure = static_cast<TransformClosure *>(b);
+    VipsRect *r = &out_region->valid;
+
+    if (vips_region_prepare(ir, r) != 0) {
+        return -1;
+    }
+
+    for (int y = 0; y < r->height; ++y) {
+        VipsPel *p = VIPS_REGION_ADDR(ir, r->left, r->top + y);
+        VipsPel *q = VIPS_REGION_ADDR(out_region, r->left, r->top + y);
+
+        cmsDoTransform(closure->handle, p, q,
+                       static_cast<cmsUInt32Number>(r->width));
+    }
+
+    return 0;
+}
+
+}  // namespace
+#endif
+
+IccTransformCache::~IccTransformCache() = default;
+
+size_t IccTransformCache::KeyHash::operator()(const Key &key) const {
+    size_t hash = key.profile_hash;
+    hash ^= std::hash<std::string>{}(key.output_profile) + 0x9e3779b9 +
+            (hash << 6) + (hash >> 2);
+    hash ^= std::hash<int>{}(static_cast<int>(key.intent) << 8 | key.bands) +
+            0x9e3779b9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+std::shared_ptr<IccTransformCache::Transform>
+IccTransformCache::create(const Key &key, const void *profile,
+                          size_t length) {
+    auto transform = std::make_shared<Transform>();
+    transform->profile.assign(static_cast<const char *>(profile), length);
+
+#ifdef WESERV_CACHE_ICC_TRANSFORMS
+    cmsHPROFILE in_profile =
+        cmsOpenProfileFromMem(profile, static_cast<cmsUInt32Number>(length));
+    if (in_profile == nullptr) {
+        return transform;
+    }
+
+    cmsUInt32Number in_format = 0;
+    switch (cmsGetColorSpace(in_profile)) {
+        case cmsSigRgbData:
+            in_format = key.bands == 3   ? TYPE_RGB_8
+                        : key.bands == 4 ? TYPE_RGBA_8
+                                         : 0;
+            break;
+        case cmsSigCmykData:
+            in_format = key.bands == 4   ? TYPE_CMYK_8
+                        : key.bands == 5 ? TYPE_CMYKA_8
+                                         : 0;
+            break;
+        default:
+            break;
+    }
+
+    bool has_alpha = in_format == TYPE_RGBA_8 || in_format == TYPE_CMYKA_8;
+    cmsUInt32Number flags = cmsFLAGS_NOCACHE;
+
+#if LCMS_VERSION >= 2080
+    if (has_alpha) {
+        flags |= cmsFLAGS_COPY_ALPHA;
+    }
+#else
+    // The alpha channel can't be copied, let libvips handle it
+    if (has_alpha) {
+        in_format = 0;
+    }
+#endif
+
+    VipsBlob *blob = nullptr;
+    if (in_format != 0 &&
+        vips_profile_load(key.output_profile.c_str(), &blob, nullptr) != 0) {
+        vips_error_clear();
+        in_format = 0;
+    }
+
+    if (in_format != 0) {
+        size_t out_length;
+        const void *out_data = vips_blob_get(blob, &out_length);
+
+        cmsHPROFILE out_profile = cmsOpenProfileFromMem(
+            out_data, static_cast<cmsUInt32Number>(out_length));
+        if (out_profile != nullptr) {
+            transform->output_profile.assign(
+                static_cast<const char *>(out_data), out_length);
+            transform->bands = has_alpha ? 4 : 3;
+            transform->handle = cmsCreateTransform(
+                in_profile, in_format, out_profile,
+                has_alpha ? TYPE_RGBA_8 : TYPE_RGB_8,
+                static_cast<cmsUInt32Number>(key.intent), flags);
+
+            cmsCloseProfile(out_profile);
+        }
+
+        vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+    }
+
+    cmsCloseProfile(in_profile);
+#endif
+
+    return transform;
+}
+
+std::shared_ptr<IccTransformCache::Transform>
+IccTransformCache::find(const Key &key, const void *profile, size_t length) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return nullptr;
+    }
+
+    const auto &transform = it->second->second;
+
+    // A hash collision, don't replace the cached transform
+    if (transform->profile.size() != length ||
+        std::memcmp(transform->profile.data(), profile, length) != 0) {
+        return nullptr;
+    }
+
+    // Move to the front
+    entries_.splice(entries_.begin(), entries_, it->second);
+
+    return transform;
+}
+
+std::shared_ptr<IccTransformCache::Transform>
+IccTransformCache::lookup(const Key &key, const void *profile, size_t length,
+                          size_t max_size) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (index_.count(key) != 0) {
+            auto transform = find(key, profile, length);
+
+            // Failed creations are cached as well, but aren't served from it
+            if (transform != nullptr && transform->valid()) {
+                ++hits_;
+            } else {
+                ++misses_;
+            }
+
+            return transform;
+        }
+    }
+
+    ++misses_;
+
+    // Building a transform is slow, don't block other requests meanwhile
+    auto transform = create(key, profile, length);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Another request may have created the same transform in the meantime
+    if (index_.count(key) != 0) {
+        auto cached = find(key, profile, length);
+        return cached != nullptr ? cached : transform;
+    }
+
+    entries_.emplace_front(key, transform);
+    index_[key] = entries_.begin();
+
+    // Evict the least recently used transforms
+    while (entries_.size() > max_size) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+
+    return transform;
+}
+
+bool IccTransformCache::transform(const VImage &image,
+                                  const std::string &output_profile,
+                                  VipsIntent intent, size_t max_size,
+                                  VImage *out) {
+#ifdef WESERV_CACHE_ICC_TRANSFORMS
+    // Only the built-in sRGB profile is supported as output
+    if (max_size == 0 || output_profile != "srgb" ||
+        image.format() != VIPS_FORMAT_UCHAR ||
+        image.get_typeof(VIPS_META_ICC_NAME) == 0) {
+        return false;
+    }
+
+    size_t length;
+    const void *profile = image.get_blob(VIPS_META_ICC_NAME, &length);
+
+    Key key{std::hash<std::string_view>{}(std::string_view(
+                static_cast<const char *>(profile), length)),
+            output_profile, intent, image.bands()};
+
+    auto transform = lookup(key, profile, length, max_size);
+    if (transform == nullptr || !transform->valid()) {
+        return false;
+    }
+
+    VipsImage *in = image.get_image();
+    VipsImage *output = vips_image_new();
+
+    if (vips_image_pipelinev(output, VIPS_DEMAND_STYLE_THINSTRIP, in,
+                             nullptr) != 0) {
+        VIPS_UNREF(output);
+        throw vips::VError();
+    }
+
+    output->Bands = transform->bands;
+    output->BandFmt = VIPS_FORMAT_UCHAR;
+    output->Type = VIPS_INTERPRETATION_sRGB;
+
+    // The embedded profile has been applied, attach the output profile
+    // instead, just like icc_transform does
+    vips_image_remove(output, VIPS_META_ICC_NAME);
+    vips_image_set_blob_copy(output, VIPS_META_ICC_NAME,
+                             transform->output_profile.data(),
+                             transform->output_profile.size());
+
+    auto *closure = new TransformClosure{image, transform, transform->handle};
+    g_object_set_data_full(G_OBJECT(output), "weserv-icc-transform", closure,
+                           transform_closure_free);
+
+    if (vips_image_generate(output, vips_start_one, transform_generate,
+                            vips_stop_one, in, closure) != 0) {
+        VIPS_UNREF(output);
+        throw vips::VError();
+    }
+
+    *out = VImage(output);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+CacheStats IccTransformCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return {hits_, misses_, entries_.size()};
+}
+
+}  // namespace weserv::api::utils
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <vips/vips8>
+#include <weserv/api_manager.h>
+
+namespace weserv::api::utils {
+
+using vips::VImage;
+
+/**
+ * A thread-safe LRU cache of ready-to-use ICC transforms, keyed by a hash of
+ * the embedded profile, the rendering intent and the output profile.
+ *
+ * Most uploads embed one of a handful of profiles (Display P3, Adobe RGB,
+ * common CMYK profiles, etc.). libvips builds a lcms transform from scratch
+ * on every `icc_transform` call, which can be avoided by keeping the
+ * transforms around across requests.
+ *
+ * @note Only 8-bit RGB(A) and CMYK(A) images can be transformed from the
+ *       cache, anything else should fall back to `VImage::icc_transform`.
+ *       The same applies when weserv is built without lcms2 or against
+ *       libvips < 8.11.
+ */
+class IccTransformCache {
+ public:
+    IccTransformCache() = default;
+
+    ~IccTransformCache();
+
+    IccTransformCache(const IccTransformCache &) = delete;
+    IccTransformCache &operator=(const IccTransformCache &) = delete;
+
+    /**
+     * Transform an image with an embedded profile with a cached transform.
+     * @param image The image to transform.
+     * @param output_profile The output profile, only `srgb` is supported.
+     *        libvips' own sRGB profile is used and attached to the output,
+     *        just like `VImage::icc_transform` does.
+     * @param intent The rendering intent.
+     * @param max_size The maximum number of transforms to keep around, set to
+     *        `0` to disable the cache.
+     * @param out Receives the transformed image.
+     * @return `false` if the image couldn't be transformed from the cache.
+     */
+    bool transform(const VImage &image, const std::string &output_profile,
+                   VipsIntent intent, size_t max_size, VImage *out);
+
+    /**
+     * @return the statistics of this cache.
+     */
+    CacheStats stats() const;
+
+ private:
+    struct Transform;
+
+    struct Key {
+        size_t profile_hash;
+        std::string output_profile;
+        VipsIntent intent;
+        int bands;
+
+        bool operator==(const Key &other) const {
+            return profile_hash == other.profile_hash &&
+                   output_profile == other.output_profile &&
+                   intent == other.intent && bands == other.bands;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+
+    using Entry = std::pair<Key, std::shared_ptr<Transform>>;
+
+    /**
+     * Find a cached transform and mark it as the most recently used.
+     * @note The mutex must be held.
+     * @return The transform, or `nullptr` if it isn't cached (or if the key
+     *         collides with a different profile).
+     */
+    std::shared_ptr<Transform> find(const Key &key, const void *profile,
+                                    size_t length);
+
+    /**
+     * Find (or create) a transform and mark it as the most recently used.
+     * The transform is created without holding the mutex.
+     * @return The transform, or `nullptr` if the profile can't be handled.
+     */
+    std::shared_ptr<Transform> lookup(const Key &key, const void *profile,
+                                      size_t length, size_t max_size);
+
+    /**
+     * Build a new transform.
+     * @return The transform, its handle is `nullptr` if the profile can't be
+     *         handled (we cache that as well).
+     */
+    static std::shared_ptr<Transform>
+    create(const Key &key, const void *profile, size_t length);
+
+    /**
+     * Guards the LRU list and its index.
+     */
+    mutable std::mutex mutex_;
+
+    /**
+     * Cached transforms, the most recently used in front.
+     */
+    std::list<Entry> entries_;
+
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+
+    std::atomic<uint64_t> hits_{0};
+
+    std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace weserv::api::utils
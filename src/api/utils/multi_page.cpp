@@ -0,0 +1,181 @@
+#include "multi_page.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace weserv::api::utils {
+
+namespace {
+
+/**
+ * Keeps the input image and the page geometry alive for as long as the output
+ * image exists.
+ */
+struct MultiPageClosure {
+    VImage in;
+
+    /**
+     * Position of each source page within the output page, negative when
+     * cropping.
+     */
+    int left;
+    int top;
+
+    int page_height;
+    int out_page_height;
+
+    /**
+     * A single pixel in the format of the image, empty when the output pages
+     * are entirely covered by the source pages.
+     */
+    std::vector<VipsPel> background;
+};
+
+void multi_page_closure_free(void *data) {
+    delete static_cast<MultiPageClosure *>(data);
+}
+
+int multi_page_generate(VipsRegion *out_region, void *seq, void * /*unused*/,
+                        void *b, gboolean * /*unused*/) {
+    auto *ir = static_cast<VipsRegion *>(seq);
+    auto *closure = static_cast<MultiPageClosure *>(b);
+    VipsRect *r = &out_region->valid;
+
+    size_t pel_size = VIPS_IMAGE_SIZEOF_PEL(out_region->im);
+
+    int first_page = r->top / closure->out_page_height;
+    int last_page = (VIPS_RECT_BOTTOM(r) - 1) / closure->out_page_height;
+
+    for (int page = first_page; page <= last_page; ++page) {
+        int page_top = page * closure->out_page_height;
+
+        // The part of the output region within this page
+        VipsRect area;
+        area.left = r->left;
+        area.top = std::max(r->top, page_top);
+        area.width = r->width;
+        area.height =
+            std::min(VIPS_RECT_BOTTOM(r), page_top + closure->out_page_height) -
+            area.top;
+
+        // The source page, in output coordinates
+        VipsRect source;
+        source.left = closure->left;
+        source.top = page_top + closure->top;
+        source.width = closure->in.width();
+        source.height = closure->page_height;
+
+        VipsRect overlap;
+        vips_rect_intersectrect(&area, &source, &overlap);
+
+        if (!vips_rect_equalsrect(&area, &overlap)) {
+            for (int y = 0; y < area.height; ++y) {
+                VipsPel *q =
+                    VIPS_REGION_ADDR(out_region, area.left, area.top + y);
+
+                for (int x = 0; x < area.width; ++x) {
+                    std::memcpy(q, closure->background.data(), pel_size);
+                    q += pel_size;
+                }
+            }
+        }
+
+        if (vips_rect_isempty(&overlap)) {
+            continue;
+        }
+
+        // Map the overlap to the source image
+        VipsRect need;
+        need.left = overlap.left - closure->left;
+        need.top = overlap.top - source.top + page * closure->page_height;
+        need.width = overlap.width;
+        need.height = overlap.height;
+
+        if (vips_region_prepare(ir, &need) != 0) {
+            return -1;
+        }
+
+        for (int y = 0; y < need.height; ++y) {
+            VipsPel *p = VIPS_REGION_ADDR(ir, need.left, need.top + y);
+            VipsPel *q =
+                VIPS_REGION_ADDR(out_region, overlap.left, overlap.top + y);
+
+            std::memcpy(q, p, pel_size * need.width);
+        }
+    }
+
+    return 0;
+}
+
+VImage multi_page(const VImage &image, int left, int top, int width,
+                  int height, std::vector<VipsPel> background, int n_pages,
+                  int page_height) {
+    VipsImage *in = image.get_image();
+    VipsImage *output = vips_image_new();
+
+    if (vips_image_pipelinev(output, VIPS_DEMAND_STYLE_THINSTRIP, in,
+                             nullptr) != 0) {
+        VIPS_UNREF(output);
+        throw vips::VError();
+    }
+
+    output->Xsize = width;
+    output->Ysize = height * n_pages;
+
+    vips_image_set_int(output, VIPS_META_PAGE_HEIGHT, height);
+
+    auto *closure = new MultiPageClosure{
+        image, left, top, page_height, height, std::move(background)};
+    g_object_set_data_full(G_OBJECT(output), "weserv-multi-page", closure,
+                           multi_page_closure_free);
+
+    if (vips_image_generate(output, vips_start_one, multi_page_generate,
+                            vips_stop_one, in, closure) != 0) {
+        VIPS_UNREF(output);
+        throw vips::VError();
+    }
+
+    return VImage(output);
+}
+
+}  // namespace
+
+VImage crop_multi_page(const VImage &image, int left, int top, int width,
+                       int height, int n_pages, int page_height) {
+    if (top == 0 && height == page_height) {
+        // Fast path; no need to adjust the height of the multi-page image
+        return image.extract_area(left, 0, width, image.height());
+    }
+
+    // The crop area lies within each page, so no background is needed
+    return multi_page(image, -left, -top, width, height, {}, n_pages,
+                      page_height);
+}
+
+VImage embed_multi_page(const VImage &image, int left, int top, int width,
+                        int height, const std::vector<double> &background,
+                        int n_pages, int page_height) {
+    if (top == 0 && height == page_height) {
+        // Fast path; no need to adjust the height of the multi-page image
+        return image.embed(left, 0, width, image.height(),
+                           VImage::option()
+                               ->set("extend", VIPS_EXTEND_BACKGROUND)
+                               ->set("background", background));
+    }
+
+    // Render the background to a single pixel in the format of the image
+    size_t size;
+    void *pixel = image.new_from_image(background)
+                      .extract_area(0, 0, 1, 1)
+                      .write_to_memory(&size);
+
+    std::vector<VipsPel> background_pixel(static_cast<VipsPel *>(pixel),
+                                          static_cast<VipsPel *>(pixel) +
+                                              size);
+    g_free(pixel);
+
+    return multi_page(image, left, top, width, height,
+                      std::move(background_pixel), n_pages, page_height);
+}
+
+}  // namespace weserv::api::utils
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include <vips/vips8>
+
+namespace weserv::api::utils {
+
+using vips::VImage;
+
+/**
+ * Crop each page of a multi-page image to the same area.
+ * @param image The source image.
+ * @param left Crop x-position.
+ * @param top Crop y-position.
+ * @param width Crop width.
+ * @param height Crop height.
+ * @param n_pages Number of pages.
+ * @param page_height Page height.
+ * @return A new image.
+ */
+VImage crop_multi_page(const VImage &image, int left, int top, int width,
+                       int height, int n_pages, int page_height);
+
+/**
+ * Embed each page of a multi-page image within a larger page, the area
+ * outside the page is filled with the background color.
+ * @param image The source image.
+ * @param left Embed x-position.
+ * @param top Embed y-position.
+ * @param width Embed width.
+ * @param height Embed height.
+ * @param background Embed background color, with the same number of bands as
+ *        the image.
+ * @param n_pages Number of pages.
+ * @param page_height Page height.
+ * @return A new image.
+ */
+VImage embed_multi_page(const VImage &image, int left, int top, int width,
+                        int height, const std::vector<double> &background,
+                        int n_pages, int page_height);
+
+}  // namespace weserv::api::utils
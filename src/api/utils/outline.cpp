@@ -0,0 +1,190 @@
+#include "outline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace weserv::api::utils {
+
+namespace {
+
+/**
+ * Number of sub-scanlines per row, for vertical anti-aliasing.
+ */
+constexpr int SUBSAMPLES = 16;
+
+/**
+ * Find the spans covered by an outline at the given (fractional) scanline.
+ */
+void outline_spans(const Outline &outline, double y,
+                   std::vector<std::pair<double, int>> *crossings,
+                   std::vector<std::pair<double, double>> *spans) {
+    spans->clear();
+
+    if (outline.ellipse) {
+        double dy = (y - outline.cy) / outline.ry;
+        if (dy > -1.0 && dy < 1.0) {
+            double half = outline.rx * std::sqrt(1.0 - dy * dy);
+            spans->emplace_back(outline.cx - half, outline.cx + half);
+        }
+        return;
+    }
+
+    crossings->clear();
+
+    const auto &points = outline.points;
+    for (size_t i = 0, j = points.size() - 1; i < points.size(); j = i++) {
+        const auto &p0 = points[j];
+        const auto &p1 = points[i];
+
+        // Half-open, so that shared vertices are counted once
+        if ((p0.y <= y && y < p1.y) || (p1.y <= y && y < p0.y)) {
+            double x = p0.x + (y - p0.y) * (p1.x - p0.x) / (p1.y - p0.y);
+            crossings->emplace_back(x, p1.y > p0.y ? 1 : -1);
+        }
+    }
+
+    std::sort(crossings->begin(), crossings->end());
+
+    // Non-zero fill rule
+    int winding = 0;
+    double start = 0.0;
+    for (const auto &crossing : *crossings) {
+        int previous = winding;
+        winding += crossing.second;
+
+        if (previous == 0 && winding != 0) {
+            start = crossing.first;
+        } else if (previous != 0 && winding == 0) {
+            spans->emplace_back(start, crossing.first);
+        }
+    }
+}
+
+/**
+ * Scratch buffers, reused for all rows of a region.
+ */
+struct RowBuffers {
+    /**
+     * Coverage deltas, accumulated from left to right. The extra element
+     * receives the deltas beyond the right edge.
+     */
+    std::vector<float> deltas;
+
+    /**
+     * Partial coverage of the pixels at the ends of the spans.
+     */
+    std::vector<float> partial;
+
+    std::vector<std::pair<double, int>> crossings;
+    std::vector<std::pair<double, double>> spans;
+};
+
+/**
+ * Compute the coverage of a single row of an outline.
+ */
+void rasterize_row(const Outline &outline, int y, int left, int width,
+                   RowBuffers *buffers, VipsPel *out) {
+    auto &deltas = buffers->deltas;
+    auto &partial = buffers->partial;
+    auto &spans = buffers->spans;
+
+    deltas.assign(width + 1, 0.0F);
+    partial.assign(width, 0.0F);
+
+    double right = left + width;
+    float weight = 1.0F / SUBSAMPLES;
+
+    for (int s = 0; s < SUBSAMPLES; ++s) {
+        outline_spans(outline, y + (s + 0.5) / SUBSAMPLES,
+                      &buffers->crossings, &spans);
+
+        for (const auto &span : spans) {
+            double x0 = std::max(span.first, static_cast<double>(left)) - left;
+            double x1 = std::min(span.second, right) - left;
+            if (x1 <= x0) {
+                continue;
+            }
+
+            auto i0 = static_cast<int>(x0);
+            auto i1 = static_cast<int>(x1);
+
+            if (i0 == i1) {
+                partial[i0] += static_cast<float>(x1 - x0) * weight;
+                continue;
+            }
+
+            // Fractional coverage of the pixels at both ends, the pixels in
+            // between are fully covered
+            partial[i0] += static_cast<float>(i0 + 1 - x0) * weight;
+            deltas[i0 + 1] += weight;
+            deltas[i1] -= weight;
+            if (i1 < width) {
+                partial[i1] += static_cast<float>(x1 - i1) * weight;
+            }
+        }
+    }
+
+    float coverage = 0.0F;
+    for (int x = 0; x < width; ++x) {
+        coverage += deltas[x];
+
+        float value = std::min(std::max(coverage + partial[x], 0.0F), 1.0F);
+        out[x] = static_cast<VipsPel>(value * 255.0F + 0.5F);
+    }
+}
+
+struct OutlineClosure {
+    Outline outline;
+    int page_height;
+};
+
+void outline_closure_free(void *data) {
+    delete static_cast<OutlineClosure *>(data);
+}
+
+int outline_generate(VipsRegion *out_region, void * /*unused*/,
+                     void * /*unused*/, void *b, gboolean * /*unused*/) {
+    auto *closure = static_cast<OutlineClosure *>(b);
+    VipsRect *r = &out_region->valid;
+
+    RowBuffers buffers;
+
+    for (int y = 0; y < r->height; ++y) {
+        rasterize_row(closure->outline, (r->top + y) % closure->page_height,
+                      r->left, r->width, &buffers,
+                      VIPS_REGION_ADDR(out_region, r->left, r->top + y));
+    }
+
+    return 0;
+}
+
+}  // namespace
+
+VImage rasterize_outline(const Outline &outline, int width, int page_height,
+                         int n_pages) {
+    VipsImage *output = vips_image_new();
+
+    vips_image_init_fields(output, width, page_height * n_pages, 1,
+                           VIPS_FORMAT_UCHAR, VIPS_CODING_NONE,
+                           VIPS_INTERPRETATION_B_W, 1.0, 1.0);
+
+    if (vips_image_pipelinev(output, VIPS_DEMAND_STYLE_ANY, nullptr) != 0) {
+        VIPS_UNREF(output);
+        throw vips::VError();
+    }
+
+    auto *closure = new OutlineClosure{outline, page_height};
+    g_object_set_data_full(G_OBJECT(output), "weserv-outline", closure,
+                           outline_closure_free);
+
+    if (vips_image_generate(output, nullptr, outline_generate, nullptr,
+                            nullptr, closure) != 0) {
+        VIPS_UNREF(output);
+        throw vips::VError();
+    }
+
+    return VImage(output);
+}
+
+}  // namespace weserv::api::utils
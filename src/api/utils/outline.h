@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include <vips/vips8>
+
+namespace weserv::api::utils {
+
+using vips::VImage;
+
+/**
+ * A closed shape, either an ellipse or a polygon (non-zero fill rule), in
+ * pixel coordinates.
+ */
+struct Outline {
+    struct Point {
+        double x, y;
+    };
+
+    /**
+     * Is this outline an ellipse? Otherwise it's a polygon.
+     */
+    bool ellipse = false;
+
+    /**
+     * The center and radii of the ellipse.
+     */
+    double cx = 0.0;
+    double cy = 0.0;
+    double rx = 0.0;
+    double ry = 0.0;
+
+    /**
+     * The vertices of the polygon.
+     */
+    std::vector<Point> points;
+};
+
+/**
+ * Rasterize the coverage of an outline into an anti-aliased, single-band
+ * 8-bit mask. The coverage is computed on demand, for each tile that is
+ * requested, with 16 sub-scanlines per row and exact horizontal coverage.
+ * @param outline The outline of each page.
+ * @param width Mask width.
+ * @param page_height Page height.
+ * @param n_pages Number of pages, the outline is repeated on every page.
+ * @return A new image.
+ */
+VImage rasterize_outline(const Outline &outline, int width, int page_height,
+                         int n_pages);
+
+}  // namespace weserv::api::utils
@@ -4,9 +4,12 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <ctime>
+#include <initializer_list>
 #include <sstream>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include <vips/vips8>
@@ -47,6 +50,29 @@ inline bool has_profile(const VImage &image) {
     return image.get_typeof(VIPS_META_ICC_NAME) != 0;
 }
 
+/**
+ * Copy a set of metadata fields from one image to another, e.g. onto an image
+ * that was decoded by one of our own codecs.
+ * @note The target image should not be shared, i.e. it should be a fresh
+ *       image or a private copy.
+ * @param from The image to copy the fields from.
+ * @param to The image to copy the fields to.
+ * @param fields The names of the fields, missing fields are ignored.
+ */
+inline void copy_fields(const VImage &from, const VImage &to,
+                        std::initializer_list<const char *> fields) {
+    for (const auto *field : fields) {
+        if (from.get_typeof(field) == 0) {
+            continue;
+        }
+
+        GValue value = {0};
+        vips_image_get(from.get_image(), field, &value);
+        vips_image_set(to.get_image(), field, &value);
+        g_value_unset(&value);
+    }
+}
+
 /**
  * Does this image have a non-default density?
  * @param image The source image.
@@ -322,6 +348,48 @@ inline std::string image_type_id(const ImageType &image_type) {
     // LCOV_EXCL_STOP
 }
 
+/**
+ * Is the loader of this image type enabled?
+ * @note Loaders of unknown image types (i.e. those without an `ImageType`)
+ *       can't be disabled.
+ * @param msk The loaders mask.
+ * @param image_type The image type enum.
+ * @return A bool indicating if the loader is enabled.
+ */
+inline bool is_loader_enabled(const uintptr_t msk,
+                              const ImageType &image_type) {
+    if (image_type == ImageType::Unknown) {
+        return true;
+    }
+
+    // The loader flags follow the order of the image type enum
+    return (msk & (1U << static_cast<int>(image_type))) != 0;
+}
+
+/**
+ * Get the supported loaders as a comma-separated string.
+ * @param msk The loaders mask.
+ * @return The supported loaders as a comma-separated string.
+ */
+inline std::string supported_loaders_string(const uintptr_t msk) {
+    std::string result;
+
+    for (int i = 0; i <= 8; ++i) {
+        auto image_type = static_cast<ImageType>(i);
+        if (is_loader_enabled(msk, image_type)) {
+            std::string loader = image_type_id(image_type);
+
+            if (result.empty()) {
+                result = loader;
+            } else {
+                result += ", " + loader;
+            }
+        }
+    }
+
+    return result;
+}
+
 /**
  * Does this image type support multiple pages?
  * @param image_type Image type to check.
@@ -397,37 +465,149 @@ calculate_position(const int in_width, const int in_height, const int out_width,
 }
 
 /**
- * Split/crop each frame and reassemble.
+ * Search for the bounding box of the area that differs from the given
+ * background.
  * @param image The source image.
- * @param left Crop x-position.
- * @param top Crop y-position.
- * @param width Crop width.
- * @param height Crop height.
- * @param n_pages Number of pages.
+ * @param threshold Background / object threshold (in the range of 1 - 254).
+ * @param background The background color, in the bands of the image
+ *        (without alpha).
+ * @return The (left, top, width, height) of the bounding box, width and
+ *         height are 0 when nothing could be found.
+ */
+inline std::tuple<int, int, int, int>
+find_trim(const VImage &image, int threshold,
+          const std::vector<double> &background) {
+    if (image.width() < 3 || image.height() < 3) {
+        return std::tuple{0, 0, 0, 0};
+    }
+
+    // Scale up 8-bit values to match 16-bit input image
+    if (is_16_bit(image.interpretation())) {
+        threshold = threshold * 256;
+    }
+
+    int left, top, width, height;
+    left = image.find_trim(&top, &width, &height,
+                           VImage::option()
+                               ->set("threshold", threshold)
+                               ->set("background", background));
+
+    return std::tuple{left, top, width, height};
+}
+
+/**
+ * Search for the bounding box of the non-background area.
+ * @param image The source image.
+ * @param threshold Background / object threshold (in the range of 1 - 254).
+ * @return The (left, top, width, height) of the bounding box, width and
+ *         height are 0 when nothing could be found.
+ */
+inline std::tuple<int, int, int, int> find_trim(const VImage &image,
+                                                int threshold) {
+    if (image.width() < 3 || image.height() < 3) {
+        return std::tuple{0, 0, 0, 0};
+    }
+
+    // Find the value of the pixel at (0, 0), `find_trim` search for all pixels
+    // significantly different from this
+    auto background = image.extract_area(0, 0, 1, 1);
+
+    // Note: If the image has alpha, we'll need to flatten before `getpoint`
+    // to get a correct background value
+    if (image.has_alpha()) {
+        background = background.flatten();
+    }
+
+    return find_trim(image, threshold, background(0, 0));
+}
+
+/**
+ * Reassemble a multi-page image from a subset of its pages.
+ * @param image The source image.
+ * @param pages The pages to keep, in ascending order.
  * @param page_height Page height.
  * @return A new image.
  */
-inline VImage crop_multi_page(const VImage &image, int left, int top, int width,
-                              int height, int n_pages, int page_height) {
-    if (top == 0 && height == page_height) {
-        // Fast path; no need to adjust the height of the multi-page image
-        return image.extract_area(left, 0, width, image.height());
+inline VImage select_pages(const VImage &image, const std::vector<int> &pages,
+                           int page_height) {
+    std::vector<VImage> frames;
+    frames.reserve(pages.size());
+
+    for (int page : pages) {
+        frames.push_back(image.extract_area(0, page_height * page,
+                                            image.width(), page_height));
     }
 
-    std::vector<VImage> pages;
-    pages.reserve(n_pages);
+    // Reassemble the frames into a tall, thin image
+    return VImage::arrayjoin(frames, VImage::option()->set("across", 1));
+}
 
-    // Split the image into cropped frames
-    for (int i = 0; i < n_pages; i++) {
-        pages.push_back(
-            image.extract_area(left, page_height * i + top, width, height));
+/**
+ * Resolve the frame delays after dropping frames, a kept frame is displayed
+ * for as long as the frames it replaces.
+ * @param delays The frame delays in milliseconds.
+ * @param pages The pages to keep, in ascending order.
+ * @param n_pages The original number of pages.
+ * @return The delays of the kept frames.
+ */
+inline std::vector<int> merge_delays(const std::vector<int> &delays,
+                                     const std::vector<int> &pages,
+                                     int n_pages) {
+    std::vector<int> merged;
+    merged.reserve(pages.size());
+
+    for (size_t i = 0; i != pages.size(); ++i) {
+        int end = i + 1 < pages.size() ? pages[i + 1] : n_pages;
+
+        int delay = 0;
+        for (int page = pages[i]; page < end; ++page) {
+            // Browsers default to 100ms for missing delays
+            delay += static_cast<size_t>(page) < delays.size() ? delays[page]
+                                                               : 100;
+        }
+
+        merged.push_back(delay);
     }
 
-    // Reassemble the frames into a tall, thin image
-    VImage assembled =
-        VImage::arrayjoin(pages, VImage::option()->set("across", 1));
+    return merged;
+}
+
+/**
+ * Merge consecutive identical pages of a multi-page image. The image is
+ * rendered to memory in order to compare the pages.
+ * @param image The source image.
+ * @param page_height Page height.
+ * @return A new image, with the delays of merged pages summed.
+ */
+inline VImage merge_duplicate_pages(const VImage &image, int page_height) {
+    VImage memory = image.copy_memory();
+
+    int n_pages = memory.height() / page_height;
+    size_t page_size =
+        VIPS_IMAGE_SIZEOF_LINE(memory.get_image()) * page_height;
+    const auto *data = VIPS_IMAGE_ADDR(memory.get_image(), 0, 0);
+
+    std::vector<int> pages{0};
+    for (int i = 1; i < n_pages; ++i) {
+        if (std::memcmp(data + pages.back() * page_size, data + i * page_size,
+                        page_size) != 0) {
+            pages.push_back(i);
+        }
+    }
+
+    if (static_cast<int>(pages.size()) == n_pages) {
+        return memory;
+    }
+
+    std::vector<int> delays = memory.get_typeof("delay") != 0
+                                  ? memory.get_array_int("delay")
+                                  : std::vector<int>{};
+
+    // Attaching metadata, need to copy the image
+    auto copy = select_pages(memory, pages, page_height).copy();
+    copy.set("delay", merge_delays(delays, pages, n_pages));
 
-    return assembled;
+    return copy;
 }
 
 /**
@@ -12,6 +12,12 @@ const u_char CONTENT_DISPOSITION_LOWCASE[] = "content-disposition";
 const ngx_str_t LINK = ngx_string("Link");
 const u_char LINK_LOWCASE[] = "link";
 
+const ngx_str_t QUALITY = ngx_string("X-Weserv-Quality");
+const u_char QUALITY_LOWCASE[] = "x-weserv-quality";
+
+const ngx_str_t VARY = ngx_string("Vary");
+const u_char VARY_LOWCASE[] = "vary";
+
 ngx_int_t set_expires_header(ngx_http_request_t *r, time_t max_age) {
     ngx_table_elt_t *e = r->headers_out.expires;
     if (e == nullptr) {
@@ -213,4 +219,44 @@ ngx_int_t set_link_header(ngx_http_request_t *r, const ngx_str_t &url) {
     return NGX_OK;
 }
 
+ngx_int_t set_quality_header(ngx_http_request_t *r, int quality) {
+    auto *p = reinterpret_cast<u_char *>(ngx_pnalloc(r->pool, NGX_INT_T_LEN));
+    if (p == nullptr) {
+        return NGX_ERROR;
+    }
+
+    auto *h = reinterpret_cast<ngx_table_elt_t *>(
+        ngx_list_push(&r->headers_out.headers));
+    if (h == nullptr) {
+        return NGX_ERROR;
+    }
+
+    h->key = QUALITY;
+    h->lowcase_key = const_cast<u_char *>(QUALITY_LOWCASE);
+    h->hash = ngx_hash_key(const_cast<u_char *>(QUALITY_LOWCASE),
+                           sizeof(QUALITY_LOWCASE) - 1);
+
+    h->value.data = p;
+    h->value.len = ngx_sprintf(p, "%d", quality) - p;
+
+    return NGX_OK;
+}
+
+ngx_int_t set_vary_accept_header(ngx_http_request_t *r) {
+    auto *h = reinterpret_cast<ngx_table_elt_t *>(
+        ngx_list_push(&r->headers_out.headers));
+    if (h == nullptr) {
+        return NGX_ERROR;
+    }
+
+    h->key = VARY;
+    h->lowcase_key = const_cast<u_char *>(VARY_LOWCASE);
+    h->hash = ngx_hash_key(const_cast<u_char *>(VARY_LOWCASE),
+                           sizeof(VARY_LOWCASE) - 1);
+
+    ngx_str_set(&h->value, "Accept");
+
+    return NGX_OK;
+}
+
 }  // namespace weserv::nginx
@@ -24,4 +24,8 @@ ngx_int_t set_location_header(ngx_http_request_t *r, ngx_str_t *value);
 
 ngx_int_t set_link_header(ngx_http_request_t *r, const ngx_str_t &url);
 
+ngx_int_t set_quality_header(ngx_http_request_t *r, int quality);
+
+ngx_int_t set_vary_accept_header(ngx_http_request_t *r);
+
 }  // namespace weserv::nginx
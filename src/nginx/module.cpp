@@ -9,6 +9,7 @@
 
 #include <weserv/enums.h>
 
+using ::weserv::api::enums::Loader;
 using ::weserv::api::enums::Output;
 using ::weserv::api::utils::Status;
 
@@ -50,6 +51,12 @@ ngx_int_t ngx_weserv_postconfiguration(ngx_conf_t *cf);
  */
 ngx_int_t ngx_weserv_response_length_variable(
     ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
+ngx_int_t ngx_weserv_icc_cache_variable(ngx_http_request_t *r,
+                                        ngx_http_variable_value_t *v,
+                                        uintptr_t data);
+ngx_int_t ngx_weserv_auto_format_variable(ngx_http_request_t *r,
+                                          ngx_http_variable_value_t *v,
+                                          uintptr_t data);
 
 ngx_http_output_header_filter_pt ngx_http_next_header_filter;
 ngx_http_output_body_filter_pt ngx_http_next_body_filter;
@@ -71,6 +78,19 @@ ngx_conf_bitmask_t ngx_weserv_savers[] = {
     {ngx_null_string, 0}  // last entry
 };
 
+ngx_conf_bitmask_t ngx_weserv_loaders[] = {
+    {ngx_string("jpeg"), static_cast<ngx_uint_t>(Loader::Jpeg)},
+    {ngx_string("png"), static_cast<ngx_uint_t>(Loader::Png)},
+    {ngx_string("webp"), static_cast<ngx_uint_t>(Loader::Webp)},
+    {ngx_string("tiff"), static_cast<ngx_uint_t>(Loader::Tiff)},
+    {ngx_string("gif"), static_cast<ngx_uint_t>(Loader::Gif)},
+    {ngx_string("svg"), static_cast<ngx_uint_t>(Loader::Svg)},
+    {ngx_string("pdf"), static_cast<ngx_uint_t>(Loader::Pdf)},
+    {ngx_string("heif"), static_cast<ngx_uint_t>(Loader::Heif)},
+    {ngx_string("magick"), static_cast<ngx_uint_t>(Loader::Magick)},
+    {ngx_null_string, 0}  // last entry
+};
+
 ngx_conf_num_bounds_t ngx_weserv_quality_bounds = {
     ngx_conf_check_num_bounds, 1, 100
 };
@@ -83,6 +103,10 @@ ngx_conf_num_bounds_t ngx_weserv_gif_effort_bounds = {
     ngx_conf_check_num_bounds, 1, 10
 };
 
+ngx_conf_num_bounds_t ngx_weserv_png_effort_bounds = {
+    ngx_conf_check_num_bounds, 1, 10
+};
+
 ngx_conf_num_bounds_t ngx_weserv_webp_effort_bounds = {
     ngx_conf_check_num_bounds, 0, 6
 };
@@ -168,6 +192,22 @@ ngx_command_t ngx_weserv_commands[] = {
      offsetof(ngx_weserv_loc_conf_t, api_conf.savers),
      &ngx_weserv_savers},
 
+    {ngx_string("weserv_auto_format"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_FLAG,
+     ngx_conf_set_flag_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.auto_format),
+     nullptr},
+
+    {ngx_string("weserv_loaders"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_1MORE,
+     ngx_conf_set_bitmask_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.loaders),
+     &ngx_weserv_loaders},
+
     {ngx_string("weserv_process_timeout"),
      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
          NGX_CONF_TAKE1,
@@ -256,6 +296,14 @@ ngx_command_t ngx_weserv_commands[] = {
      offsetof(ngx_weserv_loc_conf_t, api_conf.gif_effort),
      &ngx_weserv_gif_effort_bounds},
 
+    {ngx_string("weserv_png_effort"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.png_effort),
+     &ngx_weserv_png_effort_bounds},
+
     {ngx_string("weserv_webp_effort"),
      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
          NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
@@ -280,6 +328,77 @@ ngx_command_t ngx_weserv_commands[] = {
      offsetof(ngx_weserv_loc_conf_t, api_conf.fail_on_error),
      nullptr},
 
+    {ngx_string("weserv_icc_cache_size"),
+     NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.icc_cache_size),
+     nullptr},
+
+    {ngx_string("weserv_frame_threads"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.frame_threads),
+     nullptr},
+
+    {ngx_string("weserv_merge_frames"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_FLAG,
+     ngx_conf_set_flag_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.merge_frames),
+     nullptr},
+
+    {ngx_string("weserv_fast_blur_sigma"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.fast_blur_sigma),
+     nullptr},
+
+    {ngx_string("weserv_gif_threads"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.gif_threads),
+     nullptr},
+
+    {ngx_string("weserv_gif_global_palette"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_FLAG,
+     ngx_conf_set_flag_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.gif_global_palette),
+     nullptr},
+
+    {ngx_string("weserv_jpeg_threads"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.jpeg_threads),
+     nullptr},
+
+    {ngx_string("weserv_png_threads"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.png_threads),
+     nullptr},
+
+    {ngx_string("weserv_preset"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE2,
+     ngx_conf_set_keyval_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, presets),
+     nullptr},
+
     ngx_null_command  // last entry
 };
 
@@ -289,6 +408,18 @@ ngx_http_variable_t ngx_weserv_vars[] = {
      ngx_weserv_response_length_variable, 0,
      NGX_HTTP_VAR_NOCACHEABLE, 0},
 
+    {ngx_string("weserv_icc_cache_hits"), nullptr,
+     ngx_weserv_icc_cache_variable, 0,
+     NGX_HTTP_VAR_NOCACHEABLE, 0},
+
+    {ngx_string("weserv_icc_cache_misses"), nullptr,
+     ngx_weserv_icc_cache_variable, 1,
+     NGX_HTTP_VAR_NOCACHEABLE, 0},
+
+    {ngx_string("weserv_auto_format"), nullptr,
+     ngx_weserv_auto_format_variable, 0,
+     0, 0},
+
     ngx_http_null_variable  // last entry
 };
 // clang-format on
@@ -328,6 +459,70 @@ ngx_int_t ngx_weserv_response_length_variable(ngx_http_request_t *r,
     return NGX_OK;
 }
 
+ngx_int_t ngx_weserv_icc_cache_variable(ngx_http_request_t *r,
+                                        ngx_http_variable_value_t *v,
+                                        uintptr_t data) {
+    v->valid = 1;
+    // The counters change with every request, as the NGX_HTTP_VAR_NOCACHEABLE
+    // flag of these variables says
+    v->no_cacheable = 1;
+    v->not_found = 0;
+
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    if (mc == nullptr || mc->weserv == nullptr) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    u_char *p = reinterpret_cast<u_char *>(ngx_pnalloc(r->pool, NGX_INT64_LEN));
+    if (p == nullptr) {
+        return NGX_ERROR;
+    }
+
+    v->data = p;
+
+    // The statistics are per worker process
+    auto stats = mc->weserv->icc_cache_stats();
+    p = ngx_sprintf(p, "%uL", data == 0 ? stats.hits : stats.misses);
+
+    v->len = p - v->data;
+
+    return NGX_OK;
+}
+
+ngx_int_t ngx_weserv_auto_format_variable(ngx_http_request_t *r,
+                                          ngx_http_variable_value_t *v,
+                                          uintptr_t data) {
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_weserv_module));
+
+    if (lc == nullptr ||
+        !is_auto_format_needed(r, lc->api_conf.auto_format == 1)) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    // The negotiable outputs the client accepts, which (together with the
+    // image itself) determine the negotiated output
+    uintptr_t accepted = parse_accept_header(r) & lc->api_conf.savers;
+    bool avif = (accepted & static_cast<uintptr_t>(Output::Avif)) != 0;
+    bool webp = (accepted & static_cast<uintptr_t>(Output::Webp)) != 0;
+
+    v->data = (u_char *)(avif && webp ? "avif,webp"
+                         : avif       ? "avif"
+                         : webp       ? "webp"
+                                      : "");
+    v->len = ngx_strlen(v->data);
+
+    return NGX_OK;
+}
+
 /**
  * The module context contains initialization and configuration callbacks.
  */
@@ -390,7 +585,10 @@ void *ngx_weserv_create_main_conf(ngx_conf_t *cf) {
  * Create weserv module's location config.
  */
 void *ngx_weserv_create_loc_conf(ngx_conf_t *cf) {
-    auto *lc = new (cf->pool) ngx_weserv_loc_conf_t;
+    // The API configuration owns the parsed presets, so make sure its
+    // destructor runs
+    auto *lc =
+        register_pool_cleanup(cf->pool, new (cf->pool) ngx_weserv_loc_conf_t);
     if (lc == nullptr) {
         return nullptr;
     }
@@ -464,9 +662,12 @@ void *ngx_weserv_create_loc_conf(ngx_conf_t *cf) {
     lc->max_size = NGX_CONF_UNSET_SIZE;
     lc->max_redirects = NGX_CONF_UNSET_UINT;
     lc->canonical_header = NGX_CONF_UNSET;
+    lc->presets = reinterpret_cast<ngx_array_t *>(NGX_CONF_UNSET_PTR);
 
     // API configuration
     lc->api_conf.savers = 0;
+    lc->api_conf.auto_format = NGX_CONF_UNSET;
+    lc->api_conf.loaders = 0;
     lc->api_conf.process_timeout = NGX_CONF_UNSET;
     lc->api_conf.limit_input_pixels = NGX_CONF_UNSET_UINT;
     lc->api_conf.limit_output_pixels = NGX_CONF_UNSET_UINT;
@@ -478,9 +679,18 @@ void *ngx_weserv_create_loc_conf(ngx_conf_t *cf) {
     lc->api_conf.webp_quality = NGX_CONF_UNSET;
     lc->api_conf.avif_effort = NGX_CONF_UNSET;
     lc->api_conf.gif_effort = NGX_CONF_UNSET;
+    lc->api_conf.png_effort = NGX_CONF_UNSET;
     lc->api_conf.webp_effort = NGX_CONF_UNSET;
     lc->api_conf.zlib_level = NGX_CONF_UNSET;
     lc->api_conf.fail_on_error = NGX_CONF_UNSET;
+    lc->api_conf.icc_cache_size = NGX_CONF_UNSET;
+    lc->api_conf.frame_threads = NGX_CONF_UNSET;
+    lc->api_conf.merge_frames = NGX_CONF_UNSET;
+    lc->api_conf.fast_blur_sigma = NGX_CONF_UNSET;
+    lc->api_conf.gif_threads = NGX_CONF_UNSET;
+    lc->api_conf.gif_global_palette = NGX_CONF_UNSET;
+    lc->api_conf.jpeg_threads = NGX_CONF_UNSET;
+    lc->api_conf.png_threads = NGX_CONF_UNSET;
 
     return lc;
 }
@@ -521,6 +731,15 @@ char *ngx_weserv_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
         conf->api_conf.savers, prev->api_conf.savers,
         (NGX_CONF_BITMASK_SET | static_cast<ngx_uint_t>(Output::All)));
 
+    // Keep the original format, unless requested otherwise
+    ngx_conf_merge_value(conf->api_conf.auto_format,
+                         prev->api_conf.auto_format, 0);
+
+    // All supported loaders are enabled by default
+    ngx_conf_merge_bitmask_value(
+        conf->api_conf.loaders, prev->api_conf.loaders,
+        (NGX_CONF_BITMASK_SET | static_cast<ngx_uint_t>(Loader::All)));
+
     // Abort image processing after 10 seconds by default
     ngx_conf_merge_value(conf->api_conf.process_timeout,
                          prev->api_conf.process_timeout, 10);
@@ -554,6 +773,8 @@ char *ngx_weserv_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
                          4);
     ngx_conf_merge_value(conf->api_conf.gif_effort, prev->api_conf.gif_effort,
                          7);
+    ngx_conf_merge_value(conf->api_conf.png_effort, prev->api_conf.png_effort,
+                         7);
     ngx_conf_merge_value(conf->api_conf.webp_effort, prev->api_conf.webp_effort,
                          4);
     ngx_conf_merge_value(conf->api_conf.zlib_level, prev->api_conf.zlib_level,
@@ -564,6 +785,56 @@ char *ngx_weserv_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
     ngx_conf_merge_value(conf->api_conf.fail_on_error,
                          prev->api_conf.fail_on_error, 0);
 
+    // Keep at most 16 ICC transforms around across requests
+    ngx_conf_merge_value(conf->api_conf.icc_cache_size,
+                         prev->api_conf.icc_cache_size, 16);
+
+    // Process the frames of animated images within a single pipeline
+    ngx_conf_merge_value(conf->api_conf.frame_threads,
+                         prev->api_conf.frame_threads, 0);
+
+    // Encode every frame of animated images, even if it repeats
+    ngx_conf_merge_value(conf->api_conf.merge_frames,
+                         prev->api_conf.merge_frames, 0);
+
+    // Always blur with an accurate Gaussian
+    ngx_conf_merge_value(conf->api_conf.fast_blur_sigma,
+                         prev->api_conf.fast_blur_sigma, 0);
+
+    // Encode GIF images with cgif, on a single thread
+    ngx_conf_merge_value(conf->api_conf.gif_threads,
+                         prev->api_conf.gif_threads, 0);
+
+    // Give each frame of an animated GIF image a palette of its own
+    ngx_conf_merge_value(conf->api_conf.gif_global_palette,
+                         prev->api_conf.gif_global_palette, 0);
+
+    // Encode JPEG images with libjpeg, on a single thread
+    ngx_conf_merge_value(conf->api_conf.jpeg_threads,
+                         prev->api_conf.jpeg_threads, 0);
+
+    // Encode PNG images with libpng, on a single thread
+    ngx_conf_merge_value(conf->api_conf.png_threads,
+                         prev->api_conf.png_threads, 0);
+
+    // Inherit the presets from the enclosing level, if none are defined here
+    ngx_conf_merge_ptr_value(conf->presets, prev->presets, nullptr);
+
+    // Parse and validate the presets once, instead of on every request
+    if (conf->presets != nullptr) {
+        auto *presets = reinterpret_cast<ngx_keyval_t *>(conf->presets->elts);
+
+        for (ngx_uint_t i = 0; i < conf->presets->nelts; ++i) {
+            if (!conf->api_conf.add_preset(ngx_str_to_std(presets[i].key),
+                                           ngx_str_to_std(presets[i].value))) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid or duplicate weserv_preset \"%V\"",
+                                   &presets[i].key);
+                return static_cast<char *>(NGX_CONF_ERROR);
+            }
+        }
+    }
+
     return NGX_CONF_OK;
 }
 
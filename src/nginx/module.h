@@ -53,6 +53,12 @@ struct ngx_weserv_loc_conf_t {
     ngx_uint_t max_redirects;
 
     ngx_flag_t canonical_header;
+
+    /**
+     * Named presets (`weserv_preset` directives), parsed into `api_conf`
+     * during merge.
+     */
+    ngx_array_t *presets;
 };
 
 /**
@@ -94,6 +94,19 @@ void NgxTarget::setup(const std::string &extension) {
     extension_ = extension;
 }
 
+void NgxTarget::set_quality(int quality, bool fits) {
+    quality_ = quality;
+    fits_ = fits;
+}
+
+uintptr_t NgxTarget::accepted_outputs() {
+    return parse_accept_header(r_);
+}
+
+void NgxTarget::set_negotiated() {
+    negotiated_ = true;
+}
+
 int64_t NgxTarget::write(const void *data, size_t length) {
     int64_t padding = 0;
 
@@ -204,6 +217,28 @@ int NgxTarget::end() {
         }
     }
 
+    // The output format depends on the Accept header, if negotiated
+    if (negotiated_) {
+        if (set_vary_accept_header(r_) != NGX_OK) {
+            return -1;
+        }
+    }
+
+    // Only set the X-Weserv-Quality header if the quality was chosen to fit
+    // within `&maxbytes=`
+    if (quality_ > 0) {
+        if (set_quality_header(r_, quality_) != NGX_OK) {
+            return -1;
+        }
+
+        if (!fits_) {
+            ngx_log_error(NGX_LOG_WARN, r_->connection->log, 0,
+                          "weserv image of %O bytes exceeds \"maxbytes\" at "
+                          "quality %d",
+                          content_length_, quality_);
+        }
+    }
+
     time_t max_age = MAX_AGE_DEFAULT;
 
     ngx_str_t max_age_str;
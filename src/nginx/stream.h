@@ -47,6 +47,12 @@ class NgxTarget : public api::io::TargetInterface {
 
     void setup(const std::string &extension) override;
 
+    void set_quality(int quality, bool fits) override;
+
+    uintptr_t accepted_outputs() override;
+
+    void set_negotiated() override;
+
     int64_t write(const void *data, size_t length) override;
 
     int64_t read(void *data, size_t length) override;
@@ -64,6 +70,9 @@ class NgxTarget : public api::io::TargetInterface {
     ngx_chain_t *seek_cl_;
 
     std::string extension_;
+    int quality_ = 0;
+    bool fits_ = true;
+    bool negotiated_ = false;
     off_t content_length_ = 0;
 
     /* The current write point.
@@ -1,5 +1,11 @@
 #include "util.h"
 
+#include <weserv/enums.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
 namespace weserv::nginx {
 
 std::string ngx_str_to_std(const ngx_str_t &src) {
@@ -25,6 +31,80 @@ bool is_base64_needed(ngx_http_request_t *r) {
            ngx_strncasecmp(encoding.data, (u_char *)"base64", 6) == 0;
 }
 
+bool is_auto_format_needed(ngx_http_request_t *r, bool auto_format) {
+    ngx_str_t output;
+    if (ngx_http_arg(r, (u_char *)"output", 6, &output) != NGX_OK) {
+        // A preset may set `&output=auto` as well, which is only known once
+        // the query is parsed
+        ngx_str_t preset;
+        return auto_format ||
+               ngx_http_arg(r, (u_char *)"preset", 6, &preset) == NGX_OK;
+    }
+
+    return output.len == 4 &&
+           ngx_strncasecmp(output.data, (u_char *)"auto", 4) == 0;
+}
+
+uintptr_t parse_accept_header(ngx_http_request_t *r) {
+    uintptr_t accepted = 0;
+
+    ngx_list_part_t *part = &r->headers_in.headers.part;
+    auto *h = reinterpret_cast<ngx_table_elt_t *>(part->elts);
+
+    for (ngx_uint_t i = 0; /* void */; i++) {
+        if (i >= part->nelts) {
+            if (part->next == nullptr) {
+                break;
+            }
+
+            part = part->next;
+            h = reinterpret_cast<ngx_table_elt_t *>(part->elts);
+            i = 0;
+        }
+
+        if (h[i].hash == 0 || h[i].key.len != sizeof("Accept") - 1 ||
+            ngx_strncasecmp(h[i].key.data, (u_char *)"Accept",
+                            sizeof("Accept") - 1) != 0) {
+            continue;
+        }
+
+        std::string value = ngx_str_to_std(h[i].value);
+        std::transform(value.begin(), value.end(), value.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+
+        size_t pos = 0;
+        while (pos < value.size()) {
+            size_t end = std::min(value.find(',', pos), value.size());
+            std::string range = value.substr(pos, end - pos);
+            pos = end + 1;
+
+            // Split the media range from its parameters
+            size_t semicolon = std::min(range.find(';'), range.size());
+            std::string type = range.substr(0, semicolon);
+            type.erase(std::remove_if(type.begin(), type.end(),
+                                      [](unsigned char c) {
+                                          return std::isspace(c);
+                                      }),
+                       type.end());
+
+            // A quality of zero means "not acceptable"
+            size_t q = range.find("q=", semicolon);
+            if (q != std::string::npos &&
+                std::strtod(range.c_str() + q + 2, nullptr) <= 0.0) {
+                continue;
+            }
+
+            if (type == "image/avif") {
+                accepted |= static_cast<uintptr_t>(api::enums::Output::Avif);
+            } else if (type == "image/webp") {
+                accepted |= static_cast<uintptr_t>(api::enums::Output::Webp);
+            }
+        }
+    }
+
+    return accepted;
+}
+
 ngx_int_t output_chain_to_base64(ngx_http_request_t *r, ngx_chain_t *out) {
     size_t prefix_size = sizeof("data:") - 1;
     size_t suffix_size = sizeof(";base64,") - 1;
@@ -4,6 +4,7 @@ extern "C" {
 #include <ngx_http.h>
 }
 
+#include <cstdint>
 #include <ctime>
 #include <string>
 
@@ -25,6 +26,20 @@ bool has_valid_scheme(const ngx_str_t &url);
  */
 bool is_base64_needed(ngx_http_request_t *r);
 
+/**
+ * Can the output format be negotiated (`&output=auto`, or no `&output=` at
+ * all with `weserv_auto_format` enabled or with a preset that may set
+ * `&output=auto`)?
+ */
+bool is_auto_format_needed(ngx_http_request_t *r, bool auto_format);
+
+/**
+ * Parse the Accept request header(s) into a bitmask of the image outputs
+ * that can be negotiated (WebP and AVIF). Wildcards aren't taken into
+ * account, most clients send them regardless of their support.
+ */
+uintptr_t parse_accept_header(ngx_http_request_t *r);
+
 /**
  * Converts an entire output chain to base64.
  */
@@ -8,6 +8,7 @@
 
 using vips::VImage;
 using weserv::api::Config;
+using weserv::api::enums::Loader;
 using weserv::api::enums::Output;
 using weserv::api::io::SourceInterface;
 using weserv::api::io::TargetInterface;
@@ -25,6 +25,25 @@ TEST_CASE("invalid image", "[invalid]") {
         CHECK_THAT(status.message(),
                    Contains("Invalid or unsupported image format"));
     }
+    SECTION("disabled loader") {
+        auto test_image = fixtures->input_jpg;
+        auto config = Config();
+        config.loaders = static_cast<uintptr_t>(Loader::All & ~Loader::Jpeg);
+
+        std::string out_buf;
+        Status status = process_file(test_image, &out_buf, "", config);
+
+        CHECK(!status.ok());
+        CHECK(status.code() == static_cast<int>(Status::Code::InvalidImage));
+        CHECK(status.error_cause() == Status::ErrorCause::Application);
+        CHECK(out_buf.empty());
+
+        status = process_file(fixtures->input_png, &out_buf, "", config);
+
+        CHECK(status.ok());
+        CHECK(status.code() == 200);
+        CHECK(!out_buf.empty());
+    }
     SECTION("source") {
         class InvalidSource : public SourceInterface {
             int64_t read(void *data, size_t length) override {
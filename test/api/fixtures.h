@@ -60,6 +60,10 @@ struct Fixtures {
     std::string input_png_with_transparency{dir + "/blackbug.png"};
 
     std::string input_png_with_grey_alpha{dir + "/grey-8bit-alpha.png"};
+
+    // grey-8bit-alpha.png, re-encoded with Adam7 interlacing
+    std::string input_png_interlaced{dir + "/grey-8bit-alpha-interlaced.png"};
+
     std::string input_png_with_one_color{dir + "/2x2_fdcce6.png"};
 
     // http://www.schaik.com/pngsuite/tbgn2c16.png
@@ -80,3 +80,78 @@ TEST_CASE("query ignore", "[query]") {
         CHECK(image.width() == 200);
     }
 }
+
+TEST_CASE("query preset", "[query]") {
+    auto config = Config();
+    REQUIRE(config.add_preset("thumb", "w=200&h=100&fit=cover"));
+
+    SECTION("apply") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "preset=thumb";
+
+        VImage image = process_file<VImage>(test_image, params, config);
+
+        CHECK(image.width() == 200);
+        CHECK(image.height() == 100);
+    }
+
+    SECTION("override") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "preset=thumb&w=100";
+
+        VImage image = process_file<VImage>(test_image, params, config);
+
+        CHECK(image.width() == 100);
+        CHECK(image.height() == 100);
+    }
+
+    SECTION("override derived parameters") {
+        REQUIRE(config.add_preset("sharpen", "w=200&sharp=5,5,3"));
+
+        auto test_image = fixtures->input_jpg;
+
+        // The flat and jagged slopes of the preset are derived from &sharp=,
+        // which is overridden
+        VImage image =
+            process_file<VImage>(test_image, "preset=sharpen&sharp=3", config);
+        VImage expected = process_file<VImage>(test_image, "w=200&sharp=3");
+
+        CHECK(image.width() == 200);
+
+        CHECK((image - expected).abs().max() == 0);
+    }
+
+    SECTION("unknown") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "preset=unknown&w=100";
+
+        std::string out_buf;
+        Status status = process_file(test_image, &out_buf, params, config);
+
+        CHECK(!status.ok());
+        CHECK(status.code() == static_cast<int>(Status::Code::InvalidUri));
+        CHECK(status.http_code() == 400);
+        CHECK_THAT(status.message(),
+                   Equals("Preset \\\"unknown\\\" is not defined."));
+        CHECK(out_buf.empty());
+    }
+
+    SECTION("nested") {
+        REQUIRE(config.add_preset("square", "preset=thumb&h=200"));
+
+        auto test_image = fixtures->input_jpg;
+        auto params = "preset=square";
+
+        VImage image = process_file<VImage>(test_image, params, config);
+
+        CHECK(image.width() == 200);
+        CHECK(image.height() == 200);
+    }
+
+    SECTION("invalid") {
+        CHECK(!config.add_preset("thumb", "w=300"));
+        CHECK(!config.add_preset("empty", "foo=bar"));
+        CHECK(!config.add_preset("", "w=300"));
+        CHECK(!config.add_preset("other", "preset=unknown&w=300"));
+    }
+}
@@ -73,6 +73,35 @@ TEST_CASE("blur", "[blur]") {
         CHECK(image.width() == 320);
         CHECK(image.height() == 240);
 
+        // Unpremultiplied once at the end, back to the original format
+        CHECK(image.format() == VIPS_FORMAT_UCHAR);
+        CHECK(image.has_alpha());
+
         CHECK_THAT(image, is_similar_image(expected_image));
     }
 }
+
+TEST_CASE("fast blur", "[blur]") {
+    auto test_image = fixtures->input_jpg;
+    auto params = "w=320&h=240&fit=cover&blur=50";
+
+    auto config = Config();
+    config.fast_blur_sigma = 20;
+
+    VImage image = process_file<VImage>(test_image, params, config);
+    VImage expected = process_file<VImage>(test_image, params);
+
+    CHECK(image.width() == 320);
+    CHECK(image.height() == 240);
+    CHECK(image.bands() == expected.bands());
+
+    // Three box blurs should stay close to the accurate Gaussian
+    VImage difference = (image.cast(VIPS_FORMAT_FLOAT) -
+                         expected.cast(VIPS_FORMAT_FLOAT))
+                            .abs();
+
+    CHECK(difference.avg() < 2.0);
+    CHECK(difference.max() < 16.0);
+
+    CHECK_THAT(image, is_similar_image(expected));
+}
@@ -118,6 +118,62 @@ TEST_CASE("image extract before resize", "[crop]") {
     CHECK_THAT(image, is_similar_image(expected_image));
 }
 
+TEST_CASE("region of interest decode", "[crop]") {
+    SECTION("jpeg") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "cx=100&cy=200&cw=300&ch=150&w=100&precrop";
+
+        VImage image = process_file<VImage>(test_image, params);
+        VImage expected = process_file<VImage>(
+            test_image, "cx=100&cy=200&cw=300&ch=150&w=100");
+
+        CHECK(image.width() == 100);
+        CHECK(image.height() == 50);
+
+        CHECK_THAT(image, is_similar_image(expected));
+    }
+
+    SECTION("tiff") {
+        auto test_image = fixtures->input_tiff;
+        auto params = "cx=100&cy=200&cw=300&ch=150&precrop";
+
+        VImage image = process_file<VImage>(test_image, params);
+        VImage expected =
+            process_file<VImage>(test_image, "cx=100&cy=200&cw=300&ch=150");
+
+        CHECK(image.width() == 300);
+        CHECK(image.height() == 150);
+
+        CHECK_THAT(image, is_similar_image(expected));
+    }
+
+    SECTION("orientation") {
+        std::vector<std::string> landscape_fixtures{
+            fixtures->input_jpg_with_landscape_exif_1,
+            fixtures->input_jpg_with_landscape_exif_2,
+            fixtures->input_jpg_with_landscape_exif_3,
+            fixtures->input_jpg_with_landscape_exif_4,
+            fixtures->input_jpg_with_landscape_exif_5,
+            fixtures->input_jpg_with_landscape_exif_6,
+            fixtures->input_jpg_with_landscape_exif_7,
+            fixtures->input_jpg_with_landscape_exif_8};
+
+        // The non-precrop path decodes the whole image
+        VImage expected = process_file<VImage>(
+            landscape_fixtures[0], "cx=50&cy=100&cw=200&ch=150");
+
+        for (const auto &test_image : landscape_fixtures) {
+            VImage image = process_file<VImage>(
+                test_image, "cx=50&cy=100&cw=200&ch=150&precrop");
+
+            CHECK(image.width() == 200);
+            CHECK(image.height() == 150);
+
+            CHECK_THAT(image, is_similar_image(expected));
+        }
+    }
+}
+
 TEST_CASE("image resize and extract svg 72 dpi", "[crop]") {
     if (vips_type_find("VipsOperation", true_streaming
                                             ? "svgload_source"
@@ -227,3 +283,28 @@ TEST_CASE("animated image", "[crop]") {
     CHECK(image.width() == 510);
     CHECK(vips_image_get_page_height(image.get_image()) == 1050);
 }
+
+TEST_CASE("animated image with page height change", "[crop]") {
+    if (vips_type_find("VipsOperation", true_streaming
+                                            ? "gifload_source"
+                                            : "gifload_buffer") == 0 ||
+        vips_type_find("VipsOperation", pre_8_12
+                                            ? "magicksave_buffer"
+                                            : "gifsave_target") == 0) {
+        SUCCEED("no gif support, skipping test");
+        return;
+    }
+
+    auto test_image = fixtures->input_gif_animated;
+    auto params = "n=-1&cx=240&cy=300&cw=510&ch=500";
+
+    VImage image = process_file<VImage>(test_image, params);
+    VImage expected =
+        process_file<VImage>(test_image, "cx=240&cy=300&cw=510&ch=500");
+
+    CHECK(image.width() == 510);
+    CHECK(vips_image_get_page_height(image.get_image()) == 500);
+
+    CHECK_THAT(image.extract_area(0, 0, 510, 500),
+               is_similar_image(expected));
+}
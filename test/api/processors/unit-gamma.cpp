@@ -52,6 +52,23 @@ TEST_CASE("gamma", "[gamma]") {
         CHECK_THAT(image, is_similar_image(expected_image));
     }
 
+    SECTION("shrink-on-load") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=320&gam=true";
+
+        // Pre-resize extraction never uses shrink-on-load, which is the
+        // output from before shrink-on-load was kept for gamma correction
+        VImage expected =
+            process_file<VImage>(test_image, std::string(params) +
+                                                 "&precrop=true");
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == 320);
+        CHECK(image.height() == expected.height());
+
+        CHECK_THAT(image, is_similar_image(expected));
+    }
+
     SECTION("invalid") {
         auto test_image = fixtures->input_jpg;
         auto params = "gam=100000000";
@@ -2,10 +2,18 @@
 
 #include "../base.h"
 #include "../similar_image.h"
+#include "../../../src/api/processors/mask.h"
+#include "../../../src/api/utils/outline.h"
+
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <vips/vips8>
 
 using vips::VImage;
+using weserv::api::enums::MaskType;
+using weserv::api::processors::Mask;
 
 TEST_CASE("mask", "[mask]") {
     SECTION("circle") {
@@ -224,3 +232,61 @@ TEST_CASE("mask", "[mask]") {
         CHECK_THAT(image, is_similar_image(test_image));
     }
 }
+
+TEST_CASE("mask rasterizer", "[mask]") {
+    if (vips_type_find("VipsOperation", "svgload_buffer") == 0) {
+        SUCCEED("no svg support, skipping test");
+        return;
+    }
+
+    // The SVG paths, as rendered by librsvg, are the reference
+    std::vector<std::pair<std::string, MaskType>> masks{
+        {"circle", MaskType::Circle},
+        {"ellipse", MaskType::Ellipse},
+        {"triangle", MaskType::Triangle},
+        {"triangle-180", MaskType::Triangle180},
+        {"pentagon", MaskType::Pentagon},
+        {"pentagon-180", MaskType::Pentagon180},
+        {"hexagon", MaskType::Hexagon},
+        {"square", MaskType::Square},
+        {"star", MaskType::Star},
+        {"heart", MaskType::Heart},
+    };
+
+    int width = 320;
+    int height = 240;
+
+    for (const auto &mask : masks) {
+        SECTION(mask.first) {
+            int x_min, y_min, mask_width, mask_height;
+            auto path =
+                Mask::svg_path_by_type(width, height, mask.second, &x_min,
+                                       &y_min, &mask_width, &mask_height);
+            auto outline =
+                Mask::outline_by_type(width, height, mask.second, &x_min,
+                                      &y_min, &mask_width, &mask_height);
+
+            std::string svg =
+                R"(<svg xmlns="http://www.w3.org/2000/svg" width=")" +
+                std::to_string(width) + "\" height=\"" +
+                std::to_string(height) + "\" preserveAspectRatio=\"" +
+                (mask.second == MaskType::Ellipse ? "none" : "xMidYMid meet") +
+                R"("><path d=")" + path + "\"/></svg>";
+
+            VImage reference =
+                VImage::new_from_buffer(svg, "")[3].copy(
+                    VImage::option()->set("interpretation",
+                                          VIPS_INTERPRETATION_B_W));
+            VImage image =
+                weserv::api::utils::rasterize_outline(outline, width, height,
+                                                      1)
+                    .copy(VImage::option()->set("interpretation",
+                                                VIPS_INTERPRETATION_B_W));
+
+            CHECK(image.width() == width);
+            CHECK(image.height() == height);
+
+            CHECK_THAT(image, is_similar_image(reference));
+        }
+    }
+}
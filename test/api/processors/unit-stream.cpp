@@ -1,9 +1,19 @@
 #include <catch2/catch.hpp>
 
 #include "../base.h"
+#include "../similar_image.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <fstream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <vips/vips8>
 
 using Catch::Matchers::Contains;
@@ -11,6 +21,127 @@ using Catch::Matchers::Equals;
 using Catch::Matchers::StartsWith;
 using vips::VImage;
 
+namespace {
+
+class BufferSource : public SourceInterface {
+ public:
+    explicit BufferSource(std::string buffer) : buffer_(std::move(buffer)) {}
+
+    int64_t read(void *data, size_t length) override {
+        if (position_ >= buffer_.size()) {
+            return 0;
+        }
+
+        length = std::min(length, buffer_.size() - position_);
+        std::copy_n(buffer_.data() + position_, length,
+                    static_cast<char *>(data));
+        position_ += length;
+        return static_cast<int64_t>(length);
+    }
+
+    int64_t seek(int64_t offset, int whence) override {
+        switch (whence) {
+            case SEEK_SET:
+                position_ = static_cast<size_t>(offset);
+                break;
+            case SEEK_CUR:
+                position_ += static_cast<size_t>(offset);
+                break;
+            case SEEK_END:
+                position_ = buffer_.size() + static_cast<size_t>(offset);
+                break;
+        }
+        return static_cast<int64_t>(position_);
+    }
+
+ private:
+    std::string buffer_;
+    size_t position_ = 0;
+};
+
+/**
+ * What the API reported to a `RecordingTarget`.
+ */
+struct Recorded {
+    std::string extension;
+    int quality = 0;
+    bool fits = true;
+    bool negotiated = false;
+    size_t size = 0;
+};
+
+/**
+ * A target that records what the API reports to it, the image data itself is
+ * discarded.
+ */
+class RecordingTarget : public TargetInterface {
+ public:
+    RecordingTarget(uintptr_t accepted, Recorded *recorded)
+        : accepted_(accepted), recorded_(recorded) {}
+
+    void setup(const std::string &extension) override {
+        recorded_->extension = extension;
+    }
+
+    void set_quality(int quality, bool fits) override {
+        recorded_->quality = quality;
+        recorded_->fits = fits;
+    }
+
+    uintptr_t accepted_outputs() override {
+        return accepted_;
+    }
+
+    void set_negotiated() override {
+        recorded_->negotiated = true;
+    }
+
+    int64_t write(const void * /* unsused */, size_t length) override {
+        recorded_->size += length;
+        return static_cast<int64_t>(length);
+    }
+
+    int64_t read(void * /* unsused */, size_t /* unsused */) override {
+        return -1;
+    }
+
+    off_t seek(off_t /* unsused */, int /* unsused */) override {
+        return -1;
+    }
+
+    int end() override {
+        return 0;
+    }
+
+ private:
+    uintptr_t accepted_;
+    Recorded *recorded_;
+};
+
+/**
+ * Process an image file through a recording target.
+ */
+Recorded process_recorded(const std::string &file, const std::string &query,
+                          uintptr_t accepted = 0,
+                          const Config &config = Config()) {
+    std::ifstream stream(file, std::ios::binary);
+    std::string buffer((std::istreambuf_iterator<char>(stream)),
+                       std::istreambuf_iterator<char>());
+
+    Recorded recorded;
+    Status status = process(
+        std::unique_ptr<SourceInterface>(new BufferSource(buffer)),
+        std::unique_ptr<TargetInterface>(
+            new RecordingTarget(accepted, &recorded)),
+        query, config);
+
+    CHECK(status.ok());
+
+    return recorded;
+}
+
+}  // namespace
+
 TEST_CASE("output", "[stream]") {
     SECTION("jpeg") {
         auto test_image = fixtures->input_jpg;
@@ -205,6 +336,59 @@ TEST_CASE("special page", "[stream]") {
         CHECK(image.width() == 16);
         CHECK(image.height() == 16);
     }
+
+    SECTION("largest tiff") {
+        auto test_image = fixtures->input_tiff_pyramid;
+        auto params = "page=-1";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == 4000);
+        CHECK(image.height() == 828);
+    }
+
+    SECTION("smallest tiff") {
+        auto test_image = fixtures->input_tiff_pyramid;
+        auto params = "page=-2";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == 125);
+        CHECK(image.height() == 25);
+    }
+}
+
+TEST_CASE("truncated animated image", "[stream]") {
+    if (vips_type_find("VipsOperation", true_streaming
+                                            ? "gifload_source"
+                                            : "gifload_buffer") == 0) {
+        SUCCEED("no gif support, skipping test");
+        return;
+    }
+
+    std::ifstream stream(fixtures->input_gif_animated, std::ios::binary);
+    std::string buffer((std::istreambuf_iterator<char>(stream)),
+                       std::istreambuf_iterator<char>());
+
+    // Cut the image somewhere within the frames, before the trailer
+    buffer.resize(buffer.size() / 2);
+
+    auto get_int = [](const std::string &json, const std::string &key) {
+        auto pos = json.find("\"" + key + "\":");
+        return pos == std::string::npos
+                   ? -1
+                   : std::stoi(json.substr(pos + key.size() + 3));
+    };
+
+    std::string json =
+        process_buffer<std::string>(buffer, "n=-1&output=json");
+
+    // The pages must be consistent with what's actually decoded
+    int height = get_int(json, "height");
+    int page_height = get_int(json, "pageHeight");
+
+    CHECK(page_height == 1050);
+    CHECK(height % page_height == 0);
 }
 
 TEST_CASE("quality and compression", "[stream]") {
@@ -340,6 +524,237 @@ TEST_CASE("without adaptive filtering generates smaller file", "[stream]") {
     CHECK(buffer_without_af.size() < buffer_af.size());
 }
 
+TEST_CASE("auto format", "[stream]") {
+    auto negotiate = [](const std::string &file, const std::string &query,
+                        Output accepted, const Config &config = Config()) {
+        return process_recorded(file, query, static_cast<uintptr_t>(accepted),
+                                config)
+            .extension;
+    };
+
+    bool has_webp = vips_type_find("VipsOperation",
+                                   true_streaming ? "webpsave_target"
+                                                  : "webpsave_buffer") != 0;
+    bool has_avif = vips_type_find("VipsOperation",
+                                   true_streaming ? "heifsave_target"
+                                                  : "heifsave_buffer") != 0;
+
+    SECTION("webp") {
+        if (!has_webp) {
+            SUCCEED("no webp support, skipping test");
+            return;
+        }
+
+        CHECK(negotiate(fixtures->input_jpg, "w=300&output=auto",
+                        Output::Webp) == ".webp");
+    }
+
+    SECTION("avif") {
+        if (!has_avif) {
+            SUCCEED("no avif support, skipping test");
+            return;
+        }
+
+        CHECK(negotiate(fixtures->input_jpg, "w=300&output=auto",
+                        Output::Avif | Output::Webp) == ".avif");
+
+        // Not worth the encoding cost for tiny images
+        if (has_webp) {
+            CHECK(negotiate(fixtures->input_jpg, "w=32&output=auto",
+                            Output::Avif | Output::Webp) == ".webp");
+        }
+    }
+
+    SECTION("animated") {
+        if (!has_webp || vips_type_find("VipsOperation",
+                                        true_streaming ? "gifload_source"
+                                                       : "gifload_buffer") ==
+                             0) {
+            SUCCEED("no webp or gif support, skipping test");
+            return;
+        }
+
+        CHECK(negotiate(fixtures->input_gif_animated,
+                        "n=-1&w=300&output=auto",
+                        Output::Avif | Output::Webp) == ".webp");
+    }
+
+    SECTION("not accepted") {
+        CHECK(negotiate(fixtures->input_jpg, "w=300&output=auto",
+                        static_cast<Output>(0)) == ".jpg");
+    }
+
+    SECTION("disabled saver") {
+        auto config = Config();
+        config.savers = static_cast<uintptr_t>(Output::All ^ Output::Webp);
+
+        CHECK(negotiate(fixtures->input_jpg, "w=300&output=auto",
+                        Output::Webp, config) == ".jpg");
+    }
+
+    SECTION("config") {
+        if (!has_webp) {
+            SUCCEED("no webp support, skipping test");
+            return;
+        }
+
+        auto config = Config();
+        config.auto_format = 1;
+
+        CHECK(negotiate(fixtures->input_jpg, "w=300", Output::Webp, config) ==
+              ".webp");
+
+        // An explicit output takes precedence
+        CHECK(negotiate(fixtures->input_jpg, "w=300&output=png", Output::Webp,
+                        config) == ".png");
+    }
+
+    SECTION("reported to the target") {
+        auto config = Config();
+        REQUIRE(config.add_preset("auto", "w=300&output=auto"));
+
+        auto accepted = has_webp ? static_cast<uintptr_t>(Output::Webp) : 0;
+
+        // Also when negotiated within a preset, or when the original format
+        // is kept
+        CHECK(process_recorded(fixtures->input_jpg, "preset=auto", accepted,
+                               config)
+                  .negotiated);
+        CHECK(process_recorded(fixtures->input_jpg, "preset=auto", 0, config)
+                  .negotiated);
+
+        CHECK(!process_recorded(fixtures->input_jpg,
+                                "preset=auto&output=png", accepted, config)
+                   .negotiated);
+    }
+}
+
+TEST_CASE("max bytes", "[stream]") {
+    auto test_image = fixtures->input_jpg;
+
+    SECTION("jpeg") {
+        auto params = "w=800&output=jpg&maxbytes=20000";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK(buffer.size() <= 20000);
+
+        VImage image = VImage::new_from_buffer(buffer, "");
+
+        CHECK(image.width() == 800);
+    }
+
+    SECTION("webp") {
+        if (vips_type_find("VipsOperation", true_streaming
+                                                ? "webpsave_target"
+                                                : "webpsave_buffer") == 0) {
+            SUCCEED("no webp support, skipping test");
+            return;
+        }
+
+        auto params = "w=800&output=webp&maxbytes=15000";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK(buffer.size() <= 15000);
+    }
+
+    SECTION("without proxy") {
+        auto params = "w=300&output=jpg&maxbytes=8000";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK(buffer.size() <= 8000);
+    }
+
+    SECTION("unreachable") {
+        auto params = "w=800&output=jpg&maxbytes=100";
+
+        Recorded recorded = process_recorded(test_image, params);
+
+        // Even the lowest quality doesn't fit, which is reported
+        CHECK(recorded.quality == 1);
+        CHECK(!recorded.fits);
+        CHECK(recorded.size > 100);
+    }
+
+    SECTION("reports the quality") {
+        auto params = "w=800&output=jpg&maxbytes=20000";
+
+        Recorded recorded = process_recorded(test_image, params);
+
+        CHECK(recorded.quality >= 1);
+        CHECK(recorded.quality <= 80);
+        CHECK(recorded.fits);
+        CHECK(recorded.size <= 20000);
+    }
+
+    SECTION("never exceeds the quality") {
+        auto params = "w=800&output=jpg&q=60";
+
+        std::string buffer = process_file<std::string>(
+            test_image, std::string(params) + "&maxbytes=10000000");
+        std::string expected = process_file<std::string>(test_image, params);
+
+        CHECK(buffer.size() == expected.size());
+    }
+}
+
+TEST_CASE("png palette", "[stream]") {
+    auto test_image = fixtures->input_png;
+    auto params = "w=320&h=240&fit=cover";
+
+    std::string buffer = process_file<std::string>(test_image, params);
+
+    SECTION("palette") {
+        std::string buffer_palette = process_file<std::string>(
+            test_image, std::string(params) + "&palette=true");
+
+        CHECK(buffer_palette.size() < buffer.size());
+
+        VImage image = VImage::new_from_buffer(buffer_palette, "");
+
+        CHECK(image.width() == 320);
+        CHECK(image.height() == 240);
+    }
+
+    SECTION("colors") {
+        std::string buffer_256 = process_file<std::string>(
+            test_image, std::string(params) + "&colors=256");
+        std::string buffer_16 = process_file<std::string>(
+            test_image, std::string(params) + "&colors=16&dither=0");
+
+        CHECK(buffer_256.size() < buffer.size());
+        CHECK(buffer_16.size() < buffer_256.size());
+    }
+
+    SECTION("colors rounded up to a power of two") {
+        auto count_colors = [](const VImage &image) {
+            size_t size;
+            auto *data =
+                static_cast<unsigned char *>(image.write_to_memory(&size));
+
+            std::set<std::vector<unsigned char>> colors;
+            for (size_t i = 0; i < size; i += image.bands()) {
+                colors.emplace(data + i, data + i + image.bands());
+            }
+
+            g_free(data);
+
+            return colors.size();
+        };
+
+        VImage image_20 = process_file<VImage>(
+            test_image, std::string(params) + "&colors=20");
+        VImage image_16 = process_file<VImage>(
+            test_image, std::string(params) + "&colors=16");
+
+        // At most 2^ceil(log2(N)) colors, which is exact for powers of two
+        CHECK(count_colors(image_20) <= 32);
+        CHECK(count_colors(image_16) <= 16);
+    }
+}
+
 TEST_CASE("gif options", "[stream]") {
     SECTION("loop count") {
         if (vips_type_find("VipsOperation", true_streaming
@@ -399,6 +814,134 @@ TEST_CASE("gif options", "[stream]") {
     }
 }
 
+TEST_CASE("frame decimation", "[stream]") {
+    SECTION("frame rate") {
+        if (vips_type_find("VipsOperation", true_streaming
+                                                ? "gifload_source"
+                                                : "gifload_buffer") == 0) {
+            SUCCEED("no gif support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_gif_animated;
+        auto params = "n=-1&fps=5&output=json";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        // 8 frames of 100ms each, keep every other frame
+        CHECK_THAT(buffer, Contains(R"("pageHeight":1050)"));
+        CHECK_THAT(buffer, Contains(R"("delay":[200,200,200,200])"));
+    }
+
+    SECTION("maximum number of frames") {
+        if (vips_type_find("VipsOperation", true_streaming
+                                                ? "gifload_source"
+                                                : "gifload_buffer") == 0) {
+            SUCCEED("no gif support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_gif_animated;
+        auto params = "n=-1&maxframes=2&output=json";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("pageHeight":1050)"));
+        CHECK_THAT(buffer, Contains(R"("delay":[400,400])"));
+    }
+
+    SECTION("merge identical frames") {
+        if (vips_type_find("VipsOperation", true_streaming
+                                                ? "gifload_source"
+                                                : "gifload_buffer") == 0 ||
+            vips_type_find("VipsOperation", pre_8_12
+                                                ? "magicksave_buffer"
+                                                : "gifsave_target") == 0) {
+            SUCCEED("no gif support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_gif_animated;
+
+        // Cropping a static part of the frames
+        auto params = "n=-1&cx=0&cy=0&cw=10&ch=10&output=gif";
+
+        SECTION("disabled") {
+            VImage image = process_file<VImage>(test_image, params);
+
+            CHECK(image.height() ==
+                  8 * vips_image_get_page_height(image.get_image()));
+        }
+
+        SECTION("enabled") {
+            auto config = Config();
+            config.merge_frames = 1;
+
+            VImage image = process_file<VImage>(test_image, params, config);
+
+            CHECK(image.height() ==
+                  vips_image_get_page_height(image.get_image()));
+            CHECK(image.get_array_int("delay") == std::vector<int>{800});
+        }
+    }
+
+    SECTION("shrink-on-load") {
+        if (vips_type_find("VipsOperation", true_streaming
+                                                ? "webpload_source"
+                                                : "webpload_buffer") == 0 ||
+            vips_type_find("VipsOperation", "webpsave_buffer") == 0) {
+            SUCCEED("no webp support, skipping test");
+            return;
+        }
+
+        // Ten frames with a distinct grey level and delay each
+        std::vector<VImage> frames;
+        std::vector<int> delays;
+        for (int i = 0; i < 10; ++i) {
+            frames.push_back(
+                VImage::black(200, 200, VImage::option()->set("bands", 3)) +
+                i * 20);
+            delays.push_back(10 * (i + 1));
+        }
+
+        VImage animation =
+            VImage::arrayjoin(frames, VImage::option()->set("across", 1))
+                .cast(VIPS_FORMAT_UCHAR)
+                .copy(VImage::option()->set("interpretation",
+                                            VIPS_INTERPRETATION_sRGB));
+        animation.set(VIPS_META_PAGE_HEIGHT, 200);
+        animation.set("delay", delays);
+
+        void *buf;
+        size_t size;
+        animation.write_to_buffer(".webp", &buf, &size,
+                                  VImage::option()->set("lossless", true));
+        std::string buffer(static_cast<char *>(buf), size);
+        g_free(buf);
+
+        // libwebp reloads the frames at half the size
+        auto params = std::string("n=-1&maxframes=2&w=100");
+
+        // Frames 0 and 5 are kept, each displayed for as long as the frames
+        // it replaces
+        std::string json =
+            process_buffer<std::string>(buffer, params + "&output=json");
+
+        CHECK_THAT(json, Contains(R"("pageHeight":100)"));
+        CHECK_THAT(json, Contains(R"("delay":[150,400])"));
+
+        VImage image = process_buffer<VImage>(buffer, params + "&output=png");
+
+        CHECK(image.width() == 100);
+        CHECK(image.height() == 200);
+
+        CHECK(image.extract_area(0, 0, 100, 100).avg() ==
+              Approx(0).margin(1));
+        CHECK(image.extract_area(0, 100, 100, 100).avg() ==
+              Approx(100).margin(1));
+    }
+}
+
 TEST_CASE("metadata", "[stream]") {
     SECTION("jpeg cymk") {
         auto test_image = fixtures->input_jpg_with_cmyk_profile;
@@ -535,3 +1078,479 @@ TEST_CASE("metadata", "[stream]") {
         CHECK_THAT(buffer, Contains(R"("format":"magick")"));
     }
 }
+
+TEST_CASE("passthrough", "[stream]") {
+    if (true_streaming) {
+        SUCCEED("passthrough not supported in true streaming mode, skipping "
+                "test");
+        return;
+    }
+
+    auto read_file = [](const std::string &file) {
+        std::ifstream stream(file, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(stream),
+                           std::istreambuf_iterator<char>());
+    };
+
+    // The image data is copied as-is, only the metadata is dropped
+    auto same_image_data = [](const std::string &original,
+                              const std::string &buffer) {
+        return buffer.size() > 1024 &&
+               original.compare(original.size() - 1024, 1024, buffer,
+                                buffer.size() - 1024, 1024) == 0;
+    };
+
+    SECTION("jpeg") {
+        auto test_image = fixtures->input_jpg_with_landscape_exif_1;
+        auto params = "output=origin";
+
+        std::string original = read_file(test_image);
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK(buffer.size() < original.size());
+        CHECK(same_image_data(original, buffer));
+
+        VImage image = VImage::new_from_buffer(buffer, "");
+
+        CHECK(image.get_typeof(VIPS_META_EXIF_NAME) == 0);
+        CHECK_THAT(image, is_similar_image(test_image));
+    }
+
+    SECTION("png") {
+        auto test_image = fixtures->input_png_with_grey_alpha;
+        auto params = "output=png";
+
+        std::string original = read_file(test_image);
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK(buffer.size() < original.size());
+        CHECK(same_image_data(original, buffer));
+        CHECK_THAT(buffer, !Contains("tEXt"));
+    }
+
+    SECTION("without enlargement") {
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "w=640&h=480&we=true";
+
+        std::string original = read_file(test_image);
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK(same_image_data(original, buffer));
+    }
+
+    SECTION("srgb profile") {
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "output=origin";
+
+        std::string original = read_file(test_image);
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK(same_image_data(original, buffer));
+    }
+
+    SECTION("non-srgb profile") {
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "output=origin";
+
+        // Relabel the embedded sRGB profile, the pixels need to be converted
+        std::string original = read_file(test_image);
+        auto pos = original.find("sRGB IEC61966-2.1");
+        REQUIRE(pos != std::string::npos);
+        original.replace(pos, 17, std::string("Adobe RGB (1998)\0", 17));
+
+        std::string buffer = process_buffer<std::string>(original, params);
+
+        CHECK(!same_image_data(original, buffer));
+    }
+
+    SECTION("resize") {
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "w=640&h=480";
+
+        std::string original = read_file(test_image);
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK(!same_image_data(original, buffer));
+    }
+
+    SECTION("quality") {
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "q=50";
+
+        std::string original = read_file(test_image);
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK(!same_image_data(original, buffer));
+    }
+}
+
+TEST_CASE("lossless transform", "[stream]") {
+    if (true_streaming) {
+        SUCCEED("lossless transform not supported in true streaming mode, "
+                "skipping test");
+        return;
+    }
+
+    SECTION("rotate") {
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "ro=90";
+
+        VImage image = process_file<VImage>(test_image, params);
+        VImage expected = process_file<VImage>(test_image, "ro=90&q=100");
+
+        CHECK(image.width() == 240);
+        CHECK(image.height() == 320);
+
+        CHECK_THAT(image, is_similar_image(expected));
+    }
+
+    SECTION("round trip") {
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "ro=180&flip=true";
+
+        // The coefficients are only moved around, so the same transform
+        // twice should give back the exact same image
+        std::string buffer = process_file<std::string>(test_image, params);
+        VImage image = process_buffer<VImage>(buffer, params);
+        VImage original = VImage::new_from_file(test_image.c_str());
+
+        CHECK(image.width() == 320);
+        CHECK(image.height() == 240);
+
+        CHECK((image - original).abs().max() == 0);
+    }
+
+    SECTION("crop") {
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "cx=16&cy=32&cw=100&ch=80&ro=270";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        // An explicit quality forces the image to be re-encoded, which
+        // would produce the exact same output as the fallback
+        std::string reencoded = process_file<std::string>(
+            test_image, "cx=16&cy=32&cw=100&ch=80&ro=270&q=80");
+
+        CHECK(buffer != reencoded);
+
+        VImage image = VImage::new_from_buffer(buffer, "");
+        VImage expected = process_file<VImage>(
+            test_image, "cx=16&cy=32&cw=100&ch=80&ro=270&q=100");
+
+        CHECK(image.width() == 100);
+        CHECK(image.height() == 80);
+
+        CHECK_THAT(image, is_similar_image(expected));
+    }
+
+    SECTION("arbitrary angle") {
+        // A rotation that isn't a multiple of 90 degrees can't be done
+        // losslessly
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "ro=45&flip=true";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == 396);
+        CHECK(image.height() == 396);
+    }
+
+    SECTION("imperfect") {
+        // The height isn't a multiple of the iMCU size, so the rotation needs
+        // to be done by decoding and re-encoding the image
+        auto test_image = fixtures->input_jpg_with_landscape_exif_6;
+
+        VImage image = process_file<VImage>(test_image);
+
+        CHECK(image.width() == 600);
+        CHECK(image.height() == 400);
+    }
+}
+
+TEST_CASE("parallel gif", "[stream]") {
+    if (vips_type_find("VipsOperation", true_streaming ? "gifload_source"
+                                                       : "gifload_buffer") ==
+        0) {
+        SUCCEED("no gif support, skipping test");
+        return;
+    }
+
+#if !defined(WESERV_HAVE_IMAGEQUANT) || !defined(WESERV_HAVE_CGIF)
+    SUCCEED("no libimagequant or cgif support, skipping test");
+    return;
+#endif
+
+    auto test_image = fixtures->input_gif_animated;
+    auto params = "n=-1&w=300&output=gif";
+
+    auto config = Config();
+    config.gif_threads = 4;
+
+    VImage expected = process_file<VImage>(test_image, params);
+
+    SECTION("per-frame palette") {
+        std::string buffer =
+            process_file<std::string>(test_image, params, config);
+        VImage image = VImage::new_from_buffer(buffer, "");
+
+        CHECK(image.width() == 300);
+        CHECK(vips_image_get_n_pages(image.get_image()) ==
+              vips_image_get_n_pages(expected.get_image()));
+
+        CHECK_THAT(image, is_similar_image(expected));
+    }
+
+    SECTION("global palette") {
+        std::string per_frame =
+            process_file<std::string>(test_image, params, config);
+
+        config.gif_global_palette = 1;
+
+        std::string buffer =
+            process_file<std::string>(test_image, params, config);
+        VImage image = VImage::new_from_buffer(buffer, "");
+
+        CHECK(image.width() == 300);
+        CHECK(vips_image_get_n_pages(image.get_image()) ==
+              vips_image_get_n_pages(expected.get_image()));
+
+        CHECK_THAT(image, is_similar_image(expected));
+
+        // Only the area that changes is stored for each frame
+        CHECK(buffer.size() < per_frame.size());
+    }
+
+    SECTION("global palette with colours beyond the sampled frames") {
+        if (vips_type_find("VipsOperation", true_streaming
+                                                ? "webpload_source"
+                                                : "webpload_buffer") == 0 ||
+            vips_type_find("VipsOperation", "webpsave_buffer") == 0) {
+            SUCCEED("no webp support, skipping test");
+            return;
+        }
+
+        // 40 frames that alternate between black and white, the last frame
+        // (which isn't sampled for the palette) is grey
+        std::vector<VImage> frames;
+        for (int i = 0; i < 40; ++i) {
+            int value = i == 39 ? 128 : (i % 2) * 255;
+            frames.push_back(
+                (VImage::black(16, 16, VImage::option()->set("bands", 3)) +
+                 value)
+                    .cast(VIPS_FORMAT_UCHAR));
+        }
+
+        VImage animation =
+            VImage::arrayjoin(frames, VImage::option()->set("across", 1))
+                .copy(VImage::option()->set("interpretation",
+                                            VIPS_INTERPRETATION_sRGB));
+        animation.set(VIPS_META_PAGE_HEIGHT, 16);
+
+        void *data;
+        size_t size;
+        animation.write_to_buffer(
+            ".webp", &data, &size,
+            VImage::option()->set("lossless", true));
+        std::string input(static_cast<char *>(data), size);
+        g_free(data);
+
+        config.gif_global_palette = 1;
+
+        std::string buffer =
+            process_buffer<std::string>(input, "n=-1&output=gif", config);
+        VImage image = VImage::new_from_buffer(
+            buffer, "", VImage::option()->set("n", -1));
+
+        CHECK(image.height() == 40 * 16);
+
+        // The grey frame is dithered, instead of being mapped to white
+        CHECK(image.crop(0, 39 * 16, 16, 16).avg() ==
+              Approx(128).margin(16));
+    }
+
+    SECTION("quality compared to libvips") {
+        // All frames, as a lossless reference
+        VImage reference =
+            process_file<VImage>(test_image, "n=-1&w=300&output=png");
+
+        // The PSNR (in dB) of all frames against the reference, with
+        // transparent pixels flattened to black
+        auto psnr = [&](const std::string &buffer) {
+            VImage image = VImage::new_from_buffer(
+                buffer, "", VImage::option()->set("n", -1));
+            VImage a = image.bands() == 4 ? image.flatten() : image;
+            VImage b = reference.bands() == 4 ? reference.flatten()
+                                              : reference;
+            REQUIRE(a.width() == b.width());
+            REQUIRE(a.height() == b.height());
+
+            VImage diff = a.cast(VIPS_FORMAT_FLOAT) - b.cast(VIPS_FORMAT_FLOAT);
+            double mse = (diff * diff).avg();
+            return mse == 0.0 ? 100.0 : 10.0 * std::log10(255.0 * 255.0 / mse);
+        };
+
+        std::string expected_buffer = process_file<std::string>(test_image,
+                                                                params);
+        double expected_psnr = psnr(expected_buffer);
+
+        SECTION("per-frame palette") {
+            std::string buffer =
+                process_file<std::string>(test_image, params, config);
+
+            CHECK(psnr(buffer) >= expected_psnr - 1.0);
+        }
+
+        SECTION("global palette") {
+            config.gif_global_palette = 1;
+
+            std::string buffer =
+                process_file<std::string>(test_image, params, config);
+
+            CHECK(psnr(buffer) >= expected_psnr - 1.0);
+        }
+
+        SECTION("lower quality") {
+            std::string buffer =
+                process_file<std::string>(test_image, params, config);
+            std::string low = process_file<std::string>(
+                test_image, std::string(params) + "&q=10", config);
+
+            // `&q=` caps the quantization quality, i.e. fewer colours
+            CHECK(low.size() < buffer.size());
+            CHECK(psnr(low) < psnr(buffer));
+        }
+    }
+}
+
+TEST_CASE("parallel png", "[stream]") {
+    auto config = Config();
+    config.png_threads = 4;
+
+    SECTION("rgb") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=800&output=png&af=true";
+
+        std::string buffer =
+            process_file<std::string>(test_image, params, config);
+        std::string expected = process_file<std::string>(test_image, params);
+
+        // Only slightly larger than a single zlib stream
+        CHECK(buffer.size() < expected.size() * 1.05);
+
+        VImage image = VImage::new_from_buffer(buffer, "");
+        VImage expected_image = VImage::new_from_buffer(expected, "");
+
+        CHECK(image.width() == 800);
+        CHECK(image.bands() == 3);
+
+        // PNG is lossless, so the pixels should be identical
+        CHECK((image - expected_image).abs().max() == 0);
+    }
+
+    SECTION("resolution") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=800&output=png";
+
+        VImage image = process_file<VImage>(test_image, params, config);
+        VImage expected = process_file<VImage>(test_image, params);
+
+        CHECK(image.xres() == Approx(expected.xres()).margin(0.001));
+        CHECK(image.yres() == Approx(expected.yres()).margin(0.001));
+    }
+
+    SECTION("rgba") {
+        auto test_image = fixtures->input_png_rgb_with_alpha;
+        auto params = "w=800&output=png";
+
+        VImage image = process_file<VImage>(test_image, params, config);
+        VImage expected = process_file<VImage>(test_image, params);
+
+        CHECK(image.bands() == 4);
+
+        CHECK((image - expected).abs().max() == 0);
+    }
+}
+
+TEST_CASE("parallel jpeg", "[stream]") {
+    auto config = Config();
+    config.jpeg_threads = 4;
+
+    SECTION("rgb") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=800&output=jpg";
+
+        std::string buffer =
+            process_file<std::string>(test_image, params, config);
+        std::string expected = process_file<std::string>(test_image, params);
+
+        // The same DCT coefficients with optimal Huffman tables, only the
+        // restart markers add a few bytes
+        CHECK(buffer.size() < expected.size() * 1.01);
+
+        // A restart interval per stripe
+        CHECK(buffer.find("\xFF\xDD") != std::string::npos);
+        CHECK(buffer.find("\xFF\xD0") != std::string::npos);
+
+        VImage image = VImage::new_from_buffer(buffer, "");
+        VImage expected_image = VImage::new_from_buffer(expected, "");
+
+        CHECK(image.width() == 800);
+        CHECK(image.bands() == 3);
+
+        // The JFIF density is kept
+        CHECK(image.xres() == Approx(expected_image.xres()).margin(0.01));
+        CHECK(image.yres() == Approx(expected_image.yres()).margin(0.01));
+
+        CHECK_THAT(image, is_similar_image(expected_image));
+    }
+
+    SECTION("grey") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=800&filt=greyscale&output=jpg";
+
+        VImage image = process_file<VImage>(test_image, params, config);
+        VImage expected = process_file<VImage>(test_image, params);
+
+        CHECK(image.bands() == expected.bands());
+
+        CHECK_THAT(image, is_similar_image(expected));
+    }
+}
+
+TEST_CASE("parallel jpeg benchmark", "[stream][.benchmark]") {
+    auto test_image = fixtures->input_jpg;
+
+    auto config = Config();
+    config.jpeg_threads = static_cast<intptr_t>(
+        std::max(std::thread::hardware_concurrency(), 2U));
+
+    auto time = [&test_image](const std::string &params,
+                              const Config &config) {
+        const int runs = 5;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < runs; ++i) {
+            (void)process_file<std::string>(test_image, params, config);
+        }
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        return elapsed.count() / runs;
+    };
+
+    for (int width : {400, 800, 1600, 2725}) {
+        auto params = "w=" + std::to_string(width) + "&output=jpg";
+
+        auto size = process_file<std::string>(test_image, params).size();
+
+        double serial = time(params, Config());
+        double parallel = time(params, config);
+
+        WARN("w=" << width << " (" << size / 1024 << " KiB): " << serial
+                  << " ms serial, " << parallel << " ms on "
+                  << config.jpeg_threads << " threads (" << serial / parallel
+                  << "x)");
+    }
+
+    SUCCEED();
+}
@@ -3,6 +3,10 @@
 #include "../base.h"
 #include "../similar_image.h"
 
+#include <fstream>
+#include <iterator>
+#include <string>
+
 #include <vips/vips8>
 
 using Catch::Matchers::Contains;
@@ -457,6 +461,34 @@ TEST_CASE("from", "[thumbnail]") {
         CHECK(image.width() == 320);
     }
 
+    // The second transform should be served from the ICC transform cache,
+    // with the same result as libvips' own (uncached) icc_transform
+    SECTION("CMYK to sRGB cached") {
+        auto test_image = fixtures->input_jpg_with_cmyk_profile;
+        auto expected_image = fixtures->expected_dir + "/colourspace.cmyk.jpg";
+        auto params = "w=320&h=240&fit=contain&cbg=white";
+
+        Config uncached_config;
+        uncached_config.icc_cache_size = 0;
+
+        VImage uncached_image =
+            process_file<VImage>(test_image, params, uncached_config);
+
+        process_file<VImage>(test_image, params);
+        auto stats = api_manager->icc_cache_stats();
+
+        VImage cached_image = process_file<VImage>(test_image, params);
+        auto cached_stats = api_manager->icc_cache_stats();
+
+        CHECK(cached_stats.misses == stats.misses);
+        CHECK(cached_image.interpretation() == VIPS_INTERPRETATION_sRGB);
+        CHECK(cached_image.width() == 320);
+        CHECK(cached_image.height() == 240);
+
+        CHECK_THAT(cached_image, is_similar_image(uncached_image));
+        CHECK_THAT(cached_image, is_similar_image(expected_image));
+    }
+
     // From profile-less CMYK to sRGB
     SECTION("smaller axis") {
         auto test_image = fixtures->input_jpg_with_cmyk_no_profile;
@@ -566,6 +598,98 @@ TEST_CASE("heif", "[thumbnail]") {
     CHECK_THAT(image, is_similar_image(expected_image));
 }
 
+TEST_CASE("exif thumbnail", "[thumbnail]") {
+    if (true_streaming) {
+        SUCCEED("exif thumbnail not supported in true streaming mode, "
+                "skipping test");
+        return;
+    }
+
+    auto test_image = fixtures->input_jpg_320x240;
+    auto params = "w=100&output=jpg";
+
+    std::ifstream stream(test_image, std::ios::binary);
+    std::string original((std::istreambuf_iterator<char>(stream)),
+                         std::istreambuf_iterator<char>());
+
+    // The embedded thumbnail (196x147) is the second JPEG image within the
+    // EXIF data
+    auto start = original.find("\xFF\xD8\xFF", 2);
+    auto end = original.find("\xFF\xD9", start);
+    REQUIRE(start != std::string::npos);
+    REQUIRE(end != std::string::npos);
+
+    // The fast path resizes the very same pixels as the thumbnail on its own
+    VImage expected = process_buffer<VImage>(
+        original.substr(start, end + 2 - start), params);
+    VImage image = process_file<VImage>(test_image, params);
+
+    CHECK(image.width() == 100);
+    CHECK(image.height() == 75);
+
+    CHECK((image - expected).abs().max() == 0);
+
+    SECTION("non-srgb profile") {
+        VipsBlob *blob = nullptr;
+        if (vips_profile_load("p3", &blob, nullptr) != 0) {
+            vips_error_clear();
+            SUCCEED("no built-in p3 profile, skipping test");
+            return;
+        }
+
+        size_t length;
+        const void *profile = vips_blob_get(blob, &length);
+
+        // Tag the image as Display P3 with an APP2 segment, right after the
+        // SOI marker
+        std::string segment("\xFF\xE2", 2);
+        auto segment_length = 2 + 14 + length;
+        segment += static_cast<char>((segment_length >> 8) & 0xFF);
+        segment += static_cast<char>(segment_length & 0xFF);
+        segment.append("ICC_PROFILE\0\x01\x01", 14);
+        segment.append(static_cast<const char *>(profile), length);
+        vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+
+        std::string tagged = original;
+        tagged.insert(2, segment);
+
+        // The thumbnail would skip the conversion to sRGB, so the main image
+        // is shrunk instead
+        VImage converted = process_buffer<VImage>(tagged, params);
+        VImage full_scale =
+            process_buffer<VImage>(tagged, std::string(params) +
+                                               "&precrop=true");
+
+        CHECK(converted.width() == 100);
+        CHECK(converted.height() == 75);
+
+        CHECK((converted - expected).abs().max() > 0);
+        CHECK_THAT(converted, is_similar_image(full_scale));
+    }
+}
+
+TEST_CASE("interlaced png", "[thumbnail]") {
+    auto test_image = fixtures->input_png_interlaced;
+
+    // Pass 1 (1/8), passes 1 - 3 (1/4) and passes 1 - 5 (1/2)
+    std::vector<int> widths{40, 90, 180};
+
+    for (const auto &width : widths) {
+        auto params = "w=" + std::to_string(width);
+
+        // Pre-resize extraction disables shrink-on-load
+        VImage expected = process_file<VImage>(test_image,
+                                               params + "&precrop=true");
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == width);
+        CHECK(image.height() == expected.height());
+        CHECK(image.bands() == 2);
+
+        CHECK_THAT(image, is_similar_image(expected));
+    }
+}
+
 TEST_CASE("animated webp page", "[thumbnail]") {
     if (vips_type_find("VipsOperation", true_streaming
                                             ? "webpload_source"
@@ -589,6 +713,35 @@ TEST_CASE("animated webp page", "[thumbnail]") {
     CHECK_THAT(image, is_similar_image(expected_image));
 }
 
+TEST_CASE("frame threads", "[thumbnail]") {
+    if (vips_type_find("VipsOperation", true_streaming
+                                            ? "webpload_source"
+                                            : "webpload_buffer") == 0 ||
+        vips_type_find("VipsOperation", true_streaming
+                                            ? "webpsave_target"
+                                            : "webpsave_buffer") == 0) {
+        SUCCEED("no webp support, skipping test");
+        return;
+    }
+
+    auto test_image = fixtures->input_webp_animated;
+    auto params = "n=-1&w=160&h=160&fit=cover&output=webp";
+
+    auto config = Config();
+    config.frame_threads = 4;
+
+    VImage image = process_file<VImage>(test_image, params, config);
+    VImage expected = process_file<VImage>(test_image, params);
+
+    CHECK(image.width() == 160);
+    CHECK(vips_image_get_page_height(image.get_image()) == 160);
+
+    CHECK(image.get_int(VIPS_META_N_PAGES) ==
+          expected.get_int(VIPS_META_N_PAGES));
+
+    CHECK_THAT(image, is_similar_image(expected));
+}
+
 TEST_CASE("radiance", "[thumbnail]") {
     if (vips_type_find("VipsOperation", true_streaming
                                             ? "radload_source"
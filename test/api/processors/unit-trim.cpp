@@ -38,7 +38,7 @@ TEST_CASE("trim", "[trim]") {
         CHECK_THAT(image, is_similar_image(expected_image));
     }
 
-    SECTION("skip shrink-on-load") {
+    SECTION("shrink-on-load") {
         auto test_image = fixtures->input_jpg_overlay_layer_2;
         auto expected_image =
             fixtures->expected_dir + "/alpha-layer-2-trim-resize.jpg";
@@ -53,6 +53,22 @@ TEST_CASE("trim", "[trim]") {
         CHECK_THAT(image, is_similar_image(expected_image));
     }
 
+    SECTION("shrink-on-load matches full-scale trim") {
+        auto test_image = fixtures->input_jpg_overlay_layer_2;
+        auto params = "w=300&trim=10";
+
+        // Pre-resize extraction never uses shrink-on-load, so the trim box
+        // is found on the full-scale image
+        VImage expected = process_file<VImage>(
+            test_image, std::string(params) + "&precrop=true");
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == expected.width());
+        CHECK(image.height() == expected.height());
+
+        CHECK_THAT(image, is_similar_image(expected));
+    }
+
     SECTION("aggressive trim returns original image") {
         auto test_image = fixtures->input_png_overlay_layer_0;
         auto params = "trim=200";